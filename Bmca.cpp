@@ -0,0 +1,88 @@
+#include "Bmca.h"
+
+#include <algorithm>
+#include <cmath>
+#include <tuple>
+
+namespace PTP
+{
+	namespace
+	{
+		int Compare(const auto& a, const auto& b)
+		{
+			return a < b ? -1 : (b < a ? 1 : 0);
+		}
+	}
+
+	int CompareMasters(const ForeignMaster& a, const ForeignMaster& b)
+	{
+		const auto& x{ a.announce };
+		const auto& y{ b.announce };
+		if (x.grandmasterIdentity != y.grandmasterIdentity)
+		{
+			return Compare(
+				std::tie(x.grandmasterPriority1, x.grandmasterClockQuality, x.grandmasterPriority2, x.grandmasterIdentity),
+				std::tie(y.grandmasterPriority1, y.grandmasterClockQuality, y.grandmasterPriority2, y.grandmasterIdentity));
+		}
+		return Compare(std::tie(x.stepsRemoved, a.portIdentity), std::tie(y.stepsRemoved, b.portIdentity));
+	}
+
+	bool MasterSelector::OnAnnounce(const PtpMessage& announce, std::chrono::steady_clock::time_point now)
+	{
+		// stepsRemoved of 255 or more is a loop or a misconfiguration, IEEE 1588 9.3.2.5.
+		if (announce.header.messageType != PtpMessageType::Announce || announce.announce.stepsRemoved >= 255)
+			return Expire(now);
+
+		const auto& sender{ announce.header.sourcePortIdentity };
+		auto record{ std::ranges::find(m_foreignMasters, sender, &ForeignMaster::portIdentity) };
+		if (record == m_foreignMasters.end())
+		{
+			if (m_foreignMasters.size() >= c_maxForeignMasters)
+				return Expire(now);
+			record = m_foreignMasters.insert(m_foreignMasters.end(), ForeignMaster{ .portIdentity = sender });
+		}
+		record->announce = announce.announce;
+		record->lastAnnounce = now;
+		const auto logInterval{ std::clamp<int>(announce.header.logMessageInterval, -7, 7) };
+		record->announceInterval = std::chrono::nanoseconds(std::llround(std::ldexp(1e9, logInterval)));
+		++record->announces;
+		return Expire(now);
+	}
+
+	bool MasterSelector::Expire(std::chrono::steady_clock::time_point now)
+	{
+		std::erase_if(m_foreignMasters, [&](const ForeignMaster& master)
+		{
+			return now - master.lastAnnounce > master.announceInterval * c_announceReceiptTimeout;
+		});
+		return Select();
+	}
+
+	const ForeignMaster* MasterSelector::GetMaster() const
+	{
+		if (!m_master)
+			return nullptr;
+		const auto record{ std::ranges::find(m_foreignMasters, *m_master, &ForeignMaster::portIdentity) };
+		return record == m_foreignMasters.end() ? nullptr : &*record;
+	}
+
+	bool MasterSelector::Select()
+	{
+		const ForeignMaster* best{ nullptr };
+		for (const auto& master : m_foreignMasters)
+		{
+			if (master.announces >= c_foreignMasterThreshold && (!best || CompareMasters(master, *best) < 0))
+				best = &master;
+		}
+
+		std::optional<PortIdentity> selected;
+		if (best)
+			selected = best->portIdentity;
+		// Keep following a lost master's Syncs until another one qualifies: the servo then
+		// holds over on its last frequency rather than having nothing to track.
+		if (!selected || selected == m_master)
+			return false;
+		m_master = selected;
+		return true;
+	}
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "PtpCodec.h"
+
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+namespace PTP
+{
+	constexpr inline uint8_t c_announceReceiptTimeout{ 3 }; // Announce intervals before a master counts as lost
+	constexpr inline uint32_t c_foreignMasterThreshold{ 2 }; // Announces before a new master may be selected
+	constexpr inline size_t c_maxForeignMasters{ 16 };
+
+	// A port whose Announces the client hears, the foreign master record of IEEE 1588 9.3.2.
+	struct ForeignMaster
+	{
+		PortIdentity portIdentity{}; // Sender of the Announces
+		AnnounceBody announce{};     // Latest one
+		std::chrono::steady_clock::time_point lastAnnounce{};
+		std::chrono::nanoseconds announceInterval{}; // From the sender's logMessageInterval
+		uint32_t announces{ 0 };     // Received since the record was created
+	};
+
+	// Negative if 'a' is the better master, positive if 'b' is, 0 for the same port. The
+	// dataset comparison of IEEE 1588 9.3.4: different grandmasters are ranked by priority1,
+	// clock quality, priority2 and identity; paths to the same grandmaster by stepsRemoved,
+	// then by sender port identity.
+	int CompareMasters(const ForeignMaster& a, const ForeignMaster& b);
+
+	// Best master clock selection for a slave-only port without any I/O. Masters that stay
+	// silent for c_announceReceiptTimeout of their own Announce intervals are dropped, so a
+	// standby that keeps announcing takes over within that time.
+	class MasterSelector
+	{
+	public:
+		// Both return true when the selected master changed.
+		bool OnAnnounce(const PtpMessage& announce, std::chrono::steady_clock::time_point now);
+		bool Expire(std::chrono::steady_clock::time_point now);
+
+		const ForeignMaster* GetMaster() const; // nullptr until a master qualifies, or once it expired
+		// The master followed: the last one selected, kept while nothing better qualifies.
+		const std::optional<PortIdentity>& GetMasterIdentity() const { return m_master; }
+		size_t GetForeignMasterCount() const { return m_foreignMasters.size(); }
+
+	private:
+		bool Select();
+
+		std::vector<ForeignMaster> m_foreignMasters;
+		std::optional<PortIdentity> m_master;
+	};
+}
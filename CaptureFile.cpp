@@ -0,0 +1,211 @@
+#include "CaptureFile.h"
+#include "ClockSource.h"
+#include "Logger.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#if defined(__linux__)
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace PTP
+{
+	namespace
+	{
+		constexpr size_t c_recordAlignment{ 8 };
+
+		constexpr size_t AlignRecord(size_t size)
+		{
+			return (size + c_recordAlignment - 1) & ~(c_recordAlignment - 1);
+		}
+
+		uint32_t FirstWord(const CaptureRecordHeader& header)
+		{
+			uint32_t word;
+			std::memcpy(&word, &header, sizeof(word));
+			return word;
+		}
+	}
+
+	CaptureWriter::CaptureWriter(const std::string& path, size_t capacity)
+		: m_path(path)
+		, m_capacity(std::max(capacity, sizeof(CaptureFileHeader)))
+		, m_end(sizeof(CaptureFileHeader))
+	{
+#if defined(__linux__)
+		m_fd = ::open(path.c_str(), O_CREAT | O_RDWR | O_TRUNC, 0644);
+		if (m_fd < 0)
+			throw std::runtime_error("open " + path + " failed, errno " + std::to_string(errno));
+		if (::ftruncate(m_fd, static_cast<off_t>(m_capacity)) < 0)
+		{
+			::close(m_fd);
+			throw std::runtime_error("ftruncate " + path + " failed, errno " + std::to_string(errno));
+		}
+		auto* mapping = ::mmap(nullptr, m_capacity, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+		if (mapping == MAP_FAILED)
+		{
+			::close(m_fd);
+			throw std::runtime_error("mmap " + path + " failed, errno " + std::to_string(errno));
+		}
+		m_data = static_cast<uint8_t*>(mapping);
+
+		const CaptureFileHeader header{
+			.magic = CaptureFileHeader::c_magic,
+			.version = CaptureFileHeader::c_version,
+			.headerSize = sizeof(CaptureFileHeader),
+			.startTime = ReadClock(ClockSource::Realtime),
+			.capacity = m_capacity,
+			.reserved = {} };
+		std::memcpy(m_data, &header, sizeof(header));
+#else
+		throw std::runtime_error("Capture files are only supported on Linux");
+#endif
+	}
+
+	CaptureWriter::~CaptureWriter()
+	{
+#if defined(__linux__)
+		// Dropped records still advanced m_end.
+		const auto used{ std::min<uint64_t>(m_end.load(std::memory_order_relaxed), m_capacity) };
+		::munmap(m_data, m_capacity);
+		// Failing to trim only leaves zeros at the end, which readers stop at.
+		[[maybe_unused]] const auto trimmed{ ::ftruncate(m_fd, static_cast<off_t>(used)) };
+		::close(m_fd);
+#endif
+	}
+
+	uint8_t* CaptureWriter::Reserve(size_t size)
+	{
+		const auto offset{ m_end.fetch_add(size, std::memory_order_relaxed) };
+		if (offset + size > m_capacity)
+		{
+			if (m_dropped.fetch_add(1, std::memory_order_relaxed) == 0)
+				LogWarning("Capture {} is full after {} records, dropping the rest", LogString(m_path), GetRecords());
+			return nullptr;
+		}
+		return m_data + offset;
+	}
+
+	void CaptureWriter::Publish(uint8_t* record, const CaptureRecordHeader& header)
+	{
+		std::memcpy(record + sizeof(uint32_t), reinterpret_cast<const uint8_t*>(&header) + sizeof(uint32_t),
+			sizeof(header) - sizeof(uint32_t));
+		std::atomic_ref<uint32_t>(*reinterpret_cast<uint32_t*>(record)).store(FirstWord(header), std::memory_order_release);
+		m_records.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	void CaptureWriter::Write(const CaptureTimestamps& record)
+	{
+		auto* destination{ Reserve(sizeof(record)) };
+		if (!destination)
+			return;
+
+		auto header{ record.header };
+		header.size = sizeof(record);
+		std::memcpy(destination + sizeof(header), reinterpret_cast<const uint8_t*>(&record) + sizeof(header),
+			sizeof(record) - sizeof(header));
+		Publish(destination, header);
+	}
+
+	void CaptureWriter::WritePacket(const CapturePacket& packet, std::span<const uint8_t> payload)
+	{
+		const auto length{ std::min(payload.size(), c_maxPayload) };
+		const auto size{ AlignRecord(sizeof(packet) + length) };
+		auto* destination{ Reserve(size) };
+		if (!destination)
+			return;
+
+		auto metadata{ packet };
+		metadata.header.type = CaptureRecordType::Packet;
+		metadata.header.size = static_cast<uint16_t>(size);
+		metadata.length = static_cast<uint16_t>(length);
+		std::memcpy(destination + sizeof(metadata.header), reinterpret_cast<const uint8_t*>(&metadata) + sizeof(metadata.header),
+			sizeof(metadata) - sizeof(metadata.header));
+		std::memcpy(destination + sizeof(metadata), payload.data(), length);
+		Publish(destination, metadata.header);
+	}
+
+	CaptureReader::CaptureReader(const std::string& path)
+	{
+#if defined(__linux__)
+		const auto fd{ ::open(path.c_str(), O_RDONLY) };
+		if (fd < 0)
+			throw std::runtime_error("open " + path + " failed, errno " + std::to_string(errno));
+		struct stat status{};
+		if (::fstat(fd, &status) < 0 || static_cast<size_t>(status.st_size) < sizeof(CaptureFileHeader))
+		{
+			::close(fd);
+			throw std::runtime_error(path + " is too short for a capture");
+		}
+		m_size = static_cast<size_t>(status.st_size);
+		auto* mapping = ::mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		::close(fd);
+		if (mapping == MAP_FAILED)
+			throw std::runtime_error("mmap " + path + " failed, errno " + std::to_string(errno));
+		m_data = static_cast<const uint8_t*>(mapping);
+#if defined(MADV_SEQUENTIAL)
+		::madvise(mapping, m_size, MADV_SEQUENTIAL);
+#endif
+
+		const auto& header{ GetHeader() };
+		if (header.magic != CaptureFileHeader::c_magic || header.version != CaptureFileHeader::c_version ||
+			header.headerSize != sizeof(CaptureFileHeader))
+		{
+			::munmap(mapping, m_size);
+			throw std::runtime_error(path + " is not a version " + std::to_string(CaptureFileHeader::c_version) + " capture");
+		}
+#else
+		throw std::runtime_error("Capture files are only supported on Linux");
+#endif
+	}
+
+	CaptureReader::~CaptureReader()
+	{
+#if defined(__linux__)
+		::munmap(const_cast<uint8_t*>(m_data), m_size);
+#endif
+	}
+
+	std::optional<CaptureRecord> CaptureReader::Next()
+	{
+		if (m_offset + sizeof(CaptureRecordHeader) > m_size)
+			return std::nullopt;
+
+		const auto& header{ *reinterpret_cast<const CaptureRecordHeader*>(m_data + m_offset) };
+		if (FirstWord(header) == 0)
+			return std::nullopt;
+
+		const auto corrupt = [this]
+		{
+			return std::runtime_error("Capture record at offset " + std::to_string(m_offset) + " is corrupt");
+		};
+		if (header.size < sizeof(CaptureRecordHeader) || header.size % c_recordAlignment != 0 || m_offset + header.size > m_size)
+			throw corrupt();
+		switch (header.type)
+		{
+			case CaptureRecordType::Sync:
+			case CaptureRecordType::DelayExchange:
+			case CaptureRecordType::PeerDelay:
+				if (header.size != sizeof(CaptureTimestamps))
+					throw corrupt();
+				break;
+			case CaptureRecordType::Packet:
+				if (header.size < sizeof(CapturePacket) ||
+					header.size < sizeof(CapturePacket) + reinterpret_cast<const CapturePacket*>(&header)->length)
+					throw corrupt();
+				break;
+			default:
+				break;
+		}
+
+		const CaptureRecord record{ header, std::span(m_data + m_offset, header.size) };
+		m_offset += header.size;
+		return record;
+	}
+}
@@ -0,0 +1,160 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string>
+
+namespace PTP
+{
+	// Binary capture of what the estimators see (timestamp sets) and of raw PTP datagrams.
+	// Native byte order; a file header, then 8-byte aligned records back to back. A record
+	// whose first word is zero ends the capture: the file is sized up front and zero filled,
+	// so a capture cut short by a crash still reads up to its last complete record.
+	enum class CaptureRecordType : uint16_t
+	{
+		Sync = 1,          // t1/t2 of a Sync on its way to the offset calculation
+		DelayExchange = 2, // t1-t4 of the timestamp set handed to the path delay filter
+		PeerDelay = 3,     // t1-t4 and correction of a completed Pdelay_Req exchange
+		Packet = 4         // CapturePacket and its payload
+	};
+
+	enum class CaptureDirection : uint8_t
+	{
+		Received,
+		Sent
+	};
+
+	struct CaptureFileHeader
+	{
+		static constexpr uint32_t c_magic{ 0x43505450 }; // "PTPC"
+		static constexpr uint16_t c_version{ 1 };
+
+		uint32_t magic;
+		uint16_t version;
+		uint16_t headerSize;
+		int64_t startTime; // CLOCK_REALTIME nanoseconds when the capture was created
+		uint64_t capacity; // Bytes the writer may fill, header included
+		uint8_t reserved[40];
+	};
+	static_assert(sizeof(CaptureFileHeader) == 64);
+
+	struct CaptureRecordHeader
+	{
+		CaptureRecordType type;
+		uint16_t size;     // Whole record in bytes, a multiple of 8
+		uint8_t source;    // Ensemble source of the client core, 0 otherwise
+		uint8_t domain;
+		uint16_t sequenceId; // Timestamp records; 0 for packets, whose payload carries it
+	};
+	static_assert(sizeof(CaptureRecordHeader) == 8);
+
+	// Sync, DelayExchange and PeerDelay. Timestamps in nanoseconds on the clock that took
+	// them, corrections already applied to t1 except for PeerDelay's.
+	struct CaptureTimestamps
+	{
+		CaptureRecordHeader header;
+		int64_t t1;
+		int64_t t2;
+		int64_t t3;
+		int64_t t4;
+		int64_t correction; // Nanoseconds, PeerDelay only
+	};
+	static_assert(sizeof(CaptureTimestamps) == 48);
+
+	// Followed by 'length' bytes of UDP payload, padded to 8.
+	struct CapturePacket
+	{
+		CaptureRecordHeader header;
+		int64_t captureTime;    // CLOCK_REALTIME nanoseconds when the record was written
+		int64_t timestamp;      // Receive or departure timestamp, 0 if none was taken
+		uint32_t localAddress;  // IPv4, host order
+		uint32_t remoteAddress;
+		uint16_t localPort;
+		uint16_t remotePort;
+		uint16_t length;
+		CaptureDirection direction;
+		uint8_t reserved;
+	};
+	static_assert(sizeof(CapturePacket) == 40);
+
+	// Appends records to a file mapped into memory: a record costs one atomic add to reserve
+	// its bytes and a copy, no system call. Safe to share between threads (the shards of a
+	// server pool). The file is created at full capacity (sparse) and cut to the bytes used
+	// when the writer is destroyed; records that do not fit are counted and dropped.
+	class CaptureWriter
+	{
+	public:
+		// Throws std::runtime_error. An existing file is replaced.
+		CaptureWriter(const std::string& path, size_t capacity);
+		~CaptureWriter();
+
+		CaptureWriter(const CaptureWriter&) = delete;
+		CaptureWriter& operator=(const CaptureWriter&) = delete;
+		CaptureWriter(CaptureWriter&&) = delete;
+		CaptureWriter& operator=(CaptureWriter&&) = delete;
+
+		// record.header.size is filled in.
+		void Write(const CaptureTimestamps& record);
+		// Payloads longer than c_maxPayload are cut; packet.length keeps what was captured.
+		void WritePacket(const CapturePacket& packet, std::span<const uint8_t> payload);
+
+		uint64_t GetRecords() const { return m_records.load(std::memory_order_relaxed); }
+		uint64_t GetDropped() const { return m_dropped.load(std::memory_order_relaxed); }
+
+		static constexpr size_t c_maxPayload{ 1024 };
+
+	private:
+		// Returns where to write 'size' bytes, nullptr when the file is full.
+		uint8_t* Reserve(size_t size);
+		// Stores the first word of the record last, so a reader never sees it half written.
+		void Publish(uint8_t* record, const CaptureRecordHeader& header);
+
+		std::string m_path;
+		int m_fd{ -1 };
+		uint8_t* m_data{ nullptr };
+		size_t m_capacity;
+		std::atomic<uint64_t> m_end;
+		std::atomic<uint64_t> m_records{ 0 };
+		std::atomic<uint64_t> m_dropped{ 0 };
+	};
+
+	// One record of a capture, pointing into the reader's mapping.
+	struct CaptureRecord
+	{
+		const CaptureRecordHeader& header;
+		std::span<const uint8_t> bytes; // The whole record
+
+		const CaptureTimestamps& Timestamps() const { return *reinterpret_cast<const CaptureTimestamps*>(bytes.data()); }
+		const CapturePacket& Packet() const { return *reinterpret_cast<const CapturePacket*>(bytes.data()); }
+		std::span<const uint8_t> Payload() const { return bytes.subspan(sizeof(CapturePacket), Packet().length); }
+	};
+
+	// Maps a capture read-only and walks its records in order.
+	class CaptureReader
+	{
+	public:
+		// Throws std::runtime_error for a missing file or one that is not a capture.
+		explicit CaptureReader(const std::string& path);
+		~CaptureReader();
+
+		CaptureReader(const CaptureReader&) = delete;
+		CaptureReader& operator=(const CaptureReader&) = delete;
+		CaptureReader(CaptureReader&&) = delete;
+		CaptureReader& operator=(CaptureReader&&) = delete;
+
+		// nullopt at the end of the capture. Records of unknown types are returned as well;
+		// a record that does not fit its type or the file throws std::runtime_error.
+		std::optional<CaptureRecord> Next();
+		void Rewind() { m_offset = sizeof(CaptureFileHeader); }
+
+		const CaptureFileHeader& GetHeader() const { return *reinterpret_cast<const CaptureFileHeader*>(m_data); }
+
+	private:
+		const uint8_t* m_data{ nullptr };
+		size_t m_size{ 0 };
+		size_t m_offset{ sizeof(CaptureFileHeader) };
+	};
+}
@@ -0,0 +1,260 @@
+#include "ClockSource.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <ctime>
+#include <mutex>
+#include <stop_token>
+#include <thread>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#define PTP_HAS_TSC
+#elif defined(_M_X64)
+#include <intrin.h>
+#define PTP_HAS_TSC
+#endif
+
+namespace PTP
+{
+	namespace
+	{
+		constexpr int64_t c_nanosecondsPerSecond{ 1000000000LL };
+		constexpr auto c_tscRecalibrationInterval{ std::chrono::seconds(1) };
+		constexpr auto c_tscInitialCalibration{ std::chrono::milliseconds(20) };
+		constexpr int64_t c_tscStepThreshold{ 1000000 }; // Re-anchor instead of slewing above 1 ms
+
+		std::atomic<ClockSource> g_source{ ClockSource::Realtime };
+
+#if defined(CLOCK_REALTIME)
+		int64_t ReadKernelClock(clockid_t clock)
+		{
+			timespec ts{};
+			::clock_gettime(clock, &ts);
+			return static_cast<int64_t>(ts.tv_sec) * c_nanosecondsPerSecond + ts.tv_nsec;
+		}
+#endif
+
+		int64_t ReadRealtime()
+		{
+#if defined(CLOCK_REALTIME)
+			return ReadKernelClock(CLOCK_REALTIME);
+#else
+			return std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::system_clock::now().time_since_epoch()).count();
+#endif
+		}
+
+#if defined(PTP_HAS_TSC)
+		bool HasInvariantTsc()
+		{
+#if defined(_M_X64)
+			int registers[4]{};
+			__cpuid(registers, 0x80000007);
+			return (registers[3] & (1 << 8)) != 0;
+#else
+			unsigned eax{ 0 }, ebx{ 0 }, ecx{ 0 }, edx{ 0 };
+			if (!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx))
+				return false;
+			return (edx & (1u << 8)) != 0;
+#endif
+		}
+
+		// Maps TSC ticks onto CLOCK_REALTIME: ns = anchorNs + (tsc - anchorTsc) * nsPerTick.
+		// A background thread re-fits the line once a second and publishes it under a
+		// sequence lock, so readers never make a syscall and never block.
+		class TscClock
+		{
+		public:
+			static TscClock& Instance()
+			{
+				static TscClock clock;
+				return clock;
+			}
+
+			int64_t Read() const
+			{
+				while (true)
+				{
+					const auto sequence{ m_sequence.load(std::memory_order_acquire) };
+					if (sequence & 1)
+						continue;
+					const auto anchorTsc{ m_anchorTsc.load(std::memory_order_relaxed) };
+					const auto anchorNs{ m_anchorNs.load(std::memory_order_relaxed) };
+					const auto nsPerTick{ m_nsPerTick.load(std::memory_order_relaxed) };
+					std::atomic_thread_fence(std::memory_order_acquire);
+					if (sequence != m_sequence.load(std::memory_order_relaxed))
+						continue;
+					const auto ticks{ static_cast<int64_t>(__rdtsc() - anchorTsc) };
+					return anchorNs + static_cast<int64_t>(static_cast<double>(ticks) * nsPerTick);
+				}
+			}
+
+		private:
+			struct Sample
+			{
+				uint64_t tsc;
+				int64_t ns;
+			};
+
+			TscClock()
+			{
+				const auto first{ TakeSample() };
+				std::this_thread::sleep_for(c_tscInitialCalibration);
+				const auto second{ TakeSample() };
+				m_origin = first;
+				Publish(second.tsc, second.ns, static_cast<double>(second.ns - first.ns) / static_cast<double>(second.tsc - first.tsc));
+				m_calibrator = std::jthread([this](std::stop_token stop) { Recalibrate(stop); });
+			}
+
+			// Brackets clock_gettime between two TSC reads and keeps the tightest of a few tries.
+			static Sample TakeSample()
+			{
+				Sample best{};
+				uint64_t bestWidth{ UINT64_MAX };
+				for (int i = 0; i < 5; ++i)
+				{
+					const auto before{ __rdtsc() };
+					const auto ns{ ReadRealtime() };
+					const auto after{ __rdtsc() };
+					if (after - before < bestWidth)
+					{
+						bestWidth = after - before;
+						best = { before + (after - before) / 2, ns };
+					}
+				}
+				return best;
+			}
+
+			// Calibrator thread only, it is the sole writer.
+			int64_t At(uint64_t tsc) const
+			{
+				const auto ticks{ static_cast<int64_t>(tsc - m_anchorTsc.load(std::memory_order_relaxed)) };
+				return m_anchorNs.load(std::memory_order_relaxed) +
+					static_cast<int64_t>(static_cast<double>(ticks) * m_nsPerTick.load(std::memory_order_relaxed));
+			}
+
+			void Publish(uint64_t anchorTsc, int64_t anchorNs, double nsPerTick)
+			{
+				const auto sequence{ m_sequence.load(std::memory_order_relaxed) };
+				m_sequence.store(sequence + 1, std::memory_order_relaxed);
+				std::atomic_thread_fence(std::memory_order_release);
+				m_anchorTsc.store(anchorTsc, std::memory_order_relaxed);
+				m_anchorNs.store(anchorNs, std::memory_order_relaxed);
+				m_nsPerTick.store(nsPerTick, std::memory_order_relaxed);
+				m_sequence.store(sequence + 2, std::memory_order_release);
+			}
+
+			void Recalibrate(std::stop_token stop)
+			{
+				std::mutex mutex;
+				std::condition_variable_any wakeup;
+				while (true)
+				{
+					{
+						std::unique_lock lock(mutex);
+						wakeup.wait_for(lock, stop, c_tscRecalibrationInterval, [] { return false; });
+						if (stop.stop_requested())
+							return;
+					}
+
+					const auto sample{ TakeSample() };
+					const auto extrapolated{ At(sample.tsc) };
+					const auto error{ sample.ns - extrapolated };
+					// Long-term rate from the first sample, steered so the extrapolated line
+					// meets CLOCK_REALTIME one interval from now. Continuous unless the
+					// kernel clock was stepped.
+					const double ticksPerInterval{ static_cast<double>(sample.tsc - m_origin.tsc) /
+						static_cast<double>(sample.ns - m_origin.ns) * std::chrono::nanoseconds(c_tscRecalibrationInterval).count() };
+					if (error > c_tscStepThreshold || error < -c_tscStepThreshold || ticksPerInterval <= 0.0)
+					{
+						m_origin = sample;
+						Publish(sample.tsc, sample.ns, m_nsPerTick.load(std::memory_order_relaxed));
+						continue;
+					}
+					const double intervalNs{ static_cast<double>(std::chrono::nanoseconds(c_tscRecalibrationInterval).count()) };
+					Publish(sample.tsc, extrapolated, (intervalNs + static_cast<double>(error)) / ticksPerInterval);
+				}
+			}
+
+			std::atomic<uint32_t> m_sequence{ 0 };
+			std::atomic<uint64_t> m_anchorTsc{ 0 };
+			std::atomic<int64_t> m_anchorNs{ 0 };
+			std::atomic<double> m_nsPerTick{ 0.0 };
+			Sample m_origin{}; // Calibrator thread only
+			std::jthread m_calibrator;
+		};
+#endif
+	}
+
+	ClockSource SetClockSource(ClockSource source)
+	{
+		if (source == ClockSource::Tsc)
+		{
+#if defined(PTP_HAS_TSC)
+			if (HasInvariantTsc())
+				TscClock::Instance();
+			else
+				source = ClockSource::Realtime;
+#else
+			source = ClockSource::Realtime;
+#endif
+		}
+		g_source.store(source, std::memory_order_relaxed);
+		return source;
+	}
+
+	ClockSource GetClockSource()
+	{
+		return g_source.load(std::memory_order_relaxed);
+	}
+
+	int32_t GetKernelClockId(ClockSource source)
+	{
+		switch (source)
+		{
+#if defined(CLOCK_TAI)
+			case ClockSource::Tai:
+				return CLOCK_TAI;
+#endif
+#if defined(CLOCK_MONOTONIC_RAW)
+			case ClockSource::MonotonicRaw:
+				return CLOCK_MONOTONIC_RAW;
+#endif
+			default:
+#if defined(CLOCK_REALTIME)
+				return CLOCK_REALTIME;
+#else
+				return 0;
+#endif
+		}
+	}
+
+	int64_t ReadClock()
+	{
+		return ReadClock(g_source.load(std::memory_order_relaxed));
+	}
+
+	int64_t ReadClock(ClockSource source)
+	{
+		switch (source)
+		{
+#if defined(PTP_HAS_TSC)
+			case ClockSource::Tsc:
+				return TscClock::Instance().Read();
+#endif
+#if defined(CLOCK_TAI)
+			case ClockSource::Tai:
+				return ReadKernelClock(CLOCK_TAI);
+#endif
+#if defined(CLOCK_MONOTONIC_RAW)
+			case ClockSource::MonotonicRaw:
+				return ReadKernelClock(CLOCK_MONOTONIC_RAW);
+#endif
+			default:
+				return ReadRealtime();
+		}
+	}
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstdint>
+
+namespace PTP
+{
+	// Where GetCurrentPtpTime() reads the time from. Both ends must use the same timescale.
+	// Kernel software packet timestamps are CLOCK_REALTIME, so combine them with Realtime or
+	// Tsc (which is calibrated against CLOCK_REALTIME). NIC timestamps would be on the PHC
+	// and are not used (see TimestampMode).
+	enum class ClockSource
+	{
+		Realtime,     // CLOCK_REALTIME, UTC
+		Tai,          // CLOCK_TAI, UTC + leap seconds as PTP uses on the wire
+		MonotonicRaw, // CLOCK_MONOTONIC_RAW, unadjusted oscillator, arbitrary epoch
+		Tsc           // rdtsc scaled onto CLOCK_REALTIME, recalibrated once a second
+	};
+
+	// Selects the source for the whole process. Tsc falls back to Realtime when the CPU has
+	// no invariant TSC. Returns the source actually in use. Not for the hot path.
+	ClockSource SetClockSource(ClockSource source);
+	ClockSource GetClockSource();
+
+	// clockid_t of the kernel clock a source reads; Tsc is calibrated against CLOCK_REALTIME.
+	int32_t GetKernelClockId(ClockSource source);
+
+	// Nanoseconds since the source's epoch.
+	int64_t ReadClock();
+	int64_t ReadClock(ClockSource source);
+}
@@ -0,0 +1,158 @@
+#include "DatagramBatch.h"
+#include "Timestamping.h"
+
+#if defined(__linux__)
+#include <cerrno>
+#endif
+
+namespace PTP
+{
+	DatagramBatch::DatagramBatch(size_t capacity, size_t datagramSize)
+		: m_datagramSize(datagramSize)
+		, m_storage(capacity * datagramSize)
+		, m_sizes(capacity)
+		, m_endpoints(capacity)
+		, m_timestamps(capacity)
+#if defined(__linux__)
+		, m_control(capacity)
+		, m_messages(capacity)
+		, m_iovecs(capacity)
+#endif
+	{
+	}
+
+	std::span<const uint8_t> DatagramBatch::Payload(size_t index) const
+	{
+		return { m_storage.data() + index * m_datagramSize, m_sizes[index] };
+	}
+
+	void DatagramBatch::Clear()
+	{
+		m_count = 0;
+		m_sent = 0;
+	}
+
+	std::span<uint8_t> DatagramBatch::Append(const boost::asio::ip::udp::endpoint& destination, size_t size)
+	{
+		if (m_count == Capacity() || size > m_datagramSize)
+			return {};
+
+		m_endpoints[m_count] = destination;
+		m_sizes[m_count] = size;
+		return { m_storage.data() + m_count++ * m_datagramSize, size };
+	}
+
+#if defined(__linux__)
+	size_t DatagramBatch::Receive(boost::asio::ip::udp::socket& socket, bool kernelTimestamps)
+	{
+		for (size_t i = 0; i < Capacity(); ++i)
+		{
+			m_iovecs[i] = { m_storage.data() + i * m_datagramSize, m_datagramSize };
+			auto& header = m_messages[i].msg_hdr;
+			header = {};
+			header.msg_name = m_endpoints[i].data();
+			header.msg_namelen = static_cast<socklen_t>(m_endpoints[i].capacity());
+			header.msg_iov = &m_iovecs[i];
+			header.msg_iovlen = 1;
+			if (kernelTimestamps)
+			{
+				header.msg_control = m_control[i].data();
+				header.msg_controllen = sizeof(m_control[i]);
+			}
+			m_messages[i].msg_len = 0;
+		}
+
+		const int received = ::recvmmsg(socket.native_handle(), m_messages.data(),
+			static_cast<unsigned int>(Capacity()), MSG_DONTWAIT, nullptr);
+		if (received < 0)
+		{
+			if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+				return 0;
+			throw boost::system::system_error(errno, boost::system::system_category(), "recvmmsg");
+		}
+
+		// One clock read per wakeup for datagrams that carry no kernel timestamp.
+		const auto fallback{ GetCurrentPtpTime() };
+		for (size_t i = 0; i < static_cast<size_t>(received); ++i)
+		{
+			auto& header = m_messages[i].msg_hdr;
+			m_sizes[i] = m_messages[i].msg_len;
+			m_endpoints[i].resize(header.msg_namelen);
+			m_timestamps[i] = kernelTimestamps ? GetKernelTimestamp(header).value_or(fallback) : fallback;
+		}
+
+		m_count = static_cast<size_t>(received);
+		m_sent = m_count;
+		return m_count;
+	}
+
+	bool DatagramBatch::Send(boost::asio::ip::udp::socket& socket)
+	{
+		for (size_t i = m_sent; i < m_count; ++i)
+		{
+			m_iovecs[i] = { m_storage.data() + i * m_datagramSize, m_sizes[i] };
+			auto& header = m_messages[i].msg_hdr;
+			header = {};
+			header.msg_name = m_endpoints[i].data();
+			header.msg_namelen = static_cast<socklen_t>(m_endpoints[i].size());
+			header.msg_iov = &m_iovecs[i];
+			header.msg_iovlen = 1;
+		}
+
+		while (m_sent < m_count)
+		{
+			const int sent = ::sendmmsg(socket.native_handle(), m_messages.data() + m_sent,
+				static_cast<unsigned int>(m_count - m_sent), MSG_DONTWAIT);
+			if (sent < 0)
+			{
+				if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+					return false;
+				throw boost::system::system_error(errno, boost::system::system_category(), "sendmmsg");
+			}
+			m_sent += static_cast<size_t>(sent);
+		}
+		return true;
+	}
+#else
+	// No recvmmsg/sendmmsg: same batching semantics with one non-blocking call per datagram.
+	size_t DatagramBatch::Receive(boost::asio::ip::udp::socket& socket, bool /*kernelTimestamps*/)
+	{
+		socket.non_blocking(true);
+		const auto timestamp{ GetCurrentPtpTime() };
+		m_count = 0;
+		while (m_count < Capacity())
+		{
+			boost::system::error_code ec;
+			const auto received = socket.receive_from(
+				boost::asio::buffer(m_storage.data() + m_count * m_datagramSize, m_datagramSize),
+				m_endpoints[m_count], 0, ec);
+			if (ec == boost::asio::error::would_block)
+				break;
+			if (ec)
+				throw boost::system::system_error(ec);
+			m_sizes[m_count] = received;
+			m_timestamps[m_count] = timestamp;
+			++m_count;
+		}
+		m_sent = m_count;
+		return m_count;
+	}
+
+	bool DatagramBatch::Send(boost::asio::ip::udp::socket& socket)
+	{
+		socket.non_blocking(true);
+		while (m_sent < m_count)
+		{
+			boost::system::error_code ec;
+			socket.send_to(boost::asio::buffer(m_storage.data() + m_sent * m_datagramSize, m_sizes[m_sent]),
+				m_endpoints[m_sent], 0, ec);
+			if (ec == boost::asio::error::would_block)
+				return false;
+			if (ec)
+				throw boost::system::system_error(ec);
+			++m_sent;
+		}
+		return true;
+	}
+#endif
+}
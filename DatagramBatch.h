@@ -0,0 +1,58 @@
+#pragma once
+
+#include "Utils.h"
+
+#include <boost/asio.hpp>
+#include <array>
+#include <span>
+#include <vector>
+
+#if defined(__linux__)
+#include <sys/socket.h>
+#endif
+
+namespace PTP
+{
+	// Fixed pool of datagram slots drained with recvmmsg or flushed with sendmmsg.
+	// All memory is allocated in the constructor, Receive/Append/Send never allocate.
+	class DatagramBatch
+	{
+	public:
+		DatagramBatch(size_t capacity, size_t datagramSize);
+
+		DatagramBatch(const DatagramBatch&) = delete;
+		DatagramBatch& operator=(const DatagramBatch&) = delete;
+		DatagramBatch(DatagramBatch&&) = default;
+		DatagramBatch& operator=(DatagramBatch&&) = default;
+
+		// Receive side: reads up to Capacity() datagrams without blocking, returns the count.
+		size_t Receive(boost::asio::ip::udp::socket& socket, bool kernelTimestamps);
+		std::span<const uint8_t> Payload(size_t index) const;
+		const boost::asio::ip::udp::endpoint& Endpoint(size_t index) const { return m_endpoints[index]; }
+		PtpTimestamp Timestamp(size_t index) const { return m_timestamps[index]; }
+
+		// Send side: Append returns a slot of 'size' bytes (empty if the batch is full),
+		// Send flushes what has not gone out yet and returns false if the socket is full.
+		void Clear();
+		std::span<uint8_t> Append(const boost::asio::ip::udp::endpoint& destination, size_t size);
+		bool Send(boost::asio::ip::udp::socket& socket);
+		bool Empty() const { return m_count == m_sent; }
+
+		size_t Capacity() const { return m_sizes.size(); }
+		size_t Size() const { return m_count; }
+
+	private:
+		size_t m_datagramSize;
+		size_t m_count{ 0 };
+		size_t m_sent{ 0 };
+		std::vector<uint8_t> m_storage;
+		std::vector<size_t> m_sizes;
+		std::vector<boost::asio::ip::udp::endpoint> m_endpoints;
+		std::vector<PtpTimestamp> m_timestamps;
+#if defined(__linux__)
+		std::vector<std::array<uint64_t, 16>> m_control; // cmsg space, 8-byte aligned
+		std::vector<mmsghdr> m_messages;
+		std::vector<iovec> m_iovecs;
+#endif
+	};
+}
@@ -0,0 +1,68 @@
+#include "DelayPrefilter.h"
+#include "Logger.h"
+
+#include <cmath>
+#include <stdexcept>
+
+namespace PTP
+{
+	PrefilterSelection ParsePrefilterSelection(const std::string& selection)
+	{
+		if (selection == "none")
+			return PrefilterSelection::None;
+		if (selection == "min")
+			return PrefilterSelection::Minimum;
+		if (selection == "percentile")
+			return PrefilterSelection::Percentile;
+		if (selection == "median")
+			return PrefilterSelection::Median;
+		throw std::runtime_error("--Prefilter must be one of none, min, percentile, median");
+	}
+
+	DelayPrefilter::DelayPrefilter(const PrefilterOptions& options)
+		: m_options(options)
+		, m_window(options.Window)
+	{}
+
+	std::optional<double> DelayPrefilter::Select(double delay, std::optional<DelayPrediction> prediction)
+	{
+		if (prediction && !Gate(delay, *prediction))
+			return std::nullopt;
+
+		if (m_options.Selection == PrefilterSelection::None)
+			return delay;
+
+		m_window.Push(delay);
+		switch (m_options.Selection)
+		{
+			case PrefilterSelection::Minimum:
+				return m_window.Minimum();
+			case PrefilterSelection::Percentile:
+				return m_window.Quantile(m_options.Percentile);
+			case PrefilterSelection::Median:
+				return m_window.Median();
+			default:
+				return delay;
+		}
+	}
+
+	bool DelayPrefilter::Gate(double delay, const DelayPrediction& prediction)
+	{
+		if (m_options.GateSigma <= 0.0)
+			return true;
+
+		const auto innovation{ delay - prediction.delay };
+		if (innovation * innovation <= m_options.GateSigma * m_options.GateSigma * prediction.variance ||
+			m_consecutiveRejections >= m_options.MaxRejections)
+		{
+			m_consecutiveRejections = 0;
+			return true;
+		}
+
+		++m_consecutiveRejections;
+		++m_rejected;
+		LogDebug("Path delay {:.3f} us gated: {:+.3f} us from the estimate, {:.1f} sigma",
+			delay, innovation, std::abs(innovation) / std::sqrt(prediction.variance));
+		return false;
+	}
+}
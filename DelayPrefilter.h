@@ -0,0 +1,67 @@
+#pragma once
+
+#include "SlidingWindow.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+
+namespace PTP
+{
+	enum class PrefilterSelection
+	{
+		None,       // Every sample goes to the estimator
+		Minimum,    // Lowest delay of the window: the packets that met no queue
+		Percentile, // Nearest-rank PrefilterOptions::Percentile of the window
+		Median      // Median of the window
+	};
+
+	// Command line spelling: none, min, percentile or median, else throws std::runtime_error.
+	PrefilterSelection ParsePrefilterSelection(const std::string& selection);
+
+	struct PrefilterOptions
+	{
+		PrefilterSelection Selection{ PrefilterSelection::None };
+		size_t Window{ 8 };          // Samples selected from, at most c_maxPrefilterWindow
+		double Percentile{ 0.1 };    // Percentile selection: 0 = minimum, 0.5 = median
+		double GateSigma{ 0.0 };     // Drop samples this many innovation standard deviations away, 0 = no gate
+		size_t MaxRejections{ 4 };   // Rejected in a row before the gate gives way to a real step
+	};
+
+	constexpr inline size_t c_maxPrefilterWindow{ 64 };
+
+	// The estimator's view of the next sample: its predicted delay and the variance of the
+	// innovation, P + R.
+	struct DelayPrediction
+	{
+		double delay;    // Microseconds
+		double variance; // us^2
+	};
+
+	// Stage between the path delay measurement and its estimator. A sample first passes the
+	// gate: more than GateSigma * sqrt(P + R) from the prediction is a queueing spike and is
+	// dropped, unless MaxRejections in a row say the path itself moved. Accepted samples enter
+	// a sliding window whose minimum, percentile or median goes to the estimator, so a spike
+	// that slips through is outvoted instead of averaged in. O(Window) per sample: a binary
+	// search and a move of at most c_maxPrefilterWindow doubles, no allocation.
+	class DelayPrefilter
+	{
+	public:
+		explicit DelayPrefilter(const PrefilterOptions& options = {});
+
+		// Returns the delay to hand to the estimator, nullopt when the gate dropped the sample.
+		// No prediction (nothing estimated yet) disables the gate.
+		std::optional<double> Select(double delay, std::optional<DelayPrediction> prediction);
+
+		uint64_t GetRejected() const { return m_rejected; }
+
+	private:
+		bool Gate(double delay, const DelayPrediction& prediction);
+
+		PrefilterOptions m_options;
+		SlidingWindowOrder<c_maxPrefilterWindow> m_window;
+		size_t m_consecutiveRejections{ 0 };
+		uint64_t m_rejected{ 0 };
+	};
+}
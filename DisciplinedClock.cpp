@@ -0,0 +1,145 @@
+#include "DisciplinedClock.h"
+#include "ClockSource.h"
+
+#include <cmath>
+#include <ctime>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+#if defined(__linux__)
+#include <cerrno>
+#include <sys/timex.h>
+#endif
+
+namespace PTP
+{
+	namespace
+	{
+#if defined(__linux__)
+		void AdjustTime(timex& tx)
+		{
+			if (::clock_adjtime(CLOCK_REALTIME, &tx) < 0)
+				throw std::runtime_error("clock_adjtime failed, errno " + std::to_string(errno));
+		}
+#endif
+	}
+
+	int64_t AdjustableClock::FromTimestamp(int64_t nanoseconds) const
+	{
+		// Both clocks are read back to back; their rate difference over the age of the
+		// timestamp (microseconds) is far below a nanosecond.
+		return Now() - (ReadClock() - nanoseconds);
+	}
+
+	ClockMapping AdjustableClock::GetMapping() const
+	{
+		return { GetKernelClockId(ClockSource::MonotonicRaw), ReadClock(ClockSource::MonotonicRaw), Now(), 0.0 };
+	}
+
+	DisciplinedClock::DisciplinedClock()
+		: m_rawAnchor(ReadClock(ClockSource::MonotonicRaw))
+		, m_timeAnchor(ReadClock())
+	{}
+
+	int64_t DisciplinedClock::At(int64_t raw) const
+	{
+		const auto elapsed{ static_cast<double>(raw - m_rawAnchor) };
+		return m_timeAnchor + std::llround(elapsed * (1.0 + m_frequencyPpb * 1e-9));
+	}
+
+	int64_t DisciplinedClock::Now() const
+	{
+		return At(ReadClock(ClockSource::MonotonicRaw));
+	}
+
+	void DisciplinedClock::AdjustFrequency(double ppb)
+	{
+		// Re-anchor so the new rate only applies from now on and the clock stays continuous.
+		const auto raw{ ReadClock(ClockSource::MonotonicRaw) };
+		m_timeAnchor = At(raw);
+		m_rawAnchor = raw;
+		m_frequencyPpb = ppb;
+	}
+
+	void DisciplinedClock::Step(int64_t nanoseconds)
+	{
+		m_timeAnchor += nanoseconds;
+	}
+
+	ClockMapping DisciplinedClock::GetMapping() const
+	{
+		return { GetKernelClockId(ClockSource::MonotonicRaw), m_rawAnchor, m_timeAnchor, m_frequencyPpb };
+	}
+
+	std::unique_ptr<SystemClock> SystemClock::TryCreate()
+	{
+#if defined(__linux__)
+		// Writing the current frequency back is a no-op that still needs CAP_SYS_TIME.
+		timex tx{};
+		if (::clock_adjtime(CLOCK_REALTIME, &tx) < 0)
+			return nullptr;
+		tx.modes = ADJ_FREQUENCY;
+		if (::clock_adjtime(CLOCK_REALTIME, &tx) < 0)
+			return nullptr;
+		return std::unique_ptr<SystemClock>(new SystemClock());
+#else
+		return nullptr;
+#endif
+	}
+
+	int64_t SystemClock::Now() const
+	{
+		return ReadClock(ClockSource::Realtime);
+	}
+
+	ClockMapping SystemClock::GetMapping() const
+	{
+		// The kernel applies the correction itself.
+		return { GetKernelClockId(ClockSource::Realtime), 0, 0, 0.0 };
+	}
+
+	void SystemClock::AdjustFrequency([[maybe_unused]] double ppb)
+	{
+#if defined(__linux__)
+		timex tx{};
+		tx.modes = ADJ_FREQUENCY;
+		tx.freq = std::lround(ppb * 65.536); // ppm with a 16-bit fractional part
+		AdjustTime(tx);
+#endif
+	}
+
+	void SystemClock::Step([[maybe_unused]] int64_t nanoseconds)
+	{
+#if defined(__linux__)
+		timex tx{};
+		tx.modes = ADJ_SETOFFSET | ADJ_NANO;
+		tx.time.tv_sec = nanoseconds / 1000000000LL;
+		tx.time.tv_usec = nanoseconds % 1000000000LL;
+		if (tx.time.tv_usec < 0)
+		{
+			tx.time.tv_sec -= 1;
+			tx.time.tv_usec += 1000000000LL;
+		}
+		AdjustTime(tx);
+#endif
+	}
+
+	std::unique_ptr<AdjustableClock> CreateClock(ClockTarget target)
+	{
+		switch (target)
+		{
+			case ClockTarget::None:
+				return nullptr;
+			case ClockTarget::System:
+				if (auto clock = SystemClock::TryCreate())
+					return clock;
+				std::cerr << "Not allowed to adjust the system clock (needs CAP_SYS_TIME), "
+					"disciplining a process-local clock instead" << std::endl;
+				return std::make_unique<DisciplinedClock>();
+			case ClockTarget::Disciplined:
+			default:
+				return std::make_unique<DisciplinedClock>();
+		}
+	}
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string_view>
+
+namespace PTP
+{
+	enum class ClockTarget
+	{
+		None,        // Only measure offset and path delay
+		Disciplined, // Steer a process-local DisciplinedClock
+		System       // Steer CLOCK_REALTIME with clock_adjtime (falls back to Disciplined)
+	};
+
+	// A clock as a line over a kernel clock:
+	// time = timeAnchor + (clock - clockAnchor) * (1 + frequencyPpb * 1e-9).
+	struct ClockMapping
+	{
+		int32_t clockId; // clockid_t
+		int64_t clockAnchor;
+		int64_t timeAnchor;
+		double frequencyPpb;
+	};
+
+	// A clock the servo can steer. Times are nanoseconds on the PTP (master) timescale.
+	class AdjustableClock
+	{
+	public:
+		virtual ~AdjustableClock() = default;
+
+		virtual int64_t Now() const = 0;
+		// Maps a packet timestamp (taken on the selected ClockSource) onto this clock.
+		virtual int64_t FromTimestamp(int64_t nanoseconds) const;
+		// Absolute frequency offset relative to the underlying oscillator.
+		virtual void AdjustFrequency(double ppb) = 0;
+		virtual void Step(int64_t nanoseconds) = 0;
+		virtual std::string_view Name() const = 0;
+		// Lets other processes evaluate the clock (SharedTime.h). Exact for the clocks here,
+		// the default pairs Now() with CLOCK_MONOTONIC_RAW and assumes no rate difference.
+		virtual ClockMapping GetMapping() const;
+	};
+
+	// Process-local clock: CLOCK_MONOTONIC_RAW with a slewed rate and a phase offset on top.
+	// Needs no privileges, so the servo can be tuned on any machine.
+	class DisciplinedClock : public AdjustableClock
+	{
+	public:
+		DisciplinedClock();
+
+		int64_t Now() const override;
+		void AdjustFrequency(double ppb) override;
+		void Step(int64_t nanoseconds) override;
+		std::string_view Name() const override { return "disciplined"; }
+		ClockMapping GetMapping() const override;
+
+		double GetFrequency() const { return m_frequencyPpb; }
+
+	private:
+		int64_t At(int64_t raw) const;
+
+		int64_t m_rawAnchor;
+		int64_t m_timeAnchor;
+		double m_frequencyPpb{ 0.0 };
+	};
+
+	// CLOCK_REALTIME steered with clock_adjtime. Requires CAP_SYS_TIME.
+	class SystemClock : public AdjustableClock
+	{
+	public:
+		// Returns nullptr if the process may not adjust the system clock.
+		static std::unique_ptr<SystemClock> TryCreate();
+
+		int64_t Now() const override;
+		void AdjustFrequency(double ppb) override;
+		void Step(int64_t nanoseconds) override;
+		std::string_view Name() const override { return "system"; }
+		ClockMapping GetMapping() const override;
+
+	private:
+		SystemClock() = default;
+	};
+
+	// nullptr for ClockTarget::None.
+	std::unique_ptr<AdjustableClock> CreateClock(ClockTarget target);
+}
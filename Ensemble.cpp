@@ -0,0 +1,180 @@
+#include "Ensemble.h"
+#include "Logger.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace PTP
+{
+	Ensemble::Ensemble(size_t sources,
+		DelayEstimator estimator,
+		uint8_t domainNumber,
+		const PrefilterOptions& prefilter,
+		const EnsembleOptions& options)
+		: m_options(options)
+		, m_sources(sources)
+		, m_inRound(sources, false)
+	{
+		m_cores.reserve(sources);
+		for (size_t i = 0; i < sources; ++i)
+			m_cores.push_back(std::make_unique<ClientCore>(nullptr, estimator, false, ServoOptions{}, domainNumber, prefilter));
+		m_candidates.reserve(sources);
+	}
+
+	std::optional<EnsembleEstimate> Ensemble::OnMessage(size_t source,
+		const PtpMessage& message,
+		PtpTimestamp receiveTimestamp,
+		std::chrono::steady_clock::time_point now)
+	{
+		auto& core{ *m_cores[source] };
+		core.OnMessage(message, receiveTimestamp, now);
+		if (core.GetOffsetSamples() == m_sources[source].lastSample)
+			return std::nullopt;
+
+		m_sources[source].lastSample = core.GetOffsetSamples();
+		return AddSample(source, *core.GetLastOffset());
+	}
+
+	std::optional<EnsembleEstimate> Ensemble::AddSample(size_t source, const OffsetSample& sample)
+	{
+		constexpr double c_intervalSmoothing{ 1.0 / 8.0 };
+
+		if (!m_offsetReference)
+		{
+			m_offsetReference = sample.offset;
+			m_timeReference = sample.time;
+		}
+		// The filter sees t2 - t1 alone: the source's path delay is taken off when combining,
+		// so a new delay estimate does not have to work its way through the filter.
+		const double time{ static_cast<double>(sample.time - m_timeReference) * 1e-9 };
+		const double offset{ static_cast<double>(sample.offset + sample.pathDelay - *m_offsetReference) / 1000.0 };
+
+		auto& state{ m_sources[source] };
+		if (state.samples == 1)
+			state.interval = time - state.lastTime;
+		else if (state.samples > 1)
+			state.interval += (time - state.lastTime - state.interval) * c_intervalSmoothing;
+		state.filter.Update(offset, time);
+		state.lastTime = time;
+		++state.samples;
+
+		// A round ends once every live source delivered, or early when one delivers again
+		// before a lost or slow one did, so the servo runs at the fastest source's rate.
+		const bool repeated{ m_inRound[source] };
+		m_inRound[source] = true;
+		if (!repeated)
+		{
+			for (size_t i = 0; i < m_sources.size(); ++i)
+			{
+				if (!m_inRound[i] && IsLive(m_sources[i], time))
+					return std::nullopt;
+			}
+		}
+
+		std::fill(m_inRound.begin(), m_inRound.end(), false);
+		m_estimate = Combine(time, sample.time);
+		return m_estimate;
+	}
+
+	EnsembleEstimate Ensemble::Combine(double time, int64_t packetTime)
+	{
+		constexpr uint64_t c_reportInterval{ 64 };
+
+		// Sources still warming up only count when nothing else is there.
+		const bool anyWarm{ std::ranges::any_of(m_sources, [this, time](const EnsembleSource& source)
+		{
+			return source.samples >= m_options.WarmupSamples && IsLive(source, time);
+		}) };
+
+		m_candidates.clear();
+		for (size_t i = 0; i < m_sources.size(); ++i)
+		{
+			auto& source{ m_sources[i] };
+			source.weight = 0.0;
+			if (!IsLive(source, time) || (anyWarm && source.samples < m_options.WarmupSamples))
+				continue;
+			const auto predicted{ source.filter.GetEstimate() + source.filter.GetDrift() * (time - source.lastTime)
+				- m_cores[i]->GetMeanPathDelay().value_or(0.0) };
+			const auto variance{ Variance(source) };
+			const auto halfWidth{ std::max(m_options.FalsetickerSigma * std::sqrt(variance), m_options.MinimumInterval) };
+			m_candidates.push_back({ i, predicted, variance, predicted - halfWidth, predicted + halfWidth });
+		}
+
+		// Marzullo: the point inside the most intervals is one of their lower ends. With few
+		// sources the quadratic scan beats sorting endpoints.
+		const auto contains = [](const Candidate& candidate, double point)
+		{
+			return candidate.low <= point && point <= candidate.high;
+		};
+		double bestPoint{ 0.0 };
+		size_t bestCount{ 0 };
+		for (const auto& candidate : m_candidates)
+		{
+			const auto point{ candidate.low };
+			const auto count{ static_cast<size_t>(std::ranges::count_if(m_candidates,
+				[&](const Candidate& other) { return contains(other, point); })) };
+			if (count > bestCount)
+			{
+				bestCount = count;
+				bestPoint = point;
+			}
+		}
+		// Without a majority there is no telling who is wrong, so everyone counts.
+		const bool majority{ 2 * bestCount > m_candidates.size() };
+
+		double weightSum{ 0.0 }, weightedOffset{ 0.0 };
+		size_t truechimers{ 0 };
+		for (const auto& candidate : m_candidates)
+		{
+			if (majority && !contains(candidate, bestPoint))
+				continue;
+			const auto weight{ 1.0 / candidate.variance };
+			m_sources[candidate.source].weight = weight;
+			weightSum += weight;
+			weightedOffset += weight * candidate.offset;
+			++truechimers;
+		}
+		const auto combined{ weightSum > 0.0 ? weightedOffset / weightSum : 0.0 };
+
+		for (const auto& candidate : m_candidates)
+		{
+			auto& source{ m_sources[candidate.source] };
+			source.weight /= weightSum;
+			const bool falseticker{ source.weight == 0.0 };
+			if (falseticker && !source.falseticker)
+				LogWarning("Ensemble source {} is a falseticker: {:+.3f} us from the combined offset", candidate.source, candidate.offset - combined);
+			else if (!falseticker && source.falseticker)
+				LogInfo("Ensemble source {} agrees with the majority again", candidate.source);
+			source.falseticker = falseticker;
+		}
+
+		const EnsembleEstimate estimate{
+			.offset = *m_offsetReference + std::llround(combined * 1000.0),
+			.time = packetTime,
+			.uncertainty = weightSum > 0.0 ? std::sqrt(1.0 / weightSum) * 1000.0 : 0.0,
+			.sources = truechimers,
+			.falsetickers = m_candidates.size() - truechimers };
+		if (++m_rounds % c_reportInterval == 0)
+		{
+			LogInfo("Ensemble offset: {} ns +- {:.1f} ns from {} of {} sources | falsetickers: {}",
+				estimate.offset, estimate.uncertainty, estimate.sources, m_sources.size(), estimate.falsetickers);
+		}
+		return estimate;
+	}
+
+	// P alone trusts the filter's own noise model; a NIS mean above 1 says the innovations are
+	// larger than that model predicts, so the source is weighted as the residuals show it.
+	double Ensemble::Variance(const EnsembleSource& source) const
+	{
+		const auto nis{ source.filter.GetNisMean() };
+		const auto floor{ m_options.MinimumUncertainty * m_options.MinimumUncertainty };
+		return source.filter.GetEstimateUncertainty() * (nis > 1.0 ? nis : 1.0) + floor;
+	}
+
+	bool Ensemble::IsLive(const EnsembleSource& source, double time) const
+	{
+		if (source.samples == 0)
+			return false;
+		return source.samples < 2 || time - source.lastTime <= m_options.StaleIntervals * source.interval;
+	}
+}
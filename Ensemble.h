@@ -0,0 +1,99 @@
+#pragma once
+
+#include "PtpClientCore.h"
+#include "OffsetDriftFilter.h"
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <vector>
+
+namespace PTP
+{
+	struct EnsembleOptions
+	{
+		double FalsetickerSigma{ 4.0 };  // Half width of a source's interval in standard deviations
+		double MinimumUncertainty{ 0.1 }; // Floor of a source's standard deviation (us)
+		double MinimumInterval{ 1.0 };    // Floor of an interval's half width (us): path delay errors the filter cannot see
+		size_t WarmupSamples{ 8 };        // Samples before a source's filter is trusted
+		double StaleIntervals{ 4.0 };     // A source missing this many of its sample intervals is left out
+	};
+
+	// One combined offset, on the packet clock like the sources' own.
+	struct EnsembleEstimate
+	{
+		int64_t offset;        // Nanoseconds, packet clock - master clock
+		int64_t time;          // Packet clock nanoseconds the offset holds for
+		double uncertainty;    // Nanoseconds, standard deviation of the weighted mean
+		size_t sources;        // Truechimers combined
+		size_t falsetickers;
+	};
+
+	struct EnsembleSource
+	{
+		OffsetDriftFilter filter;
+		uint64_t samples{ 0 };
+		uint64_t lastSample{ 0 }; // The core's sample count when it was last taken over
+		double lastTime{ 0.0 };   // Seconds since the ensemble's first sample
+		double interval{ 0.0 };   // Smoothed seconds between samples
+		double weight{ 0.0 };     // Share of the last combination, 0 = left out
+		bool falseticker{ false };
+	};
+
+	// Several masters at once without any I/O. Every source is a measure-only ClientCore with
+	// its own timestamp sets and path delay filter; its t2 - t1 feed an OffsetDriftFilter.
+	// Once every live source delivered (or one delivers twice) the filters are predicted to
+	// the newest sample less their path delay, sources whose +-FalsetickerSigma intervals miss
+	// the majority's intersection (Marzullo) are dropped and the rest averaged by inverse
+	// variance. A source's variance is its filter's P inflated by its NIS mean when that shows
+	// overconfidence, so a noisy or overloaded master only costs its own weight. The combined
+	// offset is meant for ClientCore::SteerClock on the core that owns the clock.
+	class Ensemble
+	{
+	public:
+		Ensemble(size_t sources,
+			DelayEstimator estimator = DelayEstimator::Scalar,
+			uint8_t domainNumber = 0,
+			const PrefilterOptions& prefilter = {},
+			const EnsembleOptions& options = {});
+
+		// Feeds a message from server 'source'; returns an estimate when it completes a round.
+		std::optional<EnsembleEstimate> OnMessage(size_t source,
+			const PtpMessage& message,
+			PtpTimestamp receiveTimestamp,
+			std::chrono::steady_clock::time_point now);
+
+		size_t Size() const { return m_cores.size(); }
+		// For the delay requests and stale entry cleanup of each source.
+		ClientCore& GetCore(size_t source) { return *m_cores[source]; }
+		const ClientCore& GetCore(size_t source) const { return *m_cores[source]; }
+		const EnsembleSource& GetSource(size_t source) const { return m_sources[source]; }
+		std::optional<EnsembleEstimate> GetEstimate() const { return m_estimate; }
+
+	private:
+		struct Candidate
+		{
+			size_t source;
+			double offset;   // Microseconds relative to m_offsetReference, predicted to the round's time
+			double variance; // us^2
+			double low;      // offset -+ FalsetickerSigma standard deviations
+			double high;
+		};
+
+		std::optional<EnsembleEstimate> AddSample(size_t source, const OffsetSample& sample);
+		EnsembleEstimate Combine(double time, int64_t packetTime);
+		double Variance(const EnsembleSource& source) const;
+		bool IsLive(const EnsembleSource& source, double time) const;
+
+		EnsembleOptions m_options;
+		std::vector<std::unique_ptr<ClientCore>> m_cores;
+		std::vector<EnsembleSource> m_sources;
+		std::vector<bool> m_inRound;
+		std::vector<Candidate> m_candidates; // Reused by Combine
+		std::optional<int64_t> m_offsetReference; // First raw offset (ns), keeps doubles small
+		int64_t m_timeReference{ 0 };              // Its packet clock time (ns)
+		std::optional<EnsembleEstimate> m_estimate;
+		uint64_t m_rounds{ 0 };
+	};
+}
@@ -0,0 +1,130 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+
+namespace PTP
+{
+	// Row-major fixed-size matrix on the stack. Just enough linear algebra for small filters.
+	template <size_t Rows, size_t Cols>
+	struct Matrix
+	{
+		std::array<double, Rows * Cols> values{};
+
+		constexpr double& operator()(size_t row, size_t col) { return values[row * Cols + col]; }
+		constexpr double operator()(size_t row, size_t col) const { return values[row * Cols + col]; }
+
+		static constexpr Matrix Identity() requires (Rows == Cols)
+		{
+			Matrix result;
+			for (size_t i = 0; i < Rows; ++i)
+				result(i, i) = 1.0;
+			return result;
+		}
+
+		constexpr Matrix<Cols, Rows> Transposed() const
+		{
+			Matrix<Cols, Rows> result;
+			for (size_t r = 0; r < Rows; ++r)
+				for (size_t c = 0; c < Cols; ++c)
+					result(c, r) = (*this)(r, c);
+			return result;
+		}
+	};
+
+	template <size_t Rows, size_t Inner, size_t Cols>
+	constexpr Matrix<Rows, Cols> operator*(const Matrix<Rows, Inner>& lhs, const Matrix<Inner, Cols>& rhs)
+	{
+		Matrix<Rows, Cols> result;
+		for (size_t r = 0; r < Rows; ++r)
+			for (size_t c = 0; c < Cols; ++c)
+			{
+				double sum{ 0.0 };
+				for (size_t i = 0; i < Inner; ++i)
+					sum += lhs(r, i) * rhs(i, c);
+				result(r, c) = sum;
+			}
+		return result;
+	}
+
+	template <size_t Rows, size_t Cols>
+	constexpr Matrix<Rows, Cols> operator*(double scale, Matrix<Rows, Cols> matrix)
+	{
+		for (auto& value : matrix.values)
+			value *= scale;
+		return matrix;
+	}
+
+	template <size_t Rows, size_t Cols>
+	constexpr Matrix<Rows, Cols> operator+(Matrix<Rows, Cols> lhs, const Matrix<Rows, Cols>& rhs)
+	{
+		for (size_t i = 0; i < lhs.values.size(); ++i)
+			lhs.values[i] += rhs.values[i];
+		return lhs;
+	}
+
+	template <size_t Rows, size_t Cols>
+	constexpr Matrix<Rows, Cols> operator-(Matrix<Rows, Cols> lhs, const Matrix<Rows, Cols>& rhs)
+	{
+		for (size_t i = 0; i < lhs.values.size(); ++i)
+			lhs.values[i] -= rhs.values[i];
+		return lhs;
+	}
+
+	// Linear Kalman filter with N states and a scalar measurement z = H x + v, v ~ N(0, R).
+	// A scalar measurement keeps the innovation covariance a number, so no matrix inversion.
+	template <size_t N>
+	class KalmanFilter
+	{
+	public:
+		using StateVector = Matrix<N, 1>;
+		using StateMatrix = Matrix<N, N>;
+		using ObservationRow = Matrix<1, N>;
+
+		struct Innovation
+		{
+			double residual; // z - H x before the update
+			double variance; // S = H P H' + R
+		};
+
+		KalmanFilter(const StateVector& initialState, const StateMatrix& initialCovariance)
+			: m_state(initialState)
+			, m_covariance(initialCovariance)
+		{}
+
+		// x = F x, P = F P F' + Q
+		void Predict(const StateMatrix& transition, const StateMatrix& processNoise)
+		{
+			m_state = transition * m_state;
+			m_covariance = transition * m_covariance * transition.Transposed() + processNoise;
+		}
+
+		Innovation Update(double measurement, const ObservationRow& observation, double measurementNoise)
+		{
+			const auto observationT{ observation.Transposed() };
+			const double residual{ measurement - (observation * m_state)(0, 0) };
+			const double variance{ (observation * m_covariance * observationT)(0, 0) + measurementNoise };
+
+			m_gain = (1.0 / variance) * (m_covariance * observationT);
+			m_state = m_state + residual * m_gain;
+
+			// Joseph form keeps P symmetric and positive definite under rounding.
+			const auto correction{ StateMatrix::Identity() - m_gain * observation };
+			m_covariance = correction * m_covariance * correction.Transposed()
+				+ measurementNoise * (m_gain * m_gain.Transposed());
+
+			return { residual, variance };
+		}
+
+		const StateVector& GetState() const { return m_state; }
+		const StateMatrix& GetCovariance() const { return m_covariance; }
+		const StateVector& GetGain() const { return m_gain; }
+
+		void ScaleCovariance(double factor) { m_covariance = factor * m_covariance; }
+
+	private:
+		StateVector m_state;
+		StateMatrix m_covariance;
+		StateVector m_gain{};
+	};
+}
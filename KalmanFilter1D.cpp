@@ -1,24 +1,18 @@
 #include "KalmanFilter1D.h"
+#include "Logger.h"
 
-#include <numeric>
 #include <algorithm>
-#include <iostream>
 
 namespace PTP
 {
-	namespace
+	KalmanFilter1D::KalmanFilter1D(double initialEstimate, const KalmanTuning& tuning)
+		: m_tuning(tuning)
+		, m_currentEstimate(initialEstimate)
+		, m_measurements(tuning.Window)
 	{
-		double Mean(const std::vector<double>& v)
-		{
-			return  std::accumulate(v.begin(), v.end(), 0.0)
-                        / v.size();
-		}
+		m_tuning.Window = std::clamp<size_t>(tuning.Window, 1, c_maxWindow);
 	}
 
-	KalmanFilter1D::KalmanFilter1D(double initialEstimate)
-		: m_currentEstimate(initialEstimate)
-	{}
-
 	double KalmanFilter1D::Update(double measurement)
 	{
 		UpdateMeasurementNoise(measurement);
@@ -29,15 +23,18 @@ namespace PTP
 		UpdateCovariance();
 		UpdateHistory(measurement);
 
-		std::cout << std::format(
-			"Raw: {:.3f} us | Estimate: {:.3f} us | Q: {:.6f} | K: {:.7f} | R: {:.7f} | Innovation mean:{:.3f} | NIS mean:{:.3f} \r\n",
+		if (!m_diagnostics)
+			return m_currentEstimate;
+
+		LogInfo(
+			"Raw: {:.3f} us | Estimate: {:.3f} us | Q: {:.6f} | K: {:.7f} | R: {:.7f} | Innovation mean:{:.3f} | NIS mean:{:.3f}",
 			measurement,
 			m_currentEstimate,
 			m_processNoise,
 			GetKalmanGain(),
 			GetMeasurementNoise(),
-			Mean(m_innoHistory),
-			Mean(m_nisHistory)
+			m_innoHistory.Mean(),
+			m_nisHistory.Mean()
 		);
 
 		return m_currentEstimate;
@@ -48,11 +45,8 @@ namespace PTP
 	{
 		const auto updateProcessNoise{ [this](auto prevEstimate)
 		{
-            constexpr auto c_qScale = 0.01;
-            constexpr auto c_qMin = 1e-6;
-		    constexpr auto c_qMax = 10.0;
 			const double delta{ std::abs(m_currentEstimate - prevEstimate) };
-			m_processNoise = std::clamp(c_qScale * delta * delta, c_qMin, c_qMax);
+			m_processNoise = std::clamp(m_tuning.QScale * delta * delta, m_tuning.QMin, m_tuning.QMax);
 			return m_currentEstimate;
 		} };
 
@@ -63,21 +57,17 @@ namespace PTP
 
 	void KalmanFilter1D::UpdateMeasurementNoise(double measurement)
 	{
-		m_measurements.push_back(measurement);
-		const auto size{ m_measurements.size() };
-		constexpr auto c_windowSize{ 20 };
-		if (size > c_windowSize)
-			m_measurements.pop_front();
-
+		m_measurements.Push(measurement);
+		// Once the window is full the mean is divided by Window + 1 and the variance by
+		// Window, exactly as the original deque version did (it sized before pop_front).
+		if (m_measurementCount <= m_tuning.Window)
+			++m_measurementCount;
+		const auto size{ m_measurementCount };
 		if (size < 2)
 			return;
 
-		const double mean = std::accumulate(m_measurements.begin(), m_measurements.end(), 0.0)
-			/ size;
-		const double newVariance = std::accumulate(
-			m_measurements.begin(), m_measurements.end(), 0.0,
-			[mean](double acc, double v) { return acc + (v - mean) * (v - mean); }
-		) / (size - 1);
+		const double mean = m_measurements.Mean() * m_measurements.Size() / size;
+		const double newVariance = m_measurements.SumOfSquaredDeviations(mean) / (size - 1);
 
 		m_measurementNoise = std::max(newVariance, 1e-6/* Ensure it is not zero*/);
 	}
@@ -102,8 +92,8 @@ namespace PTP
 	void KalmanFilter1D::CalculateKalmanGain()
 	{
 		// Inflate uncertainty if it is too low
-		if (m_estimateUncertainty < m_measurementNoise * 0.1)
-			m_estimateUncertainty *= 10.0;
+		if (m_estimateUncertainty < m_measurementNoise * m_tuning.InflationThreshold)
+			m_estimateUncertainty *= m_tuning.InflationFactor;
 
 		const double ratio{ m_estimateUncertainty / m_measurementNoise };
 		m_kalmanGain = ratio / (1.0 + ratio);
@@ -111,16 +101,11 @@ namespace PTP
 
 	void KalmanFilter1D::UpdateHistory(double measurement)
 	{
-		constexpr auto c_historyMax{ 50 };
 		const double innovation = measurement - m_currentEstimate;
-		m_innoHistory.push_back(innovation);
-		if (m_innoHistory.size() > c_historyMax)
-			m_innoHistory.erase(m_innoHistory.begin());
+		m_innoHistory.Push(innovation);
 
 		const double S = m_estimateUncertainty + m_measurementNoise;
 		const double nis = (innovation * innovation) / S;
-		m_nisHistory.push_back(nis);
-		if (m_nisHistory.size() > c_historyMax)
-			m_nisHistory.erase(m_nisHistory.begin());
+		m_nisHistory.Push(nis);
 	}
 }
\ No newline at end of file
@@ -1,26 +1,50 @@
-#include <deque>
+#pragma once
+
+#include "SlidingWindow.h"
+
 #include <cmath>
 #include <optional>
-#include <vector>
 
 namespace PTP
 {
+	// Constants of the adaptive noise model. The defaults are the original hand-picked values;
+	// PtpTune searches them on a recorded delay series.
+	struct KalmanTuning
+	{
+		double QScale{ 0.01 };            // Q = QScale * (estimate change)^2 ...
+		double QMin{ 1e-6 };              // ... clamped to [QMin, QMax]
+		double QMax{ 10.0 };
+		size_t Window{ 20 };              // Measurements R is the variance of, at most KalmanFilter1D::c_maxWindow
+		double InflationThreshold{ 0.1 }; // P below this fraction of R ...
+		double InflationFactor{ 10.0 };   // ... is multiplied by this before the gain
+	};
+
     class KalmanFilter1D
 	{
 	public:
-		KalmanFilter1D(double initialEstimate = 300.0/*heuristic Value us*/);
+		KalmanFilter1D(double initialEstimate = 300.0/*heuristic Value us*/, const KalmanTuning& tuning = {});
 
 		double Update(double measurement);
 
+		// Print one line per update (Raw, Estimate, Q, K, R, innovation and NIS means).
+		void EnableDiagnostics(bool enabled) { m_diagnostics = enabled; }
+
 		// For Unit-tests
 		double GetEstimate() const { return m_currentEstimate; }
 		double GetMeasurementNoise() const { return m_measurementNoise; }
 		double GetProcessNoise() const { return m_processNoise; }
 		double GetKalmanGain() const { return m_kalmanGain; }
 		double GetEstimateUncertainty() const { return m_estimateUncertainty; }
+		double GetInnovationMean() const { return m_innoHistory.Mean(); }
+		double GetNisMean() const { return m_nisHistory.Mean(); }
+		const KalmanTuning& GetTuning() const { return m_tuning; }
+
+		static constexpr size_t c_maxWindow{ 64 };
 
 	private:
 
+		static constexpr size_t c_historyMax{ 50 };
+
 		void UpdateProcessNoise();
 		void UpdateMeasurementNoise(double measurement);
 		void UpdateCovariance();
@@ -29,17 +53,20 @@ namespace PTP
 		void CalculateKalmanGain();
 		void UpdateHistory(double measurement);
 
+		KalmanTuning m_tuning;
 		double m_currentEstimate;           // Microseconds
 		double m_estimateUncertainty{ 1.0 };  // P
 		double m_measurementNoise{ 1.0 };     // R
 		double m_processNoise{ 1.0 };         // Q
 		double m_kalmanGain{ 0.0 };           // K
+		bool m_diagnostics{ false };
 
 		std::optional<double> m_prevEstimate;
 
-		std::deque<double> m_measurements;
-		std::vector<double> m_innoHistory;
-		std::vector<double> m_nisHistory;
+		SlidingWindowVariance<c_maxWindow> m_measurements;
+		size_t m_measurementCount{ 0 };
+		SlidingWindowMean<c_historyMax> m_innoHistory;
+		SlidingWindowMean<c_historyMax> m_nisHistory;
 
 	};
 }
@@ -0,0 +1,174 @@
+#include "KalmanSweep.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <map>
+#include <stdexcept>
+#include <thread>
+
+// One build of the block kernel per instruction set, chosen when the program loads.
+#if defined(__x86_64__) && defined(__GNUC__) && defined(__linux__)
+#define PTP_SWEEP_TARGETS __attribute__((target_clones("avx512f", "avx2", "default")))
+#else
+#define PTP_SWEEP_TARGETS
+#endif
+
+namespace PTP
+{
+	namespace
+	{
+		using Lanes = std::array<double, c_sweepLanes>;
+
+		struct TuningBlock
+		{
+			Lanes qScale;
+			Lanes qMin;
+			Lanes qMax;
+			Lanes inflationThreshold;
+			Lanes inflationFactor;
+			Lanes estimate;
+			Lanes errorSquares;
+			Lanes nisSum;
+		};
+
+		// A block of tunings that share a Window, and so the R series.
+		struct SweepJob
+		{
+			const std::vector<double>* noise;
+			std::array<size_t, c_sweepLanes> tunings; // Indices into the caller's span
+			size_t lanes;
+		};
+
+		// KalmanFilter1D::Update, one lane per tuning, with every branch turned into a select
+		// so the lane loops vectorize. The order of operations is the filter's, so a lane ends
+		// where a KalmanFilter1D with its tuning does.
+		PTP_SWEEP_TARGETS
+		void RunBlock(TuningBlock& block,
+			const double* delays,
+			const double* noise,
+			size_t samples,
+			size_t warmup,
+			bool hasTruth,
+			double truth,
+			double initialEstimate)
+		{
+			Lanes estimate, previous, uncertainty, processNoise, errorSquares{}, nisSum{};
+			estimate.fill(initialEstimate);
+			previous.fill(initialEstimate);
+			uncertainty.fill(1.0);
+			processNoise.fill(1.0);
+
+			for (size_t i = 0; i < samples; ++i)
+			{
+				const double measurement{ delays[i] };
+				const double r{ noise[i] };
+				const bool first{ i == 0 };
+				const double weight{ i >= warmup ? 1.0 : 0.0 };
+				for (size_t lane = 0; lane < c_sweepLanes; ++lane)
+				{
+					// UpdateProcessNoise: the first update keeps the initial Q.
+					const double delta{ estimate[lane] - previous[lane] };
+					const double q{ std::clamp(block.qScale[lane] * delta * delta, block.qMin[lane], block.qMax[lane]) };
+					processNoise[lane] = first ? processNoise[lane] : q;
+					previous[lane] = estimate[lane];
+
+					double p{ uncertainty[lane] + processNoise[lane] };
+					p = p < r * block.inflationThreshold[lane] ? p * block.inflationFactor[lane] : p;
+					const double ratio{ p / r };
+					const double gain{ ratio / (1.0 + ratio) };
+					const double innovation{ measurement - estimate[lane] };
+					const double nis{ innovation * innovation / (p + r) };
+					estimate[lane] += gain * innovation;
+					uncertainty[lane] = p * (1 - gain);
+
+					const double error{ hasTruth ? estimate[lane] - truth : innovation };
+					errorSquares[lane] += weight * error * error;
+					nisSum[lane] += weight * nis;
+				}
+			}
+
+			block.estimate = estimate;
+			block.errorSquares = errorSquares;
+			block.nisSum = nisSum;
+		}
+	}
+
+	std::vector<SweepResult> SweepKalmanTuning(std::span<const double> delays,
+		std::span<const KalmanTuning> tunings,
+		const SweepOptions& options)
+	{
+		if (delays.size() <= options.Warmup)
+			throw std::runtime_error("The delay series must be longer than the warmup");
+
+		// R depends on the measurements and the window alone.
+		std::map<size_t, std::vector<size_t>> byWindow;
+		for (size_t i = 0; i < tunings.size(); ++i)
+			byWindow[std::clamp<size_t>(tunings[i].Window, 1, KalmanFilter1D::c_maxWindow)].push_back(i);
+
+		std::vector<std::vector<double>> noiseSeries;
+		noiseSeries.reserve(byWindow.size());
+		std::vector<SweepJob> jobs;
+		for (const auto& [window, indices] : byWindow)
+		{
+			KalmanFilter1D filter(options.InitialEstimate, KalmanTuning{ .Window = window });
+			auto& noise{ noiseSeries.emplace_back() };
+			noise.reserve(delays.size());
+			for (const auto delay : delays)
+			{
+				filter.Update(delay);
+				noise.push_back(filter.GetMeasurementNoise());
+			}
+
+			for (size_t first = 0; first < indices.size(); first += c_sweepLanes)
+			{
+				SweepJob job{ .noise = &noise, .tunings = {}, .lanes = std::min(c_sweepLanes, indices.size() - first) };
+				for (size_t lane = 0; lane < c_sweepLanes; ++lane)
+					job.tunings[lane] = indices[first + std::min(lane, job.lanes - 1)]; // Pad with the last
+				jobs.push_back(job);
+			}
+		}
+
+		std::vector<SweepResult> results(tunings.size());
+		const auto scored{ static_cast<double>(delays.size() - options.Warmup) };
+		std::atomic<size_t> nextJob{ 0 };
+		const auto worker = [&]
+		{
+			TuningBlock block;
+			for (auto index = nextJob.fetch_add(1); index < jobs.size(); index = nextJob.fetch_add(1))
+			{
+				const auto& job{ jobs[index] };
+				for (size_t lane = 0; lane < c_sweepLanes; ++lane)
+				{
+					const auto& tuning{ tunings[job.tunings[lane]] };
+					block.qScale[lane] = tuning.QScale;
+					block.qMin[lane] = tuning.QMin;
+					block.qMax[lane] = tuning.QMax;
+					block.inflationThreshold[lane] = tuning.InflationThreshold;
+					block.inflationFactor[lane] = tuning.InflationFactor;
+				}
+				RunBlock(block, delays.data(), job.noise->data(), delays.size(), options.Warmup,
+					options.Truth.has_value(), options.Truth.value_or(0.0), options.InitialEstimate);
+				for (size_t lane = 0; lane < job.lanes; ++lane)
+				{
+					results[job.tunings[lane]] = {
+						.tuning = tunings[job.tunings[lane]],
+						.rmsError = std::sqrt(block.errorSquares[lane] / scored),
+						.nisMean = block.nisSum[lane] / scored,
+						.estimate = block.estimate[lane] };
+				}
+			}
+		};
+
+		const auto threads{ std::min<size_t>(options.Threads != 0 ? options.Threads : std::max(1u, std::thread::hardware_concurrency()),
+			jobs.size()) };
+		{
+			std::vector<std::jthread> workers;
+			for (size_t i = 1; i < threads; ++i)
+				workers.emplace_back(worker);
+			worker();
+		}
+		return results;
+	}
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "KalmanFilter1D.h"
+
+#include <cstddef>
+#include <optional>
+#include <span>
+#include <vector>
+
+namespace PTP
+{
+	struct SweepOptions
+	{
+		size_t Threads{ 0 };            // 0 = one per hardware thread
+		size_t Warmup{ 20 };            // Leading samples left out of the scores
+		std::optional<double> Truth;    // Known true delay (us): score the estimate against it
+		double InitialEstimate{ 300.0 }; // As KalmanFilter1D's default
+	};
+
+	// One tuning's scores over the whole series, after the warmup.
+	struct SweepResult
+	{
+		KalmanTuning tuning;
+		double rmsError;  // us: estimate - Truth, or without it the one-step prediction error
+		double nisMean;   // Innovation^2 / (P + R) before each update, 1 when P and R are honest
+		double estimate;  // us, after the last sample
+	};
+
+	// Runs KalmanFilter1D's update for every tuning over the same delay series. Tunings are
+	// grouped by Window, whose R series depends on the measurements alone and is computed once
+	// by a scalar KalmanFilter1D; the rest of the state lives in structure-of-arrays blocks of
+	// c_sweepLanes tunings stepped together, which the compiler vectorizes (AVX-512, AVX2 or
+	// scalar, picked at run time on x86-64), and the blocks are spread over threads.
+	// Results come back in the order of 'tunings'.
+	std::vector<SweepResult> SweepKalmanTuning(std::span<const double> delays,
+		std::span<const KalmanTuning> tunings,
+		const SweepOptions& options = {});
+
+	constexpr inline size_t c_sweepLanes{ 16 };
+}
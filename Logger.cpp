@@ -0,0 +1,312 @@
+#include "Logger.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+namespace PTP
+{
+	namespace
+	{
+		constexpr size_t c_ringCapacity{ 1024 }; // Records per producing thread, power of two
+		constexpr auto c_idleSleep{ std::chrono::milliseconds(1) };
+		constexpr auto c_dropReportInterval{ std::chrono::seconds(1) };
+
+		int64_t Now()
+		{
+			return std::chrono::steady_clock::now().time_since_epoch().count();
+		}
+
+		std::string_view LevelName(LogLevel level)
+		{
+			switch (level)
+			{
+				case LogLevel::Debug: return "DEBUG";
+				case LogLevel::Info: return "INFO";
+				case LogLevel::Warning: return "WARN";
+				case LogLevel::Error: return "ERROR";
+				default: return "";
+			}
+		}
+
+		// Single producer (the owning thread), single consumer (the writer thread).
+		class LogRing
+		{
+		public:
+			Detail::LogRecord* Begin()
+			{
+				const auto head{ m_head.load(std::memory_order_relaxed) };
+				if (head - m_cachedTail == c_ringCapacity)
+				{
+					m_cachedTail = m_tail.load(std::memory_order_acquire);
+					if (head - m_cachedTail == c_ringCapacity)
+					{
+						m_dropped.fetch_add(1, std::memory_order_relaxed);
+						return nullptr;
+					}
+				}
+				return &m_records[head & (c_ringCapacity - 1)];
+			}
+
+			void Commit()
+			{
+				m_head.store(m_head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+			}
+
+			const Detail::LogRecord* Front() const
+			{
+				const auto tail{ m_tail.load(std::memory_order_relaxed) };
+				if (tail == m_head.load(std::memory_order_acquire))
+					return nullptr;
+				return &m_records[tail & (c_ringCapacity - 1)];
+			}
+
+			void Pop()
+			{
+				m_tail.store(m_tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+			}
+
+			bool AllowRecord(int64_t now, uint32_t recordsPerSecond)
+			{
+				if (recordsPerSecond == 0)
+					return true;
+
+				// Token bucket with a burst of one second's worth of records.
+				const double elapsed{ static_cast<double>(now - m_lastRefill) * 1e-9 };
+				m_lastRefill = now;
+				m_tokens = std::min(m_tokens + elapsed * recordsPerSecond, static_cast<double>(recordsPerSecond));
+				if (m_tokens < 1.0)
+				{
+					m_dropped.fetch_add(1, std::memory_order_relaxed);
+					return false;
+				}
+				m_tokens -= 1.0;
+				return true;
+			}
+
+			uint64_t Dropped() const { return m_dropped.load(std::memory_order_relaxed); }
+
+		private:
+			alignas(64) std::atomic<uint64_t> m_head{ 0 };
+			uint64_t m_cachedTail{ 0 };
+			int64_t m_lastRefill{ Now() };
+			double m_tokens{ std::numeric_limits<double>::max() }; // Clamped to one burst on first use
+			alignas(64) std::atomic<uint64_t> m_tail{ 0 };
+			alignas(64) std::atomic<uint64_t> m_dropped{ 0 };
+			std::array<Detail::LogRecord, c_ringCapacity> m_records{};
+		};
+
+		class AsyncLogger
+		{
+		public:
+			static AsyncLogger& Instance()
+			{
+				static AsyncLogger logger;
+				return logger;
+			}
+
+			AsyncLogger(const AsyncLogger&) = delete;
+			AsyncLogger& operator=(const AsyncLogger&) = delete;
+			AsyncLogger(AsyncLogger&&) = delete;
+			AsyncLogger& operator=(AsyncLogger&&) = delete;
+
+			~AsyncLogger()
+			{
+				m_stop.store(true, std::memory_order_release);
+				m_writer.join();
+			}
+
+			LogRing& ThreadRing()
+			{
+				thread_local LogRing* ring{ nullptr };
+				if (ring == nullptr)
+				{
+					std::scoped_lock lock(m_ringsMutex);
+					m_rings.push_back(std::make_unique<LogRing>());
+					ring = m_rings.back().get();
+				}
+				return *ring;
+			}
+
+			void Flush()
+			{
+				std::unique_lock lock(m_flushMutex);
+				const auto target{ m_passes.load(std::memory_order_acquire) + 2 };
+				m_flushed.wait(lock, [&] { return m_passes.load(std::memory_order_acquire) >= target; });
+			}
+
+			uint64_t Dropped()
+			{
+				std::scoped_lock lock(m_ringsMutex);
+				uint64_t dropped{ 0 };
+				for (const auto& ring : m_rings)
+					dropped += ring->Dropped();
+				return dropped;
+			}
+
+			std::atomic<LogLevel> m_level{ LogLevel::Info };
+			std::atomic<uint32_t> m_rateLimit{ 0 };
+
+		private:
+			AsyncLogger()
+				: m_start(Now())
+				, m_writer([this] { Run(); })
+			{}
+
+			void Run()
+			{
+				std::string out;
+				uint64_t reportedDrops{ 0 };
+				auto nextDropReport{ std::chrono::steady_clock::now() + c_dropReportInterval };
+				while (true)
+				{
+					const bool stopping{ m_stop.load(std::memory_order_acquire) };
+					const bool wrote{ Drain(out) };
+
+					if (std::chrono::steady_clock::now() >= nextDropReport)
+					{
+						nextDropReport += c_dropReportInterval;
+						const auto dropped{ Dropped() };
+						if (dropped != reportedDrops)
+						{
+							std::fprintf(stderr, "logger: %llu records dropped\n",
+								static_cast<unsigned long long>(dropped - reportedDrops));
+							reportedDrops = dropped;
+						}
+					}
+
+					{
+						std::scoped_lock lock(m_flushMutex);
+						m_passes.fetch_add(1, std::memory_order_release);
+					}
+					m_flushed.notify_all();
+
+					if (stopping)
+						return;
+					if (!wrote)
+						std::this_thread::sleep_for(c_idleSleep);
+				}
+			}
+
+			bool Drain(std::string& out)
+			{
+				// Rings are never removed, so their pointers stay valid after the lock: formatting
+				// and writing to a slow terminal or pipe must not hold up a thread registering.
+				{
+					std::scoped_lock lock(m_ringsMutex);
+					m_drainRings.resize(m_rings.size());
+					std::ranges::transform(m_rings, m_drainRings.begin(), [](const auto& ring) { return ring.get(); });
+				}
+
+				bool wrote{ false };
+				for (auto* ring : m_drainRings)
+				{
+					while (const auto* record = ring->Front())
+					{
+						out.clear();
+						std::format_to(std::back_inserter(out), "{:.6f} {} ",
+							static_cast<double>(record->timestamp - m_start) * 1e-9, LevelName(record->level));
+						record->formatter(out, record->format, record->args.data());
+						out.push_back('\n');
+						std::fwrite(out.data(), 1, out.size(), record->level >= LogLevel::Warning ? stderr : stdout);
+						ring->Pop();
+						wrote = true;
+					}
+				}
+				if (wrote)
+				{
+					std::fflush(stdout);
+					std::fflush(stderr);
+				}
+				return wrote;
+			}
+
+			int64_t m_start;
+			std::atomic<bool> m_stop{ false };
+			std::mutex m_ringsMutex; // Only taken to register a thread and by the writer
+			std::vector<std::unique_ptr<LogRing>> m_rings;
+			std::vector<LogRing*> m_drainRings; // Writer thread only, m_rings as of the last drain
+			std::mutex m_flushMutex;
+			std::condition_variable m_flushed;
+			std::atomic<uint64_t> m_passes{ 0 };
+			std::thread m_writer;
+		};
+
+		thread_local LogRing* t_pendingRing{ nullptr };
+	}
+
+	LogLevel ParseLogLevel(const std::string& level)
+	{
+		if (level == "debug")
+			return LogLevel::Debug;
+		if (level == "info")
+			return LogLevel::Info;
+		if (level == "warning")
+			return LogLevel::Warning;
+		if (level == "error")
+			return LogLevel::Error;
+		if (level == "off")
+			return LogLevel::Off;
+		throw std::runtime_error("--LogLevel must be one of debug, info, warning, error, off");
+	}
+
+	void SetLogLevel(LogLevel level)
+	{
+		AsyncLogger::Instance().m_level.store(level, std::memory_order_relaxed);
+	}
+
+	void SetLogRateLimit(uint32_t recordsPerSecond)
+	{
+		AsyncLogger::Instance().m_rateLimit.store(recordsPerSecond, std::memory_order_relaxed);
+	}
+
+	uint64_t GetDroppedLogRecords()
+	{
+		return AsyncLogger::Instance().Dropped();
+	}
+
+	void FlushLog()
+	{
+		AsyncLogger::Instance().Flush();
+	}
+
+	namespace Detail
+	{
+		bool IsLogEnabled(LogLevel level)
+		{
+			return level >= AsyncLogger::Instance().m_level.load(std::memory_order_relaxed);
+		}
+
+		LogRecord* BeginLogRecord(LogLevel level)
+		{
+			auto& logger{ AsyncLogger::Instance() };
+			auto& ring{ logger.ThreadRing() };
+			const auto now{ Now() };
+			if (!ring.AllowRecord(now, logger.m_rateLimit.load(std::memory_order_relaxed)))
+				return nullptr;
+
+			auto* record = ring.Begin();
+			if (record == nullptr)
+				return nullptr;
+
+			record->timestamp = now;
+			record->level = level;
+			t_pendingRing = &ring;
+			return record;
+		}
+
+		void CommitLogRecord()
+		{
+			t_pendingRing->Commit();
+			t_pendingRing = nullptr;
+		}
+	}
+}
@@ -0,0 +1,159 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <format>
+#include <iterator>
+#include <new>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+
+namespace PTP
+{
+	// Asynchronous logging. The calling thread only copies the format string pointer and
+	// the (trivially copyable) arguments into a fixed-size record in its own lock-free
+	// single-producer ring; a background thread does the formatting and the writing.
+	// A full ring drops the record and counts it, the caller never blocks.
+	enum class LogLevel : uint8_t
+	{
+		Debug,
+		Info,
+		Warning,
+		Error,
+		Off
+	};
+
+	// Fixed-size copy of a runtime string (e.g. exception::what()), truncated to fit a record.
+	struct LogString
+	{
+		explicit LogString(std::string_view text)
+			: size(static_cast<uint8_t>(std::min(text.size(), data.size())))
+		{
+			std::copy_n(text.data(), size, data.data());
+		}
+
+		std::string_view View() const { return { data.data(), size }; }
+
+		std::array<char, 47> data{};
+		uint8_t size{ 0 };
+	};
+
+	// Command line spelling: debug, info, warning, error or off, else throws std::runtime_error.
+	LogLevel ParseLogLevel(const std::string& level);
+	void SetLogLevel(LogLevel level);
+	// Maximum records per second per thread, 0 = unlimited. Excess records are counted as dropped.
+	void SetLogRateLimit(uint32_t recordsPerSecond);
+	uint64_t GetDroppedLogRecords();
+	// Blocks until everything logged so far has been written. Not for the hot path.
+	void FlushLog();
+
+	namespace Detail
+	{
+		constexpr inline size_t c_logPayloadSize{ 88 };
+
+		struct LogRecord
+		{
+			using FormatFunction = void (*)(std::string& out, std::string_view format, const std::byte* args);
+
+			int64_t timestamp;
+			std::string_view format;
+			FormatFunction formatter;
+			LogLevel level;
+			alignas(std::max_align_t) std::array<std::byte, c_logPayloadSize> args;
+		};
+
+		bool IsLogEnabled(LogLevel level);
+		LogRecord* BeginLogRecord(LogLevel level);
+		void CommitLogRecord();
+
+		// Arguments are checked against the type they are printed as.
+		template <typename T>
+		struct LogArgument
+		{
+			using type = T;
+		};
+
+		template <>
+		struct LogArgument<LogString>
+		{
+			using type = std::string_view;
+		};
+
+		template <typename T>
+		const auto& Printable(const T& value)
+		{
+			return value;
+		}
+
+		inline std::string_view Printable(const LogString& value)
+		{
+			return value.View();
+		}
+
+		template <typename... Args>
+		void FormatLogRecord(std::string& out, std::string_view format, const std::byte* args)
+		{
+			#pragma warning(suppress: 26490) // Don't use reinterpret_cast
+			const auto& stored = *std::launder(reinterpret_cast<const std::tuple<Args...>*>(args));
+			std::apply([&](const auto&... values)
+			{
+				auto printable = std::tuple<std::remove_cvref_t<decltype(Printable(values))>...>{ Printable(values)... };
+				std::apply([&](auto&... projected)
+				{
+					std::vformat_to(std::back_inserter(out), format, std::make_format_args(projected...));
+				}, printable);
+			}, stored);
+		}
+	}
+
+	template <typename... Args>
+	using LogFormat = std::format_string<typename Detail::LogArgument<Args>::type...>;
+
+	template <typename... Args>
+	void Log(LogLevel level, LogFormat<Args...> format, const Args&... args)
+	{
+		static_assert((std::is_trivially_copyable_v<Args> && ...),
+			"log arguments are copied as bytes; wrap runtime strings in LogString");
+		static_assert(sizeof(std::tuple<Args...>) <= Detail::c_logPayloadSize, "too many log arguments");
+
+		if (!Detail::IsLogEnabled(level))
+			return;
+
+		auto* record = Detail::BeginLogRecord(level);
+		if (record == nullptr)
+			return;
+
+		record->format = format.get();
+		record->formatter = &Detail::FormatLogRecord<Args...>;
+		new (record->args.data()) std::tuple<Args...>(args...);
+		Detail::CommitLogRecord();
+	}
+
+	template <typename... Args>
+	void LogDebug(LogFormat<Args...> format, const Args&... args)
+	{
+		Log(LogLevel::Debug, format, args...);
+	}
+
+	template <typename... Args>
+	void LogInfo(LogFormat<Args...> format, const Args&... args)
+	{
+		Log(LogLevel::Info, format, args...);
+	}
+
+	template <typename... Args>
+	void LogWarning(LogFormat<Args...> format, const Args&... args)
+	{
+		Log(LogLevel::Warning, format, args...);
+	}
+
+	template <typename... Args>
+	void LogError(LogFormat<Args...> format, const Args&... args)
+	{
+		Log(LogLevel::Error, format, args...);
+	}
+}
@@ -1,10 +1,14 @@
 #include "PtpClient.h"
 #include "PtpServer.h"
+#include "PtpServerPool.h"
+#include "Logger.h"
+#include "ClockSource.h"
 
 #include <span> 
 #include <filesystem> 
 #include <boost/program_options.hpp>
-#include <iostream> 
+#include <iostream>
+#include <sstream> 
 
 namespace
 {
@@ -13,8 +17,118 @@ namespace
 		std::filesystem::path ProgramName;
 		std::string IpAddress;
 		bool Client{ false };
+		PTP::TimestampMode Timestamping{ PTP::TimestampMode::Application };
+		PTP::ClockSource ClockSource{ PTP::ClockSource::Realtime };
+		bool TxTimestamps{ false };
+		PTP::DelayMechanism PathDelay{ PTP::DelayMechanism::EndToEnd };
+		size_t BatchSize{ 0 };
+		size_t Threads{ 1 };
+		bool FilterDiagnostics{ false };
+		PTP::DelayEstimator Estimator{ PTP::DelayEstimator::Scalar };
+		PTP::PrefilterOptions Prefilter;
+		PTP::LogLevel LogLevel{ PTP::LogLevel::Info };
+		uint32_t LogRateLimit{ 0 };
+		PTP::ClockTarget Clock{ PTP::ClockTarget::Disciplined };
+		double ServoKp{ PTP::ServoOptions{}.Kp };
+		double ServoKi{ PTP::ServoOptions{}.Ki };
+		std::string TimeExport;
+		int8_t LogSyncInterval{ PTP::c_logSyncInterval };
+		uint32_t SyncSpin{ 0 };
+		bool OneStep{ false };
+		PTP::SessionTableOptions Sessions;
+		PTP::ClockProperties ServerClock;
+		std::vector<PTP::ServerDomain> Domains;
+		uint8_t Domain{ 0 };
+		std::vector<std::string> Servers;
+		std::string Capture;
+		size_t CaptureSize{ 256 }; // MiB
+		unsigned short MetricsPort{ 0 };
 	};
 
+	PTP::TimestampMode ParseTimestampMode(const std::string& mode)
+	{
+		if (mode == "application")
+			return PTP::TimestampMode::Application;
+		if (mode == "software")
+			return PTP::TimestampMode::Software;
+		if (mode == "hardware")
+			throw std::runtime_error("--Timestamping hardware is not supported: NIC timestamps count on the NIC's clock, not CLOCK_REALTIME");
+		throw std::runtime_error("--Timestamping must be one of application, software");
+	}
+
+	PTP::ClockSource ParseClockSource(const std::string& source)
+	{
+		if (source == "realtime")
+			return PTP::ClockSource::Realtime;
+		if (source == "tai")
+			return PTP::ClockSource::Tai;
+		if (source == "monotonic_raw")
+			return PTP::ClockSource::MonotonicRaw;
+		if (source == "tsc")
+			return PTP::ClockSource::Tsc;
+		throw std::runtime_error("--ClockSource must be one of realtime, tai, monotonic_raw, tsc");
+	}
+
+	// "0,1:16,2": domain numbers, each optionally with its own Sync rate.
+	std::vector<PTP::ServerDomain> ParseDomains(const std::string& domains)
+	{
+		constexpr auto c_error{ "--Domains must be a comma-separated list of domain[:syncRate], domains 0-255" };
+		std::vector<PTP::ServerDomain> parsed;
+		std::istringstream stream(domains);
+		std::string item;
+		while (std::getline(stream, item, ','))
+		{
+			const auto colon{ item.find(':') };
+			PTP::ServerDomain domain;
+			try
+			{
+				size_t used{ 0 };
+				const auto number{ std::stoul(item.substr(0, colon), &used) };
+				if (used != item.substr(0, colon).size() || number > 255)
+					throw std::runtime_error(c_error);
+				domain.Number = static_cast<uint8_t>(number);
+				if (colon != std::string::npos)
+					domain.LogSyncInterval = PTP::SyncRateToLogInterval(std::stod(item.substr(colon + 1)));
+			}
+			catch (const std::logic_error&)
+			{
+				throw std::runtime_error(c_error);
+			}
+			parsed.push_back(domain);
+		}
+		if (parsed.empty())
+			throw std::runtime_error(c_error);
+		return parsed;
+	}
+
+	// "10.0.0.1,10.0.0.2,ptp3": the servers an ensemble client combines, none or at least two.
+	std::vector<std::string> ParseServers(const std::string& servers)
+	{
+		std::vector<std::string> parsed;
+		std::istringstream stream(servers);
+		std::string server;
+		while (std::getline(stream, server, ','))
+		{
+			if (server.empty())
+				throw std::runtime_error("--Servers must be a comma-separated list of addresses");
+			parsed.push_back(server);
+		}
+		if (parsed.size() == 1)
+			throw std::runtime_error("--Servers needs at least two servers to combine, use the default server for one");
+		return parsed;
+	}
+
+	PTP::ClockTarget ParseClockTarget(const std::string& target)
+	{
+		if (target == "none")
+			return PTP::ClockTarget::None;
+		if (target == "disciplined")
+			return PTP::ClockTarget::Disciplined;
+		if (target == "system")
+			return PTP::ClockTarget::System;
+		throw std::runtime_error("--Clock must be one of none, disciplined, system");
+	}
+
     boost::program_options::variables_map GetProgramArguments(
         std::span<const char* const> args,
         const boost::program_options::options_description& description)
@@ -43,18 +157,177 @@ namespace
 	{
 		constexpr auto c_clientArgument{ "Client" };
 		constexpr auto c_ipArgument{ "IpAddress" };
+		constexpr auto c_timestampingArgument{ "Timestamping" };
+		constexpr auto c_txTimestampsArgument{ "TxTimestamps" };
+		constexpr auto c_clockSourceArgument{ "ClockSource" };
+		constexpr auto c_delayMechanismArgument{ "DelayMechanism" };
+		constexpr auto c_batchSizeArgument{ "BatchSize" };
+		constexpr auto c_threadsArgument{ "Threads" };
+		constexpr auto c_filterDiagnosticsArgument{ "FilterDiagnostics" };
+		constexpr auto c_estimatorArgument{ "Estimator" };
+		constexpr auto c_prefilterArgument{ "Prefilter" };
+		constexpr auto c_prefilterWindowArgument{ "PrefilterWindow" };
+		constexpr auto c_prefilterPercentileArgument{ "PrefilterPercentile" };
+		constexpr auto c_prefilterGateArgument{ "PrefilterGate" };
+		constexpr auto c_logLevelArgument{ "LogLevel" };
+		constexpr auto c_logRateLimitArgument{ "LogRateLimit" };
+		constexpr auto c_clockArgument{ "Clock" };
+		constexpr auto c_servoKpArgument{ "ServoKp" };
+		constexpr auto c_servoKiArgument{ "ServoKi" };
+		constexpr auto c_timeExportArgument{ "TimeExport" };
+		constexpr auto c_syncRateArgument{ "SyncRate" };
+		constexpr auto c_syncSpinArgument{ "SyncSpin" };
+		constexpr auto c_oneStepArgument{ "OneStep" };
+		constexpr auto c_maxSessionsArgument{ "MaxSessions" };
+		constexpr auto c_clientRateArgument{ "ClientRate" };
+		constexpr auto c_clientBurstArgument{ "ClientBurst" };
+		constexpr auto c_priority1Argument{ "Priority1" };
+		constexpr auto c_priority2Argument{ "Priority2" };
+		constexpr auto c_clockClassArgument{ "ClockClass" };
+		constexpr auto c_announceRateArgument{ "AnnounceRate" };
+		constexpr auto c_domainsArgument{ "Domains" };
+		constexpr auto c_domainArgument{ "Domain" };
+		constexpr auto c_serversArgument{ "Servers" };
+		constexpr auto c_captureArgument{ "Capture" };
+		constexpr auto c_captureSizeArgument{ "CaptureSize" };
+		constexpr auto c_metricsPortArgument{ "MetricsPort" };
 
 		boost::program_options::options_description description("Client Server");
 		description.add_options()
 			(c_ipArgument, boost::program_options::value<std::string>(),
 			"provide ip address of the the server")
 			(c_clientArgument, boost::program_options::bool_switch()->default_value(false),
-			"server as default, write --Client if you want to change");
+			"server as default, write --Client if you want to change")
+			(c_timestampingArgument, boost::program_options::value<std::string>()->default_value("application"),
+			"where receive timestamps are taken: application or software (kernel)")
+			(c_txTimestampsArgument, boost::program_options::bool_switch()->default_value(false),
+			"take t1/t3 from the socket error queue (SO_TIMESTAMPING) instead of before sending")
+			(c_clockSourceArgument, boost::program_options::value<std::string>()->default_value("realtime"),
+			"clock behind application timestamps: realtime, tai, monotonic_raw or tsc (calibrated rdtsc)")
+			(c_delayMechanismArgument, boost::program_options::value<std::string>()->default_value("e2e"),
+			"path delay: e2e (Delay_Req to the master) or p2p (Pdelay_Req to the neighbour), same on both ends")
+			(c_batchSizeArgument, boost::program_options::value<size_t>()->default_value(0),
+			"server: answer up to N Delay_Req per wakeup with recvmmsg/sendmmsg (0 = one request per wakeup, answered inline)")
+			(c_threadsArgument, boost::program_options::value<size_t>()->default_value(1),
+			"server: worker threads, each with its own SO_REUSEPORT event socket")
+			(c_filterDiagnosticsArgument, boost::program_options::bool_switch()->default_value(false),
+			"client: print the Kalman filter state after every update")
+			(c_estimatorArgument, boost::program_options::value<std::string>()->default_value("scalar"),
+			"client: path delay filter, scalar (1-state Kalman) or drift (2-state offset/drift Kalman)")
+			(c_prefilterArgument, boost::program_options::value<std::string>()->default_value("none"),
+			"client: path delay samples the filter sees: none (all), min, percentile or median of the last --PrefilterWindow")
+			(c_prefilterWindowArgument, boost::program_options::value<size_t>()->default_value(PTP::PrefilterOptions{}.Window),
+			"client: path delay samples --Prefilter selects from (1-64)")
+			(c_prefilterPercentileArgument, boost::program_options::value<double>()->default_value(PTP::PrefilterOptions{}.Percentile),
+			"client: fraction of the window for --Prefilter percentile (0 = min, 0.5 = median)")
+			(c_prefilterGateArgument, boost::program_options::value<double>()->default_value(PTP::PrefilterOptions{}.GateSigma),
+			"client: drop path delay samples this many innovation standard deviations from the estimate (0 = off)")
+			(c_logLevelArgument, boost::program_options::value<std::string>()->default_value("info"),
+			"debug, info, warning, error or off")
+			(c_logRateLimitArgument, boost::program_options::value<uint32_t>()->default_value(0),
+			"maximum log records per second per thread (0 = unlimited)")
+			(c_clockArgument, boost::program_options::value<std::string>()->default_value("disciplined"),
+			"client: clock steered by the servo: none, disciplined (process-local) or system (clock_adjtime)")
+			(c_servoKpArgument, boost::program_options::value<double>()->default_value(PTP::ServoOptions{}.Kp),
+			"client: servo proportional gain")
+			(c_servoKiArgument, boost::program_options::value<double>()->default_value(PTP::ServoOptions{}.Ki),
+			"client: servo integral gain")
+			(c_timeExportArgument, boost::program_options::value<std::string>()->default_value(""),
+			"client: publish the synchronized time to this shared memory name (e.g. /ptp-time) for SharedTime.h readers")
+			(c_syncRateArgument, boost::program_options::value<double>()->default_value(4.0),
+			"server: Sync messages per second, a power of two from 0.0625 to 128 (sent as logMessageInterval)")
+			(c_syncSpinArgument, boost::program_options::value<uint32_t>()->default_value(0),
+			"server: busy-wait the last N microseconds before each Sync for lower departure jitter")
+			(c_oneStepArgument, boost::program_options::bool_switch()->default_value(false),
+			"server: one-step Sync carrying its own origin timestamp, no Follow_Up")
+			(c_maxSessionsArgument, boost::program_options::value<size_t>()->default_value(PTP::SessionTableOptions{}.Capacity),
+			"server: clients tracked per thread, the least recently seen is evicted beyond this")
+			(c_clientRateArgument, boost::program_options::value<double>()->default_value(PTP::SessionTableOptions{}.Rate),
+			"server: delay requests per second each client may sustain (0 = no limit)")
+			(c_clientBurstArgument, boost::program_options::value<double>()->default_value(PTP::SessionTableOptions{}.Burst),
+			"server: delay requests a client may send back to back")
+			(c_priority1Argument, boost::program_options::value<uint32_t>()->default_value(PTP::ClockProperties{}.Priority1),
+			"server: announced priority1, clients follow the lowest (0-255)")
+			(c_priority2Argument, boost::program_options::value<uint32_t>()->default_value(PTP::ClockProperties{}.Priority2),
+			"server: announced priority2, breaks ties between equal clocks (0-255)")
+			(c_clockClassArgument, boost::program_options::value<uint32_t>()->default_value(PTP::ClockQuality{}.clockClass),
+			"server: announced clockClass, e.g. 6 locked to GPS, 248 free running (0-255)")
+			(c_announceRateArgument, boost::program_options::value<double>()->default_value(4.0),
+			"server: Announce messages per second, a power of two from 1/16 to 8; clients fail over after 3 missed")
+			(c_domainsArgument, boost::program_options::value<std::string>()->default_value("0"),
+			"server: PTP domains hosted on the same sockets, e.g. 0,1:16,2 (domain[:syncRate], default rate --SyncRate)")
+			(c_domainArgument, boost::program_options::value<uint32_t>()->default_value(0),
+			"client: PTP domain to synchronize to (0-255)")
+			(c_serversArgument, boost::program_options::value<std::string>()->default_value(""),
+			"client: combine these servers (comma-separated, at least two; majority rejects falsetickers from three on)")
+			(c_captureArgument, boost::program_options::value<std::string>()->default_value(""),
+			"append timestamp sets and datagrams to this capture file for PtpReplay (client), or requests and Syncs (server)")
+			(c_captureSizeArgument, boost::program_options::value<size_t>()->default_value(ProgramOptions{}.CaptureSize),
+			"largest capture file in MiB, later records are dropped")
+			(c_metricsPortArgument, boost::program_options::value<unsigned short>()->default_value(0),
+			"serve Prometheus metrics on http://127.0.0.1:<port>/metrics (0 = off)");
 
 		const auto arguments{ GetProgramArguments(args, description) };
 		ProgramOptions programOptions;
 		programOptions.ProgramName = std::filesystem::path(std::size(args) > 0 ? args[0] : "");
 		programOptions.Client = arguments[c_clientArgument].as<bool>();
+		programOptions.Timestamping = ParseTimestampMode(arguments[c_timestampingArgument].as<std::string>());
+		programOptions.TxTimestamps = arguments[c_txTimestampsArgument].as<bool>();
+		programOptions.ClockSource = ParseClockSource(arguments[c_clockSourceArgument].as<std::string>());
+		// Kernel software timestamps are CLOCK_REALTIME (NIC timestamps, on the PHC, are refused
+		// above); mixed with another timeline they would be off by the TAI offset or the time
+		// since boot.
+		const bool realtimeBased{ programOptions.ClockSource == PTP::ClockSource::Realtime ||
+			programOptions.ClockSource == PTP::ClockSource::Tsc };
+		if (!realtimeBased && (programOptions.Timestamping != PTP::TimestampMode::Application || programOptions.TxTimestamps))
+			throw std::runtime_error("--ClockSource tai and monotonic_raw need --Timestamping application without --TxTimestamps: kernel timestamps are CLOCK_REALTIME");
+		programOptions.PathDelay = PTP::ParseDelayMechanism(arguments[c_delayMechanismArgument].as<std::string>());
+		programOptions.BatchSize = arguments[c_batchSizeArgument].as<size_t>();
+		programOptions.Threads = arguments[c_threadsArgument].as<size_t>();
+		programOptions.FilterDiagnostics = arguments[c_filterDiagnosticsArgument].as<bool>();
+		programOptions.Estimator = PTP::ParseDelayEstimator(arguments[c_estimatorArgument].as<std::string>());
+		programOptions.Prefilter.Selection = PTP::ParsePrefilterSelection(arguments[c_prefilterArgument].as<std::string>());
+		programOptions.Prefilter.Window = arguments[c_prefilterWindowArgument].as<size_t>();
+		programOptions.Prefilter.Percentile = arguments[c_prefilterPercentileArgument].as<double>();
+		programOptions.Prefilter.GateSigma = arguments[c_prefilterGateArgument].as<double>();
+		const auto& prefilter{ programOptions.Prefilter };
+		if (prefilter.Window == 0 || prefilter.Window > PTP::c_maxPrefilterWindow ||
+			prefilter.Percentile < 0.0 || prefilter.Percentile > 1.0 || prefilter.GateSigma < 0.0)
+			throw std::runtime_error("--PrefilterWindow must be 1-64, --PrefilterPercentile in [0, 1] and --PrefilterGate not negative");
+		programOptions.LogLevel = PTP::ParseLogLevel(arguments[c_logLevelArgument].as<std::string>());
+		programOptions.LogRateLimit = arguments[c_logRateLimitArgument].as<uint32_t>();
+		programOptions.Clock = ParseClockTarget(arguments[c_clockArgument].as<std::string>());
+		programOptions.ServoKp = arguments[c_servoKpArgument].as<double>();
+		programOptions.ServoKi = arguments[c_servoKiArgument].as<double>();
+		programOptions.TimeExport = arguments[c_timeExportArgument].as<std::string>();
+		programOptions.LogSyncInterval = PTP::SyncRateToLogInterval(arguments[c_syncRateArgument].as<double>());
+		programOptions.SyncSpin = arguments[c_syncSpinArgument].as<uint32_t>();
+		programOptions.OneStep = arguments[c_oneStepArgument].as<bool>();
+		programOptions.Sessions.Capacity = arguments[c_maxSessionsArgument].as<size_t>();
+		programOptions.Sessions.Rate = arguments[c_clientRateArgument].as<double>();
+		programOptions.Sessions.Burst = arguments[c_clientBurstArgument].as<double>();
+		const auto priority1{ arguments[c_priority1Argument].as<uint32_t>() };
+		const auto priority2{ arguments[c_priority2Argument].as<uint32_t>() };
+		const auto clockClass{ arguments[c_clockClassArgument].as<uint32_t>() };
+		if (priority1 > 255 || priority2 > 255 || clockClass > 255)
+			throw std::runtime_error("--Priority1, --Priority2 and --ClockClass must be between 0 and 255");
+		programOptions.ServerClock.Priority1 = static_cast<uint8_t>(priority1);
+		programOptions.ServerClock.Priority2 = static_cast<uint8_t>(priority2);
+		programOptions.ServerClock.Quality.clockClass = static_cast<uint8_t>(clockClass);
+		programOptions.Domains = ParseDomains(arguments[c_domainsArgument].as<std::string>());
+		const auto domain{ arguments[c_domainArgument].as<uint32_t>() };
+		if (domain > 255)
+			throw std::runtime_error("--Domain must be between 0 and 255");
+		programOptions.Domain = static_cast<uint8_t>(domain);
+		programOptions.Servers = ParseServers(arguments[c_serversArgument].as<std::string>());
+		programOptions.Capture = arguments[c_captureArgument].as<std::string>();
+		programOptions.CaptureSize = arguments[c_captureSizeArgument].as<size_t>();
+		if (programOptions.CaptureSize == 0)
+			throw std::runtime_error("--CaptureSize must be positive");
+		programOptions.MetricsPort = arguments[c_metricsPortArgument].as<unsigned short>();
+		programOptions.ServerClock.LogAnnounceInterval = PTP::AnnounceRateToLogInterval(arguments[c_announceRateArgument].as<double>());
+		if (programOptions.Sessions.Capacity == 0 || programOptions.Sessions.Rate < 0.0 || programOptions.Sessions.Burst < 1.0)
+			throw std::runtime_error("--MaxSessions must be positive, --ClientRate not negative and --ClientBurst at least 1");
 
         if (programOptions.Client && !arguments.count(c_ipArgument))
             throw std::runtime_error("--IpAddress is required when --Client is specified.");
@@ -76,14 +349,58 @@ int main(int argc, char* argv[])
 	{
 		boost::asio::io_context ioContext;
 		const auto programOptions{ ReadProgramOptions(std::span(argv, argc)) };
+		PTP::SetLogLevel(programOptions.LogLevel);
+		PTP::SetLogRateLimit(programOptions.LogRateLimit);
+		if (PTP::SetClockSource(programOptions.ClockSource) != programOptions.ClockSource)
+			std::cerr << "Clock source not available on this machine, using realtime" << std::endl;
+		const auto capture{ programOptions.Capture.empty() ? nullptr
+			: std::make_shared<PTP::CaptureWriter>(programOptions.Capture, programOptions.CaptureSize << 20) };
 		if (programOptions.Client)
 		{
-			PTP::Client client(ioContext, PTP::c_serverIP, PTP::c_clientIP);
+			PTP::ClientOptions clientOptions;
+			clientOptions.Timestamping = programOptions.Timestamping;
+			clientOptions.TxTimestamps = programOptions.TxTimestamps;
+			clientOptions.PathDelay = programOptions.PathDelay;
+			clientOptions.Domain = programOptions.Domain;
+			clientOptions.FilterDiagnostics = programOptions.FilterDiagnostics;
+			clientOptions.Estimator = programOptions.Estimator;
+			clientOptions.Prefilter = programOptions.Prefilter;
+			clientOptions.Clock = programOptions.Clock;
+			clientOptions.Servo.Kp = programOptions.ServoKp;
+			clientOptions.Servo.Ki = programOptions.ServoKi;
+			clientOptions.TimeExport = programOptions.TimeExport;
+			clientOptions.Servers = programOptions.Servers;
+			clientOptions.Capture = capture;
+			clientOptions.MetricsPort = programOptions.MetricsPort;
+			PTP::Client client(ioContext, PTP::c_serverIP, PTP::c_clientIP, clientOptions);
 			ioContext.run();
 		}
 		else
 		{
-			PTP::Server server(ioContext, PTP::c_serverIP, PTP::c_ptpEventPort, PTP::c_ptpGeneralPort);
+			PTP::ServerOptions serverOptions;
+			serverOptions.Timestamping = programOptions.Timestamping;
+			serverOptions.TxTimestamps = programOptions.TxTimestamps;
+			serverOptions.PathDelay = programOptions.PathDelay;
+			serverOptions.BatchSize = programOptions.BatchSize;
+			serverOptions.Threads = programOptions.Threads;
+			serverOptions.LogSyncInterval = programOptions.LogSyncInterval;
+			serverOptions.SyncSpin = std::chrono::microseconds(programOptions.SyncSpin);
+			serverOptions.OneStep = programOptions.OneStep;
+			serverOptions.Sessions = programOptions.Sessions;
+			serverOptions.Clock = programOptions.ServerClock;
+			serverOptions.Domains = programOptions.Domains;
+			serverOptions.Capture = capture;
+			serverOptions.MetricsPort = programOptions.MetricsPort;
+			// An explicit address lets a standby server run next to the primary on one host.
+			serverOptions.BindAddress = !programOptions.IpAddress.empty();
+			const auto serverIP{ serverOptions.BindAddress ? programOptions.IpAddress : std::string(PTP::c_serverIP) };
+			if (serverOptions.Threads > 1)
+			{
+				PTP::ServerPool serverPool(serverIP, PTP::c_ptpEventPort, PTP::c_ptpGeneralPort, serverOptions);
+				serverPool.Run();
+				return EXIT_SUCCESS;
+			}
+			PTP::Server server(ioContext, serverIP, PTP::c_ptpEventPort, PTP::c_ptpGeneralPort, serverOptions);
 			ioContext.run();
 		}
 
@@ -0,0 +1,215 @@
+#include "Metrics.h"
+#include "Logger.h"
+#include "Utils.h"
+
+#include <array>
+#include <atomic>
+#include <format>
+#include <string_view>
+
+namespace PTP
+{
+	namespace
+	{
+		// Upper bounds in nanoseconds, shared by every histogram; one more bucket counts the rest.
+		constexpr std::array<int64_t, 12> c_bucketBounds{
+			1'000, 2'000, 5'000, 10'000, 20'000, 50'000, 100'000, 200'000, 500'000, 1'000'000, 10'000'000, 100'000'000 };
+
+		struct MetricDescription
+		{
+			std::string_view name;
+			std::string_view help;
+		};
+
+		constexpr std::array<MetricDescription, static_cast<size_t>(MetricCounter::Count)> c_counters{ {
+			{ "ptp_server_sync_sent_total", "Sync messages sent" },
+			{ "ptp_server_follow_up_sent_total", "Follow_Up messages sent" },
+			{ "ptp_server_announce_sent_total", "Announce messages sent" },
+			{ "ptp_server_requests_received_total", "Delay_Req or Pdelay_Req received for a hosted domain" },
+			{ "ptp_server_requests_dropped_total", "Requests not admitted by the session table" },
+			{ "ptp_server_responses_sent_total", "Delay_Resp or Pdelay_Resp sent" },
+			{ "ptp_client_sync_received_total", "Sync messages received from the master" },
+			{ "ptp_client_follow_up_received_total", "Follow_Up messages received from the master" },
+			{ "ptp_client_follow_up_mismatches_total", "Follow_Up messages matching no Sync waiting for t1, dropped" },
+			{ "ptp_client_delay_requests_sent_total", "Delay_Req or Pdelay_Req sent" },
+			{ "ptp_client_delay_responses_received_total", "Delay_Resp messages received from the master" },
+			{ "ptp_client_stale_entries_removed_total", "Incomplete timestamp sets removed by the cleanup task" },
+			{ "ptp_client_path_delay_samples_total", "Path delay samples handed to the filter" },
+			{ "ptp_client_path_delay_rejected_total", "Path delay samples dropped by the pre-filter's innovation gate" },
+		} };
+
+		constexpr std::array<MetricDescription, static_cast<size_t>(MetricGauge::Count)> c_gauges{ {
+			{ "ptp_server_sessions", "Client sessions tracked" },
+			{ "ptp_client_path_delay_seconds", "Path delay filter estimate" },
+			{ "ptp_client_path_delay_stddev_seconds", "Square root of the path delay filter covariance" },
+			{ "ptp_client_path_delay_drift", "Path delay drift in seconds per second (drift estimator)" },
+			{ "ptp_client_offset_from_master_seconds", "Last offset from the master" },
+			{ "ptp_client_frequency_ppb", "Servo frequency adjustment" },
+			{ "ptp_client_servo_state", "Servo state: 0 unlocked, 1 stepped, 2 locked" },
+		} };
+
+		constexpr std::array<MetricDescription, static_cast<size_t>(MetricHistogram::Count)> c_histograms{ {
+			{ "ptp_server_response_latency_seconds", "Delay request dequeued to response sent" },
+			{ "ptp_server_sync_lateness_seconds", "Sync departure past its deadline" },
+		} };
+
+		struct HistogramCells
+		{
+			std::array<std::atomic<uint64_t>, c_bucketBounds.size() + 1> buckets{};
+			std::atomic<int64_t> sum{ 0 }; // Nanoseconds
+		};
+
+		// Written by its thread only; 64-byte alignment keeps two threads' cells off one line.
+		struct alignas(64) MetricsShard
+		{
+			std::array<std::atomic<uint64_t>, static_cast<size_t>(MetricCounter::Count)> counters{};
+			std::array<std::atomic<double>, static_cast<size_t>(MetricGauge::Count)> gauges{};
+			std::array<HistogramCells, static_cast<size_t>(MetricHistogram::Count)> histograms{};
+			MetricsShard* next{ nullptr };
+		};
+
+		// Shards are only ever prepended, so a scrape can walk the list while threads register.
+		std::atomic<MetricsShard*> g_shards{ nullptr };
+
+		MetricsShard& ThreadShard()
+		{
+			thread_local MetricsShard* shard{ nullptr };
+			if (shard == nullptr)
+			{
+				shard = new MetricsShard;
+				shard->next = g_shards.load(std::memory_order_relaxed);
+				while (!g_shards.compare_exchange_weak(shard->next, shard, std::memory_order_release, std::memory_order_relaxed))
+					;
+			}
+			return *shard;
+		}
+
+		template <typename T>
+		void Add(std::atomic<T>& cell, T value)
+		{
+			cell.store(cell.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+		}
+
+		template <typename Function>
+		void ForEachShard(Function&& function)
+		{
+			for (const auto* shard = g_shards.load(std::memory_order_acquire); shard != nullptr; shard = shard->next)
+				function(*shard);
+		}
+
+		void AppendHeader(std::string& out, const MetricDescription& description, std::string_view type)
+		{
+			std::format_to(std::back_inserter(out), "# HELP {} {}\n# TYPE {} {}\n",
+				description.name, description.help, description.name, type);
+		}
+
+		boost::asio::ip::tcp::endpoint LocalEndpoint(unsigned short port)
+		{
+			return { boost::asio::ip::address_v4::loopback(), port };
+		}
+	}
+
+	void Increment(MetricCounter counter, uint64_t count)
+	{
+		Add(ThreadShard().counters[static_cast<size_t>(counter)], count);
+	}
+
+	void SetGauge(MetricGauge gauge, double value)
+	{
+		ThreadShard().gauges[static_cast<size_t>(gauge)].store(value, std::memory_order_relaxed);
+	}
+
+	void Observe(MetricHistogram histogram, std::chrono::nanoseconds value)
+	{
+		auto& cells{ ThreadShard().histograms[static_cast<size_t>(histogram)] };
+		const auto bucket{ std::ranges::lower_bound(c_bucketBounds, value.count()) - c_bucketBounds.begin() };
+		Add(cells.buckets[static_cast<size_t>(bucket)], uint64_t{ 1 });
+		Add(cells.sum, static_cast<int64_t>(value.count()));
+	}
+
+	std::string FormatMetrics()
+	{
+		std::string out;
+		for (size_t i = 0; i < c_counters.size(); ++i)
+		{
+			uint64_t total{ 0 };
+			ForEachShard([&](const MetricsShard& shard) { total += shard.counters[i].load(std::memory_order_relaxed); });
+			AppendHeader(out, c_counters[i], "counter");
+			std::format_to(std::back_inserter(out), "{} {}\n", c_counters[i].name, total);
+		}
+
+		for (size_t i = 0; i < c_gauges.size(); ++i)
+		{
+			double total{ 0.0 };
+			ForEachShard([&](const MetricsShard& shard) { total += shard.gauges[i].load(std::memory_order_relaxed); });
+			AppendHeader(out, c_gauges[i], "gauge");
+			std::format_to(std::back_inserter(out), "{} {}\n", c_gauges[i].name, total);
+		}
+
+		for (size_t i = 0; i < c_histograms.size(); ++i)
+		{
+			std::array<uint64_t, c_bucketBounds.size() + 1> buckets{};
+			int64_t sum{ 0 };
+			ForEachShard([&](const MetricsShard& shard)
+			{
+				const auto& cells{ shard.histograms[i] };
+				for (size_t bucket = 0; bucket < buckets.size(); ++bucket)
+					buckets[bucket] += cells.buckets[bucket].load(std::memory_order_relaxed);
+				sum += cells.sum.load(std::memory_order_relaxed);
+			});
+
+			// Prometheus buckets are cumulative.
+			const auto& name{ c_histograms[i].name };
+			AppendHeader(out, c_histograms[i], "histogram");
+			uint64_t count{ 0 };
+			for (size_t bucket = 0; bucket < c_bucketBounds.size(); ++bucket)
+			{
+				count += buckets[bucket];
+				std::format_to(std::back_inserter(out), "{}_bucket{{le=\"{:g}\"}} {}\n", name, c_bucketBounds[bucket] * 1e-9, count);
+			}
+			count += buckets.back();
+			std::format_to(std::back_inserter(out), "{}_bucket{{le=\"+Inf\"}} {}\n{}_sum {:g}\n{}_count {}\n",
+				name, count, name, sum * 1e-9, name, count);
+		}
+		return out;
+	}
+
+	MetricsServer::MetricsServer(boost::asio::io_context& ioContext, unsigned short port)
+		: m_ioContext(ioContext)
+		, m_acceptor(ioContext, LocalEndpoint(port))
+	{
+		LogInfo("Metrics on http://127.0.0.1:{}/metrics", port);
+		boost::asio::co_spawn(m_ioContext, Accept(), RethrowException);
+	}
+
+	boost::asio::awaitable<void> MetricsServer::Accept()
+	{
+		while (true)
+		{
+			auto socket{ co_await m_acceptor.async_accept(boost::asio::use_awaitable) };
+			boost::asio::co_spawn(m_ioContext, Serve(std::move(socket)), boost::asio::detached);
+		}
+	}
+
+	boost::asio::awaitable<void> MetricsServer::Serve(boost::asio::ip::tcp::socket socket)
+	{
+		try
+		{
+			std::string request;
+			co_await boost::asio::async_read_until(socket, boost::asio::dynamic_buffer(request, c_maxRequestSize),
+				"\r\n\r\n", boost::asio::use_awaitable);
+
+			const std::string_view requestLine{ std::string_view(request).substr(0, request.find("\r\n")) };
+			const bool found{ requestLine.starts_with("GET /metrics ") || requestLine.starts_with("GET / ") };
+			const auto body{ found ? FormatMetrics() : std::string("Not found\n") };
+			const auto response{ std::format(
+				"HTTP/1.0 {}\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: {}\r\nConnection: close\r\n\r\n{}",
+				found ? "200 OK" : "404 Not Found", body.size(), body) };
+			co_await boost::asio::async_write(socket, boost::asio::buffer(response), boost::asio::use_awaitable);
+		}
+		catch (const std::exception& e)
+		{
+			LogDebug("Metrics connection closed: {}", LogString(e.what()));
+		}
+	}
+}
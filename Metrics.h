@@ -0,0 +1,85 @@
+#pragma once
+
+#include <boost/asio.hpp>
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace PTP
+{
+	// Process-wide counters, gauges and histograms. Each thread writes its own cache-line-aligned
+	// shard with relaxed atomic loads and stores (one writer per cell, so no read-modify-write);
+	// a scrape walks the shards and adds them up. Updating never locks or allocates after the
+	// thread's first update, and a scrape never waits for the threads that update.
+	// Shards outlive their threads so their counts are kept. With several client cores in one
+	// process (ensemble sources, PtpSim) the client metrics cover all of them.
+	enum class MetricCounter : uint8_t
+	{
+		ServerSyncSent,
+		ServerFollowUpSent,
+		ServerAnnounceSent,
+		ServerRequestsReceived,   // Delay_Req or Pdelay_Req for a hosted domain
+		ServerRequestsDropped,    // Not admitted by the session table
+		ServerResponsesSent,      // Delay_Resp, or Pdelay_Resp with its follow-up
+		ClientSyncReceived,
+		ClientFollowUpReceived,
+		ClientFollowUpMismatches, // Follow_Up matching no Sync waiting for its t1, dropped
+		ClientDelayRequestsSent,  // Delay_Req or Pdelay_Req
+		ClientDelayResponsesReceived,
+		ClientStaleEntriesRemoved,
+		ClientPathDelaySamples,   // Handed to the path delay filter
+		ClientPathDelayRejected,  // Dropped by the pre-filter's innovation gate
+		Count
+	};
+
+	// Summed over threads: set each from one thread, or per shard where the sum is the total.
+	enum class MetricGauge : uint8_t
+	{
+		ServerSessions,
+		ClientPathDelay,         // Seconds, filter state
+		ClientPathDelayStddev,   // Seconds, square root of the filter covariance P
+		ClientPathDelayDrift,    // Seconds per second, drift estimator only
+		ClientOffsetFromMaster,  // Seconds
+		ClientFrequency,         // ppb, servo frequency adjustment
+		ClientServoState,        // ServoState as a number
+		Count
+	};
+
+	enum class MetricHistogram : uint8_t
+	{
+		ServerResponseLatency, // Request dequeued to response sent
+		ServerSyncLateness,    // Sync wakeup past its deadline
+		Count
+	};
+
+	void Increment(MetricCounter counter, uint64_t count = 1);
+	void SetGauge(MetricGauge gauge, double value);
+	void Observe(MetricHistogram histogram, std::chrono::nanoseconds value);
+
+	// Everything in the Prometheus text exposition format (0.0.4). Not for the hot path.
+	std::string FormatMetrics();
+
+	// Serves FormatMetrics on GET /metrics over HTTP/1.0 from 127.0.0.1:port, on the caller's
+	// io_context. One scrape at a time per connection, closed after the response.
+	class MetricsServer
+	{
+	public:
+		MetricsServer(boost::asio::io_context& ioContext, unsigned short port);
+
+		MetricsServer(const MetricsServer&) = delete;
+		MetricsServer& operator=(const MetricsServer&) = delete;
+		MetricsServer(MetricsServer&&) = delete;
+		MetricsServer& operator=(MetricsServer&&) = delete;
+
+	private:
+		static constexpr size_t c_maxRequestSize{ 4096 };
+
+		boost::asio::awaitable<void> Accept();
+		static boost::asio::awaitable<void> Serve(boost::asio::ip::tcp::socket socket);
+
+		boost::asio::io_context& m_ioContext;
+		boost::asio::ip::tcp::acceptor m_acceptor;
+	};
+}
@@ -0,0 +1,82 @@
+#include "OffsetDriftFilter.h"
+#include "Logger.h"
+
+#include <algorithm>
+
+namespace PTP
+{
+	namespace
+	{
+		constexpr Matrix<1, 2> c_observation{ { 1.0, 0.0 } }; // Only the offset is measured
+	}
+
+	OffsetDriftFilter::OffsetDriftFilter(double processNoise)
+		: m_processNoise(processNoise)
+		, m_filter({}, Matrix<2, 2>::Identity())
+	{}
+
+	double OffsetDriftFilter::Update(double measurement, double time)
+	{
+		if (!m_lastTime)
+		{
+			// Start from the first measurement instead of a heuristic.
+			m_filter = KalmanFilter<2>({ { measurement, 0.0 } }, Matrix<2, 2>::Identity());
+			m_lastTime = time;
+			return measurement;
+		}
+
+		Predict(std::max(time - *m_lastTime, 0.0));
+		m_lastTime = time;
+		UpdateMeasurementNoise(measurement);
+
+		// Same freeze protection as KalmanFilter1D: keep a minimum gain when R explodes.
+		if (GetEstimateUncertainty() < m_measurementNoise * 0.1)
+			m_filter.ScaleCovariance(10.0);
+
+		const auto innovation{ m_filter.Update(measurement, c_observation, m_measurementNoise) };
+		m_innoHistory.Push(innovation.residual);
+		m_nisHistory.Push(innovation.residual * innovation.residual / innovation.variance);
+
+		if (m_diagnostics)
+		{
+			LogInfo(
+				"Raw: {:.3f} us | Estimate: {:.3f} us | Drift: {:.4f} us/s | K: {:.7f} | R: {:.7f} | Innovation mean:{:.3f} | NIS mean:{:.3f}",
+				measurement,
+				GetEstimate(),
+				GetDrift(),
+				GetKalmanGain(),
+				GetMeasurementNoise(),
+				m_innoHistory.Mean(),
+				m_nisHistory.Mean()
+			);
+		}
+
+		return GetEstimate();
+	}
+
+	// Same 20-sample window as KalmanFilter1D, but over the residuals against the predicted
+	// offset: raw measurements of a drifting value would count the trend as noise.
+	// var(residual) = P + R, so the prediction's own uncertainty is taken out again.
+	void OffsetDriftFilter::UpdateMeasurementNoise(double measurement)
+	{
+		m_residuals.Push(measurement - GetEstimate());
+		const auto size{ m_residuals.Size() };
+		if (size < 2)
+			return;
+
+		const double variance{ m_residuals.SumOfSquaredDeviations(m_residuals.Mean()) / (size - 1) };
+		m_measurementNoise = std::max(variance - GetEstimateUncertainty(), 1e-6/* Ensure it is not zero*/);
+	}
+
+	// Constant-velocity model with a white-noise drift: F = [1 dt; 0 1],
+	// Q = q [dt^3/3 dt^2/2; dt^2/2 dt].
+	void OffsetDriftFilter::Predict(double dt)
+	{
+		const Matrix<2, 2> transition{ { 1.0, dt, 0.0, 1.0 } };
+		const double dt2{ dt * dt };
+		const Matrix<2, 2> processNoise{ {
+			m_processNoise * dt2 * dt / 3.0, m_processNoise * dt2 / 2.0,
+			m_processNoise * dt2 / 2.0, m_processNoise * dt } };
+		m_filter.Predict(transition, processNoise);
+	}
+}
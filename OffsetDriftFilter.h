@@ -0,0 +1,49 @@
+#pragma once
+
+#include "KalmanFilter.h"
+#include "SlidingWindow.h"
+
+#include <optional>
+
+namespace PTP
+{
+	// Two-state Kalman filter: a value (offset) and its rate of change (drift), propagated
+	// over the real time between measurements. Drift is tracked instead of showing up as a
+	// lagging estimate. Adaptive R, freeze protection and diagnostics follow KalmanFilter1D.
+	class OffsetDriftFilter
+	{
+	public:
+		// processNoise: spectral density of the drift random walk (unit^2 / s^3).
+		explicit OffsetDriftFilter(double processNoise = 0.01);
+
+		// time: seconds on any monotonic-enough scale, only differences are used.
+		double Update(double measurement, double time);
+
+		void EnableDiagnostics(bool enabled) { m_diagnostics = enabled; }
+
+		double GetEstimate() const { return m_filter.GetState()(0, 0); }
+		double GetDrift() const { return m_filter.GetState()(1, 0); } // Units per second
+		double GetMeasurementNoise() const { return m_measurementNoise; }
+		double GetKalmanGain() const { return m_filter.GetGain()(0, 0); }
+		double GetEstimateUncertainty() const { return m_filter.GetCovariance()(0, 0); }
+		double GetInnovationMean() const { return m_innoHistory.Mean(); }
+		double GetNisMean() const { return m_nisHistory.Mean(); }
+
+	private:
+		static constexpr size_t c_windowSize{ 20 };
+		static constexpr size_t c_historyMax{ 50 };
+
+		void UpdateMeasurementNoise(double measurement);
+		void Predict(double dt);
+
+		double m_processNoise;
+		double m_measurementNoise{ 1.0 };
+		bool m_diagnostics{ false };
+		std::optional<double> m_lastTime;
+
+		KalmanFilter<2> m_filter;
+		SlidingWindowVariance<c_windowSize> m_residuals; // Measurement minus predicted offset
+		SlidingWindowMean<c_historyMax> m_innoHistory;
+		SlidingWindowMean<c_historyMax> m_nisHistory;
+	};
+}
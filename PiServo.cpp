@@ -0,0 +1,84 @@
+#include "PiServo.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace PTP
+{
+	PiServo::PiServo(const ServoOptions& options)
+		: m_options(options)
+	{}
+
+	ServoAdjustment PiServo::Sample(int64_t offset, std::chrono::steady_clock::time_point now)
+	{
+		using namespace std::chrono;
+
+		const double interval{ m_sampleCount == 0 ? 0.0 : duration<double>(now - m_lastSample).count() };
+		if (m_sampleCount > 0 && interval <= 0.0)
+			return { m_state, std::nullopt, m_frequency }; // Duplicate sample, nothing to learn from
+
+		m_lastSample = now;
+		++m_sampleCount;
+
+		if (m_sampleCount == 1)
+		{
+			m_start = now;
+			m_firstOffset = offset;
+			return { m_state, std::nullopt, m_frequency };
+		}
+
+		if (m_sampleCount == 2)
+		{
+			// The offset moved by (offset - first) over 'interval' at the current frequency.
+			const double rate{ static_cast<double>(offset - m_firstOffset) / interval };
+			m_drift = ClampFrequency(m_frequency - rate);
+			m_frequency = m_drift;
+			m_state = ServoState::Stepped;
+			return { m_state, -offset, m_frequency };
+		}
+
+		if (m_options.StepThreshold > 0 && std::abs(offset) > m_options.StepThreshold)
+		{
+			m_state = ServoState::Stepped;
+			m_samplesInLock = 0;
+			return { m_state, -offset, m_frequency };
+		}
+
+		const double normalizedOffset{ static_cast<double>(offset) / interval };
+		m_drift = ClampFrequency(m_drift - m_options.Ki * normalizedOffset);
+		m_frequency = ClampFrequency(m_drift - m_options.Kp * normalizedOffset);
+		m_offsets.Push(static_cast<double>(offset));
+		UpdateLock(offset, now);
+		return { m_state, std::nullopt, m_frequency };
+	}
+
+	double PiServo::GetOffsetRms() const
+	{
+		if (m_offsets.Size() == 0)
+			return 0.0;
+		return std::sqrt(m_offsets.SumOfSquaredDeviations(0.0) / m_offsets.Size());
+	}
+
+	double PiServo::ClampFrequency(double ppb) const
+	{
+		return std::clamp(ppb, -m_options.MaxFrequency, m_options.MaxFrequency);
+	}
+
+	void PiServo::UpdateLock(int64_t offset, std::chrono::steady_clock::time_point now)
+	{
+		if (std::abs(offset) >= m_options.LockThreshold)
+		{
+			m_samplesInLock = 0;
+			if (m_state == ServoState::Locked)
+				m_state = ServoState::Stepped;
+			return;
+		}
+
+		if (++m_samplesInLock < m_options.LockSamples || m_state == ServoState::Locked)
+			return;
+
+		m_state = ServoState::Locked;
+		if (!m_convergenceTime)
+			m_convergenceTime = std::chrono::duration<double>(now - m_start).count();
+	}
+}
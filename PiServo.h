@@ -0,0 +1,74 @@
+#pragma once
+
+#include "SlidingWindow.h"
+
+#include <chrono>
+#include <cstdint>
+#include <optional>
+
+namespace PTP
+{
+	struct ServoOptions
+	{
+		double Kp{ 0.7 };                       // Fraction of the offset removed per sample
+		double Ki{ 0.3 };                       // Fraction of the offset folded into the frequency per sample
+		int64_t StepThreshold{ 1'000'000 };     // Step instead of slewing above this offset (ns), 0 = never
+		double MaxFrequency{ 500'000.0 };       // Clamp for the frequency adjustment (ppb)
+		int64_t LockThreshold{ 1'000 };         // |offset| below this (ns) ...
+		size_t LockSamples{ 8 };                // ... for this many samples in a row counts as converged
+	};
+
+	enum class ServoState
+	{
+		Unlocked, // Collecting the first two samples
+		Stepped,  // Phase stepped and frequency estimated, not yet within LockThreshold
+		Locked
+	};
+
+	// What the caller has to apply to its clock after a sample.
+	struct ServoAdjustment
+	{
+		ServoState state;
+		std::optional<int64_t> step; // Nanoseconds to add to the clock
+		double frequency;            // Absolute frequency adjustment (ppb)
+	};
+
+	// Proportional-integral clock servo in the style of linuxptp's pi.c.
+	// The first two samples estimate the frequency error and step the phase, after that
+	// the offset is slewed out: frequency = drift - Kp * offset / T, drift -= Ki * offset / T,
+	// with T the time between samples so the gains do not depend on the Sync interval.
+	class PiServo
+	{
+	public:
+		explicit PiServo(const ServoOptions& options = {});
+
+		// offset = local clock - master clock (ns), sampled at 'now'.
+		ServoAdjustment Sample(int64_t offset, std::chrono::steady_clock::time_point now);
+
+		ServoState GetState() const { return m_state; }
+		double GetFrequency() const { return m_frequency; }
+		// Seconds from the first sample until the lock criterion was met.
+		std::optional<double> GetConvergenceTime() const { return m_convergenceTime; }
+		// Statistics of the last c_statisticsWindow offsets since the servo stepped.
+		double GetOffsetMean() const { return m_offsets.Mean(); }
+		double GetOffsetRms() const;
+
+	private:
+		static constexpr size_t c_statisticsWindow{ 64 };
+
+		double ClampFrequency(double ppb) const;
+		void UpdateLock(int64_t offset, std::chrono::steady_clock::time_point now);
+
+		ServoOptions m_options;
+		ServoState m_state{ ServoState::Unlocked };
+		size_t m_sampleCount{ 0 };
+		int64_t m_firstOffset{ 0 };
+		std::chrono::steady_clock::time_point m_start;
+		std::chrono::steady_clock::time_point m_lastSample;
+		double m_drift{ 0.0 };      // Integral term (ppb)
+		double m_frequency{ 0.0 };  // Last frequency handed out (ppb)
+		size_t m_samplesInLock{ 0 };
+		std::optional<double> m_convergenceTime;
+		SlidingWindowVariance<c_statisticsWindow> m_offsets;
+	};
+}
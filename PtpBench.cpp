@@ -0,0 +1,361 @@
+// Load generator and Delay_Resp latency benchmark for PTP::Server.
+// Runs the server in-process on its own ports and simulates many virtual clients over loopback.
+#include "PtpServerPool.h"
+#include "PtpCodec.h"
+
+#include <span>
+#include <boost/program_options.hpp>
+#include <atomic>
+#include <bit>
+#include <ctime>
+#include <format>
+#include <iostream>
+#include <thread>
+
+namespace
+{
+	constexpr unsigned short c_benchEventPort{ 11319 };
+	constexpr unsigned short c_benchGeneralPort{ 11320 };
+	constexpr auto c_drainTime{ std::chrono::milliseconds(500) };
+
+	struct BenchOptions
+	{
+		size_t Clients{ 2000 };
+		double Rate{ 0.5 };          // Delay_Req per second per virtual client
+		double Duration{ 10.0 };     // Seconds
+		size_t Sockets{ 64 };        // Virtual clients share these loopback addresses
+		size_t GeneratorThreads{ 1 };
+		PTP::ServerOptions Server;
+	};
+
+	boost::program_options::variables_map GetProgramArguments(
+		std::span<const char* const> args,
+		const boost::program_options::options_description& description)
+	{
+		namespace po = boost::program_options;
+
+		po::variables_map vm;
+		try
+		{
+			po::store(po::command_line_parser(static_cast<int>(args.size()), args.data())
+				.options(description)
+				.run(),
+				vm);
+			po::notify(vm);
+		}
+		catch (const po::error& ex)
+		{
+			throw std::runtime_error(std::string("Argument parsing error: ") + ex.what());
+		}
+
+		return vm;
+	}
+
+	BenchOptions ReadBenchOptions(std::span<const char* const> args)
+	{
+		namespace po = boost::program_options;
+
+		BenchOptions options;
+		po::options_description description("PTP server benchmark");
+		description.add_options()
+			("Clients", po::value(&options.Clients)->default_value(options.Clients), "virtual clients")
+			("Rate", po::value(&options.Rate)->default_value(options.Rate), "Delay_Req per second per client")
+			("Duration", po::value(&options.Duration)->default_value(options.Duration), "seconds of load")
+			("Sockets", po::value(&options.Sockets)->default_value(options.Sockets),
+				"loopback addresses (127.1.x.y) the virtual clients are spread over")
+			("GeneratorThreads", po::value(&options.GeneratorThreads)->default_value(options.GeneratorThreads),
+				"load generator threads")
+			("Threads", po::value(&options.Server.Threads)->default_value(options.Server.Threads),
+				"server worker threads")
+			("BatchSize", po::value(&options.Server.BatchSize)->default_value(options.Server.BatchSize),
+				"server recvmmsg/sendmmsg batch size (0 = one request per wakeup, answered inline)")
+			("ClientRate", po::value(&options.Server.Sessions.Rate)->default_value(options.Server.Sessions.Rate),
+				"server per-client Delay_Req rate limit (0 = no limit)");
+
+		GetProgramArguments(args, description);
+		if (options.Clients == 0 || options.Sockets == 0 || options.GeneratorThreads == 0 || options.Rate <= 0.0)
+			throw std::runtime_error("Clients, Sockets, GeneratorThreads and Rate must be positive");
+		options.Sockets = std::min(options.Sockets, options.Clients);
+		return options;
+	}
+
+	std::chrono::nanoseconds ThreadCpuTime()
+	{
+#if defined(CLOCK_THREAD_CPUTIME_ID)
+		timespec ts{};
+		::clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+		return std::chrono::seconds(ts.tv_sec) + std::chrono::nanoseconds(ts.tv_nsec);
+#else
+		return std::chrono::nanoseconds(0);
+#endif
+	}
+
+	std::chrono::nanoseconds ProcessCpuTime()
+	{
+		return std::chrono::nanoseconds(
+			static_cast<int64_t>(static_cast<double>(std::clock()) * 1e9 / CLOCKS_PER_SEC));
+	}
+
+	// Log-linear histogram, 32 sub-buckets per power of two (about 3% resolution).
+	class LatencyHistogram
+	{
+	public:
+		void Record(uint64_t nanoseconds)
+		{
+			++m_counts[std::min(BucketOf(nanoseconds), m_counts.size() - 1)];
+			++m_total;
+		}
+
+		void Merge(const LatencyHistogram& other)
+		{
+			for (size_t i = 0; i < m_counts.size(); ++i)
+				m_counts[i] += other.m_counts[i];
+			m_total += other.m_total;
+		}
+
+		uint64_t Percentile(double percentile) const
+		{
+			if (m_total == 0)
+				return 0;
+			const auto rank{ std::min(m_total - 1,
+				static_cast<uint64_t>(percentile / 100.0 * static_cast<double>(m_total))) };
+			uint64_t seen{ 0 };
+			for (size_t i = 0; i < m_counts.size(); ++i)
+			{
+				seen += m_counts[i];
+				if (seen > rank)
+					return ValueOf(i);
+			}
+			return ValueOf(m_counts.size() - 1);
+		}
+
+	private:
+		static constexpr size_t c_subBucketBits{ 5 };
+		static constexpr uint64_t c_subBuckets{ 1 << c_subBucketBits };
+
+		static size_t BucketOf(uint64_t value)
+		{
+			if (value < c_subBuckets)
+				return static_cast<size_t>(value);
+			const auto shift{ static_cast<size_t>(std::bit_width(value)) - c_subBucketBits - 1 };
+			return static_cast<size_t>(c_subBuckets * (shift + 1) + ((value >> shift) - c_subBuckets));
+		}
+
+		static uint64_t ValueOf(size_t bucket)
+		{
+			if (bucket < c_subBuckets)
+				return bucket;
+			const auto shift{ bucket / c_subBuckets - 1 };
+			return (c_subBuckets + bucket % c_subBuckets) << shift;
+		}
+
+		std::array<uint64_t, c_subBuckets * 40> m_counts{};
+		uint64_t m_total{ 0 };
+	};
+
+	// One loopback address bound to the Delay_Resp port. Its virtual clients take turns
+	// sending Delay_Req; replies are matched by sequenceId.
+	class VirtualHost
+	{
+	public:
+		VirtualHost(boost::asio::io_context& ioContext, size_t index, size_t clients, double rate)
+			: m_socket(ioContext)
+			, m_index(index)
+			, m_clients(clients)
+			, m_interval(std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::duration<double>(1.0 / (rate * static_cast<double>(clients)))))
+			, m_sendTimes(std::numeric_limits<uint16_t>::max() + 1, 0)
+		{
+			// Server replies to <source address>:c_ptpGeneralPort.
+			const boost::asio::ip::address_v4 address{ { 127, 1,
+				static_cast<uint8_t>(index / 250), static_cast<uint8_t>(index % 250 + 1) } };
+			m_socket.open(boost::asio::ip::udp::v4());
+			m_socket.bind({ address, PTP::c_ptpGeneralPort });
+		}
+
+		boost::asio::awaitable<void> Send(std::chrono::steady_clock::time_point start,
+			std::chrono::steady_clock::time_point end)
+		{
+			const boost::asio::ip::udp::endpoint server{ boost::asio::ip::make_address(PTP::c_serverIP), c_benchEventPort };
+			std::array<uint8_t, PTP::Wire::c_delayReqSize> buffer{};
+			PTP::PtpMessage request;
+			request.header.messageType = PTP::PtpMessageType::Delay_Req;
+			boost::asio::steady_timer timer(m_socket.get_executor());
+
+			// Stagger hosts so they do not all fire on the same tick.
+			auto next{ start + m_interval * (m_index % 97) / 97 };
+			while (next < end)
+			{
+				timer.expires_at(next);
+				co_await timer.async_wait(boost::asio::use_awaitable);
+
+				const auto now{ std::chrono::steady_clock::now() };
+				for (; next <= now && next < end; next += m_interval)
+				{
+					request.header.sequenceId = m_sequenceId;
+					const auto client{ static_cast<uint16_t>(m_sent % m_clients) };
+					std::memcpy(request.header.sourcePortIdentity.data(), &client, sizeof(client));
+					PTP::EncodeMessage(request, buffer);
+
+					m_sendTimes[m_sequenceId] = std::chrono::steady_clock::now().time_since_epoch().count();
+					boost::system::error_code ec;
+					m_socket.send_to(boost::asio::buffer(buffer), server, 0, ec);
+					if (ec)
+						++m_sendErrors;
+					else
+						++m_sent;
+					++m_sequenceId;
+				}
+			}
+		}
+
+		boost::asio::awaitable<void> Receive()
+		{
+			std::array<uint8_t, PTP::Wire::c_maxMessageSize> buffer{};
+			boost::asio::ip::udp::endpoint sender;
+			while (true)
+			{
+				const auto bytes{ co_await m_socket.async_receive_from(boost::asio::buffer(buffer), sender, boost::asio::use_awaitable) };
+				const auto now{ std::chrono::steady_clock::now().time_since_epoch().count() };
+				const auto response{ PTP::DecodeMessage(std::span(buffer).first(bytes)) };
+				if (!response || response->header.messageType != PTP::PtpMessageType::Delay_Resp)
+					continue;
+
+				auto& sendTime{ m_sendTimes[response->header.sequenceId] };
+				if (sendTime == 0)
+				{
+					++m_unexpected;
+					continue;
+				}
+				m_latencies.Record(static_cast<uint64_t>(now - sendTime));
+				sendTime = 0;
+				++m_received;
+			}
+		}
+
+		void Close() { m_socket.close(); }
+
+		uint64_t Sent() const { return m_sent; }
+		uint64_t Received() const { return m_received; }
+		uint64_t SendErrors() const { return m_sendErrors; }
+		uint64_t Unexpected() const { return m_unexpected; }
+		const LatencyHistogram& Latencies() const { return m_latencies; }
+
+	private:
+		boost::asio::ip::udp::socket m_socket;
+		size_t m_index;
+		size_t m_clients;
+		std::chrono::nanoseconds m_interval;
+		std::vector<std::chrono::steady_clock::rep> m_sendTimes; // Indexed by sequenceId, 0 = answered
+		uint16_t m_sequenceId{ 0 };
+		uint64_t m_sent{ 0 };
+		uint64_t m_received{ 0 };
+		uint64_t m_sendErrors{ 0 };
+		uint64_t m_unexpected{ 0 };
+		LatencyHistogram m_latencies;
+	};
+
+	void RunBenchmark(const BenchOptions& options)
+	{
+		PTP::ServerPool serverPool(PTP::c_serverIP, c_benchEventPort, c_benchGeneralPort, options.Server);
+		std::exception_ptr serverError;
+		std::jthread serverThread([&serverPool, &serverError]
+		{
+			try
+			{
+				serverPool.Run();
+			}
+			catch (...)
+			{
+				serverError = std::current_exception();
+			}
+		});
+
+		std::vector<std::unique_ptr<boost::asio::io_context>> generators;
+		for (size_t i = 0; i < options.GeneratorThreads; ++i)
+			generators.push_back(std::make_unique<boost::asio::io_context>(1));
+
+		std::vector<std::unique_ptr<VirtualHost>> hosts;
+		for (size_t i = 0; i < options.Sockets; ++i)
+		{
+			const auto clients{ options.Clients / options.Sockets + (i < options.Clients % options.Sockets ? 1 : 0) };
+			hosts.push_back(std::make_unique<VirtualHost>(*generators[i % generators.size()], i, clients, options.Rate));
+		}
+
+		const auto start{ std::chrono::steady_clock::now() + std::chrono::milliseconds(100) };
+		const auto end{ start + std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::duration<double>(options.Duration)) };
+		for (size_t i = 0; i < hosts.size(); ++i)
+		{
+			auto& ioContext{ *generators[i % generators.size()] };
+			boost::asio::co_spawn(ioContext, hosts[i]->Send(start, end), PTP::RethrowException);
+			boost::asio::co_spawn(ioContext, hosts[i]->Receive(), boost::asio::detached);
+		}
+
+		const auto processCpuBefore{ ProcessCpuTime() };
+		std::atomic<int64_t> generatorCpu{ 0 };
+		{
+			std::vector<std::jthread> generatorThreads;
+			for (auto& ioContext : generators)
+			{
+				generatorThreads.emplace_back([&ioContext, &generatorCpu, end]
+				{
+					const auto cpuBefore{ ThreadCpuTime() };
+					ioContext->run_until(end + c_drainTime);
+					generatorCpu += (ThreadCpuTime() - cpuBefore).count();
+				});
+			}
+		}
+		const auto serverCpu{ ProcessCpuTime() - processCpuBefore - std::chrono::nanoseconds(generatorCpu.load()) };
+
+		serverPool.Stop();
+		serverThread.join();
+		PTP::RethrowException(serverError);
+		for (auto& host : hosts)
+			host->Close();
+
+		LatencyHistogram latencies;
+		uint64_t sent{ 0 }, received{ 0 }, sendErrors{ 0 }, unexpected{ 0 };
+		for (const auto& host : hosts)
+		{
+			latencies.Merge(host->Latencies());
+			sent += host->Sent();
+			received += host->Received();
+			sendErrors += host->SendErrors();
+			unexpected += host->Unexpected();
+		}
+
+		const auto seconds{ options.Duration };
+		const auto toMicroseconds = [](uint64_t ns) { return static_cast<double>(ns) / 1000.0; };
+		std::cout << std::format(
+			"clients: {} | offered: {:.0f} req/s | server threads: {} | batch: {}\n"
+			"sent: {} | received: {} | drops: {} | send errors: {} | unexpected: {}\n"
+			"throughput: {:.0f} resp/s\n"
+			"turnaround us p50: {:.1f} | p99: {:.1f} | p99.9: {:.1f} | max: {:.1f}\n"
+			"server cpu: {:.3f} s ({:.1f}% of one core)\n",
+			options.Clients, static_cast<double>(options.Clients) * options.Rate,
+			options.Server.Threads, options.Server.BatchSize,
+			sent, received, sent - received, sendErrors, unexpected,
+			static_cast<double>(received) / seconds,
+			toMicroseconds(latencies.Percentile(50.0)),
+			toMicroseconds(latencies.Percentile(99.0)),
+			toMicroseconds(latencies.Percentile(99.9)),
+			toMicroseconds(latencies.Percentile(100.0)),
+			std::chrono::duration<double>(serverCpu).count(),
+			100.0 * std::chrono::duration<double>(serverCpu).count() / seconds);
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	try
+	{
+		RunBenchmark(ReadBenchOptions(std::span(argv, argc)));
+		return EXIT_SUCCESS;
+	}
+	catch (const std::exception& e)
+	{
+		std::cerr << "Error: " << e.what() << std::endl;
+		return EXIT_FAILURE;
+	}
+}
@@ -1,26 +1,62 @@
 #include "PtpClient.h"
-#include <range/v3/all.hpp> 
+#include "Logger.h"
+#include "ClockSource.h"
 
+#include <algorithm>
+#include <cmath>
 #include <iostream>
 
 namespace PTP
 {
 	Client::Client(boost::asio::io_context& ioContext,
 		const std::string& serverHost,
-		const std::string& local)
+		const std::string& local,
+		const ClientOptions& options)
 		: m_ioContext(ioContext)
 		, m_localAdapter(boost::asio::ip::make_address(local))
 		, m_eventSocket(m_ioContext)
 		, m_generalSocket(m_ioContext)
+		, m_eventTxTimestamps(m_eventSocket)
+		, m_delayMechanism(options.PathDelay)
+		, m_clock(CreateClock(options.Clock))
+		, m_core(m_clock.get(), options.Estimator, options.FilterDiagnostics, options.Servo, options.Domain, options.Prefilter)
+		, m_timeExport(options.TimeExport.empty() ? nullptr : std::make_unique<SharedTimePublisher>(options.TimeExport))
+		, m_capture(options.Capture)
 	{
 		try
 		{
 			SetupEventSocket(serverHost);
 			SetupGeneralSocket(serverHost);
+			if (options.Servers.size() > 1)
+			{
+				boost::asio::ip::udp::resolver resolver(m_ioContext);
+				for (const auto& server : options.Servers)
+				{
+					m_sourceEndpoints.push_back(*resolver.resolve(
+						boost::asio::ip::udp::v4(),
+						server,
+						std::to_string(c_ptpEventPort)).begin());
+					std::cout << "PTP Client ensemble source " << m_sourceEndpoints.size() - 1 << ": " << m_sourceEndpoints.back() << std::endl;
+				}
+				m_ensemble = std::make_unique<Ensemble>(m_sourceEndpoints.size(), options.Estimator, options.Domain, options.Prefilter);
+			}
+			for (size_t source = 0; source < (m_ensemble ? m_ensemble->Size() : 1); ++source)
+				(m_ensemble ? m_ensemble->GetCore(source) : m_core).SetCapture(m_capture.get(), static_cast<uint8_t>(source));
+			const auto support{ EnableTimestamping(m_eventSocket, options.Timestamping, options.TxTimestamps) };
+			m_kernelRxTimestamps = support.rx;
+			m_kernelTxTimestamps = support.tx;
+			if (options.Timestamping != TimestampMode::Application && !m_kernelRxTimestamps)
+				std::cerr << "Kernel receive timestamps not supported, using application timestamps" << std::endl;
+			if (options.TxTimestamps && !m_kernelTxTimestamps)
+				std::cerr << "Kernel transmit timestamps not supported, using application timestamps" << std::endl;
 			boost::asio::co_spawn(m_ioContext, ListenOnEventSocket(), RethrowException);
 			boost::asio::co_spawn(m_ioContext, ListenOnGeneralSocket(), RethrowException);
 			boost::asio::co_spawn(m_ioContext, RunDelayRequester(), RethrowException);
 			boost::asio::co_spawn(m_ioContext, CleanupStaleEntries(), RethrowException);
+			if (m_kernelTxTimestamps)
+				boost::asio::co_spawn(m_ioContext, m_eventTxTimestamps.Run(), RethrowException);
+			if (options.MetricsPort != 0)
+				m_metrics = std::make_unique<MetricsServer>(m_ioContext, options.MetricsPort);
 		}
 		catch (const std::exception& e)
 		{
@@ -34,11 +70,28 @@ namespace PTP
 		while (true)
 		{
 			boost::asio::ip::udp::endpoint senderEndpoint;
-			co_await m_eventSocket.async_receive_from(
+			const auto received = co_await ReceiveWithTimestamp(m_eventSocket,
 				boost::asio::buffer(m_eventRecvBuffer),
 				senderEndpoint,
-				boost::asio::use_awaitable);
-			OnSyncReceived();
+				m_kernelRxTimestamps);
+			RecordPacket(CaptureDirection::Received, senderEndpoint, c_ptpEventPort, received.timestamp,
+				std::span(m_eventRecvBuffer).first(received.bytesReceived));
+			const auto message{ DecodeMessage(std::span(m_eventRecvBuffer).first(received.bytesReceived)) };
+			if (!message || (message->header.messageType != PtpMessageType::Sync &&
+				message->header.messageType != PtpMessageType::Pdelay_Resp))
+			{
+				continue;
+			}
+
+			OnMessage(*message, received.timestamp, senderEndpoint.address());
+			FollowMaster(*message, senderEndpoint);
+			// A one-step Sync completes t1/t2 on its own and has already updated the clock; a
+			// Pdelay_Resp may have completed a link delay measurement.
+			if (message->header.messageType == PtpMessageType::Pdelay_Resp ||
+				!(message->header.flags & Wire::c_twoStepFlag))
+			{
+				PublishStatus();
+			}
 		}
 	}
 
@@ -47,22 +100,79 @@ namespace PTP
 		while (true)
 		{
 			boost::asio::ip::udp::endpoint senderEndpoint;
-			co_await m_generalSocket.async_receive_from(
+			const auto bytesReceived = co_await m_generalSocket.async_receive_from(
 				boost::asio::buffer(m_generalRecvBuffer),
 				senderEndpoint,
 				boost::asio::use_awaitable);
+			RecordPacket(CaptureDirection::Received, senderEndpoint, c_ptpGeneralPort, {},
+				std::span(m_generalRecvBuffer).first(bytesReceived));
 
-			OnFollowUpReceived();
-			OnRequestResponseReceived();
+			const auto message{ DecodeMessage(std::span(m_generalRecvBuffer).first(bytesReceived)) };
+			if (message && message->header.messageType != PtpMessageType::Sync)
+			{
+				OnMessage(*message, {}, senderEndpoint.address());
+				FollowMaster(*message, senderEndpoint);
+				PublishStatus();
+			}
 		}
 	}
 
+	void Client::OnMessage(const PtpMessage& message, PtpTimestamp receiveTimestamp, const boost::asio::ip::address& sender)
+	{
+		const auto now{ std::chrono::steady_clock::now() };
+		if (!m_ensemble)
+		{
+			m_core.OnMessage(message, receiveTimestamp, now);
+			return;
+		}
+
+		// A handful of sources: a linear scan is the cheapest lookup.
+		const auto source{ std::ranges::find_if(m_sourceEndpoints, [&sender](const auto& endpoint) { return endpoint.address() == sender; }) };
+		if (source == m_sourceEndpoints.end())
+			return;
+		const auto index{ static_cast<size_t>(source - m_sourceEndpoints.begin()) };
+		if (const auto estimate = m_ensemble->OnMessage(index, message, receiveTimestamp, now))
+			m_core.SteerClock(estimate->offset, estimate->time, now);
+	}
+
+	// Ensemble sources keep to their configured servers.
+	void Client::FollowMaster(const PtpMessage& message, const boost::asio::ip::udp::endpoint& sender)
+	{
+		if (m_ensemble)
+			return;
+		if (message.header.messageType == PtpMessageType::Announce)
+		{
+			const auto& identity{ message.header.sourcePortIdentity };
+			if (m_masterAddresses.contains(identity) || m_masterAddresses.size() < c_maxForeignMasters)
+				m_masterAddresses[identity] = sender.address();
+		}
+
+		const auto& master{ m_core.GetMasters().GetMasterIdentity() };
+		if (!master || master == m_master)
+			return;
+		m_master = master;
+		const auto address{ m_masterAddresses.find(*master) };
+		if (address == m_masterAddresses.end())
+			return;
+		m_serverEventEndpoint.address(address->second);
+		m_serverGeneralEndpoint.address(address->second);
+		LogInfo("Delay requests now go to {}", LogString(address->second.to_string()));
+	}
+
     boost::asio::awaitable<void> Client::RunDelayRequester()
 	{
 		while (true)
 		{
 			co_await WaitForTimeout(c_delayRequestTimeout);
-			co_await DelayRequest();
+			for (size_t source = 0; source < (m_ensemble ? m_ensemble->Size() : 1); ++source)
+			{
+				auto& core{ m_ensemble ? m_ensemble->GetCore(source) : m_core };
+				const auto& server{ m_ensemble ? m_sourceEndpoints[source] : m_serverEventEndpoint };
+				if (m_delayMechanism == DelayMechanism::PeerToPeer)
+					co_await PeerDelayRequest(core, server);
+				else
+					co_await DelayRequest(core, server);
+			}
 			// Note: We do not wait for the response here, as the ListenOnGeneralSocket will handle it.
 		}
 	}
@@ -72,121 +182,141 @@ namespace PTP
 		while (true)
 		{
 			co_await WaitForTimeout(c_cleanupInterval);
-			const auto now = std::chrono::steady_clock::now();
-
-			// Remove any entries that are older than the timeout AND are not yet complete.
-			// This handles cases where a Follow_Up or Delay_Resp was lost.
-			const auto entriesBeforeCleanup = m_timestampSets.size();
-			const auto numStale = std::erase_if(m_timestampSets, [&](const PtpTimestampSet& entry)
-			{
-				const bool isComplete = entry.t1Received && entry.t2Received && entry.t3Sent && entry.t4Received;
-				if (isComplete)
-				{
-					return false; // Don't remove completed entries based on time.
-				}
-				return (now - entry.creationTime) > c_entryStaleTimeout;
-			});
-
-			if (numStale > 0)
-			{
-				std::cout << std::format("entries before {}. Cleanup task removed {} stale PTP entries. Entries left: {}",
-					entriesBeforeCleanup,
-					numStale,
-					m_timestampSets.size()) << std::endl;
-			}
 
-			while (m_timestampSets.size() > c_maxTimestampSets)
-			{
-				m_timestampSets.pop_front();// Keep only the last 10 timestamp sets
-			}
+			m_core.RemoveStaleEntries(std::chrono::steady_clock::now());
+			for (size_t source = 0; m_ensemble && source < m_ensemble->Size(); ++source)
+				m_ensemble->GetCore(source).RemoveStaleEntries(std::chrono::steady_clock::now());
 		}
 	}
 
-    boost::asio::awaitable<void> Client::DelayRequest()
+    boost::asio::awaitable<void> Client::DelayRequest(ClientCore& core, const boost::asio::ip::udp::endpoint& server)
 	{
-		const auto buffer = CreateDelayRequest();
+		const auto sequenceId{ core.GetSequenceId() };
+		auto departure{ GetCurrentPtpTime() };
+		// With transmit timestamps t3 stays pending until the error queue answers, so a Delay_Resp
+		// that beats it is not measured from the application timestamp.
+		const auto size{ core.WriteDelayRequest(m_delayRequestBuffer,
+			m_kernelTxTimestamps ? std::nullopt : std::optional(departure)) };
 		co_await m_eventSocket.async_send_to(
-			boost::asio::buffer(buffer, buffer.size()),
-			m_serverEventEndpoint,
+			boost::asio::buffer(m_delayRequestBuffer, size),
+			server,
 			boost::asio::use_awaitable);
-	}
-
+		const auto txKey{ m_eventTxTimestamps.Sent() };
+		Increment(MetricCounter::ClientDelayRequestsSent);
 
-	SimplifiedPtpHeader Client::GetPtpEventHeader()
-	{
-		SimplifiedPtpHeader header;
-		std::memcpy(&header, m_eventRecvBuffer.data(), sizeof(SimplifiedPtpHeader));
-		return header;
+		if (m_kernelTxTimestamps)
+		{
+			const auto t3{ co_await m_eventTxTimestamps.WaitForTimestamp(txKey, c_txTimestampTimeout) };
+			if (t3)
+				departure = *t3;
+			else
+				LogWarning("No transmit timestamp for delay request {}, using application timestamp", sequenceId);
+			core.SetDelayRequestTimestamp(sequenceId, departure);
+		}
+		RecordPacket(CaptureDirection::Sent, server, c_ptpEventPort, departure, std::span(m_delayRequestBuffer).first(size));
 	}
 
-	SimplifiedPtpHeader Client::GetPtpGeneralHeader()
+    boost::asio::awaitable<void> Client::PeerDelayRequest(ClientCore& core, const boost::asio::ip::udp::endpoint& server)
 	{
-		SimplifiedPtpHeader header;
-		std::memcpy(&header, m_generalRecvBuffer.data(), sizeof(SimplifiedPtpHeader));
-		return header;
-	}
+		auto departure{ GetCurrentPtpTime() };
+		const auto size{ core.WritePeerDelayRequest(m_delayRequestBuffer,
+			m_kernelTxTimestamps ? std::nullopt : std::optional(departure)) };
+		const auto sequenceId{ core.GetPeerDelaySequenceId() };
+		co_await m_eventSocket.async_send_to(
+			boost::asio::buffer(m_delayRequestBuffer, size),
+			server,
+			boost::asio::use_awaitable);
+		const auto txKey{ m_eventTxTimestamps.Sent() };
+		Increment(MetricCounter::ClientDelayRequestsSent);
 
-	PtpTimestamp Client::GetTimeStampFromGeneralBuffer()
-	{
-		PtpTimestamp timestampPayload;
-		std::memcpy(&timestampPayload, m_generalRecvBuffer.data() + sizeof(SimplifiedPtpHeader), sizeof(PtpTimestamp));
-		return timestampPayload;
+		if (m_kernelTxTimestamps)
+		{
+			// The link delay is measured once t1 is known, however early the response came.
+			const auto t1{ co_await m_eventTxTimestamps.WaitForTimestamp(txKey, c_txTimestampTimeout) };
+			if (t1)
+				departure = *t1;
+			else
+				LogWarning("No transmit timestamp for peer delay request {}, using application timestamp", sequenceId);
+			core.SetPeerDelayRequestTimestamp(sequenceId, departure);
+		}
+		RecordPacket(CaptureDirection::Sent, server, c_ptpEventPort, departure, std::span(m_delayRequestBuffer).first(size));
 	}
 
-	void Client::OnSyncReceived()
+
+	void Client::RecordPacket(CaptureDirection direction,
+		const boost::asio::ip::udp::endpoint& remote,
+		unsigned short localPort,
+		PtpTimestamp timestamp,
+		std::span<const uint8_t> payload)
 	{
-		const auto t2{ GetCurrentPtpTime() };
-		const auto ptpHeader{ GetPtpEventHeader() };
-		if (ptpHeader.GetMessageType() != PtpMessageType::Sync)
+		if (!m_capture)
 			return;
 
-		PtpTimestampSet newSet;
-		m_sequenceId = SwapEndianness(ptpHeader.sequenceId);
-		newSet.sequenceId = m_sequenceId;
-		newSet.t2 = t2;
-		newSet.t2Received = true;
-		newSet.creationTime = std::chrono::steady_clock::now();
-
-		m_timestampSets.push_back(newSet);
+		m_capture->WritePacket({
+			.header = {},
+			.captureTime = ReadClock(ClockSource::Realtime),
+			.timestamp = timestamp.to_nanoseconds(),
+			.localAddress = m_localAdapter.to_v4().to_uint(),
+			.remoteAddress = remote.address().to_v4().to_uint(),
+			.localPort = localPort,
+			.remotePort = remote.port(),
+			.length = 0,
+			.direction = direction,
+			.reserved = 0 }, payload);
 	}
 
-	void Client::OnFollowUpReceived()
+	std::optional<int64_t> Client::Now() const
 	{
-		const auto ptpHeader{ GetPtpGeneralHeader() };
-		if (ptpHeader.GetMessageType() != PtpMessageType::Follow_Up)
-			return;
-
-		const auto OnSequenceId = [this](PtpTimestampSet ptpTimestampSet)
-		{
-			return ptpTimestampSet.sequenceId == m_sequenceId;
-		};
-
-		for (auto& ptpTimestampSet : m_timestampSets | ranges::views::filter(OnSequenceId))
-		{
-			ptpTimestampSet.t1 = GetTimeStampFromGeneralBuffer();
-			ptpTimestampSet.t1Received = true;
-		}
+		const auto status{ GetStatus() };
+		if (status.time.state == SharedTimeState::NoData)
+			return std::nullopt;
+		return status.time.Now();
 	}
 
-	void Client::OnRequestResponseReceived()
+	void Client::PublishStatus()
 	{
-		const auto ptpHeader{ GetPtpGeneralHeader() };
-		if (ptpHeader.GetMessageType() != PtpMessageType::Delay_Resp)
+		// With an ensemble the path delay shown is the first source's.
+		const auto& delayCore{ m_ensemble ? m_ensemble->GetCore(0) : m_core };
+		const auto offset{ m_core.GetOffsetFromMaster() };
+		const auto delay{ delayCore.GetDelayEstimate() };
+		if (!offset && !delay)
 			return;
 
-		const auto OnSequenceId = [this](PtpTimestampSet ptpTimestampSet)
+		ClientStatus status;
+		auto& snapshot{ status.time };
+		const auto servoState{ m_core.GetServo().GetState() };
+		// Before the first step the clock is still free running and has no time to offer.
+		if (offset && (!m_clock || servoState != ServoState::Unlocked))
 		{
-			return ptpTimestampSet.sequenceId == m_sequenceId;
-		};
-		for (auto& ptpTimestampSet : m_timestampSets | ranges::views::filter(OnSequenceId))
-		{
-			ptpTimestampSet.t4 = GetTimeStampFromGeneralBuffer();
-			ptpTimestampSet.t4Received = true;
+			// Measuring only: master time is the packet clock minus the last offset.
+			const auto mapping{ m_clock ? m_clock->GetMapping() : ClockMapping{ GetKernelClockId(GetClockSource()), 0, -*offset, 0.0 } };
+			snapshot.state = !m_clock ? SharedTimeState::Measuring
+				: servoState == ServoState::Locked ? SharedTimeState::Locked : SharedTimeState::Acquiring;
+			snapshot.clockId = mapping.clockId;
+			snapshot.clockAnchor = mapping.clockAnchor;
+			snapshot.timeAnchor = mapping.timeAnchor;
+			snapshot.frequencyPpb = mapping.frequencyPpb;
 		}
-
-		UpdateMeanPathDelay();
-
+		snapshot.driftPpb = m_clock ? m_core.GetServo().GetFrequency() : 0.0;
+		snapshot.offsetFromMaster = offset.value_or(0);
+		snapshot.offsetRms = m_clock ? m_core.GetServo().GetOffsetRms() : 0.0;
+		snapshot.meanPathDelay = delayCore.GetMeanPathDelay().value_or(0.0) * 1000.0;
+		snapshot.updateTime = ReadClock(ClockSource::MonotonicRaw);
+		snapshot.updates = m_status.Load().time.updates + 1;
+		status.hasDelayEstimate = delay.has_value();
+		status.delay = delay.value_or(DelayEstimate{});
+
+		m_status.Store(status);
+		SetGauge(MetricGauge::ClientPathDelay, status.delay.delay * 1e-6);
+		SetGauge(MetricGauge::ClientPathDelayStddev, std::sqrt(status.delay.variance) * 1e-6);
+		SetGauge(MetricGauge::ClientPathDelayDrift, status.delay.drift * 1e-6);
+		SetGauge(MetricGauge::ClientOffsetFromMaster, static_cast<double>(snapshot.offsetFromMaster) * 1e-9);
+		SetGauge(MetricGauge::ClientFrequency, snapshot.driftPpb);
+		SetGauge(MetricGauge::ClientServoState, static_cast<double>(servoState));
+		if (m_timeExport && snapshot.state != SharedTimeState::NoData)
+			m_timeExport->Publish(snapshot);
 	}
+
 	void Client::SetupEventSocket(const std::string& serverHost)
 	{
 		boost::asio::ip::udp::resolver resolver(m_ioContext);
@@ -239,73 +369,4 @@ namespace PTP
 		 	<< " on interface " << m_localAdapter.to_string() << std::endl;
 		}
 	}
-
-	void Client::UpdateMeanPathDelay()
-	{
-
-		if (m_timestampSets.empty())
-			return;
-
-		const auto isComplete = [](PtpTimestampSet entry)
-		{
-			return entry.t1Received && entry.t2Received && entry.t3Sent && entry.t4Received;
-		};
-
-		const auto calculatePathDelay = [](const PtpTimestampSet& entry)
-		{
-			const auto t1 = entry.t1.to_nanoseconds();
-			const auto t2 = entry.t2.to_nanoseconds();
-			const auto t3 = entry.t3.to_nanoseconds();
-			const auto t4 = entry.t4.to_nanoseconds();
-			return ((t4 - t1) - (t3 - t2)) / 2.0;
-		};
-
-		const auto aboveZero = [](const auto pathDelay)
-		{
-			return pathDelay>0;
-		};
-
-		const auto toMicroseconds = [](const auto& value)
-		{
-			return value / 1000.0;
-		};
-
-        auto pathDelays = m_timestampSets
-                | ranges::views::filter(isComplete)
-                | ranges::views::reverse
-                | ranges::views::take(c_maxTimestampSets)
-                | ranges::views::transform(calculatePathDelay)
-				| ranges::views::filter(aboveZero)
-                | ranges::views::transform(toMicroseconds)
-                | ranges::to_vector;
-
-		if (!pathDelays.empty())
-		{
-			const double rawMeasurement=pathDelays.back();
-			m_meanPathDelay = m_kalmanFilter.Update(rawMeasurement);
-		}
-	}
-
-	std::vector<uint8_t> Client::CreateDelayRequest()
-	{
-		const auto OnSequenceId = [this](PtpTimestampSet ptpTimestampSet)
-		{
-			return ptpTimestampSet.sequenceId == m_sequenceId;
-		};
-
-		for (auto& ptpTimestampSet : m_timestampSets | ranges::views::filter(OnSequenceId))
-		{
-			ptpTimestampSet.t3 = GetCurrentPtpTime();
-			ptpTimestampSet.t3Sent = true;
-		}
-
-		constexpr auto messageSize{ sizeof(SimplifiedPtpHeader) + sizeof(PtpTimestamp) };
-		std::vector<uint8_t> buffer(messageSize);
-
-		#pragma warning(suppress: 26490) // Don't use reinterpret_cast
-		auto* headerPtr = reinterpret_cast<SimplifiedPtpHeader*>(buffer.data());
-		headerPtr->transportSpecificMessageType = static_cast<uint8_t>(PtpMessageType::Delay_Req);
-		headerPtr->sequenceId = SwapEndianness(m_sequenceId);
-		return buffer;
-	}
 }
\ No newline at end of file
@@ -2,39 +2,68 @@
 #include <boost/asio/experimental/awaitable_operators.hpp>
 #include <boost/asio/experimental/channel.hpp>
 
+#include <map>
+#include <memory>
+#include <vector>
+
 
 #include "Utils.h"
-#include "KalmanFilter1D.h"
+#include "PtpCodec.h"
+#include "PtpClientCore.h"
+#include "Ensemble.h"
+#include "Timestamping.h"
+#include "SharedTimePublisher.h"
+#include "SeqLock.h"
+#include "Metrics.h"
 
 namespace PTP
 {
-    class Client
+	struct ClientOptions
+	{
+		TimestampMode Timestamping{ TimestampMode::Application };
+		bool TxTimestamps{ false };
+		DelayMechanism PathDelay{ DelayMechanism::EndToEnd }; // Delay_Req to the master or Pdelay_Req to the neighbour
+		uint8_t Domain{ 0 };              // PTP domain to synchronize to
+		bool FilterDiagnostics{ false }; // Kalman filter prints one line per update
+		DelayEstimator Estimator{ DelayEstimator::Scalar };
+		PrefilterOptions Prefilter; // Selection and gating of path delay samples before the estimator
+		ClockTarget Clock{ ClockTarget::Disciplined };
+		ServoOptions Servo;
+		std::string TimeExport; // Shared memory name for SharedTimeReader, empty = no export
+		// Two or more: a session with each of these servers instead of following serverHost,
+		// combined by Ensemble. All share the client's two sockets.
+		std::vector<std::string> Servers;
+		// Receives every datagram, delay request and timestamp set the estimators use; nullptr = off.
+		std::shared_ptr<CaptureWriter> Capture;
+		unsigned short MetricsPort{ 0 }; // Prometheus scrape endpoint on 127.0.0.1, 0 = off
+	};
+
+	// Consistent view of the client's estimates, republished after every Follow_Up and Delay_Resp.
+	struct ClientStatus
 	{
-		struct PtpTimestampSet
-		{
-			uint16_t sequenceId;
-			PtpTimestamp t1; // Master sends Sync (from Follow_Up)
-			PtpTimestamp t2; // Slave receives Sync
-			PtpTimestamp t3; // Slave sends Delay_Req
-			PtpTimestamp t4; // Master receives Delay_Req (from Delay_Resp)
-			bool t1Received{ false };
-			bool t2Received{ false };
-			bool t3Sent{ false };
-			bool t4Received{ false };
-			std::chrono::steady_clock::time_point creationTime;
-		};
+		SharedTimeSnapshot time; // Clock line, offset, drift, path delay, servo state and update time
+		bool hasDelayEstimate{ false };
+		DelayEstimate delay{};   // Path delay filter state and uncertainty
+	};
 
+    class Client
+	{
 	public:
 
 		Client(boost::asio::io_context& ioContext,
 			const std::string& serverHost = c_serverIP,
-			const std::string& local = c_clientIP);
+			const std::string& local = c_clientIP,
+			const ClientOptions& options = {});
 
 		Client(const Client&) = delete;
 		Client& operator=(const Client&) = delete;
 		Client(Client&&) = delete;
 		Client& operator=(Client&&) = delete;
 
+		// Both are lock-free and may be called from any thread while the io_context runs.
+		ClientStatus GetStatus() const { return m_status.Load(); }
+		// Synchronized time in nanoseconds on the PTP timescale, nullopt before the first estimate.
+		std::optional<int64_t> Now() const;
 
 	private:
 
@@ -43,18 +72,22 @@ namespace PTP
 		boost::asio::awaitable<void> RunDelayRequester();
 		boost::asio::awaitable<void> CleanupStaleEntries();
 
-		boost::asio::awaitable<void> DelayRequest();
+		boost::asio::awaitable<void> DelayRequest(ClientCore& core, const boost::asio::ip::udp::endpoint& server);
+		boost::asio::awaitable<void> PeerDelayRequest(ClientCore& core, const boost::asio::ip::udp::endpoint& server);
+		// Feeds a message to m_core, or to the ensemble source it came from.
+		void OnMessage(const PtpMessage& message, PtpTimestamp receiveTimestamp, const boost::asio::ip::address& sender);
+		void PublishStatus();
+		void RecordPacket(CaptureDirection direction,
+			const boost::asio::ip::udp::endpoint& remote,
+			unsigned short localPort,
+			PtpTimestamp timestamp,
+			std::span<const uint8_t> payload);
+		// Remembers where Announces come from and points the delay requests at the master
+		// the core selected.
+		void FollowMaster(const PtpMessage& message, const boost::asio::ip::udp::endpoint& sender);
 
-		SimplifiedPtpHeader GetPtpEventHeader();
-		SimplifiedPtpHeader GetPtpGeneralHeader();
-		PtpTimestamp GetTimeStampFromGeneralBuffer();
-		void OnSyncReceived();
-		void OnFollowUpReceived();
-		void OnRequestResponseReceived();
 		void SetupEventSocket(const std::string& serverHost);
 		void SetupGeneralSocket(const std::string& serverHost);
-		void UpdateMeanPathDelay();
-		std::vector<uint8_t> CreateDelayRequest();
 
 		boost::asio::io_context& m_ioContext;
 		boost::asio::ip::address m_localAdapter;
@@ -62,14 +95,24 @@ namespace PTP
 		boost::asio::ip::udp::socket m_generalSocket;
 		boost::asio::ip::udp::endpoint m_serverEventEndpoint;
 		boost::asio::ip::udp::endpoint m_serverGeneralEndpoint;
+		std::map<PortIdentity, boost::asio::ip::address> m_masterAddresses; // At most c_maxForeignMasters
+		std::optional<PortIdentity> m_master;
 
-		std::array<char, 1024> m_eventRecvBuffer{ {} };
-		std::array<char, 1024> m_generalRecvBuffer{ {} };
+		std::array<uint8_t, 1024> m_eventRecvBuffer{ {} };
+		std::array<uint8_t, 1024> m_generalRecvBuffer{ {} };
+		std::array<uint8_t, std::max(Wire::c_delayReqSize, Wire::c_pdelayReqSize)> m_delayRequestBuffer{};
 
-		std::deque<PtpTimestampSet> m_timestampSets;
-		std::optional<double> m_meanPathDelay;
-		double m_filteredDelay;
-		uint16_t m_sequenceId{ 0 };
-		KalmanFilter1D m_kalmanFilter;
+		TxTimestampReader m_eventTxTimestamps;
+		bool m_kernelRxTimestamps{ false };
+		bool m_kernelTxTimestamps{ false };
+		DelayMechanism m_delayMechanism;
+		std::unique_ptr<AdjustableClock> m_clock; // nullptr = measure only
+		ClientCore m_core; // Steers m_clock; with an ensemble it only runs the servo
+		std::unique_ptr<Ensemble> m_ensemble; // nullptr = one server
+		std::vector<boost::asio::ip::udp::endpoint> m_sourceEndpoints; // Event port of each ensemble source
+		std::unique_ptr<SharedTimePublisher> m_timeExport; // nullptr = no export
+		std::shared_ptr<CaptureWriter> m_capture; // nullptr = no capture
+		std::unique_ptr<MetricsServer> m_metrics; // nullptr = no scrape endpoint
+		SeqLock<ClientStatus> m_status;
 	};
 }
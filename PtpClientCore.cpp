@@ -0,0 +1,552 @@
+#include "PtpClientCore.h"
+#include "Logger.h"
+#include "Metrics.h"
+#include <range/v3/all.hpp> 
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <ranges>
+#include <stdexcept>
+#include <type_traits>
+
+namespace PTP
+{
+	DelayEstimator ParseDelayEstimator(const std::string& estimator)
+	{
+		if (estimator == "scalar")
+			return DelayEstimator::Scalar;
+		if (estimator == "drift")
+			return DelayEstimator::OffsetDrift;
+		throw std::runtime_error("--Estimator must be one of scalar, drift");
+	}
+
+	namespace
+	{
+		// Clients have no configured identity; a random one tells apart the Delay_Resp of
+		// clients sharing a host, whose general sockets all receive them.
+		PortIdentity RandomPortIdentity()
+		{
+			std::random_device random;
+			ClockIdentity identity{};
+			std::ranges::generate(identity, [&random] { return static_cast<uint8_t>(random()); });
+			return MakePortIdentity(identity, 1);
+		}
+	}
+
+	ClientCore::ClientCore(AdjustableClock* clock,
+		DelayEstimator estimator,
+		bool filterDiagnostics,
+		const ServoOptions& servo,
+		uint8_t domainNumber,
+		const PrefilterOptions& prefilter)
+		: m_clock(clock)
+		, m_domainNumber(domainNumber)
+		, m_portIdentity(RandomPortIdentity())
+		, m_delayPrefilter(prefilter)
+		, m_servo(servo)
+	{
+		if (estimator == DelayEstimator::OffsetDrift)
+			m_delayFilter.emplace<OffsetDriftFilter>();
+		std::visit([&](auto& filter) { filter.EnableDiagnostics(filterDiagnostics); }, m_delayFilter);
+	}
+
+	void ClientCore::OnMessage(const PtpMessage& message,
+		PtpTimestamp receiveTimestamp,
+		std::chrono::steady_clock::time_point now)
+	{
+		// Servers hosting several domains send all of them to every client.
+		if (message.header.domainNumber != m_domainNumber)
+			return;
+
+		// Checking expiry on every message rather than on a timer: a standby keeps sending,
+		// so the loss of the master is noticed as soon as its receipt timeout has run out.
+		const auto* master{ m_masters.GetMaster() };
+		const auto previousAnnounce{ master ? std::optional{ master->lastAnnounce } : std::nullopt };
+		const auto masterChanged{ message.header.messageType == PtpMessageType::Announce
+			? m_masters.OnAnnounce(message, now)
+			: m_masters.Expire(now) };
+		if (masterChanged)
+			OnMasterChanged(previousAnnounce, now);
+
+		switch (message.header.messageType)
+		{
+			case PtpMessageType::Sync:
+				OnSyncReceived(message, receiveTimestamp, now);
+				break;
+			case PtpMessageType::Follow_Up:
+				OnFollowUpReceived(message, now);
+				break;
+			case PtpMessageType::Delay_Resp:
+				OnRequestResponseReceived(message);
+				break;
+			case PtpMessageType::Pdelay_Resp:
+				OnPeerDelayResponseReceived(message, receiveTimestamp);
+				break;
+			case PtpMessageType::Pdelay_Resp_Follow_Up:
+				OnPeerDelayFollowUpReceived(message);
+				break;
+			default:
+				break;
+		}
+	}
+
+	bool ClientCore::IsFromMaster(const PtpMessage& message) const
+	{
+		// Before the first Announce qualifies anyone, follow whoever sends Syncs.
+		const auto& master{ m_masters.GetMasterIdentity() };
+		return !master || message.header.sourcePortIdentity == *master;
+	}
+
+	void ClientCore::OnMasterChanged(std::optional<std::chrono::steady_clock::time_point> previousAnnounce,
+		std::chrono::steady_clock::time_point now)
+	{
+		// The new master's timestamp sets start from scratch, but the path delay filter and the
+		// servo carry over: the local oscillator did not change, and both masters should agree
+		// on the time, so the servo keeps its frequency and needs no step or reacquisition.
+		m_timestampSets.clear();
+		++m_masterChanges;
+
+		const auto& master{ *m_masters.GetMaster() };
+		const auto identity{ FormatPortIdentity(master.portIdentity) };
+		if (previousAnnounce)
+		{
+			LogInfo("Master changed to {} (priority1 {}, class {}), previous master heard from {:.1f} ms ago",
+				LogString(identity), master.announce.grandmasterPriority1,
+				master.announce.grandmasterClockQuality.clockClass,
+				std::chrono::duration<double, std::milli>(now - *previousAnnounce).count());
+		}
+		else
+		{
+			LogInfo("Master {} selected (priority1 {}, class {}) from {} announcing", LogString(identity),
+				master.announce.grandmasterPriority1, master.announce.grandmasterClockQuality.clockClass,
+				m_masters.GetForeignMasterCount());
+		}
+	}
+
+	void ClientCore::RemoveStaleEntries(std::chrono::steady_clock::time_point now)
+	{
+		// Remove any entries that are older than the timeout AND are not yet complete.
+		// This handles cases where a Follow_Up or Delay_Resp was lost.
+		const auto entriesBeforeCleanup = m_timestampSets.size();
+		const auto numStale = std::erase_if(m_timestampSets, [&](const PtpTimestampSet& entry)
+		{
+			const bool isComplete = entry.t1Received && entry.t2Received && entry.t3Sent && entry.t4Received;
+			if (isComplete)
+			{
+				return false; // Don't remove completed entries based on time.
+			}
+			return (now - entry.creationTime) > c_entryStaleTimeout;
+		});
+
+		if (numStale > 0)
+		{
+			Increment(MetricCounter::ClientStaleEntriesRemoved, numStale);
+			LogInfo("entries before {}. Cleanup task removed {} stale PTP entries. Entries left: {}",
+				entriesBeforeCleanup,
+				numStale,
+				m_timestampSets.size());
+		}
+
+		while (m_timestampSets.size() > c_maxTimestampSets)
+		{
+			m_timestampSets.pop_front();// Keep only the last 10 timestamp sets
+		}
+	}
+
+	void ClientCore::OnSyncReceived(const PtpMessage& message, PtpTimestamp t2, std::chrono::steady_clock::time_point now)
+	{
+		if (message.header.messageType != PtpMessageType::Sync || !IsFromMaster(message))
+			return;
+
+		Increment(MetricCounter::ClientSyncReceived);
+		PtpTimestampSet newSet;
+		m_sequenceId = message.header.sequenceId;
+		newSet.sequenceId = m_sequenceId;
+		newSet.t2 = t2;
+		newSet.t2Received = true;
+		newSet.creationTime = now;
+
+		// A one-step Sync carries t1 itself, less the send latency in correctionField; a
+		// two-step one waits for its Follow_Up.
+		if (!(message.header.flags & Wire::c_twoStepFlag))
+		{
+			newSet.t1 = PtpTimestamp::FromNanoseconds(message.timestamp.to_nanoseconds() +
+				CorrectionNanoseconds(message.header.correctionField));
+			newSet.t1Received = true;
+		}
+		else
+		{
+			newSet.syncCorrection = CorrectionNanoseconds(message.header.correctionField);
+		}
+
+		m_timestampSets.push_back(newSet);
+		if (newSet.t1Received)
+			UpdateClock(newSet, now);
+	}
+
+	void ClientCore::OnFollowUpReceived(const PtpMessage& message, std::chrono::steady_clock::time_point now)
+	{
+		if (message.header.messageType != PtpMessageType::Follow_Up || !IsFromMaster(message))
+			return;
+
+		Increment(MetricCounter::ClientFollowUpReceived);
+
+		// Matched by the Follow_Up's own sequenceId: at high Sync rates the next Sync may
+		// already have arrived. One Follow_Up completes one set; should a restarted master reuse
+		// a sequenceId, the newest set takes it.
+		auto newestFirst{ m_timestampSets | std::views::reverse };
+		const auto ptpTimestampSet = std::ranges::find_if(newestFirst, [&message](const PtpTimestampSet& entry)
+		{
+			return entry.sequenceId == message.header.sequenceId && !entry.t1Received;
+		});
+
+		const bool matched{ ptpTimestampSet != newestFirst.end() };
+		if (matched)
+		{
+			ptpTimestampSet->t1 = PtpTimestamp::FromNanoseconds(message.timestamp.to_nanoseconds() +
+				CorrectionNanoseconds(message.header.correctionField) + ptpTimestampSet->syncCorrection);
+			ptpTimestampSet->t1Received = true;
+			if (ptpTimestampSet->t2Received)
+				UpdateClock(*ptpTimestampSet, now);
+			// The Delay_Resp may have come first.
+			UpdateMeanPathDelay(*ptpTimestampSet);
+		}
+
+		// Its Sync was lost, already removed as stale, or already has a t1: nothing is applied.
+		if (!matched)
+			Increment(MetricCounter::ClientFollowUpMismatches);
+	}
+
+	void ClientCore::OnRequestResponseReceived(const PtpMessage& message)
+	{
+		if (message.header.messageType != PtpMessageType::Delay_Resp || !IsFromMaster(message))
+			return;
+
+		if (message.requestingPortIdentity != m_portIdentity)
+			return;
+
+		Increment(MetricCounter::ClientDelayResponsesReceived);
+
+		const auto OnSequenceId = [&message](const PtpTimestampSet& ptpTimestampSet)
+		{
+			return ptpTimestampSet.sequenceId == message.header.sequenceId && ptpTimestampSet.delayRequested;
+		};
+		for (auto& ptpTimestampSet : m_timestampSets | ranges::views::filter(OnSequenceId))
+		{
+			ptpTimestampSet.t4 = message.timestamp;
+			ptpTimestampSet.t4Received = true;
+			// Waits for SetDelayRequestTimestamp if t3 is still pending.
+			UpdateMeanPathDelay(ptpTimestampSet);
+		}
+	}
+
+	void ClientCore::UpdateMeanPathDelay(PtpTimestampSet& entry)
+	{
+		const bool isComplete{ entry.t1Received && entry.t2Received && entry.t3Sent && entry.t4Received };
+		if (!isComplete || entry.pathDelayUsed)
+			return;
+
+		// A duplicated Delay_Resp must not feed the pre-filter window the same exchange twice.
+		entry.pathDelayUsed = true;
+		auto sample{ CalculatePathDelay(entry) };
+		if (sample.delay <= 0)
+			return;
+
+		Capture(CaptureRecordType::DelayExchange, entry.sequenceId, entry.t1, entry.t2, entry.t3, entry.t4);
+		sample.delay /= 1000.0;
+		FilterPathDelay(sample);
+	}
+
+	ClientCore::PathDelaySample ClientCore::CalculatePathDelay(const PtpTimestampSet& entry)
+	{
+		const auto t1 = entry.t1.to_nanoseconds();
+		const auto t2 = entry.t2.to_nanoseconds();
+		const auto t3 = entry.t3.to_nanoseconds();
+		const auto t4 = entry.t4.to_nanoseconds();
+		return PathDelaySample{ ((t4 - t1) - (t3 - t2)) / 2.0, t3 * 1e-9 };
+	}
+
+	void ClientCore::FilterPathDelay(const PathDelaySample& sample)
+	{
+		const auto selected{ m_delayPrefilter.Select(sample.delay, PredictPathDelay()) };
+		if (!selected)
+		{
+			Increment(MetricCounter::ClientPathDelayRejected);
+			return;
+		}
+
+		Increment(MetricCounter::ClientPathDelaySamples);
+		m_meanPathDelay = std::visit([&](auto& filter)
+		{
+			if constexpr (std::is_same_v<std::decay_t<decltype(filter)>, OffsetDriftFilter>)
+				return filter.Update(*selected, sample.time);
+			else
+				return filter.Update(*selected);
+		}, m_delayFilter);
+	}
+
+	// Innovation variance P + R of the next update. The drift model's prediction to the
+	// sample's time is left out: at a few ns/s it is far inside any useful gate.
+	std::optional<DelayPrediction> ClientCore::PredictPathDelay() const
+	{
+		if (!m_meanPathDelay)
+			return std::nullopt;
+
+		return std::visit([](const auto& filter)
+		{
+			return DelayPrediction{ filter.GetEstimate(), filter.GetEstimateUncertainty() + filter.GetMeasurementNoise() };
+		}, m_delayFilter);
+	}
+
+	void ClientCore::OnPeerDelayResponseReceived(const PtpMessage& message, PtpTimestamp t4)
+	{
+		if (!m_peerDelay || message.header.sequenceId != m_peerDelay->sequenceId || m_peerDelay->responseReceived)
+			return;
+
+		m_peerDelay->t2 = message.timestamp;
+		m_peerDelay->t4 = t4;
+		m_peerDelay->correction += CorrectionNanoseconds(message.header.correctionField);
+		m_peerDelay->responseReceived = true;
+
+		// A one-step responder reports its turnaround in correctionField and sends no follow-up.
+		if (!(message.header.flags & Wire::c_twoStepFlag))
+		{
+			m_peerDelay->t3 = m_peerDelay->t2;
+			m_peerDelay->followUpReceived = true;
+		}
+		UpdateLinkDelay();
+	}
+
+	void ClientCore::OnPeerDelayFollowUpReceived(const PtpMessage& message)
+	{
+		// The follow-up travels on the general port and may overtake its Pdelay_Resp.
+		if (!m_peerDelay || message.header.sequenceId != m_peerDelay->sequenceId || m_peerDelay->followUpReceived)
+			return;
+
+		m_peerDelay->t3 = message.timestamp;
+		m_peerDelay->correction += CorrectionNanoseconds(message.header.correctionField);
+		m_peerDelay->followUpReceived = true;
+		UpdateLinkDelay();
+	}
+
+	void ClientCore::UpdateLinkDelay()
+	{
+		if (!m_peerDelay || !m_peerDelay->t1Sent || !m_peerDelay->responseReceived || !m_peerDelay->followUpReceived)
+			return;
+
+		const auto exchange{ *m_peerDelay };
+		m_peerDelay.reset();
+		Capture(CaptureRecordType::PeerDelay, exchange.sequenceId, exchange.t1, exchange.t2, exchange.t3, exchange.t4,
+			exchange.correction);
+		FilterLinkDelay(exchange);
+	}
+
+	void ClientCore::FilterLinkDelay(const PeerDelayExchange& exchange)
+	{
+		// meanLinkDelay = ((t4 - t1) - (t3 - t2) - correction) / 2, IEEE 1588 11.4.3. The
+		// neighbour rate ratio is taken as 1: at 100 ppm it scales the turnaround by 1e-4.
+		const auto roundTrip{ exchange.t4.to_nanoseconds() - exchange.t1.to_nanoseconds() };
+		const auto turnaround{ exchange.t3.to_nanoseconds() - exchange.t2.to_nanoseconds() };
+		const auto delay{ (roundTrip - turnaround - exchange.correction) / 2.0 };
+		const auto time{ exchange.t1.to_nanoseconds() * 1e-9 };
+
+		if (delay > 0)
+			FilterPathDelay({ delay / 1000.0, time });
+	}
+
+	void ClientCore::UpdateClock(const PtpTimestampSet& entry, std::chrono::steady_clock::time_point now)
+	{
+		Capture(CaptureRecordType::Sync, entry.sequenceId, entry.t1, entry.t2, {}, {});
+		if (!m_meanPathDelay)
+			return;
+
+		// offsetFromMaster = ((t2 - t1) - (t4 - t3)) / 2 = (t2 - t1) - meanPathDelay. Using the
+		// filtered delay lets the servo run at the Sync rate instead of the Delay_Req rate.
+		// t2 is taken on the packet clock source and is moved onto the clock being steered first.
+		const auto t1{ entry.t1.to_nanoseconds() };
+		const auto rawT2{ entry.t2.to_nanoseconds() };
+		const auto t2{ m_clock ? m_clock->FromTimestamp(rawT2) : rawT2 };
+		const auto pathDelay{ std::llround(*m_meanPathDelay * 1000.0) };
+		m_offsetFromMaster = (t2 - t1) - pathDelay;
+		m_lastOffset = OffsetSample{ (rawT2 - t1) - pathDelay, rawT2, pathDelay };
+		++m_offsetSamples;
+
+		if (!m_clock)
+		{
+			LogDebug("Offset from master: {} ns | path delay: {:.3f} us", *m_offsetFromMaster, *m_meanPathDelay);
+			return;
+		}
+
+		const auto adjustment{ SampleServo(now) };
+		LogDebug("Offset from master: {} ns | frequency: {:.3f} ppb | path delay: {:.3f} us",
+			*m_offsetFromMaster, adjustment.frequency, *m_meanPathDelay);
+		ReportServo(adjustment);
+	}
+
+	void ClientCore::SteerClock(int64_t offset, int64_t time, std::chrono::steady_clock::time_point now)
+	{
+		m_offsetFromMaster = m_clock ? offset + (m_clock->FromTimestamp(time) - time) : offset;
+		if (!m_clock)
+			return;
+
+		const auto adjustment{ SampleServo(now) };
+		LogDebug("Offset from master: {} ns | frequency: {:.3f} ppb", *m_offsetFromMaster, adjustment.frequency);
+		ReportServo(adjustment);
+	}
+
+	void ClientCore::SetCapture(CaptureWriter* capture, uint8_t source)
+	{
+		m_capture = capture;
+		m_captureSource = source;
+	}
+
+	void ClientCore::Capture(CaptureRecordType type, uint16_t sequenceId,
+		PtpTimestamp t1, PtpTimestamp t2, PtpTimestamp t3, PtpTimestamp t4, int64_t correction)
+	{
+		if (!m_capture)
+			return;
+
+		m_capture->Write({
+			.header = { .type = type, .size = 0, .source = m_captureSource, .domain = m_domainNumber, .sequenceId = sequenceId },
+			.t1 = t1.to_nanoseconds(),
+			.t2 = t2.to_nanoseconds(),
+			.t3 = t3.to_nanoseconds(),
+			.t4 = t4.to_nanoseconds(),
+			.correction = correction });
+	}
+
+	// Enters each record where it was captured, after the timestamp matching, so the
+	// estimators see exactly the live sequence without the deque or any decoding.
+	void ClientCore::Replay(const CaptureTimestamps& record, std::chrono::steady_clock::time_point now)
+	{
+		const auto t1{ PtpTimestamp::FromNanoseconds(record.t1) };
+		const auto t2{ PtpTimestamp::FromNanoseconds(record.t2) };
+		const auto t3{ PtpTimestamp::FromNanoseconds(record.t3) };
+		const auto t4{ PtpTimestamp::FromNanoseconds(record.t4) };
+		switch (record.header.type)
+		{
+			case CaptureRecordType::Sync:
+			{
+				const PtpTimestampSet entry{ .sequenceId = record.header.sequenceId, .t1 = t1, .t2 = t2, .t3 = {}, .t4 = {},
+					.t1Received = true, .t2Received = true, .syncCorrection = 0, .creationTime = now };
+				UpdateClock(entry, now);
+				break;
+			}
+			case CaptureRecordType::DelayExchange:
+			{
+				const PtpTimestampSet entry{ .sequenceId = record.header.sequenceId, .t1 = t1, .t2 = t2, .t3 = t3, .t4 = t4,
+					.t1Received = true, .t2Received = true, .delayRequested = true, .t3Sent = true, .t4Received = true,
+					.syncCorrection = 0, .creationTime = now };
+				auto sample{ CalculatePathDelay(entry) };
+				sample.delay /= 1000.0;
+				FilterPathDelay(sample);
+				break;
+			}
+			case CaptureRecordType::PeerDelay:
+				FilterLinkDelay({ .sequenceId = record.header.sequenceId, .t1 = t1, .t2 = t2, .t3 = t3, .t4 = t4,
+					.correction = record.correction });
+				break;
+			default:
+				break;
+		}
+	}
+
+	ServoAdjustment ClientCore::SampleServo(std::chrono::steady_clock::time_point now)
+	{
+		const auto adjustment{ m_servo.Sample(*m_offsetFromMaster, now) };
+		if (adjustment.step)
+		{
+			m_clock->Step(*adjustment.step);
+			LogInfo("Servo stepped {} clock by {} ns", m_clock->Name(), *adjustment.step);
+		}
+		m_clock->AdjustFrequency(adjustment.frequency);
+		return adjustment;
+	}
+
+	void ClientCore::ReportServo(const ServoAdjustment& adjustment)
+	{
+		constexpr size_t c_servoReportInterval{ 16 };
+
+		if (const auto convergence = m_servo.GetConvergenceTime();
+			convergence && adjustment.state == ServoState::Locked && m_servoSamples == 0)
+		{
+			LogInfo("Servo converged after {:.3f} s", *convergence);
+		}
+		if (adjustment.state == ServoState::Locked && ++m_servoSamples % c_servoReportInterval == 0)
+		{
+			LogInfo("Servo steady state: offset mean {:.1f} ns | rms {:.1f} ns | frequency {:.3f} ppb",
+				m_servo.GetOffsetMean(), m_servo.GetOffsetRms(), adjustment.frequency);
+		}
+	}
+
+	std::optional<DelayEstimate> ClientCore::GetDelayEstimate() const
+	{
+		if (!m_meanPathDelay)
+			return std::nullopt;
+
+		return std::visit([](const auto& filter)
+		{
+			DelayEstimate estimate{ filter.GetEstimate(), filter.GetEstimateUncertainty(), 0.0 };
+			if constexpr (std::is_same_v<std::decay_t<decltype(filter)>, OffsetDriftFilter>)
+				estimate.drift = filter.GetDrift();
+			return estimate;
+		}, m_delayFilter);
+	}
+
+	size_t ClientCore::WriteDelayRequest(std::span<uint8_t> buffer, std::optional<PtpTimestamp> t3)
+	{
+		for (auto& ptpTimestampSet : m_timestampSets)
+		{
+			if (ptpTimestampSet.sequenceId == m_sequenceId)
+				ptpTimestampSet.delayRequested = true;
+		}
+		if (t3)
+			SetDelayRequestTimestamp(m_sequenceId, *t3);
+
+		PtpMessage message;
+		message.header.messageType = PtpMessageType::Delay_Req;
+		message.header.domainNumber = m_domainNumber;
+		message.header.sourcePortIdentity = m_portIdentity;
+		message.header.sequenceId = m_sequenceId;
+		return EncodeMessage(message, buffer);
+	}
+
+	size_t ClientCore::WritePeerDelayRequest(std::span<uint8_t> buffer, std::optional<PtpTimestamp> t1)
+	{
+		m_peerDelay = PeerDelayExchange{ .sequenceId = ++m_peerDelaySequenceId, .t1 = t1.value_or(PtpTimestamp{}), .t1Sent = t1.has_value() };
+
+		PtpMessage message;
+		message.header.messageType = PtpMessageType::Pdelay_Req;
+		message.header.domainNumber = m_domainNumber;
+		message.header.sourcePortIdentity = m_portIdentity;
+		message.header.sequenceId = m_peerDelaySequenceId;
+		message.header.logMessageInterval = c_logMinDelayReqInterval;
+		return EncodeMessage(message, buffer);
+	}
+
+	void ClientCore::SetPeerDelayRequestTimestamp(uint16_t sequenceId, PtpTimestamp t1)
+	{
+		if (!m_peerDelay || m_peerDelay->sequenceId != sequenceId || m_peerDelay->t1Sent)
+			return;
+
+		m_peerDelay->t1 = t1;
+		m_peerDelay->t1Sent = true;
+		// The response and its follow-up may have come first.
+		UpdateLinkDelay();
+	}
+
+	void ClientCore::SetDelayRequestTimestamp(uint16_t sequenceId, PtpTimestamp t3)
+	{
+		for (auto& ptpTimestampSet : m_timestampSets)
+		{
+			if (ptpTimestampSet.sequenceId != sequenceId || !ptpTimestampSet.delayRequested || ptpTimestampSet.t3Sent)
+				continue;
+
+			ptpTimestampSet.t3 = t3;
+			ptpTimestampSet.t3Sent = true;
+			// The Delay_Resp may have come first.
+			UpdateMeanPathDelay(ptpTimestampSet);
+		}
+	}
+}
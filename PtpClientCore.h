@@ -0,0 +1,181 @@
+#pragma once
+
+#include "Utils.h"
+#include "PtpCodec.h"
+#include "Bmca.h"
+#include "CaptureFile.h"
+#include "DelayPrefilter.h"
+#include "KalmanFilter1D.h"
+#include "OffsetDriftFilter.h"
+#include "DisciplinedClock.h"
+#include "PiServo.h"
+
+#include <chrono>
+#include <deque>
+#include <optional>
+#include <span>
+#include <string>
+#include <variant>
+
+namespace PTP
+{
+	enum class DelayEstimator
+	{
+		Scalar,     // KalmanFilter1D, constant path delay
+		OffsetDrift // OffsetDriftFilter, path delay plus its drift over real time
+	};
+
+	// Command line spelling: scalar or drift, else throws std::runtime_error.
+	DelayEstimator ParseDelayEstimator(const std::string& estimator);
+
+	struct DelayEstimate
+	{
+		double delay;    // Microseconds, filter state
+		double variance; // us^2, filter covariance P
+		double drift;    // us per second, OffsetDrift estimator only
+	};
+
+	// One offset measurement before it reaches the servo.
+	struct OffsetSample
+	{
+		int64_t offset;    // Nanoseconds, packet clock - master clock
+		int64_t time;      // t2 on the packet clock (ns)
+		int64_t pathDelay; // Nanoseconds, the mean path delay taken off t2 - t1
+	};
+
+	// The client's protocol state without any I/O: matches Sync/Follow_Up/Delay_Req/Delay_Resp
+	// into timestamp sets, filters the path delay and drives the servo. Client feeds it from
+	// sockets, PtpSim from a simulated network; every time it needs is passed in.
+	class ClientCore
+	{
+		struct PtpTimestampSet
+		{
+			uint16_t sequenceId;
+			PtpTimestamp t1; // Master sends Sync (from the Sync in one-step, else the Follow_Up)
+			PtpTimestamp t2; // Slave receives Sync
+			PtpTimestamp t3; // Slave sends Delay_Req (final once t3Sent)
+			PtpTimestamp t4; // Master receives Delay_Req (from Delay_Resp)
+			bool t1Received{ false };
+			bool t2Received{ false };
+			bool delayRequested{ false }; // Delay_Req sent, t3 may still wait for its transmit timestamp
+			bool t3Sent{ false };
+			bool t4Received{ false };
+			bool pathDelayUsed{ false }; // Handed to the path delay filter, never again
+			int64_t syncCorrection{ 0 }; // Nanoseconds, correctionField of a two-step Sync
+			std::chrono::steady_clock::time_point creationTime;
+		};
+
+		// One Pdelay_Req exchange with the neighbour; t2/t3 are on the responder's clock.
+		struct PeerDelayExchange
+		{
+			uint16_t sequenceId{ 0 };
+			PtpTimestamp t1{}; // Pdelay_Req sent (final once t1Sent)
+			PtpTimestamp t2{}; // Responder received Pdelay_Req (from Pdelay_Resp)
+			PtpTimestamp t3{}; // Responder sent Pdelay_Resp (from Pdelay_Resp_Follow_Up)
+			PtpTimestamp t4{}; // Pdelay_Resp received
+			int64_t correction{ 0 }; // Nanoseconds, correctionFields of the response and its follow-up
+			bool t1Sent{ false };
+			bool responseReceived{ false };
+			bool followUpReceived{ false };
+		};
+
+		struct PathDelaySample
+		{
+			double delay; // Microseconds
+			double time;  // Request departure in seconds, spacing for the drift model
+		};
+
+	public:
+		// 'clock' is steered by the servo and may be nullptr (measure only); not owned. Messages
+		// of other PTP domains than 'domainNumber' are ignored. Path delay samples pass
+		// 'prefilter' before the estimator.
+		ClientCore(AdjustableClock* clock,
+			DelayEstimator estimator = DelayEstimator::Scalar,
+			bool filterDiagnostics = false,
+			const ServoOptions& servo = {},
+			uint8_t domainNumber = 0,
+			const PrefilterOptions& prefilter = {});
+
+		// receiveTimestamp is t2 for a Sync, t4 for a Pdelay_Resp and ignored otherwise. Accepts
+		// one-step Sync (t1 in the Sync) and two-step Sync (t1 in the Follow_Up), told apart by
+		// the twoStep flag, and so does the peer delay requester for Pdelay_Resp. Once Announces
+		// select a master, Sync, Follow_Up and Delay_Resp from any other port are ignored.
+		void OnMessage(const PtpMessage& message, PtpTimestamp receiveTimestamp, std::chrono::steady_clock::time_point now);
+
+		// Encodes a Delay_Req for the latest Sync and records t3 for it. nullopt leaves t3 pending
+		// until SetDelayRequestTimestamp, e.g. for the transmit timestamp from the error queue;
+		// no path delay is measured from the exchange before then, even if its Delay_Resp is in.
+		size_t WriteDelayRequest(std::span<uint8_t> buffer, std::optional<PtpTimestamp> t3);
+		void SetDelayRequestTimestamp(uint16_t sequenceId, PtpTimestamp t3);
+		// Peer delay mechanism: starts a new exchange (abandoning an unanswered one) and records
+		// its t1, pending like t3 above when nullopt. The link delay then feeds the same filter as
+		// end-to-end path delay.
+		size_t WritePeerDelayRequest(std::span<uint8_t> buffer, std::optional<PtpTimestamp> t1);
+		void SetPeerDelayRequestTimestamp(uint16_t sequenceId, PtpTimestamp t1);
+		uint16_t GetPeerDelaySequenceId() const { return m_peerDelaySequenceId; }
+		void RemoveStaleEntries(std::chrono::steady_clock::time_point now);
+		// Steers the clock to an offset measured elsewhere, e.g. combined by Ensemble. offset and
+		// time are on the packet clock like OffsetSample.
+		void SteerClock(int64_t offset, int64_t time, std::chrono::steady_clock::time_point now);
+		// Appends every Sync and path delay measurement handed to the estimators to 'capture'
+		// (not owned, nullptr = off), tagged with 'source'.
+		void SetCapture(CaptureWriter* capture, uint8_t source);
+		// Hands a captured Sync, DelayExchange or PeerDelay record to the estimators as if it
+		// had just been measured, for offline replay. Other records are ignored.
+		void Replay(const CaptureTimestamps& record, std::chrono::steady_clock::time_point now);
+
+		uint16_t GetSequenceId() const { return m_sequenceId; }
+		const PortIdentity& GetPortIdentity() const { return m_portIdentity; }
+		std::optional<double> GetMeanPathDelay() const { return m_meanPathDelay; }       // Microseconds
+		std::optional<int64_t> GetOffsetFromMaster() const { return m_offsetFromMaster; } // Nanoseconds
+		std::optional<DelayEstimate> GetDelayEstimate() const;
+		std::optional<OffsetSample> GetLastOffset() const { return m_lastOffset; }
+		uint64_t GetOffsetSamples() const { return m_offsetSamples; } // Counts GetLastOffset updates
+		const PiServo& GetServo() const { return m_servo; }
+		const DelayPrefilter& GetDelayPrefilter() const { return m_delayPrefilter; }
+		const MasterSelector& GetMasters() const { return m_masters; }
+		uint64_t GetMasterChanges() const { return m_masterChanges; }
+
+	private:
+		void OnSyncReceived(const PtpMessage& message, PtpTimestamp t2, std::chrono::steady_clock::time_point now);
+		void OnFollowUpReceived(const PtpMessage& message, std::chrono::steady_clock::time_point now);
+		void OnRequestResponseReceived(const PtpMessage& message);
+		void OnPeerDelayResponseReceived(const PtpMessage& message, PtpTimestamp t4);
+		void OnPeerDelayFollowUpReceived(const PtpMessage& message);
+		// Filters the path delay of 'entry' once it is complete, at most once per set.
+		void UpdateMeanPathDelay(PtpTimestampSet& entry);
+		void UpdateLinkDelay();
+		void FilterLinkDelay(const PeerDelayExchange& exchange);
+		static PathDelaySample CalculatePathDelay(const PtpTimestampSet& entry); // Nanoseconds
+		void Capture(CaptureRecordType type, uint16_t sequenceId,
+			PtpTimestamp t1, PtpTimestamp t2, PtpTimestamp t3, PtpTimestamp t4, int64_t correction = 0);
+		void FilterPathDelay(const PathDelaySample& sample);
+		std::optional<DelayPrediction> PredictPathDelay() const;
+		void UpdateClock(const PtpTimestampSet& entry, std::chrono::steady_clock::time_point now);
+		ServoAdjustment SampleServo(std::chrono::steady_clock::time_point now);
+		void ReportServo(const ServoAdjustment& adjustment);
+		bool IsFromMaster(const PtpMessage& message) const;
+		void OnMasterChanged(std::optional<std::chrono::steady_clock::time_point> previousAnnounce,
+			std::chrono::steady_clock::time_point now);
+
+		AdjustableClock* m_clock;
+		uint8_t m_domainNumber;
+		PortIdentity m_portIdentity; // sourcePortIdentity of our requests, requestingPortIdentity of the answers
+		CaptureWriter* m_capture{ nullptr };
+		uint8_t m_captureSource{ 0 };
+		std::deque<PtpTimestampSet> m_timestampSets;
+		std::optional<double> m_meanPathDelay;
+		uint16_t m_sequenceId{ 0 };
+		std::optional<PeerDelayExchange> m_peerDelay;
+		uint16_t m_peerDelaySequenceId{ 0 };
+		DelayPrefilter m_delayPrefilter;
+		std::variant<KalmanFilter1D, OffsetDriftFilter> m_delayFilter;
+		PiServo m_servo;
+		std::optional<int64_t> m_offsetFromMaster; // Nanoseconds, m_clock - master
+		std::optional<OffsetSample> m_lastOffset;
+		uint64_t m_offsetSamples{ 0 };
+		size_t m_servoSamples{ 0 };
+		MasterSelector m_masters;
+		uint64_t m_masterChanges{ 0 };
+	};
+}
@@ -0,0 +1,213 @@
+#include "PtpCodec.h"
+
+#include <algorithm>
+#include <cstring>
+#include <format>
+
+namespace PTP
+{
+	namespace
+	{
+		constexpr uint32_t c_nanosecondsPerSecond{ 1000000000 };
+
+		template <std::integral T>
+		void Store(std::span<uint8_t> buffer, size_t offset, T value)
+		{
+			const auto bigEndian{ SwapEndianness(value) };
+			std::memcpy(buffer.data() + offset, &bigEndian, sizeof(T));
+		}
+
+		template <std::integral T>
+		T Load(std::span<const uint8_t> buffer, size_t offset)
+		{
+			T bigEndian;
+			std::memcpy(&bigEndian, buffer.data() + offset, sizeof(T));
+			return SwapEndianness(bigEndian);
+		}
+
+		void StoreTimestamp(std::span<uint8_t> buffer, size_t offset, const PtpTimestamp& timestamp)
+		{
+			const auto seconds{ timestamp.Seconds() };
+			Store(buffer, offset, static_cast<uint16_t>(seconds >> 32));
+			Store(buffer, offset + 2, static_cast<uint32_t>(seconds));
+			Store(buffer, offset + 6, SwapEndianness(timestamp.nanoseconds));
+		}
+
+		std::optional<PtpTimestamp> LoadTimestamp(std::span<const uint8_t> buffer, size_t offset)
+		{
+			const auto seconds{ (static_cast<uint64_t>(Load<uint16_t>(buffer, offset)) << 32) | Load<uint32_t>(buffer, offset + 2) };
+			const auto nanoseconds{ Load<uint32_t>(buffer, offset + 6) };
+			if (nanoseconds >= c_nanosecondsPerSecond)
+				return std::nullopt;
+			return PtpTimestamp::FromParts(seconds, nanoseconds);
+		}
+
+		uint8_t ControlField(PtpMessageType type)
+		{
+			switch (type)
+			{
+				case PtpMessageType::Sync: return 0;
+				case PtpMessageType::Delay_Req: return 1;
+				case PtpMessageType::Follow_Up: return 2;
+				case PtpMessageType::Delay_Resp: return 3;
+				default: return 5;
+			}
+		}
+
+		PtpMessageType ToMessageType(uint8_t nibble)
+		{
+			switch (nibble)
+			{
+				case 0x0: return PtpMessageType::Sync;
+				case 0x1: return PtpMessageType::Delay_Req;
+				case 0x2: return PtpMessageType::Pdelay_Req;
+				case 0x3: return PtpMessageType::Pdelay_Resp;
+				case 0x8: return PtpMessageType::Follow_Up;
+				case 0x9: return PtpMessageType::Delay_Resp;
+				case 0xA: return PtpMessageType::Pdelay_Resp_Follow_Up;
+				case 0xB: return PtpMessageType::Announce;
+				case 0xC: return PtpMessageType::Signaling;
+				case 0xD: return PtpMessageType::Management;
+				default:  return PtpMessageType::Unknown;
+			}
+		}
+
+		bool HasRequestingPortIdentity(PtpMessageType type)
+		{
+			return type == PtpMessageType::Delay_Resp || type == PtpMessageType::Pdelay_Resp ||
+				type == PtpMessageType::Pdelay_Resp_Follow_Up;
+		}
+	}
+
+	PortIdentity MakePortIdentity(const ClockIdentity& clockIdentity, uint16_t portNumber)
+	{
+		PortIdentity portIdentity{};
+		std::copy(clockIdentity.begin(), clockIdentity.end(), portIdentity.begin());
+		Store(portIdentity, Wire::c_clockIdentitySize, portNumber);
+		return portIdentity;
+	}
+
+	std::string FormatPortIdentity(const PortIdentity& portIdentity)
+	{
+		return std::format("{:02x}{:02x}{:02x}.{:02x}{:02x}.{:02x}{:02x}{:02x}-{}",
+			portIdentity[0], portIdentity[1], portIdentity[2], portIdentity[3],
+			portIdentity[4], portIdentity[5], portIdentity[6], portIdentity[7],
+			Load<uint16_t>(portIdentity, Wire::c_clockIdentitySize));
+	}
+
+	size_t MessageSize(PtpMessageType type)
+	{
+		switch (type)
+		{
+			case PtpMessageType::Sync: return Wire::c_syncSize;
+			case PtpMessageType::Delay_Req: return Wire::c_delayReqSize;
+			case PtpMessageType::Follow_Up: return Wire::c_followUpSize;
+			case PtpMessageType::Delay_Resp: return Wire::c_delayRespSize;
+			case PtpMessageType::Pdelay_Req: return Wire::c_pdelayReqSize;
+			case PtpMessageType::Pdelay_Resp: return Wire::c_pdelayRespSize;
+			case PtpMessageType::Pdelay_Resp_Follow_Up: return Wire::c_pdelayRespFollowUpSize;
+			case PtpMessageType::Announce: return Wire::c_announceSize;
+			default: return 0;
+		}
+	}
+
+	size_t EncodeMessage(const PtpMessage& message, std::span<uint8_t> buffer)
+	{
+		const auto& header{ message.header };
+		const auto size{ MessageSize(header.messageType) };
+		if (size == 0 || buffer.size() < size)
+			return 0;
+
+		auto out{ buffer.first(size) };
+		std::fill(out.begin(), out.end(), uint8_t{ 0 });
+		out[Wire::c_messageTypeOffset] = static_cast<uint8_t>((header.transportSpecific << 4) |
+			(static_cast<uint8_t>(header.messageType) & c_lower4BitsMask));
+		out[Wire::c_versionOffset] = header.version & c_lower4BitsMask;
+		Store(out, Wire::c_messageLengthOffset, static_cast<uint16_t>(size));
+		out[Wire::c_domainNumberOffset] = header.domainNumber;
+		Store(out, Wire::c_flagsOffset, header.flags);
+		Store(out, Wire::c_correctionFieldOffset, header.correctionField);
+		std::copy(header.sourcePortIdentity.begin(), header.sourcePortIdentity.end(),
+			out.begin() + Wire::c_sourcePortIdentityOffset);
+		Store(out, Wire::c_sequenceIdOffset, header.sequenceId);
+		out[Wire::c_controlFieldOffset] = ControlField(header.messageType);
+		out[Wire::c_logMessageIntervalOffset] = static_cast<uint8_t>(header.logMessageInterval);
+
+		StoreTimestamp(out, Wire::c_timestampOffset, message.timestamp);
+		if (HasRequestingPortIdentity(header.messageType))
+		{
+			std::copy(message.requestingPortIdentity.begin(), message.requestingPortIdentity.end(),
+				out.begin() + Wire::c_requestingPortIdentityOffset);
+		}
+		if (header.messageType == PtpMessageType::Announce)
+		{
+			const auto& announce{ message.announce };
+			Store(out, Wire::c_currentUtcOffsetOffset, announce.currentUtcOffset);
+			out[Wire::c_grandmasterPriority1Offset] = announce.grandmasterPriority1;
+			out[Wire::c_grandmasterClockQualityOffset] = announce.grandmasterClockQuality.clockClass;
+			out[Wire::c_grandmasterClockQualityOffset + 1] = announce.grandmasterClockQuality.clockAccuracy;
+			Store(out, Wire::c_grandmasterClockQualityOffset + 2, announce.grandmasterClockQuality.offsetScaledLogVariance);
+			out[Wire::c_grandmasterPriority2Offset] = announce.grandmasterPriority2;
+			std::copy(announce.grandmasterIdentity.begin(), announce.grandmasterIdentity.end(),
+				out.begin() + Wire::c_grandmasterIdentityOffset);
+			Store(out, Wire::c_stepsRemovedOffset, announce.stepsRemoved);
+			out[Wire::c_timeSourceOffset] = announce.timeSource;
+		}
+		return size;
+	}
+
+	std::optional<PtpMessage> DecodeMessage(std::span<const uint8_t> buffer)
+	{
+		if (buffer.size() < Wire::c_headerSize)
+			return std::nullopt;
+
+		PtpMessage message;
+		auto& header{ message.header };
+		header.messageType = ToMessageType(buffer[Wire::c_messageTypeOffset] & c_lower4BitsMask);
+		header.transportSpecific = buffer[Wire::c_messageTypeOffset] >> 4;
+		header.version = buffer[Wire::c_versionOffset] & c_lower4BitsMask;
+		header.messageLength = Load<uint16_t>(buffer, Wire::c_messageLengthOffset);
+
+		const auto size{ MessageSize(header.messageType) };
+		if (header.version != Wire::c_version || size == 0 ||
+			header.messageLength < size || header.messageLength > buffer.size())
+		{
+			return std::nullopt;
+		}
+
+		header.domainNumber = buffer[Wire::c_domainNumberOffset];
+		header.flags = Load<uint16_t>(buffer, Wire::c_flagsOffset);
+		header.correctionField = Load<int64_t>(buffer, Wire::c_correctionFieldOffset);
+		std::copy_n(buffer.begin() + Wire::c_sourcePortIdentityOffset, Wire::c_portIdentitySize,
+			header.sourcePortIdentity.begin());
+		header.sequenceId = Load<uint16_t>(buffer, Wire::c_sequenceIdOffset);
+		header.controlField = buffer[Wire::c_controlFieldOffset];
+		header.logMessageInterval = static_cast<int8_t>(buffer[Wire::c_logMessageIntervalOffset]);
+
+		const auto timestamp{ LoadTimestamp(buffer, Wire::c_timestampOffset) };
+		if (!timestamp)
+			return std::nullopt;
+		message.timestamp = *timestamp;
+
+		if (HasRequestingPortIdentity(header.messageType))
+		{
+			std::copy_n(buffer.begin() + Wire::c_requestingPortIdentityOffset, Wire::c_portIdentitySize,
+				message.requestingPortIdentity.begin());
+		}
+		if (header.messageType == PtpMessageType::Announce)
+		{
+			auto& announce{ message.announce };
+			announce.currentUtcOffset = Load<int16_t>(buffer, Wire::c_currentUtcOffsetOffset);
+			announce.grandmasterPriority1 = buffer[Wire::c_grandmasterPriority1Offset];
+			announce.grandmasterClockQuality.clockClass = buffer[Wire::c_grandmasterClockQualityOffset];
+			announce.grandmasterClockQuality.clockAccuracy = buffer[Wire::c_grandmasterClockQualityOffset + 1];
+			announce.grandmasterClockQuality.offsetScaledLogVariance = Load<uint16_t>(buffer, Wire::c_grandmasterClockQualityOffset + 2);
+			announce.grandmasterPriority2 = buffer[Wire::c_grandmasterPriority2Offset];
+			std::copy_n(buffer.begin() + Wire::c_grandmasterIdentityOffset, Wire::c_clockIdentitySize,
+				announce.grandmasterIdentity.begin());
+			announce.stepsRemoved = Load<uint16_t>(buffer, Wire::c_stepsRemovedOffset);
+			announce.timeSource = buffer[Wire::c_timeSourceOffset];
+		}
+		return message;
+	}
+}
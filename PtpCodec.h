@@ -0,0 +1,126 @@
+#pragma once
+
+#include "Utils.h"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string>
+
+namespace PTP
+{
+	// IEEE 1588-2008 wire layout. All multi-byte fields are big-endian.
+	namespace Wire
+	{
+		constexpr inline size_t c_messageTypeOffset{ 0 };        // transportSpecific << 4 | messageType
+		constexpr inline size_t c_versionOffset{ 1 };            // reserved << 4 | versionPTP
+		constexpr inline size_t c_messageLengthOffset{ 2 };
+		constexpr inline size_t c_domainNumberOffset{ 4 };
+		constexpr inline size_t c_flagsOffset{ 6 };
+		constexpr inline size_t c_correctionFieldOffset{ 8 };
+		constexpr inline size_t c_sourcePortIdentityOffset{ 20 };
+		constexpr inline size_t c_sequenceIdOffset{ 30 };
+		constexpr inline size_t c_controlFieldOffset{ 32 };
+		constexpr inline size_t c_logMessageIntervalOffset{ 33 };
+		constexpr inline size_t c_headerSize{ 34 };
+
+		constexpr inline size_t c_timestampOffset{ c_headerSize }; // origin, preciseOrigin, receive or responseOrigin timestamp
+		constexpr inline size_t c_timestampSize{ 10 };
+		constexpr inline size_t c_requestingPortIdentityOffset{ c_timestampOffset + c_timestampSize };
+		constexpr inline size_t c_portIdentitySize{ 10 };
+		constexpr inline size_t c_clockIdentitySize{ 8 };
+
+		// Announce body after the originTimestamp
+		constexpr inline size_t c_currentUtcOffsetOffset{ c_timestampOffset + c_timestampSize };
+		constexpr inline size_t c_grandmasterPriority1Offset{ c_currentUtcOffsetOffset + 3 }; // after 1 reserved byte
+		constexpr inline size_t c_grandmasterClockQualityOffset{ c_grandmasterPriority1Offset + 1 };
+		constexpr inline size_t c_grandmasterPriority2Offset{ c_grandmasterClockQualityOffset + 4 };
+		constexpr inline size_t c_grandmasterIdentityOffset{ c_grandmasterPriority2Offset + 1 };
+		constexpr inline size_t c_stepsRemovedOffset{ c_grandmasterIdentityOffset + c_clockIdentitySize };
+		constexpr inline size_t c_timeSourceOffset{ c_stepsRemovedOffset + 2 };
+
+		constexpr inline size_t c_syncSize{ c_headerSize + c_timestampSize };
+		constexpr inline size_t c_delayReqSize{ c_headerSize + c_timestampSize };
+		constexpr inline size_t c_followUpSize{ c_headerSize + c_timestampSize };
+		constexpr inline size_t c_delayRespSize{ c_requestingPortIdentityOffset + c_portIdentitySize };
+		constexpr inline size_t c_pdelayReqSize{ c_requestingPortIdentityOffset + c_portIdentitySize }; // 10 reserved bytes
+		constexpr inline size_t c_pdelayRespSize{ c_requestingPortIdentityOffset + c_portIdentitySize };
+		constexpr inline size_t c_pdelayRespFollowUpSize{ c_requestingPortIdentityOffset + c_portIdentitySize };
+		constexpr inline size_t c_announceSize{ c_timeSourceOffset + 1 };
+		constexpr inline size_t c_maxMessageSize{ c_announceSize };
+
+		constexpr inline uint8_t c_version{ 2 };
+		constexpr inline uint16_t c_twoStepFlag{ 0x0200 };
+		constexpr inline int8_t c_logIntervalUnspecified{ 0x7F };
+	}
+
+	using PortIdentity = std::array<uint8_t, Wire::c_portIdentitySize>; // clockIdentity + portNumber
+	using ClockIdentity = std::array<uint8_t, Wire::c_clockIdentitySize>;
+
+	PortIdentity MakePortIdentity(const ClockIdentity& clockIdentity, uint16_t portNumber);
+	// "xxxxxx.xxxx.xxxxxx-port", the usual notation of linuxptp and the standard's examples.
+	std::string FormatPortIdentity(const PortIdentity& portIdentity);
+
+	// Decoded common header, host byte order.
+	struct PtpHeader
+	{
+		PtpMessageType messageType{ PtpMessageType::Unknown };
+		uint8_t transportSpecific{ 0 };
+		uint8_t version{ Wire::c_version };
+		uint16_t messageLength{ 0 };      // Filled in by EncodeMessage
+		uint8_t domainNumber{ 0 };
+		uint16_t flags{ 0 };
+		int64_t correctionField{ 0 };     // Nanoseconds * 2^16
+		PortIdentity sourcePortIdentity{};
+		uint16_t sequenceId{ 0 };
+		uint8_t controlField{ 0 };        // Filled in by EncodeMessage from messageType
+		int8_t logMessageInterval{ Wire::c_logIntervalUnspecified };
+	};
+
+	// correctionField carries nanoseconds scaled by 2^16; the sub-nanosecond part is dropped.
+	constexpr int64_t ToCorrectionField(int64_t nanoseconds) { return nanoseconds * 65536; }
+	constexpr int64_t CorrectionNanoseconds(int64_t correctionField) { return correctionField / 65536; }
+
+	// Lower is better in every field, IEEE 1588 7.6.2.
+	struct ClockQuality
+	{
+		uint8_t clockClass{ 248 };                  // 248: default, not synchronized to anything
+		uint8_t clockAccuracy{ 0xFE };              // 0xFE: unknown
+		uint16_t offsetScaledLogVariance{ 0xFFFF }; // 0xFFFF: not computed
+
+		auto operator<=>(const ClockQuality&) const = default;
+	};
+
+	// The grandmaster a port announces, IEEE 1588 13.5.
+	struct AnnounceBody
+	{
+		int16_t currentUtcOffset{ 37 };  // TAI - UTC in seconds
+		uint8_t grandmasterPriority1{ 128 };
+		ClockQuality grandmasterClockQuality{};
+		uint8_t grandmasterPriority2{ 128 };
+		ClockIdentity grandmasterIdentity{};
+		uint16_t stepsRemoved{ 0 };
+		uint8_t timeSource{ 0xA0 };      // 0xA0: internal oscillator
+	};
+
+	struct PtpMessage
+	{
+		PtpHeader header;
+		PtpTimestamp timestamp{};                // Sync/Delay_Req/Pdelay_Req origin, Follow_Up precise origin,
+		                                         // Delay_Resp/Pdelay_Resp request receipt, Pdelay_Resp_Follow_Up response origin
+		PortIdentity requestingPortIdentity{};   // Delay_Resp, Pdelay_Resp and Pdelay_Resp_Follow_Up only
+		AnnounceBody announce{};                 // Announce only
+	};
+
+	// Wire size of a message type, 0 if the codec does not handle it.
+	size_t MessageSize(PtpMessageType type);
+
+	// Writes the message into 'buffer' and returns the bytes written, 0 if the type is not
+	// supported or the buffer is too small. Never allocates.
+	size_t EncodeMessage(const PtpMessage& message, std::span<uint8_t> buffer);
+
+	// Validates version, type and messageLength against the datagram and decodes it.
+	std::optional<PtpMessage> DecodeMessage(std::span<const uint8_t> buffer);
+}
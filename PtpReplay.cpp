@@ -0,0 +1,382 @@
+// Offline replay of a capture written by PTP --Capture or PtpSim --Capture. Streams the
+// recorded Sync and path delay measurements through fresh, measure-only ClientCores (one per
+// ensemble source), so estimator and pre-filter settings can be tried on a production
+// incident in milliseconds instead of minutes of live running. Optionally exports the
+// captured datagrams as pcap for Wireshark.
+#include "CaptureFile.h"
+#include "PtpClientCore.h"
+#include "Logger.h"
+
+#include <boost/program_options.hpp>
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <format>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <span>
+#include <string>
+#include <vector>
+
+namespace
+{
+	struct ReplayOptions
+	{
+		std::string Input;
+		std::string Pcap;   // Export the captured datagrams here, empty = no export
+		std::string Trace;  // CSV of every measurement and the estimates after it, empty = none
+		size_t Repeat{ 1 }; // Passes over the capture, each with fresh estimators, for timing
+		PTP::DelayEstimator Estimator{ PTP::DelayEstimator::Scalar };
+		PTP::PrefilterOptions Prefilter;
+		PTP::LogLevel LogLevel{ PTP::LogLevel::Warning };
+	};
+
+	ReplayOptions ReadReplayOptions(std::span<const char* const> args)
+	{
+		namespace po = boost::program_options;
+
+		ReplayOptions options;
+		std::string estimator{ "scalar" }, prefilter{ "none" }, logLevel{ "warning" };
+
+		po::options_description description("PTP capture replay");
+		description.add_options()
+			("Input", po::value(&options.Input)->required(), "capture file written with --Capture")
+			("Pcap", po::value(&options.Pcap)->default_value(options.Pcap), "write the captured datagrams to this pcap file")
+			("Trace", po::value(&options.Trace)->default_value(options.Trace),
+				"write a CSV line per measurement: source, type, time, measured value and the estimates after it")
+			("Repeat", po::value(&options.Repeat)->default_value(options.Repeat),
+				"replay the capture this many times with fresh estimators, for throughput")
+			("Estimator", po::value(&estimator)->default_value(estimator), "path delay estimator: scalar, drift")
+			("Prefilter", po::value(&prefilter)->default_value(prefilter),
+				"path delay samples the estimator sees: none, min, percentile, median of the last --PrefilterWindow")
+			("PrefilterWindow", po::value(&options.Prefilter.Window)->default_value(options.Prefilter.Window),
+				"path delay samples --Prefilter selects from (1-64)")
+			("PrefilterPercentile", po::value(&options.Prefilter.Percentile)->default_value(options.Prefilter.Percentile),
+				"fraction of the window for --Prefilter percentile")
+			("PrefilterGate", po::value(&options.Prefilter.GateSigma)->default_value(options.Prefilter.GateSigma),
+				"drop path delay samples this many innovation standard deviations off (0 = off)")
+			("LogLevel", po::value(&logLevel)->default_value(logLevel), "debug, info, warning, error, off");
+
+		po::positional_options_description positional;
+		positional.add("Input", 1);
+
+		po::variables_map vm;
+		try
+		{
+			po::store(po::command_line_parser(static_cast<int>(args.size()), args.data())
+				.options(description)
+				.positional(positional)
+				.run(),
+				vm);
+			po::notify(vm);
+		}
+		catch (const po::error& ex)
+		{
+			throw std::runtime_error(std::string("Argument parsing error: ") + ex.what());
+		}
+
+		if (options.Repeat == 0)
+			throw std::runtime_error("Repeat must be at least 1");
+		if (options.Prefilter.Window == 0 || options.Prefilter.Window > PTP::c_maxPrefilterWindow ||
+			options.Prefilter.Percentile < 0.0 || options.Prefilter.Percentile > 1.0 || options.Prefilter.GateSigma < 0.0)
+			throw std::runtime_error("PrefilterWindow must be 1-64, PrefilterPercentile in [0, 1] and PrefilterGate not negative");
+		options.Estimator = PTP::ParseDelayEstimator(estimator);
+		options.Prefilter.Selection = PTP::ParsePrefilterSelection(prefilter);
+		options.LogLevel = PTP::ParseLogLevel(logLevel);
+		return options;
+	}
+
+	// Datagrams as raw IPv4 (LINKTYPE_RAW) with nanosecond timestamps; the IPv4 and UDP
+	// headers are rebuilt from the captured addresses and ports.
+	class PcapWriter
+	{
+	public:
+		explicit PcapWriter(const std::string& path)
+			: m_file(path, std::ios::binary | std::ios::trunc)
+		{
+			constexpr uint32_t c_nanosecondMagic{ 0xA1B23C4D };
+			constexpr uint32_t c_linkTypeRaw{ 101 };
+
+			if (!m_file)
+				throw std::runtime_error("Cannot create " + path);
+			WriteNative<uint32_t>(c_nanosecondMagic);
+			WriteNative<uint16_t>(2);
+			WriteNative<uint16_t>(4);
+			WriteNative<int32_t>(0);
+			WriteNative<uint32_t>(0);
+			WriteNative<uint32_t>(UINT16_MAX);
+			WriteNative<uint32_t>(c_linkTypeRaw);
+		}
+
+		void Write(const PTP::CapturePacket& packet, std::span<const uint8_t> payload)
+		{
+			constexpr size_t c_ipHeaderSize{ 20 };
+			constexpr size_t c_udpHeaderSize{ 8 };
+
+			const bool sent{ packet.direction == PTP::CaptureDirection::Sent };
+			const auto source{ sent ? packet.localAddress : packet.remoteAddress };
+			const auto destination{ sent ? packet.remoteAddress : packet.localAddress };
+			const auto sourcePort{ sent ? packet.localPort : packet.remotePort };
+			const auto destinationPort{ sent ? packet.remotePort : packet.localPort };
+			const auto totalLength{ static_cast<uint16_t>(c_ipHeaderSize + c_udpHeaderSize + payload.size()) };
+
+			std::array<uint8_t, c_ipHeaderSize + c_udpHeaderSize> headers{};
+			auto* ip{ headers.data() };
+			ip[0] = 0x45; // IPv4, 5 words
+			PutBig16(ip + 2, totalLength);
+			PutBig16(ip + 6, 0x4000); // Don't fragment
+			ip[8] = 64;               // TTL
+			ip[9] = 17;               // UDP
+			PutBig32(ip + 12, source);
+			PutBig32(ip + 16, destination);
+			uint32_t sum{ 0 };
+			for (size_t i = 0; i < c_ipHeaderSize; i += 2)
+				sum += static_cast<uint32_t>(ip[i] << 8 | ip[i + 1]);
+			while (sum >> 16)
+				sum = (sum & 0xFFFF) + (sum >> 16);
+			PutBig16(ip + 10, static_cast<uint16_t>(~sum));
+
+			auto* udp{ ip + c_ipHeaderSize };
+			PutBig16(udp, sourcePort);
+			PutBig16(udp + 2, destinationPort);
+			PutBig16(udp + 4, static_cast<uint16_t>(c_udpHeaderSize + payload.size()));
+			// UDP checksum 0: not computed, allowed over IPv4.
+
+			WriteNative<uint32_t>(static_cast<uint32_t>(packet.captureTime / 1'000'000'000));
+			WriteNative<uint32_t>(static_cast<uint32_t>(packet.captureTime % 1'000'000'000));
+			WriteNative<uint32_t>(totalLength);
+			WriteNative<uint32_t>(totalLength);
+			m_file.write(reinterpret_cast<const char*>(headers.data()), headers.size());
+			m_file.write(reinterpret_cast<const char*>(payload.data()), static_cast<std::streamsize>(payload.size()));
+			++m_packets;
+		}
+
+		uint64_t Packets() const { return m_packets; }
+
+	private:
+		template <typename T>
+		void WriteNative(T value)
+		{
+			m_file.write(reinterpret_cast<const char*>(&value), sizeof(value));
+		}
+
+		static void PutBig16(uint8_t* destination, uint16_t value)
+		{
+			destination[0] = static_cast<uint8_t>(value >> 8);
+			destination[1] = static_cast<uint8_t>(value);
+		}
+
+		static void PutBig32(uint8_t* destination, uint32_t value)
+		{
+			PutBig16(destination, static_cast<uint16_t>(value >> 16));
+			PutBig16(destination + 2, static_cast<uint16_t>(value));
+		}
+
+		std::ofstream m_file;
+		uint64_t m_packets{ 0 };
+	};
+
+	// The estimators of one ensemble source (0 for a single server) and what came out of them.
+	struct SourceReplay
+	{
+		std::unique_ptr<PTP::ClientCore> core;
+		uint64_t syncs{ 0 };
+		uint64_t delays{ 0 };
+		uint64_t offsets{ 0 };         // Syncs that produced an offset, i.e. after the first path delay
+		double offsetSum{ 0.0 };       // Nanoseconds
+		double offsetSquares{ 0.0 };
+		double offsetMinimum{ std::numeric_limits<double>::max() };
+		double offsetMaximum{ std::numeric_limits<double>::lowest() };
+	};
+
+	class Replay
+	{
+	public:
+		explicit Replay(const ReplayOptions& options)
+			: m_options(options)
+			, m_reader(options.Input)
+		{
+			if (!options.Trace.empty())
+			{
+				m_trace.open(options.Trace, std::ios::trunc);
+				if (!m_trace)
+					throw std::runtime_error("Cannot create " + options.Trace);
+				m_trace << "source,type,sequence,time_s,measured,path_delay_us,path_delay_variance,offset_ns\n";
+			}
+		}
+
+		void Run()
+		{
+			std::unique_ptr<PcapWriter> pcap;
+			if (!m_options.Pcap.empty())
+				pcap = std::make_unique<PcapWriter>(m_options.Pcap);
+
+			const auto wallStart{ std::chrono::steady_clock::now() };
+			for (size_t pass = 0; pass < m_options.Repeat; ++pass)
+			{
+				// Only the last pass is reported; the earlier ones are for timing.
+				m_sources.clear();
+				m_packets = 0;
+				m_unknown = 0;
+				m_reader.Rewind();
+				const bool last{ pass + 1 == m_options.Repeat };
+				while (const auto record = m_reader.Next())
+				{
+					++m_records;
+					switch (record->header.type)
+					{
+						case PTP::CaptureRecordType::Sync:
+						case PTP::CaptureRecordType::DelayExchange:
+						case PTP::CaptureRecordType::PeerDelay:
+							OnTimestamps(record->Timestamps(), last);
+							break;
+						case PTP::CaptureRecordType::Packet:
+							++m_packets;
+							if (pcap && last)
+								pcap->Write(record->Packet(), record->Payload());
+							break;
+						default:
+							++m_unknown;
+							break;
+					}
+				}
+			}
+			m_wallTime = std::chrono::steady_clock::now() - wallStart;
+			PrintSummary(pcap.get());
+		}
+
+	private:
+		void OnTimestamps(const PTP::CaptureTimestamps& record, bool trace)
+		{
+			auto& source{ Source(record.header.source) };
+			auto& core{ *source.core };
+			// The estimators only use 'now' for the servo, which a measure-only core does not run.
+			const std::chrono::steady_clock::time_point now{ std::chrono::nanoseconds(record.t2) };
+			const auto offsetSamples{ core.GetOffsetSamples() };
+			core.Replay(record, now);
+
+			double measured{ 0.0 };
+			if (record.header.type == PTP::CaptureRecordType::Sync)
+			{
+				++source.syncs;
+				measured = static_cast<double>(record.t2 - record.t1);
+				if (core.GetOffsetSamples() != offsetSamples)
+				{
+					const auto offset{ static_cast<double>(core.GetLastOffset()->offset) };
+					++source.offsets;
+					source.offsetSum += offset;
+					source.offsetSquares += offset * offset;
+					source.offsetMinimum = std::min(source.offsetMinimum, offset);
+					source.offsetMaximum = std::max(source.offsetMaximum, offset);
+				}
+			}
+			else
+			{
+				++source.delays;
+				measured = record.header.type == PTP::CaptureRecordType::PeerDelay
+					? ((record.t4 - record.t1) - (record.t3 - record.t2) - record.correction) / 2000.0
+					: ((record.t4 - record.t1) - (record.t3 - record.t2)) / 2000.0;
+			}
+
+			if (trace && m_trace.is_open())
+			{
+				const auto estimate{ core.GetDelayEstimate() };
+				const auto offset{ core.GetLastOffset() };
+				m_trace << std::format("{},{},{},{:.9f},{:.3f},{},{},{}\n",
+					record.header.source, TypeName(record.header.type), record.header.sequenceId,
+					static_cast<double>(record.t1) * 1e-9, measured,
+					estimate ? std::format("{:.6f}", estimate->delay) : std::string(),
+					estimate ? std::format("{:.6g}", estimate->variance) : std::string(),
+					offset ? std::to_string(offset->offset) : std::string());
+			}
+		}
+
+		SourceReplay& Source(uint8_t index)
+		{
+			if (index >= m_sources.size())
+				m_sources.resize(index + 1);
+			auto& source{ m_sources[index] };
+			if (!source.core)
+				source.core = std::make_unique<PTP::ClientCore>(nullptr, m_options.Estimator, false, PTP::ServoOptions{}, 0, m_options.Prefilter);
+			return source;
+		}
+
+		static const char* TypeName(PTP::CaptureRecordType type)
+		{
+			switch (type)
+			{
+				case PTP::CaptureRecordType::Sync:
+					return "sync";
+				case PTP::CaptureRecordType::DelayExchange:
+					return "delay";
+				case PTP::CaptureRecordType::PeerDelay:
+					return "pdelay";
+				default:
+					return "other";
+			}
+		}
+
+		void PrintSummary(const PcapWriter* pcap) const
+		{
+			const auto wall{ std::chrono::duration<double>(m_wallTime).count() };
+			uint64_t measurements{ 0 };
+			for (const auto& source : m_sources)
+				measurements += source.syncs + source.delays;
+			std::cout << std::format(
+				"capture: {} | records: {} per pass, {} datagrams{} | passes: {} | wall: {:.3f} s | {:.2f} M records/s\n",
+				m_options.Input, m_records / m_options.Repeat, m_packets,
+				m_unknown ? std::format(", {} of unknown type", m_unknown) : std::string(),
+				m_options.Repeat, wall, wall > 0.0 ? static_cast<double>(m_records) / wall * 1e-6 : 0.0);
+			if (measurements == 0)
+				std::cout << "no timestamp sets: was the capture written by a server?\n";
+
+			for (size_t index = 0; index < m_sources.size(); ++index)
+			{
+				const auto& source{ m_sources[index] };
+				if (!source.core)
+					continue;
+				const auto estimate{ source.core->GetDelayEstimate() };
+				const auto samples{ static_cast<double>(source.offsets) };
+				const auto mean{ source.offsets ? source.offsetSum / samples : 0.0 };
+				std::cout << std::format(
+					"source {}: syncs: {} | path delays: {} ({} gated) | path delay: {} | offset over {} syncs: mean {:+.1f} ns | rms {:.1f} ns | min {:+.0f} | max {:+.0f}\n",
+					index, source.syncs, source.delays, source.core->GetDelayPrefilter().GetRejected(),
+					estimate ? std::format("{:.3f} us +- {:.3f}", estimate->delay, std::sqrt(estimate->variance)) : std::string("-"),
+					source.offsets, mean,
+					source.offsets ? std::sqrt(source.offsetSquares / samples) : 0.0,
+					source.offsets ? source.offsetMinimum : 0.0,
+					source.offsets ? source.offsetMaximum : 0.0);
+			}
+			if (pcap)
+				std::cout << std::format("pcap: {} datagrams to {}\n", pcap->Packets(), m_options.Pcap);
+		}
+
+		ReplayOptions m_options;
+		PTP::CaptureReader m_reader;
+		std::ofstream m_trace;
+		std::vector<SourceReplay> m_sources;
+		uint64_t m_records{ 0 }; // Over all passes
+		uint64_t m_packets{ 0 };
+		uint64_t m_unknown{ 0 };
+		std::chrono::steady_clock::duration m_wallTime{};
+	};
+}
+
+int main(int argc, char* argv[])
+{
+	try
+	{
+		const auto options{ ReadReplayOptions(std::span(argv, argc)) };
+		PTP::SetLogLevel(options.LogLevel);
+		Replay(options).Run();
+		return EXIT_SUCCESS;
+	}
+	catch (const std::exception& e)
+	{
+		std::cerr << "Error: " << e.what() << std::endl;
+		return EXIT_FAILURE;
+	}
+}
@@ -1,26 +1,103 @@
 #include "PtpServer.h"
+#include "Logger.h"
+#include "ClockSource.h"
+#include <algorithm>
+#include <cmath>
 #include <iostream>
 
 namespace PTP
 {
 	namespace
 	{
-		constexpr auto c_messageSize{sizeof(SimplifiedPtpHeader) + sizeof(PtpTimestamp) };
+		boost::asio::ip::udp::socket OpenSocket(boost::asio::io_context& ioContext,
+			const boost::asio::ip::address& address, unsigned short port, bool reusePort)
+		{
+			boost::asio::ip::udp::socket socket(ioContext, boost::asio::ip::udp::v4());
+			if (reusePort)
+			{
+#if defined(SO_REUSEPORT)
+				using ReusePortOption = boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>;
+				socket.set_option(ReusePortOption(true));
+#else
+				throw std::runtime_error("SO_REUSEPORT is not supported on this platform");
+#endif
+			}
+			socket.bind(boost::asio::ip::udp::endpoint(address, port));
+			return socket;
+		}
+
+		// Without a configured identity, one in the EUI-64 layout built from the IPv4 address
+		// and event port: unique per server on a host, and the same for every shard of a pool.
+		ClockProperties WithIdentity(ClockProperties clock, const boost::asio::ip::address& address, unsigned short port)
+		{
+			if (clock.Identity != ClockIdentity{})
+				return clock;
+			const auto bytes{ address.to_v4().to_bytes() };
+			clock.Identity = { bytes[0], bytes[1], bytes[2], 0xFF, 0xFE, bytes[3],
+				static_cast<uint8_t>(port >> 8), static_cast<uint8_t>(port) };
+			return clock;
+		}
+
+		std::vector<ServerDomain> DomainsOrDefault(const ServerOptions& options)
+		{
+			if (options.Domains.empty())
+				return { ServerDomain{} };
+			return options.Domains;
+		}
+
+		int64_t SteadyNanoseconds()
+		{
+			return std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::steady_clock::now().time_since_epoch()).count();
+		}
 	}
 
 	Server::Server(boost::asio::io_context& ioContext,
 		const std::string& ipAddress,
 		unsigned short eventPort,
-		unsigned short generalPort)
+		unsigned short generalPort,
+		const ServerOptions& options)
 		: m_ioContext(ioContext)
 		, m_localAdapter(boost::asio::ip::make_address(ipAddress))
-		, m_eventSocket(ioContext, boost::asio::ip::udp::endpoint(
-			boost::asio::ip::udp::v4(), eventPort))
-		, m_generalSocket(ioContext, boost::asio::ip::udp::endpoint(
-			boost::asio::ip::udp::v4(), generalPort))
+		, m_eventSocket(OpenSocket(ioContext, options.BindAddress ? m_localAdapter : boost::asio::ip::address_v4::any(),
+			eventPort, options.ReusePort))
+		, m_generalSocket(OpenSocket(ioContext, options.BindAddress ? m_localAdapter : boost::asio::ip::address_v4::any(),
+			generalPort, options.ReusePort))
 		, m_remoteEventEndpoint(boost::asio::ip::udp::endpoint(boost::asio::ip::address_v4{}, 0))
 		, m_remoteGeneralEndpoint(boost::asio::ip::udp::endpoint(boost::asio::ip::address_v4{}, 0))
+		, m_eventTxTimestamps(m_eventSocket)
+		, m_requestBatch(options.BatchSize, c_receiveBufferSize)
+		, m_responseBatch(options.BatchSize, Wire::c_delayRespSize)
+		, m_delayMechanism(options.PathDelay)
+		, m_sessions(options.Sessions)
+		, m_followUpBatch(DomainsOrDefault(options).size(), Wire::c_followUpSize)
+		, m_announceBatch(DomainsOrDefault(options).size(), Wire::c_announceSize)
+		, m_syncTimer(ioContext)
+		, m_announceTimer(ioContext)
+		, m_syncSpin(options.SyncSpin)
+		, m_oneStep(options.OneStep)
+		, m_capture(options.Capture)
+		, m_eventPort(eventPort)
 	{
+		m_batchSessions.reserve(options.BatchSize);
+
+		const auto clock{ WithIdentity(options.Clock, m_localAdapter, eventPort) };
+		const auto domains{ DomainsOrDefault(options) };
+		if (domains.size() >= c_noDomain)
+			throw std::runtime_error("Too many PTP domains for one server");
+		m_domainIndex.fill(c_noDomain);
+		m_domains.reserve(domains.size());
+		m_dueDomains.reserve(domains.size());
+		for (const auto& domain : domains)
+		{
+			if (m_domainIndex[domain.Number] != c_noDomain)
+				throw std::runtime_error("PTP domain " + std::to_string(domain.Number) + " is configured twice");
+			m_domainIndex[domain.Number] = static_cast<uint8_t>(m_domains.size());
+			ServerCore core(domain.LogSyncInterval.value_or(options.LogSyncInterval), clock, domain.Number);
+			const auto syncInterval{ std::chrono::duration_cast<std::chrono::steady_clock::duration>(core.GetSyncInterval()) };
+			m_domains.push_back({ .core = core, .syncInterval = syncInterval });
+		}
+
 		// Set socket options on the server's sending socket for robust multicast.
 
 		// 1. Enable loopback so client/server on the same machine can communicate.
@@ -28,170 +105,456 @@ namespace PTP
 		//m_eventSocket.set_option(boost::asio::ip::multicast::enable_loopback(true));
 		m_eventSocket.set_option(boost::asio::ip::multicast::outbound_interface(m_localAdapter.to_v4()));
 		m_generalSocket.set_option(boost::asio::ip::multicast::outbound_interface(m_localAdapter.to_v4()));
+
+		// Every shard answers Pdelay_Req and needs the Pdelay_Resp departure time; only the
+		// Sync shard needs it otherwise.
+		const bool txTimestamps{ options.TxTimestamps &&
+			(options.SendsSync || options.PathDelay == DelayMechanism::PeerToPeer) };
+		const auto support{ EnableTimestamping(m_eventSocket, options.Timestamping, txTimestamps) };
+		m_kernelRxTimestamps = support.rx;
+		m_kernelTxTimestamps = support.tx;
+		if (options.Timestamping != TimestampMode::Application && !m_kernelRxTimestamps)
+			std::cerr << "Kernel receive timestamps not supported, using application timestamps" << std::endl;
+		if (txTimestamps && !m_kernelTxTimestamps)
+			std::cerr << "Kernel transmit timestamps not supported, using application timestamps" << std::endl;
 	
 		std::cout << "PTP Server listening on Event Port: "
 			<< eventPort << " and General Port: " << generalPort << std::endl;
 	
 
-		boost::asio::co_spawn(m_ioContext, Broadcast(), RethrowException);
-		boost::asio::co_spawn(m_ioContext, Receive(), RethrowException);
+		if (options.SendsSync)
+		{
+			LogInfo("Announcing clock {} in {} domains with priority1 {}, class {}, priority2 {}",
+				LogString(FormatPortIdentity(m_domains.front().core.GetPortIdentity())), m_domains.size(),
+				options.Clock.Priority1, options.Clock.Quality.clockClass, options.Clock.Priority2);
+			boost::asio::co_spawn(m_ioContext, Broadcast(), RethrowException);
+			boost::asio::co_spawn(m_ioContext, Announce(), RethrowException);
+		}
+		if (options.BatchSize > 0)
+			boost::asio::co_spawn(m_ioContext, ReceiveBatched(), RethrowException);
+		else
+			boost::asio::co_spawn(m_ioContext, Receive(), RethrowException);
+		if (m_kernelTxTimestamps)
+			boost::asio::co_spawn(m_ioContext, m_eventTxTimestamps.Run(), RethrowException);
+		boost::asio::co_spawn(m_ioContext, ReportSessions(), RethrowException);
+		if (options.MetricsPort != 0 && options.SendsSync)
+			m_metrics = std::make_unique<MetricsServer>(m_ioContext, options.MetricsPort);
 	}
 
 	boost::asio::awaitable<void> Server::Broadcast()
 	{
+		constexpr uint32_t c_latenessReportInterval{ 1024 }; // Syncs
+
+		// Absolute deadlines on one timer: send time and wakeup latency do not accumulate into
+		// the period. With SyncSpin the timer fires early and the last stretch is busy-waited,
+		// trading CPU for less jitter on the departure instant. Every domain's schedule starts
+		// at the same instant and rates are powers of two, so the slower domains' deadlines fall
+		// on the faster ones' and one wakeup serves all domains that are due.
+		const boost::asio::ip::udp::endpoint followUpEndpoint{ m_localAdapter.is_loopback()?
+			boost::asio::ip::make_address(c_clientIP):c_multicastGeneral, c_ptpGeneralPort };
+		const auto start{ std::chrono::steady_clock::now() };
+		for (auto& domain : m_domains)
+			domain.nextSync = start + domain.syncInterval;
+		std::chrono::steady_clock::duration maxLateness{};
+		uint32_t sent{ 0 };
 		while (true)
 		{
-			co_await WaitForTimeout(c_brodcastTimeout);
-			co_await SendSyncMessage();
-			co_await SendFollowUpMessage();
-			++m_sequenceId; // TODO Iher: assuming all clients synchronize within 4 seconds
+			const auto deadline{ std::ranges::min(m_domains, {}, &Domain::nextSync).nextSync };
+			m_syncTimer.expires_at(deadline - m_syncSpin);
+			co_await m_syncTimer.async_wait(boost::asio::use_awaitable);
+			while (std::chrono::steady_clock::now() < deadline)
+				;
+
+			const auto lateness{ std::chrono::steady_clock::now() - deadline };
+			maxLateness = std::max(maxLateness, lateness);
+			Observe(MetricHistogram::ServerSyncLateness, lateness);
+			m_dueDomains.clear();
+			for (auto& domain : m_domains)
+			{
+				if (domain.nextSync <= deadline)
+					m_dueDomains.push_back(&domain);
+			}
+
+			// Each Sync needs its own departure time, so they go one by one; the Follow_Ups only
+			// carry those times and leave together in one sendmmsg.
+			for (auto* domain : m_dueDomains)
+				co_await SendSyncMessage(*domain);
+			if (!m_oneStep)
+			{
+				m_followUpBatch.Clear();
+				for (const auto* domain : m_dueDomains)
+				{
+					domain->core.WriteFollowUpMessage(m_followUpBatch.Append(followUpEndpoint, Wire::c_followUpSize),
+						domain->syncTimestamp);
+				}
+				try
+				{
+					co_await Flush(m_followUpBatch);
+					Increment(MetricCounter::ServerFollowUpSent, m_dueDomains.size());
+				}
+				catch (const std::exception& e)
+				{
+					LogError("Error in server followup loop: {}", LogString(e.what()));
+				}
+			}
+
+			const auto now{ std::chrono::steady_clock::now() };
+			for (auto* domain : m_dueDomains)
+			{
+				domain->core.NextSequence(); // TODO Iher: assuming all clients synchronize within 4 seconds
+
+				// Skip slots missed while the process was descheduled rather than sending a burst.
+				const auto interval{ domain->syncInterval };
+				domain->nextSync += interval;
+				if (domain->nextSync <= now)
+					domain->nextSync += interval * ((now - domain->nextSync) / interval + 1);
+			}
+
+			if (++sent == c_latenessReportInterval)
+			{
+				LogDebug("Sync departures up to {} ns late over the last {} wakeups",
+					std::chrono::nanoseconds(maxLateness).count(), sent);
+				maxLateness = {};
+				sent = 0;
+			}
 		}
 	}
 
+	boost::asio::awaitable<void> Server::Announce()
+	{
+		// Announce timing only bounds how fast clients notice a lost master, so a plain
+		// relative timer is enough.
+		const boost::asio::ip::udp::endpoint announceEndpoint{ m_localAdapter.is_loopback()?
+			boost::asio::ip::make_address(c_clientIP):c_multicastGeneral, c_ptpGeneralPort };
+		const auto interval{ std::chrono::duration_cast<std::chrono::steady_clock::duration>(m_domains.front().core.GetAnnounceInterval()) };
+		while (true)
+		{
+			m_announceBatch.Clear();
+			const auto originTimestamp{ GetCurrentPtpTime() };
+			for (auto& domain : m_domains)
+			{
+				domain.core.WriteAnnounceMessage(m_announceBatch.Append(announceEndpoint, Wire::c_announceSize), originTimestamp);
+				domain.core.NextAnnounce();
+			}
+			try
+			{
+				co_await Flush(m_announceBatch);
+				Increment(MetricCounter::ServerAnnounceSent, m_domains.size());
+			}
+			catch (const std::exception& e)
+			{
+				LogError("Error in server announce loop: {}", LogString(e.what()));
+			}
+
+			m_announceTimer.expires_after(interval);
+			co_await m_announceTimer.async_wait(boost::asio::use_awaitable);
+		}
+	}
 
 	boost::asio::awaitable<void> Server::Receive()
 	{
 		while (true)
 		{
-			std::vector<uint8_t> buffer(c_messageSize);
 			boost::asio::ip::udp::endpoint remoteEndpoint;
-
-			co_await m_eventSocket.async_receive_from(
-				boost::asio::buffer(buffer),
+			const auto received = co_await ReceiveWithTimestamp(m_eventSocket,
+				boost::asio::buffer(m_receiveBuffer),
 				remoteEndpoint,
-				boost::asio::use_awaitable);
-			
-			const auto requestTimeStamp = GetCurrentPtpTime();
-			boost::asio::co_spawn(m_ioContext,
-				SendDelayResponse(requestTimeStamp, std::move(buffer), std::move(remoteEndpoint)),
-				RethrowException);
-		}
+				m_kernelRxTimestamps);
+			RecordPacket(CaptureDirection::Received, remoteEndpoint, received.timestamp,
+				std::span(m_receiveBuffer).first(received.bytesReceived));
 
-	}
+			const auto request{ DecodeMessage(std::span(m_receiveBuffer).first(received.bytesReceived)) };
+			if (!request || request->header.messageType != RequestType())
+				continue;
+			const auto* domain{ FindDomain(request->header.domainNumber) };
+			if (!domain)
+				continue;
 
-	
+			Increment(MetricCounter::ServerRequestsReceived);
+			const auto dequeued{ std::chrono::steady_clock::now() };
+			const auto admitted{ m_sessions.Admit(SessionKey::From(remoteEndpoint, request->header.sourcePortIdentity), SteadyNanoseconds()) };
+			if (admitted.admission != Admission::Accepted)
+			{
+				Increment(MetricCounter::ServerRequestsDropped);
+				continue;
+			}
 
-	boost::asio::awaitable<void> Server::SendSyncMessage()
-	{
-		try
-		{
-			const boost::asio::ip::udp::endpoint multicastEndpoint{ m_localAdapter.is_loopback()?
-				boost::asio::ip::make_address(c_clientIP):c_multicastEvent, c_ptpEventPort };
-			const std::vector<uint8_t> syncBuffer{ CreateSyncMessage() };
-			m_syncTimestamp = GetCurrentPtpTime();
-			const size_t bytesSent
+			if (m_delayMechanism == DelayMechanism::PeerToPeer)
 			{
-				co_await m_eventSocket.async_send_to(
-					boost::asio::buffer(syncBuffer),
-					multicastEndpoint,
-					boost::asio::use_awaitable)
-			};
+				co_await RespondToPeerDelay(domain->core, *request, remoteEndpoint.address(), received.timestamp,
+					admitted.session, dequeued);
+				continue;
+			}
 
-			if (bytesSent != syncBuffer.size())
+			bool answered{ false };
+			try
+			{
+				const auto size{ domain->core.WriteDelayResponse(m_sendBuffer, *request, received.timestamp) };
+				co_await m_generalSocket.async_send_to(
+					boost::asio::buffer(m_sendBuffer, size),
+					boost::asio::ip::udp::endpoint(remoteEndpoint.address(), c_ptpGeneralPort),
+					boost::asio::use_awaitable);
+				answered = true;
+				Increment(MetricCounter::ServerResponsesSent);
+				Observe(MetricHistogram::ServerResponseLatency, std::chrono::steady_clock::now() - dequeued);
+			}
+			catch (const std::exception& e)
 			{
-				std::cerr << "Failed to send sync message, sent bytes: "
-					<< bytesSent << ", expected: " << syncBuffer.size() << std::endl;
+				LogError("Failed to send delay response: {}", LogString(e.what()));
 			}
+			m_sessions.Complete(admitted.session, answered);
 		}
-		catch (const std::exception& e)
+	}
+
+	boost::asio::awaitable<void> Server::ReceiveBatched()
+	{
+		while (true)
 		{
-			std::cerr << "Error in server sync loop: " << e.what() << std::endl;
+			co_await m_eventSocket.async_wait(boost::asio::socket_base::wait_read, boost::asio::use_awaitable);
+
+			const auto received{ m_requestBatch.Receive(m_eventSocket, m_kernelRxTimestamps) };
+			const auto dequeued{ std::chrono::steady_clock::now() };
+			const auto now{ SteadyNanoseconds() };
+			m_responseBatch.Clear();
+			m_batchSessions.clear();
+			for (size_t i = 0; i < received; ++i)
+			{
+				RecordPacket(CaptureDirection::Received, m_requestBatch.Endpoint(i), m_requestBatch.Timestamp(i), m_requestBatch.Payload(i));
+				const auto request{ DecodeMessage(m_requestBatch.Payload(i)) };
+				if (!request || request->header.messageType != RequestType())
+					continue;
+				const auto* domain{ FindDomain(request->header.domainNumber) };
+				if (!domain)
+					continue;
+
+				Increment(MetricCounter::ServerRequestsReceived);
+				const auto& endpoint{ m_requestBatch.Endpoint(i) };
+				const auto admitted{ m_sessions.Admit(SessionKey::From(endpoint, request->header.sourcePortIdentity), now) };
+				if (admitted.admission != Admission::Accepted)
+				{
+					Increment(MetricCounter::ServerRequestsDropped);
+					continue;
+				}
+
+				// Each Pdelay_Resp_Follow_Up needs its own departure time, so those are not batched.
+				if (m_delayMechanism == DelayMechanism::PeerToPeer)
+				{
+					co_await RespondToPeerDelay(domain->core, *request, endpoint.address(), m_requestBatch.Timestamp(i),
+						admitted.session, dequeued);
+					continue;
+				}
+
+				const boost::asio::ip::udp::endpoint responseEndpoint(endpoint.address(), c_ptpGeneralPort);
+				domain->core.WriteDelayResponse(m_responseBatch.Append(responseEndpoint, Wire::c_delayRespSize),
+					*request, m_requestBatch.Timestamp(i));
+				m_batchSessions.push_back(admitted.session);
+			}
+
+			co_await Flush(m_responseBatch);
+			for (const auto session : m_batchSessions)
+				m_sessions.Complete(session, true);
+
+			// The whole batch leaves with one sendmmsg, so every response in it took as long.
+			const auto latency{ std::chrono::steady_clock::now() - dequeued };
+			Increment(MetricCounter::ServerResponsesSent, m_batchSessions.size());
+			for (size_t i = 0; i < m_batchSessions.size(); ++i)
+				Observe(MetricHistogram::ServerResponseLatency, latency);
 		}
 	}
 
-	boost::asio::awaitable<void> Server::SendFollowUpMessage()
+	boost::asio::awaitable<void> Server::ReportSessions()
 	{
-		try
+		SessionTableStats reported{};
+		while (true)
 		{
-			const boost::asio::ip::udp::endpoint multicastEndpoint{ m_localAdapter.is_loopback()?
-				boost::asio::ip::make_address(c_clientIP):c_multicastGeneral, c_ptpGeneralPort };
-			const std::vector<uint8_t> buffer{ CreateFollowUpMessage() };
-			const size_t bytesSent
-			{
-				co_await m_generalSocket.async_send_to(
-					boost::asio::buffer(buffer),
-					multicastEndpoint,
-					boost::asio::use_awaitable)
-			};
+			co_await WaitForTimeout(c_sessionReportInterval);
 
-			if (bytesSent != buffer.size())
+			// Only overload is worth a line: clients that were throttled, evicted or turned away.
+			const auto stats{ m_sessions.GetStats() };
+			SetGauge(MetricGauge::ServerSessions, static_cast<double>(stats.sessions));
+			const auto rateLimited{ stats.rateLimited - reported.rateLimited };
+			const auto overflowed{ stats.overflowed - reported.overflowed };
+			const auto rejected{ stats.rejected - reported.rejected };
+			const auto evicted{ stats.evicted - reported.evicted };
+			reported = stats;
+			if (rateLimited + overflowed + rejected + evicted == 0)
+				continue;
+
+			const Session* worst{ nullptr };
+			m_sessions.ForEach([&worst](const Session& session)
+			{
+				const auto dropped{ session.counters.rateLimited + session.counters.overflowed };
+				if (dropped > 0 && (!worst || dropped > worst->counters.rateLimited + worst->counters.overflowed))
+					worst = &session;
+			});
+			LogWarning("Sessions: {} clients, {} evicted | dropped {} rate limited, {} over the in-flight bound, {} from rejected new clients",
+				stats.sessions, evicted, rateLimited, overflowed, rejected);
+			if (worst)
 			{
-				std::cerr << "Failed to send followup message, sent bytes: "
-					<< bytesSent << ", expected: " << buffer.size() << std::endl;
+				LogWarning("Most dropped client: {} with {} of {} requests dropped",
+					LogString(worst->key.ToString()),
+					worst->counters.rateLimited + worst->counters.overflowed, worst->counters.requests);
 			}
 		}
-		catch (const std::exception& e)
+	}
+
+	boost::asio::awaitable<void> Server::Flush(DatagramBatch& batch)
+	{
+		while (!batch.Send(m_generalSocket))
 		{
-			std::cerr << "Error in server followup loop: " << e.what() << std::endl;
+			co_await m_generalSocket.async_wait(boost::asio::socket_base::wait_write, boost::asio::use_awaitable);
 		}
 	}
 
-	std::vector<uint8_t> Server::CreateSyncMessage()
+	
+
+	boost::asio::awaitable<void> Server::RespondToPeerDelay(const ServerCore& core,
+		const PtpMessage& request,
+		const boost::asio::ip::address& requester,
+		PtpTimestamp receiveTimestamp,
+		uint32_t session,
+		std::chrono::steady_clock::time_point dequeued)
 	{
-		// A standard Sync message contains a 10-byte originTimestamp in its body.
-		std::vector<uint8_t> buffer(c_messageSize);
-
-		#pragma warning(suppress: 26490) // Don't use reinterpret_cast
-		auto* timestampPtr = reinterpret_cast<PtpTimestamp*>(buffer.data() + sizeof(SimplifiedPtpHeader));
-		*timestampPtr = { 0, 0 };
-
-		#pragma warning(suppress: 26490) // Don't use reinterpret_cast
-		auto* headerPtr = reinterpret_cast<SimplifiedPtpHeader*>(buffer.data());
-		headerPtr->transportSpecificMessageType = static_cast<uint8_t>(PtpMessageType::Sync);
-		headerPtr->sequenceId = SwapEndianness(m_sequenceId);
-		return buffer;
+		try
+		{
+			// Pdelay_Resp leaves through the event socket, so with --TxTimestamps t3 is its
+			// transmit timestamp, taken like t2 by the kernel; otherwise it is the
+			// application time right before the send.
+			const auto size{ core.WritePeerDelayResponse(m_sendBuffer, request, receiveTimestamp) };
+			const auto responseOrigin{ GetCurrentPtpTime() };
+			co_await m_eventSocket.async_send_to(
+				boost::asio::buffer(m_sendBuffer, size),
+				boost::asio::ip::udp::endpoint(requester, c_ptpEventPort),
+				boost::asio::use_awaitable);
+			const auto txKey{ m_eventTxTimestamps.Sent() };
+
+			// The follow-up waits for the transmit timestamp on its own, so the shard goes on
+			// receiving; the session table's in-flight bound caps how many wait per client.
+			if (m_kernelTxTimestamps)
+				boost::asio::co_spawn(m_ioContext,
+					SendPeerDelayFollowUp(core, request, requester, txKey, responseOrigin, session, dequeued),
+					RethrowException);
+			else
+				co_await SendPeerDelayFollowUp(core, request, requester, std::nullopt, responseOrigin, session, dequeued);
+		}
+		catch (const std::exception& e)
+		{
+			LogError("Failed to send peer delay response: {}", LogString(e.what()));
+			m_sessions.Complete(session, false);
+		}
 	}
 
-	std::vector<uint8_t> Server::CreateFollowUpMessage()
+	boost::asio::awaitable<void> Server::SendPeerDelayFollowUp(const ServerCore& core,
+		PtpMessage request,
+		boost::asio::ip::address requester,
+		std::optional<uint32_t> txKey,
+		PtpTimestamp responseOrigin,
+		uint32_t session,
+		std::chrono::steady_clock::time_point dequeued)
 	{
-		std::vector<uint8_t> buffer(c_messageSize);
-
-		#pragma warning(suppress: 26490) // Don't use reinterpret_cast
-		auto* timestampPtr = reinterpret_cast<PtpTimestamp*>(buffer.data() + sizeof(SimplifiedPtpHeader));
-		*timestampPtr = m_syncTimestamp;
+		bool answered{ false };
+		try
+		{
+			if (txKey)
+			{
+				const auto departure{ co_await m_eventTxTimestamps.WaitForTimestamp(*txKey, c_txTimestampTimeout) };
+				if (departure)
+					responseOrigin = *departure;
+				else
+					LogWarning("No transmit timestamp for Pdelay_Resp {}, using application timestamp", request.header.sequenceId);
+			}
 
-		#pragma warning(suppress: 26490) // Don't use reinterpret_cast
-		auto* headerPtr = reinterpret_cast<SimplifiedPtpHeader*>(buffer.data());
-		headerPtr->transportSpecificMessageType = static_cast<uint8_t>(PtpMessageType::Follow_Up);
-		headerPtr->sequenceId = SwapEndianness(m_sequenceId);
-		return buffer;
+			// Several follow-ups may be waiting at once, each builds its own.
+			std::array<uint8_t, Wire::c_maxMessageSize> buffer{};
+			const auto size{ core.WritePeerDelayResponseFollowUp(buffer, request, responseOrigin) };
+			co_await m_generalSocket.async_send_to(
+				boost::asio::buffer(buffer, size),
+				boost::asio::ip::udp::endpoint(requester, c_ptpGeneralPort),
+				boost::asio::use_awaitable);
+			answered = true;
+			Increment(MetricCounter::ServerResponsesSent);
+			Observe(MetricHistogram::ServerResponseLatency, std::chrono::steady_clock::now() - dequeued);
+		}
+		catch (const std::exception& e)
+		{
+			LogError("Failed to send peer delay response follow-up: {}", LogString(e.what()));
+		}
+		m_sessions.Complete(session, answered);
 	}
 
-	boost::asio::awaitable<void> Server::SendDelayResponse(
-		PtpTimestamp requestTimeStamp,
-		std::vector<uint8_t> receiveBuffer,
-		boost::asio::ip::udp::endpoint endpoint)
+	void Server::RecordPacket(CaptureDirection direction,
+		const boost::asio::ip::udp::endpoint& remote,
+		PtpTimestamp timestamp,
+		std::span<const uint8_t> payload)
 	{
-		// The handler coroutine (SendDelayResponse) does not have a try/catch block. 
-		// If an exception is thrown here, it may terminate the coroutine and potentially the process, depending on the coroutine framework. 
-		// Consider adding error handling/logging.
-		std::vector<uint8_t> sendBuffer{ CreateDelayResponseMessage(requestTimeStamp, receiveBuffer) };
-		const boost::asio::ip::udp::endpoint responseEndpoint(
-			endpoint.address(),
-			c_ptpGeneralPort
-		);
-
-		co_await m_generalSocket.async_send_to(
-			boost::asio::buffer(sendBuffer, sendBuffer.size()),
-			responseEndpoint,
-			boost::asio::use_awaitable);
+		if (!m_capture)
+			return;
+
+		m_capture->WritePacket({
+			.header = {},
+			.captureTime = ReadClock(ClockSource::Realtime),
+			.timestamp = timestamp.to_nanoseconds(),
+			.localAddress = m_localAdapter.to_v4().to_uint(),
+			.remoteAddress = remote.address().to_v4().to_uint(),
+			.localPort = m_eventPort,
+			.remotePort = remote.port(),
+			.length = 0,
+			.direction = direction,
+			.reserved = 0 }, payload);
 	}
 
-	std::vector<uint8_t> Server::CreateDelayResponseMessage(PtpTimestamp requestTimeStamp, std::vector<uint8_t> receiveBuffer)
+	boost::asio::awaitable<void> Server::SendSyncMessage(Domain& domain)
 	{
-		SimplifiedPtpHeader receiveHeader;
-		std::memcpy(&receiveHeader, receiveBuffer.data(), sizeof(SimplifiedPtpHeader));
-
-		std::vector<uint8_t> buffer(c_messageSize);
+		try
+		{
+			const boost::asio::ip::udp::endpoint multicastEndpoint{ m_localAdapter.is_loopback()?
+				boost::asio::ip::make_address(c_clientIP):c_multicastEvent, c_ptpEventPort };
+			domain.syncTimestamp = GetCurrentPtpTime();
+			// One-step cannot rewrite the packet once it is queued, so the correctionField carries
+			// the send latency measured on earlier Syncs (zero without transmit timestamps).
+			const auto size{ m_oneStep
+				? domain.core.WriteOneStepSyncMessage(m_syncBuffer, domain.syncTimestamp, std::llround(m_syncSendLatency.value_or(0.0)))
+				: domain.core.WriteSyncMessage(m_syncBuffer) };
+			const size_t bytesSent
+			{
+				co_await m_eventSocket.async_send_to(
+					boost::asio::buffer(m_syncBuffer, size),
+					multicastEndpoint,
+					boost::asio::use_awaitable)
+			};
+			const auto txKey{ m_eventTxTimestamps.Sent() };
 
-		#pragma warning(suppress: 26490) // Don't use reinterpret_cast
-		auto* timestampPtr = reinterpret_cast<PtpTimestamp*>(buffer.data() + sizeof(SimplifiedPtpHeader));
-		*timestampPtr = requestTimeStamp;
+			if (bytesSent != size)
+			{
+				LogError("Failed to send sync message, sent bytes: {}, expected: {}", bytesSent, size);
+			}
+			else
+			{
+				Increment(MetricCounter::ServerSyncSent);
+			}
 
-		#pragma warning(suppress: 26490) // Don't use reinterpret_cast
-		auto* headerPtr = reinterpret_cast<SimplifiedPtpHeader*>(buffer.data());
-		headerPtr->transportSpecificMessageType = static_cast<uint8_t>(PtpMessageType::Delay_Resp);
-		headerPtr->sequenceId = receiveHeader.sequenceId;
-		return buffer;
+			if (m_kernelTxTimestamps)
+			{
+				// Follow_Up carries the actual departure time when the kernel reports it; in one-step
+				// mode it trains the latency estimate for the next Syncs.
+				constexpr double c_sendLatencyGain{ 1.0 / 16.0 };
+				const auto departure{ co_await m_eventTxTimestamps.WaitForTimestamp(txKey, c_txTimestampTimeout) };
+				if (departure && m_oneStep)
+				{
+					const auto latency{ static_cast<double>(departure->to_nanoseconds() - domain.syncTimestamp.to_nanoseconds()) };
+					m_syncSendLatency = m_syncSendLatency ? *m_syncSendLatency + c_sendLatencyGain * (latency - *m_syncSendLatency) : latency;
+				}
+				if (departure)
+					domain.syncTimestamp = *departure;
+				else
+					LogWarning("No transmit timestamp for sync {} in domain {}, using application timestamp",
+						domain.core.GetSequenceId(), domain.core.GetDomainNumber());
+			}
+			RecordPacket(CaptureDirection::Sent, multicastEndpoint, domain.syncTimestamp, std::span(m_syncBuffer).first(size));
+		}
+		catch (const std::exception& e)
+		{
+			LogError("Error in server sync loop: {}", LogString(e.what()));
+		}
 	}
-}
\ No newline at end of file
+}
@@ -1,11 +1,54 @@
 
 
+#pragma once
+
 #include "Utils.h"
+#include "PtpCodec.h"
+#include "PtpServerCore.h"
+#include "Timestamping.h"
+#include "DatagramBatch.h"
+#include "SessionTable.h"
+#include "CaptureFile.h"
+#include "Metrics.h"
 
 #include <boost/asio.hpp>
 
+#include <array>
+#include <memory>
+#include <optional>
+#include <vector>
+
 namespace PTP
 {
+	// One PTP domain the server hosts on its shared sockets.
+	struct ServerDomain
+	{
+		uint8_t Number{ 0 };
+		std::optional<int8_t> LogSyncInterval; // nullopt: ServerOptions::LogSyncInterval
+	};
+
+	struct ServerOptions
+	{
+		TimestampMode Timestamping{ TimestampMode::Application };
+		bool TxTimestamps{ false };
+		DelayMechanism PathDelay{ DelayMechanism::EndToEnd }; // Answer Delay_Req, or Pdelay_Req from neighbours
+		size_t BatchSize{ 0 }; // > 0 drains Delay_Req with recvmmsg and answers with one sendmmsg
+		size_t Threads{ 1 };   // > 1 runs a ServerPool with one SO_REUSEPORT event socket per thread
+		bool ReusePort{ false };
+		bool SendsSync{ true }; // Only one shard generates Sync/Follow_Up/Announce so sequence IDs stay coherent
+		int8_t LogSyncInterval{ c_logSyncInterval };     // log2 seconds between Sync, -7 (128/s) to 4
+		std::vector<ServerDomain> Domains;               // Empty: domain 0 only
+		std::chrono::microseconds SyncSpin{ 0 };         // Busy-wait this long before each Sync deadline
+		bool OneStep{ false };  // Sync carries its origin timestamp, no Follow_Up
+		SessionTableOptions Sessions; // Per-client admission control, per shard
+		ClockProperties Clock;        // Announced to clients for master selection
+		bool BindAddress{ false };    // Bind to ipAddress instead of any, so several servers can share a host
+		// Receives every datagram on the event socket and every Sync with its departure time;
+		// shared by all shards, nullptr = off.
+		std::shared_ptr<CaptureWriter> Capture;
+		unsigned short MetricsPort{ 0 }; // Prometheus scrape endpoint on 127.0.0.1, 0 = off; the Sync shard serves it
+	};
+
 	class Server
 	{
 	public:
@@ -13,7 +56,8 @@ namespace PTP
 		Server(boost::asio::io_context& ioContext
 			, const std::string& ipAddress
 			, unsigned short eventPort
-			, unsigned short generalPort);
+			, unsigned short generalPort
+			, const ServerOptions& options = {});
 
 		Server(const Server&) = delete;
 		Server& operator=(const Server&) = delete;
@@ -22,19 +66,59 @@ namespace PTP
 
 
 	private:
+		static constexpr size_t c_receiveBufferSize{ 128 }; // Room for TLVs appended by other implementations
+		static constexpr auto c_sessionReportInterval{ std::chrono::seconds(10) };
+		static constexpr uint8_t c_noDomain{ UINT8_MAX };
+
+		// Everything that differs between the hosted domains; sockets, sessions and the
+		// send path are shared.
+		struct Domain
+		{
+			ServerCore core;
+			std::chrono::steady_clock::duration syncInterval;
+			std::chrono::steady_clock::time_point nextSync{};
+			PtpTimestamp syncTimestamp{}; // Departure of the latest Sync, for its Follow_Up
+		};
 
         boost::asio::awaitable<void> Broadcast();
+		boost::asio::awaitable<void> Announce();
 		boost::asio::awaitable<void> Receive();
-		boost::asio::awaitable<void> SendSyncMessage();
-		boost::asio::awaitable<void> SendFollowUpMessage();
-		std::vector<uint8_t> CreateSyncMessage();
-		std::vector<uint8_t> CreateFollowUpMessage();
-		boost::asio::awaitable<void>  SendDelayResponse(
-			PtpTimestamp requestTimeStamp,
-			std::vector<uint8_t> buffer, boost::asio::ip::udp::endpoint endpoint);
-		std::vector<uint8_t> CreateDelayResponseMessage(
-			PtpTimestamp requestTimeStamp,
-			std::vector<uint8_t> receiveBuffer);
+		boost::asio::awaitable<void> ReceiveBatched();
+		boost::asio::awaitable<void> Flush(DatagramBatch& batch);
+		boost::asio::awaitable<void> ReportSessions();
+		// Sends the Pdelay_Resp and hands its follow-up to SendPeerDelayFollowUp, which
+		// completes 'session' once both are out or one failed.
+		boost::asio::awaitable<void> RespondToPeerDelay(const ServerCore& core,
+			const PtpMessage& request,
+			const boost::asio::ip::address& requester,
+			PtpTimestamp receiveTimestamp,
+			uint32_t session,
+			std::chrono::steady_clock::time_point dequeued);
+		// Takes the Pdelay_Resp departure from the error queue when txKey is set. Its own
+		// coroutine then, so it owns copies of the request and the requester.
+		boost::asio::awaitable<void> SendPeerDelayFollowUp(const ServerCore& core,
+			PtpMessage request,
+			boost::asio::ip::address requester,
+			std::optional<uint32_t> txKey,
+			PtpTimestamp responseOrigin,
+			uint32_t session,
+			std::chrono::steady_clock::time_point dequeued);
+		boost::asio::awaitable<void> SendSyncMessage(Domain& domain);
+		void RecordPacket(CaptureDirection direction,
+			const boost::asio::ip::udp::endpoint& remote,
+			PtpTimestamp timestamp,
+			std::span<const uint8_t> payload);
+		// nullptr for a domain this server does not host.
+		Domain* FindDomain(uint8_t domainNumber)
+		{
+			const auto index{ m_domainIndex[domainNumber] };
+			return index == c_noDomain ? nullptr : &m_domains[index];
+		}
+		// The one request type the configured delay mechanism answers.
+		PtpMessageType RequestType() const
+		{
+			return m_delayMechanism == DelayMechanism::PeerToPeer ? PtpMessageType::Pdelay_Req : PtpMessageType::Delay_Req;
+		}
 
 		boost::asio::io_context& m_ioContext;
 		boost::asio::ip::address m_localAdapter;
@@ -42,8 +126,29 @@ namespace PTP
 		boost::asio::ip::udp::socket m_generalSocket;
 		boost::asio::ip::udp::endpoint m_remoteEventEndpoint;
 		boost::asio::ip::udp::endpoint m_remoteGeneralEndpoint;
-		uint16_t m_sequenceId{ 0 };
-		PtpTimestamp m_syncTimestamp;
-		PtpTimestamp m_requestTimeStamp;
+		TxTimestampReader m_eventTxTimestamps;
+		DatagramBatch m_requestBatch;
+		DatagramBatch m_responseBatch;
+		bool m_kernelRxTimestamps{ false };
+		bool m_kernelTxTimestamps{ false };
+		DelayMechanism m_delayMechanism;
+		SessionTable m_sessions;
+		std::vector<uint32_t> m_batchSessions; // Sessions with a Delay_Resp in m_responseBatch
+		std::vector<Domain> m_domains;
+		std::array<uint8_t, 256> m_domainIndex; // domainNumber -> m_domains index, or c_noDomain
+		std::vector<Domain*> m_dueDomains;      // Broadcast: domains whose Sync is due this wakeup
+		DatagramBatch m_followUpBatch;          // Follow_Ups of the domains in m_dueDomains, one sendmmsg
+		DatagramBatch m_announceBatch;          // Announces of all domains, one sendmmsg
+		boost::asio::steady_timer m_syncTimer;
+		boost::asio::steady_timer m_announceTimer;
+		std::chrono::microseconds m_syncSpin;
+		bool m_oneStep;
+		std::optional<double> m_syncSendLatency; // Nanoseconds, one-step: average TX timestamp minus origin timestamp
+		std::array<uint8_t, Wire::c_syncSize> m_syncBuffer{};
+		std::array<uint8_t, c_receiveBufferSize> m_receiveBuffer{};
+		std::array<uint8_t, Wire::c_maxMessageSize> m_sendBuffer{}; // Delay_Resp or Pdelay_Resp
+		std::shared_ptr<CaptureWriter> m_capture; // nullptr = no capture
+		std::unique_ptr<MetricsServer> m_metrics; // nullptr = no scrape endpoint
+		unsigned short m_eventPort;
 	};
 }
\ No newline at end of file
@@ -0,0 +1,165 @@
+#include "PtpServerCore.h"
+
+#include <cmath>
+#include <stdexcept>
+
+namespace PTP
+{
+	namespace
+	{
+		int8_t RateToLogInterval(double rate, int8_t minLogInterval, int8_t maxLogInterval, const char* error)
+		{
+			const auto logInterval{ rate > 0.0 ? -std::log2(rate) : 0.0 };
+			if (rate <= 0.0 || logInterval != std::round(logInterval) ||
+				logInterval < minLogInterval || logInterval > maxLogInterval)
+			{
+				throw std::runtime_error(error);
+			}
+			return static_cast<int8_t>(logInterval);
+		}
+
+		std::chrono::nanoseconds LogIntervalToDuration(int8_t logInterval)
+		{
+			return std::chrono::nanoseconds(std::llround(std::ldexp(1e9, logInterval)));
+		}
+	}
+
+	int8_t SyncRateToLogInterval(double rate)
+	{
+		return RateToLogInterval(rate, c_minLogSyncInterval, c_maxLogSyncInterval,
+			"Sync rate must be a power of two between 1/16 and 128 per second");
+	}
+
+	int8_t AnnounceRateToLogInterval(double rate)
+	{
+		return RateToLogInterval(rate, c_minLogAnnounceInterval, c_maxLogAnnounceInterval,
+			"Announce rate must be a power of two between 1/16 and 8 per second");
+	}
+
+	ServerCore::ServerCore(int8_t logSyncInterval, const ClockProperties& clock, uint8_t domainNumber)
+		: m_logSyncInterval(logSyncInterval)
+		, m_domainNumber(domainNumber)
+		, m_clock(clock)
+		, m_portIdentity(MakePortIdentity(clock.Identity, 1))
+	{}
+
+	std::chrono::nanoseconds ServerCore::GetSyncInterval() const
+	{
+		return LogIntervalToDuration(m_logSyncInterval);
+	}
+
+	std::chrono::nanoseconds ServerCore::GetAnnounceInterval() const
+	{
+		return LogIntervalToDuration(m_clock.LogAnnounceInterval);
+	}
+
+	PtpMessage ServerCore::NewMessage(PtpMessageType type) const
+	{
+		PtpMessage message;
+		message.header.messageType = type;
+		message.header.domainNumber = m_domainNumber;
+		message.header.sourcePortIdentity = m_portIdentity;
+		return message;
+	}
+
+	size_t ServerCore::WriteSyncMessage(std::span<uint8_t> buffer) const
+	{
+		// Two-step: the originTimestamp stays zero, the Follow_Up carries the departure time.
+		auto message{ NewMessage(PtpMessageType::Sync) };
+		message.header.flags = Wire::c_twoStepFlag;
+		message.header.sequenceId = m_sequenceId;
+		message.header.logMessageInterval = m_logSyncInterval;
+		return EncodeMessage(message, buffer);
+	}
+
+	size_t ServerCore::WriteOneStepSyncMessage(std::span<uint8_t> buffer,
+		PtpTimestamp originTimestamp,
+		int64_t sendLatency) const
+	{
+		auto message{ NewMessage(PtpMessageType::Sync) };
+		message.header.correctionField = ToCorrectionField(sendLatency);
+		message.header.sequenceId = m_sequenceId;
+		message.header.logMessageInterval = m_logSyncInterval;
+		message.timestamp = originTimestamp;
+		return EncodeMessage(message, buffer);
+	}
+
+	size_t ServerCore::WriteFollowUpMessage(std::span<uint8_t> buffer, PtpTimestamp preciseOriginTimestamp) const
+	{
+		auto message{ NewMessage(PtpMessageType::Follow_Up) };
+		message.header.sequenceId = m_sequenceId;
+		message.header.logMessageInterval = m_logSyncInterval;
+		message.timestamp = preciseOriginTimestamp;
+		return EncodeMessage(message, buffer);
+	}
+
+	size_t ServerCore::WriteDelayResponse(std::span<uint8_t> buffer,
+		const PtpMessage& request,
+		PtpTimestamp receiveTimestamp) const
+	{
+		const auto& requestHeader{ request.header };
+		if (requestHeader.messageType != PtpMessageType::Delay_Req)
+			return 0;
+
+		auto message{ NewMessage(PtpMessageType::Delay_Resp) };
+		message.header.domainNumber = requestHeader.domainNumber;
+		message.header.sequenceId = requestHeader.sequenceId;
+		message.header.correctionField = requestHeader.correctionField;
+		message.header.logMessageInterval = c_logMinDelayReqInterval;
+		message.timestamp = receiveTimestamp;
+		message.requestingPortIdentity = requestHeader.sourcePortIdentity;
+		return EncodeMessage(message, buffer);
+	}
+
+	size_t ServerCore::WritePeerDelayResponse(std::span<uint8_t> buffer,
+		const PtpMessage& request,
+		PtpTimestamp receiveTimestamp) const
+	{
+		const auto& requestHeader{ request.header };
+		if (requestHeader.messageType != PtpMessageType::Pdelay_Req)
+			return 0;
+
+		auto message{ NewMessage(PtpMessageType::Pdelay_Resp) };
+		message.header.domainNumber = requestHeader.domainNumber;
+		message.header.flags = Wire::c_twoStepFlag;
+		message.header.sequenceId = requestHeader.sequenceId;
+		message.timestamp = receiveTimestamp;
+		message.requestingPortIdentity = requestHeader.sourcePortIdentity;
+		return EncodeMessage(message, buffer);
+	}
+
+	size_t ServerCore::WritePeerDelayResponseFollowUp(std::span<uint8_t> buffer,
+		const PtpMessage& request,
+		PtpTimestamp responseOriginTimestamp) const
+	{
+		const auto& requestHeader{ request.header };
+		if (requestHeader.messageType != PtpMessageType::Pdelay_Req)
+			return 0;
+
+		// A two-step responder returns the request's correctionField (residence time added by
+		// transparent clocks on the way) in the follow-up, so the requester can take it out.
+		auto message{ NewMessage(PtpMessageType::Pdelay_Resp_Follow_Up) };
+		message.header.domainNumber = requestHeader.domainNumber;
+		message.header.sequenceId = requestHeader.sequenceId;
+		message.header.correctionField = requestHeader.correctionField;
+		message.timestamp = responseOriginTimestamp;
+		message.requestingPortIdentity = requestHeader.sourcePortIdentity;
+		return EncodeMessage(message, buffer);
+	}
+
+	size_t ServerCore::WriteAnnounceMessage(std::span<uint8_t> buffer, PtpTimestamp originTimestamp) const
+	{
+		auto message{ NewMessage(PtpMessageType::Announce) };
+		message.header.sequenceId = m_announceSequenceId;
+		message.header.logMessageInterval = m_clock.LogAnnounceInterval;
+		message.timestamp = originTimestamp;
+		auto& announce{ message.announce };
+		announce.currentUtcOffset = m_clock.CurrentUtcOffset;
+		announce.grandmasterPriority1 = m_clock.Priority1;
+		announce.grandmasterClockQuality = m_clock.Quality;
+		announce.grandmasterPriority2 = m_clock.Priority2;
+		announce.grandmasterIdentity = m_clock.Identity;
+		announce.timeSource = m_clock.TimeSource;
+		return EncodeMessage(message, buffer);
+	}
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include "Utils.h"
+#include "PtpCodec.h"
+
+#include <chrono>
+#include <span>
+
+namespace PTP
+{
+	constexpr inline int8_t c_minLogSyncInterval{ -7 }; // 128 Sync per second
+	constexpr inline int8_t c_maxLogSyncInterval{ 4 };  // One Sync every 16 seconds
+	constexpr inline int8_t c_logAnnounceInterval{ -2 }; // Clients notice a lost master within a second
+	constexpr inline int8_t c_minLogAnnounceInterval{ -3 };
+	constexpr inline int8_t c_maxLogAnnounceInterval{ 4 };
+
+	// Sync/s as logMessageInterval. Throws std::runtime_error unless 'rate' is a power of two
+	// between 1/16 and 128, the only rates the header can advertise exactly.
+	int8_t SyncRateToLogInterval(double rate);
+	// Same for Announce/s, between 1/16 and 8.
+	int8_t AnnounceRateToLogInterval(double rate);
+
+	// What the server announces about its clock, the defaultDS of IEEE 1588 8.2.1. Clients
+	// pick the master with the lowest Priority1, Quality, Priority2, Identity in that order.
+	struct ClockProperties
+	{
+		ClockIdentity Identity{};          // All zero: the server derives one from its address
+		uint8_t Priority1{ 128 };
+		uint8_t Priority2{ 128 };
+		ClockQuality Quality{};
+		int16_t CurrentUtcOffset{ 37 };
+		uint8_t TimeSource{ 0xA0 };
+		int8_t LogAnnounceInterval{ c_logAnnounceInterval };
+	};
+
+	// The server's message construction without any I/O. Server drives it from sockets,
+	// PtpSim from a simulated network.
+	class ServerCore
+	{
+	public:
+		explicit ServerCore(int8_t logSyncInterval = c_logSyncInterval, const ClockProperties& clock = {}, uint8_t domainNumber = 0);
+
+		uint8_t GetDomainNumber() const { return m_domainNumber; }
+		int8_t GetLogSyncInterval() const { return m_logSyncInterval; }
+		std::chrono::nanoseconds GetSyncInterval() const;
+		std::chrono::nanoseconds GetAnnounceInterval() const;
+		const PortIdentity& GetPortIdentity() const { return m_portIdentity; }
+
+		size_t WriteSyncMessage(std::span<uint8_t> buffer) const;
+		// One-step: the Sync carries its own origin timestamp, and the time from taking it to the
+		// packet leaving in correctionField, so no Follow_Up is needed.
+		size_t WriteOneStepSyncMessage(std::span<uint8_t> buffer, PtpTimestamp originTimestamp, int64_t sendLatency) const;
+		size_t WriteFollowUpMessage(std::span<uint8_t> buffer, PtpTimestamp preciseOriginTimestamp) const;
+		// Two-step peer delay responder: the Pdelay_Resp carries the Pdelay_Req receive time (t2),
+		// the Pdelay_Resp_Follow_Up the Pdelay_Resp departure time (t3). Both return 0 for any
+		// message other than a Pdelay_Req.
+		size_t WritePeerDelayResponse(std::span<uint8_t> buffer, const PtpMessage& request, PtpTimestamp receiveTimestamp) const;
+		size_t WritePeerDelayResponseFollowUp(std::span<uint8_t> buffer, const PtpMessage& request, PtpTimestamp responseOriginTimestamp) const;
+		// Answers a Delay_Req with its receive timestamp, returns 0 for any other message.
+		size_t WriteDelayResponse(std::span<uint8_t> buffer, const PtpMessage& request, PtpTimestamp receiveTimestamp) const;
+		// The server is its own grandmaster: stepsRemoved 0, grandmasterIdentity its clock identity.
+		size_t WriteAnnounceMessage(std::span<uint8_t> buffer, PtpTimestamp originTimestamp) const;
+
+		uint16_t GetSequenceId() const { return m_sequenceId; }
+		void NextSequence() { ++m_sequenceId; }
+		void NextAnnounce() { ++m_announceSequenceId; }
+
+	private:
+		PtpMessage NewMessage(PtpMessageType type) const;
+
+		int8_t m_logSyncInterval;
+		uint8_t m_domainNumber;
+		ClockProperties m_clock;
+		PortIdentity m_portIdentity;
+		uint16_t m_sequenceId{ 0 };
+		uint16_t m_announceSequenceId{ 0 };
+	};
+}
@@ -0,0 +1,64 @@
+#include "PtpServerPool.h"
+
+#include <mutex>
+#include <thread>
+
+namespace PTP
+{
+	ServerPool::ServerPool(const std::string& ipAddress,
+		unsigned short eventPort,
+		unsigned short generalPort,
+		const ServerOptions& options)
+	{
+		const auto threads{ std::max<size_t>(options.Threads, 1) };
+		for (size_t shard = 0; shard < threads; ++shard)
+		{
+			ServerOptions shardOptions{ options };
+			shardOptions.ReusePort = true;
+			shardOptions.SendsSync = shard == 0;
+
+			// One thread per io_context, so the context can skip internal locking.
+			m_ioContexts.push_back(std::make_unique<boost::asio::io_context>(1));
+			m_servers.push_back(std::make_unique<Server>(
+				*m_ioContexts.back(), ipAddress, eventPort, generalPort, shardOptions));
+		}
+	}
+
+	void ServerPool::Run()
+	{
+		std::mutex errorMutex;
+		std::exception_ptr firstError;
+
+		const auto runShard = [&](boost::asio::io_context& ioContext)
+		{
+			try
+			{
+				ioContext.run();
+			}
+			catch (...)
+			{
+				{
+					std::scoped_lock lock(errorMutex);
+					if (!firstError)
+						firstError = std::current_exception();
+				}
+				Stop();
+			}
+		};
+
+		std::vector<std::jthread> workers;
+		for (size_t shard = 1; shard < m_ioContexts.size(); ++shard)
+			workers.emplace_back(runShard, std::ref(*m_ioContexts[shard]));
+
+		runShard(*m_ioContexts.front());
+		workers.clear();
+
+		RethrowException(firstError);
+	}
+
+	void ServerPool::Stop()
+	{
+		for (auto& ioContext : m_ioContexts)
+			ioContext->stop();
+	}
+}
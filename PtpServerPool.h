@@ -0,0 +1,38 @@
+#pragma once
+
+#include "PtpServer.h"
+
+#include <boost/asio.hpp>
+#include <memory>
+#include <vector>
+
+namespace PTP
+{
+	// Runs one Server per worker thread, each on its own io_context with its own
+	// SO_REUSEPORT event socket, so the kernel spreads Delay_Req across cores.
+	// Shard 0 is the only one that sends Sync/Follow_Up.
+	class ServerPool
+	{
+	public:
+
+		ServerPool(const std::string& ipAddress
+			, unsigned short eventPort
+			, unsigned short generalPort
+			, const ServerOptions& options);
+
+		ServerPool(const ServerPool&) = delete;
+		ServerPool& operator=(const ServerPool&) = delete;
+		ServerPool(ServerPool&&) = delete;
+		ServerPool& operator=(ServerPool&&) = delete;
+
+		// Blocks until every shard has stopped, rethrows the first shard failure.
+		void Run();
+		// Thread-safe, makes Run() return.
+		void Stop();
+
+	private:
+
+		std::vector<std::unique_ptr<boost::asio::io_context>> m_ioContexts;
+		std::vector<std::unique_ptr<Server>> m_servers;
+	};
+}
@@ -0,0 +1,642 @@
+// Deterministic network simulation of one PTP server and one client, optionally with a
+// standby server the client fails over to, or with several servers the client combines.
+// Runs ServerCore and ClientCore over in-memory links on a virtual clock, so hours of
+// protocol time take seconds of wall time and every run is reproduced by its seed.
+#include "PtpServerCore.h"
+#include "PtpClientCore.h"
+#include "Ensemble.h"
+#include "Simulation.h"
+#include "Logger.h"
+
+#include <boost/program_options.hpp>
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <format>
+#include <iostream>
+#include <memory>
+#include <span>
+#include <string>
+#include <vector>
+
+namespace
+{
+	// Server oscillator reading at true time zero, so timestamps look like current TAI.
+	constexpr int64_t c_epoch{ 1'700'000'000'000'000'000 };
+
+	constexpr int64_t ToNanoseconds(std::chrono::nanoseconds duration)
+	{
+		return duration.count();
+	}
+
+	struct SimOptions
+	{
+		uint64_t Seed{ 1 };
+		double Duration{ 3600.0 };             // Simulated seconds
+		double Report{ 300.0 };                // Simulated seconds between progress lines, 0 = none
+		double ConvergenceThreshold{ 1000.0 }; // Nanoseconds of true error
+		PTP::LinkOptions MasterToSlave;
+		PTP::LinkOptions SlaveToMaster;
+		PTP::OscillatorOptions Server;
+		PTP::OscillatorOptions Client;
+		int8_t LogSyncInterval{ PTP::c_logSyncInterval };
+		bool OneStep{ false };
+		PTP::DelayMechanism PathDelay{ PTP::DelayMechanism::EndToEnd };
+		double FailoverAt{ 0.0 };              // Simulated seconds until the primary server dies, 0 = no standby
+		size_t Servers{ 1 };                   // More than one: the client combines them (Ensemble)
+		double WorstJitter{ 0.0 };             // Nanoseconds, jitter of the last server's links, spread linearly from the first's
+		double FalseTicker{ 0.0 };             // Nanoseconds the last server's clock is off
+		PTP::DelayEstimator Estimator{ PTP::DelayEstimator::Scalar };
+		PTP::PrefilterOptions Prefilter;
+		PTP::ServoOptions Servo;
+		PTP::LogLevel LogLevel{ PTP::LogLevel::Warning };
+		std::string Capture;                   // Capture file of the client's timestamp sets, empty = none
+		size_t CaptureSize{ 256 };             // MiB
+	};
+
+	PTP::DelayDistribution ParseDelayDistribution(const std::string& distribution)
+	{
+		if (distribution == "constant")
+			return PTP::DelayDistribution::Constant;
+		if (distribution == "uniform")
+			return PTP::DelayDistribution::Uniform;
+		if (distribution == "normal")
+			return PTP::DelayDistribution::Normal;
+		if (distribution == "exponential")
+			return PTP::DelayDistribution::Exponential;
+		throw std::runtime_error("--Distribution must be one of constant, uniform, normal, exponential");
+	}
+
+	SimOptions ReadSimOptions(std::span<const char* const> args)
+	{
+		namespace po = boost::program_options;
+
+		SimOptions options;
+		// The command line uses microseconds for delays and offsets, the options nanoseconds.
+		double delay{ 50.0 }, jitter{ 5.0 }, asymmetry{ 0.0 }, reorderDelay{ 1000.0 }, initialOffset{ 1000.0 };
+		double serverDrift{ 0.0 }, clientDrift{ 20.0 }, wander{ 0.0 }, timestampNoise{ 0.0 };
+		double loss{ 0.0 }, reorder{ 0.0 }, syncRate{ 4.0 }, worstJitter{ -1.0 }, falseTicker{ 0.0 };
+		std::string distribution{ "exponential" }, estimator{ "scalar" }, delayMechanism{ "e2e" }, logLevel{ "warning" };
+		std::string prefilter{ "none" };
+
+		po::options_description description("PTP network simulation");
+		description.add_options()
+			("Seed", po::value(&options.Seed)->default_value(options.Seed), "random seed, equal seeds give identical runs")
+			("Duration", po::value(&options.Duration)->default_value(options.Duration), "simulated seconds")
+			("Report", po::value(&options.Report)->default_value(options.Report),
+				"simulated seconds between progress lines (0 = summary only)")
+			("Delay", po::value(&delay)->default_value(delay), "fixed one-way delay in us")
+			("Jitter", po::value(&jitter)->default_value(jitter), "scale of the random delay in us")
+			("Distribution", po::value(&distribution)->default_value(distribution),
+				"random delay: constant, uniform, normal, exponential")
+			("Asymmetry", po::value(&asymmetry)->default_value(asymmetry),
+				"extra master to slave delay in us (shows up as an offset error of half of it)")
+			("Loss", po::value(&loss)->default_value(loss), "probability a datagram is dropped")
+			("Reorder", po::value(&reorder)->default_value(reorder), "probability a datagram is held back")
+			("ReorderDelay", po::value(&reorderDelay)->default_value(reorderDelay), "maximum hold back in us")
+			("ServerDrift", po::value(&serverDrift)->default_value(serverDrift), "server oscillator error in ppm")
+			("ClientDrift", po::value(&clientDrift)->default_value(clientDrift), "client oscillator error in ppm")
+			("Wander", po::value(&wander)->default_value(wander),
+				"client frequency random walk in ppb per sqrt(second)")
+			("InitialOffset", po::value(&initialOffset)->default_value(initialOffset),
+				"client clock minus server clock at the start in us")
+			("TimestampNoise", po::value(&timestampNoise)->default_value(timestampNoise),
+				"RMS noise of every packet timestamp in ns")
+			("ConvergenceThreshold", po::value(&options.ConvergenceThreshold)->default_value(options.ConvergenceThreshold),
+				"true offset error in ns the client must stay within to count as converged")
+			("SyncRate", po::value(&syncRate)->default_value(syncRate), "Sync per second, a power of two from 0.0625 to 128")
+			("OneStep", po::bool_switch(&options.OneStep), "one-step Sync with the origin timestamp, no Follow_Up")
+			("DelayMechanism", po::value(&delayMechanism)->default_value(delayMechanism),
+				"path delay: e2e (Delay_Req/Delay_Resp) or p2p (Pdelay_Req/Pdelay_Resp/Pdelay_Resp_Follow_Up)")
+			("FailoverAt", po::value(&options.FailoverAt)->default_value(options.FailoverAt),
+				"add a standby server and stop the primary after this many simulated seconds (0 = no standby)")
+			("Servers", po::value(&options.Servers)->default_value(options.Servers),
+				"servers the client combines into one estimate, each over its own links")
+			("WorstJitter", po::value(&worstJitter),
+				"jitter of the last server's links in us, spread linearly from --Jitter over the servers (default --Jitter)")
+			("FalseTicker", po::value(&falseTicker)->default_value(falseTicker),
+				"offset of the last server's clock in us, for the client to reject")
+			("Estimator", po::value(&estimator)->default_value(estimator), "path delay estimator: scalar, drift")
+			("Prefilter", po::value(&prefilter)->default_value(prefilter),
+				"path delay samples the estimator sees: none, min, percentile, median of the last --PrefilterWindow")
+			("PrefilterWindow", po::value(&options.Prefilter.Window)->default_value(options.Prefilter.Window),
+				"path delay samples --Prefilter selects from (1-64)")
+			("PrefilterPercentile", po::value(&options.Prefilter.Percentile)->default_value(options.Prefilter.Percentile),
+				"fraction of the window for --Prefilter percentile")
+			("PrefilterGate", po::value(&options.Prefilter.GateSigma)->default_value(options.Prefilter.GateSigma),
+				"drop path delay samples this many innovation standard deviations off (0 = off)")
+			("ServoKp", po::value(&options.Servo.Kp)->default_value(options.Servo.Kp), "servo proportional gain")
+			("ServoKi", po::value(&options.Servo.Ki)->default_value(options.Servo.Ki), "servo integral gain")
+			("Capture", po::value(&options.Capture)->default_value(options.Capture),
+				"record the client's timestamp sets to this file for PtpReplay")
+			("CaptureSize", po::value(&options.CaptureSize)->default_value(options.CaptureSize), "capture file size in MiB")
+			("LogLevel", po::value(&logLevel)->default_value(logLevel), "debug, info, warning, error, off");
+
+		po::variables_map vm;
+		try
+		{
+			po::store(po::command_line_parser(static_cast<int>(args.size()), args.data())
+				.options(description)
+				.run(),
+				vm);
+			po::notify(vm);
+		}
+		catch (const po::error& ex)
+		{
+			throw std::runtime_error(std::string("Argument parsing error: ") + ex.what());
+		}
+
+		if (options.Duration <= 0.0 || delay < 0.0 || jitter < 0.0 || reorderDelay < 0.0 || timestampNoise < 0.0)
+			throw std::runtime_error("Duration must be positive, Delay, Jitter, ReorderDelay and TimestampNoise not negative");
+		if (loss < 0.0 || loss >= 1.0 || reorder < 0.0 || reorder > 1.0)
+			throw std::runtime_error("Loss must be in [0, 1), Reorder in [0, 1]");
+		if (options.FailoverAt < 0.0 || options.FailoverAt >= options.Duration)
+			throw std::runtime_error("FailoverAt must be in [0, Duration)");
+		if (options.Servers == 0 || (options.Servers > 1 && options.FailoverAt > 0.0))
+			throw std::runtime_error("Servers must be at least 1 and cannot be combined with FailoverAt");
+		if (options.Prefilter.Window == 0 || options.Prefilter.Window > PTP::c_maxPrefilterWindow ||
+			options.Prefilter.Percentile < 0.0 || options.Prefilter.Percentile > 1.0 || options.Prefilter.GateSigma < 0.0)
+			throw std::runtime_error("PrefilterWindow must be 1-64, PrefilterPercentile in [0, 1] and PrefilterGate not negative");
+		if (delay + asymmetry < 0.0)
+			throw std::runtime_error("Asymmetry must not make the master to slave delay negative");
+
+		options.SlaveToMaster.Delay = delay * 1000.0;
+		options.SlaveToMaster.Jitter = jitter * 1000.0;
+		options.SlaveToMaster.Distribution = ParseDelayDistribution(distribution);
+		options.SlaveToMaster.Loss = loss;
+		options.SlaveToMaster.Reorder = reorder;
+		options.SlaveToMaster.ReorderDelay = reorderDelay * 1000.0;
+		options.MasterToSlave = options.SlaveToMaster;
+		options.MasterToSlave.Delay += asymmetry * 1000.0;
+		options.WorstJitter = (worstJitter < 0.0 ? jitter : worstJitter) * 1000.0;
+		options.FalseTicker = falseTicker * 1000.0;
+
+		options.Server.Drift = serverDrift;
+		options.Server.Offset = c_epoch;
+		options.Server.TimestampNoise = timestampNoise;
+		options.Client.Drift = clientDrift;
+		options.Client.Wander = wander;
+		options.Client.Offset = c_epoch + std::llround(initialOffset * 1000.0);
+		options.Client.TimestampNoise = timestampNoise;
+
+		options.LogSyncInterval = PTP::SyncRateToLogInterval(syncRate);
+		options.PathDelay = PTP::ParseDelayMechanism(delayMechanism);
+		options.Estimator = PTP::ParseDelayEstimator(estimator);
+		options.Prefilter.Selection = PTP::ParsePrefilterSelection(prefilter);
+		options.LogLevel = PTP::ParseLogLevel(logLevel);
+		return options;
+	}
+
+	// A server with its own oscillator and a link in each direction to the client. The
+	// event/general port split does not matter in memory, all messages of a direction share
+	// one link.
+	struct SimulatedMaster
+	{
+		SimulatedMaster(PTP::VirtualTimeExecutor& executor,
+			std::mt19937_64& random,
+			const SimOptions& options,
+			const PTP::ClockProperties& clock,
+			size_t source = 0)
+			: toSlave(executor, random, options.MasterToSlave)
+			, fromSlave(executor, random, options.SlaveToMaster)
+			, oscillator(executor, random, options.Server)
+			, core(options.LogSyncInterval, clock)
+			, source(source)
+		{}
+
+		PTP::SimulatedLink toSlave;
+		PTP::SimulatedLink fromSlave;
+		PTP::SimulatedOscillator oscillator;
+		PTP::ServerCore core;
+		size_t source;        // Index into the client's Ensemble
+		bool failed{ false }; // Silent: sends nothing, answers nothing
+	};
+
+	// The options of ensemble server 'source': its share of the jitter spread, and the last
+	// one's clock off by FalseTicker. Server 0 keeps the plain options.
+	SimOptions EnsembleServerOptions(const SimOptions& options, size_t source)
+	{
+		auto server{ options };
+		const auto last{ options.Servers - 1 };
+		const auto jitter{ options.SlaveToMaster.Jitter +
+			(options.WorstJitter - options.SlaveToMaster.Jitter) * static_cast<double>(source) / static_cast<double>(last) };
+		server.MasterToSlave.Jitter = jitter;
+		server.SlaveToMaster.Jitter = jitter;
+		if (source == last)
+			server.Server.Offset += std::llround(options.FalseTicker);
+		return server;
+	}
+
+	// One server and one client. With FailoverAt a standby server of lower priority runs
+	// alongside, both send Announces, and the primary goes silent at that time. The standby's
+	// oscillator has the same offset and drift, so true error stays measured against the
+	// primary's. With Servers the primary is the first of several servers sending Syncs out of
+	// phase, each answering its own delay requests, and the client steers to their Ensemble.
+	class Simulation
+	{
+	public:
+		explicit Simulation(const SimOptions& options)
+			: m_options(options)
+			, m_random(options.Seed)
+			, m_primary(m_executor, m_random, options, { .Identity = { 0, 0, 0, 0xFF, 0xFE, 0, 0, 1 } })
+			, m_clientOscillator(m_executor, m_random, options.Client)
+			, m_clientClock(m_clientOscillator)
+			, m_client(&m_clientClock, options.Estimator, false, options.Servo, 0, options.Prefilter)
+			, m_syncInterval(ToNanoseconds(m_primary.core.GetSyncInterval()))
+		{
+			m_errors.reserve(static_cast<size_t>(options.Duration * 1e9 / m_syncInterval) + 1);
+			if (options.FailoverAt > 0.0)
+			{
+				m_standby = std::make_unique<SimulatedMaster>(m_executor, m_random, options,
+					PTP::ClockProperties{ .Identity = { 0, 0, 0, 0xFF, 0xFE, 0, 0, 2 }, .Priority1 = 200 });
+			}
+			if (options.Servers > 1)
+			{
+				m_ensemble = std::make_unique<PTP::Ensemble>(options.Servers, options.Estimator, 0, options.Prefilter);
+				for (size_t source = 1; source < options.Servers; ++source)
+				{
+					const auto id{ static_cast<uint8_t>(source + 1) };
+					m_others.push_back(std::make_unique<SimulatedMaster>(m_executor, m_random,
+						EnsembleServerOptions(options, source), PTP::ClockProperties{ .Identity = { 0, 0, 0, 0xFF, 0xFE, 0, 0, id } }, source));
+				}
+			}
+			if (!options.Capture.empty())
+			{
+				m_capture = std::make_unique<PTP::CaptureWriter>(options.Capture, options.CaptureSize << 20);
+				if (m_ensemble)
+				{
+					for (size_t source = 0; source < m_ensemble->Size(); ++source)
+						m_ensemble->GetCore(source).SetCapture(m_capture.get(), static_cast<uint8_t>(source));
+				}
+				else
+				{
+					m_client.SetCapture(m_capture.get(), 0);
+				}
+			}
+		}
+
+		void Run()
+		{
+			const auto end{ std::llround(m_options.Duration * 1e9) };
+			m_executor.PostPeriodic(0, m_syncInterval, [this, end]
+			{
+				SampleError();
+				SendSync(m_primary);
+				return m_executor.Now() < end;
+			});
+			if (m_standby)
+				StartFailover(end);
+			// Spread over the first half of the interval, clear of the delay requests' phase.
+			for (auto& other : m_others)
+			{
+				m_executor.PostPeriodic(m_syncInterval * static_cast<int64_t>(other->source) / static_cast<int64_t>(2 * m_options.Servers),
+					m_syncInterval, [this, master = other.get(), end]
+				{
+					SendSync(*master);
+					return m_executor.Now() < end;
+				});
+			}
+			// The client's timer is not aligned with the server's Sync schedule; half an interval
+			// out of phase keeps each Delay_Resp from racing the next Sync.
+			const auto delayRequestStart{ ToNanoseconds(PTP::c_delayRequestTimeout) + m_syncInterval / 2 };
+			m_executor.PostPeriodic(delayRequestStart, ToNanoseconds(PTP::c_delayRequestTimeout), [this, end]
+			{
+				SendDelayRequest();
+				return m_executor.Now() < end;
+			});
+			m_executor.PostPeriodic(ToNanoseconds(PTP::c_cleanupInterval), ToNanoseconds(PTP::c_cleanupInterval), [this, end]
+			{
+				m_client.RemoveStaleEntries(ClientSteadyTime());
+				for (size_t source = 0; m_ensemble && source < m_ensemble->Size(); ++source)
+					m_ensemble->GetCore(source).RemoveStaleEntries(ClientSteadyTime());
+				return m_executor.Now() < end;
+			});
+			if (m_options.Report > 0.0)
+			{
+				const auto interval{ std::llround(m_options.Report * 1e9) };
+				m_executor.PostPeriodic(interval, interval, [this, end]
+				{
+					PrintProgress();
+					return m_executor.Now() < end;
+				});
+			}
+
+			const auto wallStart{ std::chrono::steady_clock::now() };
+			m_events = m_executor.RunUntil(end);
+			m_wallTime = std::chrono::steady_clock::now() - wallStart;
+			PTP::FlushLog();
+			PrintSummary();
+		}
+
+	private:
+		// The client's monotonic clock is its free-running oscillator.
+		std::chrono::steady_clock::time_point ClientSteadyTime()
+		{
+			return std::chrono::steady_clock::time_point(std::chrono::nanoseconds(m_clientOscillator.Read()));
+		}
+
+		// Announces only run in the failover scenario, so the other scenarios keep the packet
+		// sequence, and with it the results, their seeds always gave.
+		void StartFailover(int64_t end)
+		{
+			const auto announceInterval{ ToNanoseconds(m_primary.core.GetAnnounceInterval()) };
+			for (auto* master : { &m_primary, m_standby.get() })
+			{
+				m_executor.PostPeriodic(0, announceInterval, [this, master, end]
+				{
+					SendAnnounce(*master);
+					return m_executor.Now() < end;
+				});
+			}
+			// Out of phase with the primary, as two independent servers would be.
+			m_executor.PostPeriodic(m_syncInterval / 3, m_syncInterval, [this, end]
+			{
+				SendSync(*m_standby);
+				return m_executor.Now() < end;
+			});
+			m_executor.Post(std::llround(m_options.FailoverAt * 1e9), [this]
+			{
+				m_primary.failed = true;
+				m_failureTime = m_executor.Now();
+				m_masterChangesAtFailure = m_client.GetMasterChanges();
+			});
+		}
+
+		void SendAnnounce(SimulatedMaster& master)
+		{
+			if (master.failed)
+				return;
+			const auto size{ master.core.WriteAnnounceMessage(m_serverBuffer, master.oscillator.Timestamp()) };
+			master.toSlave.Send(std::span(m_serverBuffer.data(), size), [this, &master](auto datagram) { OnClientReceive(master, datagram); });
+			master.core.NextAnnounce();
+		}
+
+		void SendSync(SimulatedMaster& master)
+		{
+			if (master.failed)
+				return;
+			const auto t1{ master.oscillator.Timestamp() };
+			if (m_options.OneStep)
+			{
+				// The oscillator timestamp is the departure time, nothing left for correctionField.
+				const auto size{ master.core.WriteOneStepSyncMessage(m_serverBuffer, t1, 0) };
+				master.toSlave.Send(std::span(m_serverBuffer.data(), size), [this, &master](auto datagram) { OnClientReceive(master, datagram); });
+				master.core.NextSequence();
+				return;
+			}
+
+			const auto syncSize{ master.core.WriteSyncMessage(m_serverBuffer) };
+			master.toSlave.Send(std::span(m_serverBuffer.data(), syncSize), [this, &master](auto datagram) { OnClientReceive(master, datagram); });
+
+			const auto followUpSize{ master.core.WriteFollowUpMessage(m_serverBuffer, t1) };
+			master.toSlave.Send(std::span(m_serverBuffer.data(), followUpSize), [this, &master](auto datagram) { OnClientReceive(master, datagram); });
+			master.core.NextSequence();
+		}
+
+		// Delay requests go where the client's master selection points, as Client does.
+		SimulatedMaster& SelectedMaster()
+		{
+			const auto& master{ m_client.GetMasters().GetMasterIdentity() };
+			return m_standby && master == m_standby->core.GetPortIdentity() ? *m_standby : m_primary;
+		}
+
+		// The ensemble's sources each ask their own server.
+		void SendDelayRequest()
+		{
+			if (!m_ensemble)
+			{
+				SendDelayRequest(m_client, SelectedMaster());
+				return;
+			}
+			SendDelayRequest(m_ensemble->GetCore(0), m_primary);
+			for (auto& other : m_others)
+				SendDelayRequest(m_ensemble->GetCore(other->source), *other);
+		}
+
+		void SendDelayRequest(PTP::ClientCore& client, SimulatedMaster& master)
+		{
+			const auto size{ m_options.PathDelay == PTP::DelayMechanism::PeerToPeer
+				? client.WritePeerDelayRequest(m_clientBuffer, m_clientOscillator.Timestamp())
+				: client.WriteDelayRequest(m_clientBuffer, m_clientOscillator.Timestamp()) };
+			master.fromSlave.Send(std::span(m_clientBuffer.data(), size), [this, &master](auto datagram) { OnServerReceive(master, datagram); });
+		}
+
+		void OnServerReceive(SimulatedMaster& master, std::span<const uint8_t> datagram)
+		{
+			if (master.failed)
+				return;
+			const auto t4{ master.oscillator.Timestamp() };
+			const auto message{ PTP::DecodeMessage(datagram) };
+			if (!message)
+			{
+				++m_malformed;
+				return;
+			}
+			if (m_options.PathDelay == PTP::DelayMechanism::PeerToPeer)
+			{
+				const auto size{ master.core.WritePeerDelayResponse(m_serverBuffer, *message, t4) };
+				if (size == 0)
+					return;
+				const auto t3{ master.oscillator.Timestamp() };
+				master.toSlave.Send(std::span(m_serverBuffer.data(), size), [this, &master](auto response) { OnClientReceive(master, response); });
+				const auto followUpSize{ master.core.WritePeerDelayResponseFollowUp(m_serverBuffer, *message, t3) };
+				master.toSlave.Send(std::span(m_serverBuffer.data(), followUpSize), [this, &master](auto response) { OnClientReceive(master, response); });
+				return;
+			}
+
+			const auto size{ master.core.WriteDelayResponse(m_serverBuffer, *message, t4) };
+			if (size != 0)
+				master.toSlave.Send(std::span(m_serverBuffer.data(), size), [this, &master](auto response) { OnClientReceive(master, response); });
+		}
+
+		void OnClientReceive(const SimulatedMaster& master, std::span<const uint8_t> datagram)
+		{
+			const auto t2{ m_clientOscillator.Timestamp() };
+			const auto message{ PTP::DecodeMessage(datagram) };
+			if (!message)
+			{
+				++m_malformed;
+				return;
+			}
+			if (m_ensemble)
+			{
+				if (const auto estimate = m_ensemble->OnMessage(master.source, *message, t2, ClientSteadyTime()))
+					m_client.SteerClock(estimate->offset, estimate->time, ClientSteadyTime());
+				return;
+			}
+			m_client.OnMessage(*message, t2, ClientSteadyTime());
+			if (m_failureTime && !m_failoverTime && m_client.GetMasterChanges() > m_masterChangesAtFailure)
+				m_failoverTime = m_executor.Now() - *m_failureTime;
+		}
+
+		// True error: what the client's disciplined clock reads minus the server's clock.
+		int64_t TrueError()
+		{
+			return m_clientClock.Now() - m_primary.oscillator.Read();
+		}
+
+		void SampleError()
+		{
+			const auto error{ TrueError() };
+			if (std::abs(error) > m_options.ConvergenceThreshold)
+				m_lastViolation = m_executor.Now();
+			m_errors.push_back(static_cast<double>(error));
+
+			// The second half only, so the estimator's start up does not swamp what the
+			// pre-filter does to it.
+			const auto delay{ PathDelayCore().GetMeanPathDelay() };
+			if (delay && static_cast<double>(m_executor.Now()) * 1e-9 >= m_options.Duration / 2.0)
+			{
+				const auto delayError{ *delay * 1000.0 - TrueMeanPathDelay() };
+				m_delayErrorSquares += delayError * delayError;
+				++m_delaySamples;
+			}
+		}
+
+		// The ensemble's client core only steers; path delay is the primary's source's.
+		const PTP::ClientCore& PathDelayCore() const
+		{
+			return m_ensemble ? m_ensemble->GetCore(0) : m_client;
+		}
+
+		double TrueMeanPathDelay() const
+		{
+			return (m_primary.toSlave.MeanDelay() + m_primary.fromSlave.MeanDelay()) / 2.0;
+		}
+
+		// Servo frequency at which the client clock runs at the server's rate.
+		double IdealFrequency() const
+		{
+			return ((1.0 + m_primary.oscillator.GetFrequency() * 1e-9) / (1.0 + m_clientOscillator.GetFrequency() * 1e-9) - 1.0) * 1e9;
+		}
+
+		void PrintProgress()
+		{
+			const auto delay{ PathDelayCore().GetMeanPathDelay() };
+			const auto offset{ m_client.GetOffsetFromMaster() };
+			std::cout << std::format("t={:.0f} s | true error: {:+} ns | offset: {} | path delay: {} us | frequency: {:+.1f} ppb (ideal {:+.1f})\n",
+				static_cast<double>(m_executor.Now()) * 1e-9,
+				TrueError(),
+				offset ? std::format("{:+} ns", *offset) : std::string("-"),
+				delay ? std::format("{:.3f}", *delay) : std::string("-"),
+				m_client.GetServo().GetFrequency(),
+				IdealFrequency());
+		}
+
+		void PrintSummary() const
+		{
+			// Steady state starts at the last sample outside the threshold.
+			const auto settled{ m_lastViolation ? static_cast<size_t>(*m_lastViolation / m_syncInterval) + 1 : 0 };
+			double sum{ 0.0 }, sumOfSquares{ 0.0 }, maximum{ 0.0 };
+			for (size_t i = settled; i < m_errors.size(); ++i)
+			{
+				sum += m_errors[i];
+				sumOfSquares += m_errors[i] * m_errors[i];
+				maximum = std::max(maximum, std::abs(m_errors[i]));
+			}
+			const auto samples{ m_errors.size() - std::min(settled, m_errors.size()) };
+
+			const auto simulated{ m_options.Duration };
+			const auto wall{ std::chrono::duration<double>(m_wallTime).count() };
+			const auto servoConvergence{ m_client.GetServo().GetConvergenceTime() };
+			const auto delay{ PathDelayCore().GetMeanPathDelay() };
+			std::cout << std::format(
+				"seed: {} | simulated: {:.0f} s | wall: {:.3f} s | speedup: {:.0f}x | events: {}\n"
+				"master->slave sent: {} lost: {} reordered: {} | slave->master sent: {} lost: {} reordered: {} | malformed: {}\n"
+				"path delay: {} us (true mean {:.3f}, error rms {:.1f} ns, {} gated) | frequency: {:+.1f} ppb (ideal {:+.1f})\n"
+				"servo converged: {} | within {:.0f} ns after: {}\n"
+				"steady state over {} samples: mean {:+.1f} ns | rms {:.1f} ns | max {:.0f} ns\n",
+				m_options.Seed, simulated, wall, wall > 0.0 ? simulated / wall : 0.0, m_events,
+				m_primary.toSlave.Sent(), m_primary.toSlave.Lost(), m_primary.toSlave.Reordered(),
+				m_primary.fromSlave.Sent(), m_primary.fromSlave.Lost(), m_primary.fromSlave.Reordered(), m_malformed,
+				delay ? std::format("{:.3f}", *delay) : std::string("-"), TrueMeanPathDelay() * 1e-3,
+				m_delaySamples != 0 ? std::sqrt(m_delayErrorSquares / static_cast<double>(m_delaySamples)) : 0.0,
+				PathDelayCore().GetDelayPrefilter().GetRejected(),
+				m_client.GetServo().GetFrequency(), IdealFrequency(),
+				servoConvergence ? std::format("{:.3f} s", *servoConvergence) : std::string("no"),
+				m_options.ConvergenceThreshold,
+				settled < m_errors.size()
+					? std::format("{:.3f} s", static_cast<double>(settled) * static_cast<double>(m_syncInterval) * 1e-9)
+					: std::string("never"),
+				samples,
+				samples != 0 ? sum / samples : 0.0,
+				samples != 0 ? std::sqrt(sumOfSquares / samples) : 0.0,
+				maximum);
+			if (m_failureTime)
+				PrintFailover();
+			if (m_ensemble)
+				PrintEnsemble();
+		}
+
+		void PrintEnsemble() const
+		{
+			std::string sources;
+			for (size_t source = 0; source < m_ensemble->Size(); ++source)
+			{
+				const auto& state{ m_ensemble->GetSource(source) };
+				sources += std::format("{}{}: {:.2f}{}", source == 0 ? "" : " | ", source, state.weight,
+					state.falseticker ? " (falseticker)" : "");
+			}
+			const auto estimate{ m_ensemble->GetEstimate() };
+			std::cout << std::format("ensemble weights: {} | uncertainty: {}\n", sources,
+				estimate ? std::format("{:.1f} ns", estimate->uncertainty) : std::string("-"));
+		}
+
+		void PrintFailover() const
+		{
+			constexpr int64_t c_window{ 10'000'000'000 }; // Nanoseconds after the failure
+			const auto first{ static_cast<size_t>(*m_failureTime / m_syncInterval) };
+			const auto last{ std::min(m_errors.size(), static_cast<size_t>((*m_failureTime + c_window) / m_syncInterval) + 1) };
+			double maximum{ 0.0 };
+			for (size_t i = first; i < last; ++i)
+				maximum = std::max(maximum, std::abs(m_errors[i]));
+			std::cout << std::format(
+				"failover: primary silent at {:.3f} s | standby selected after {} | max error over the next {} s: {:.0f} ns\n",
+				static_cast<double>(*m_failureTime) * 1e-9,
+				m_failoverTime ? std::format("{:.1f} ms", static_cast<double>(*m_failoverTime) * 1e-6) : std::string("never"),
+				c_window / 1'000'000'000, maximum);
+		}
+
+		SimOptions m_options;
+		std::mt19937_64 m_random;
+		PTP::VirtualTimeExecutor m_executor;
+		SimulatedMaster m_primary;
+		PTP::SimulatedOscillator m_clientOscillator;
+		PTP::SimulatedClock m_clientClock;
+		PTP::ClientCore m_client;
+		std::unique_ptr<SimulatedMaster> m_standby; // FailoverAt only
+		std::unique_ptr<PTP::Ensemble> m_ensemble;  // Servers > 1 only
+		std::vector<std::unique_ptr<SimulatedMaster>> m_others; // Ensemble servers after the primary
+		std::unique_ptr<PTP::CaptureWriter> m_capture;          // Capture only
+		int64_t m_syncInterval;
+		std::array<uint8_t, PTP::Wire::c_maxMessageSize> m_serverBuffer{};
+		std::array<uint8_t, PTP::Wire::c_maxMessageSize> m_clientBuffer{};
+		std::vector<double> m_errors; // True error at every Sync
+		double m_delayErrorSquares{ 0.0 }; // Path delay estimate minus true mean, at every Sync of the second half
+		uint64_t m_delaySamples{ 0 };
+		std::optional<int64_t> m_lastViolation;
+		std::optional<int64_t> m_failureTime;  // When the primary went silent
+		std::optional<int64_t> m_failoverTime; // From then until the client selected another master
+		uint64_t m_masterChangesAtFailure{ 0 };
+		uint64_t m_malformed{ 0 };
+		size_t m_events{ 0 };
+		std::chrono::steady_clock::duration m_wallTime{};
+	};
+}
+
+int main(int argc, char* argv[])
+{
+	try
+	{
+		const auto options{ ReadSimOptions(std::span(argv, argc)) };
+		PTP::SetLogLevel(options.LogLevel);
+		Simulation(options).Run();
+		return EXIT_SUCCESS;
+	}
+	catch (const std::exception& e)
+	{
+		std::cerr << "Error: " << e.what() << std::endl;
+		return EXIT_FAILURE;
+	}
+}
@@ -0,0 +1,531 @@
+// Behaviour checks for the parts that do no I/O: SessionTable against a reference model,
+// MasterSelector, the codec and ClientCore's exchange matching. Prints every failed check and
+// exits non-zero if there was one, so it can gate a build.
+#include "SessionTable.h"
+#include "Bmca.h"
+#include "PtpCodec.h"
+#include "PtpClientCore.h"
+#include "PtpServerCore.h"
+#include "Logger.h"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <format>
+#include <iostream>
+#include <list>
+#include <optional>
+#include <random>
+#include <source_location>
+#include <span>
+#include <string_view>
+#include <vector>
+
+namespace
+{
+	using PTP::Admission;
+	using namespace std::chrono_literals;
+
+	size_t g_checks{ 0 };
+	size_t g_failures{ 0 };
+
+	bool Check(bool condition, std::string_view what, std::source_location location = std::source_location::current())
+	{
+		++g_checks;
+		if (!condition)
+		{
+			++g_failures;
+			std::cout << std::format("FAILED line {}: {}\n", location.line(), what);
+		}
+		return condition;
+	}
+
+	std::string_view ToString(Admission admission)
+	{
+		switch (admission)
+		{
+			case Admission::Accepted: return "accepted";
+			case Admission::RateLimited: return "rate limited";
+			case Admission::Overflowed: return "overflowed";
+			case Admission::Rejected: return "rejected";
+		}
+		return "?";
+	}
+
+	PTP::SessionKey MakeKey(uint32_t client)
+	{
+		PTP::SessionKey key;
+		key.address = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xFF, 0xFF, 127, 1,
+			static_cast<uint8_t>(client >> 8), static_cast<uint8_t>(client) };
+		key.port = 1319;
+		key.portIdentity[7] = static_cast<uint8_t>(client);
+		return key;
+	}
+
+	// What SessionTable promises, written the obvious way: a list in LRU order searched
+	// linearly, with the same token bucket, in-flight bound, eviction and rejection rules.
+	class SessionModel
+	{
+	public:
+		struct Entry
+		{
+			PTP::SessionKey key;
+			PTP::SessionCounters counters;
+			double tokens;
+			int64_t lastRefill;
+			uint32_t inFlight{ 0 };
+		};
+
+		explicit SessionModel(const PTP::SessionTableOptions& options) : m_options(options) {}
+
+		Admission Admit(const PTP::SessionKey& key, int64_t now)
+		{
+			auto entry{ std::ranges::find(m_entries, key, &Entry::key) };
+			if (entry == m_entries.end())
+			{
+				if (m_entries.size() >= std::max<size_t>(m_options.Capacity, 1))
+				{
+					if (m_entries.back().inFlight > 0)
+					{
+						++m_stats.rejected;
+						return Admission::Rejected;
+					}
+					m_entries.pop_back();
+					++m_stats.evicted;
+				}
+				m_entries.push_front(Entry{ .key = key, .counters = {}, .tokens = m_options.Burst, .lastRefill = now });
+				++m_stats.created;
+			}
+			else
+			{
+				m_entries.splice(m_entries.begin(), m_entries, entry);
+			}
+			m_stats.sessions = m_entries.size();
+
+			auto& session{ m_entries.front() };
+			++session.counters.requests;
+			if (m_options.Rate > 0.0)
+			{
+				const auto elapsed{ static_cast<double>(std::max<int64_t>(now - session.lastRefill, 0)) * 1e-9 };
+				session.tokens = std::min(m_options.Burst, session.tokens + elapsed * m_options.Rate);
+				session.lastRefill = now;
+				if (session.tokens < 1.0)
+				{
+					++session.counters.rateLimited;
+					++m_stats.rateLimited;
+					return Admission::RateLimited;
+				}
+			}
+			if (session.inFlight >= m_options.MaxInFlight)
+			{
+				++session.counters.overflowed;
+				++m_stats.overflowed;
+				return Admission::Overflowed;
+			}
+			if (m_options.Rate > 0.0)
+				session.tokens -= 1.0;
+			++session.inFlight;
+			return Admission::Accepted;
+		}
+
+		void Complete(const PTP::SessionKey& key, bool answered)
+		{
+			auto& entry{ *std::ranges::find(m_entries, key, &Entry::key) };
+			--entry.inFlight;
+			if (answered)
+				++entry.counters.answered;
+		}
+
+		const std::list<Entry>& GetEntries() const { return m_entries; }
+		const PTP::SessionTableStats& GetStats() const { return m_stats; }
+
+	private:
+		PTP::SessionTableOptions m_options;
+		std::list<Entry> m_entries; // Most recently seen first
+		PTP::SessionTableStats m_stats;
+	};
+
+	bool SameSession(const PTP::Session& session, const SessionModel::Entry& entry)
+	{
+		return session.key == entry.key && session.tokens == entry.tokens && session.lastRefill == entry.lastRefill &&
+			session.inFlight == entry.inFlight && session.counters.requests == entry.counters.requests &&
+			session.counters.answered == entry.counters.answered &&
+			session.counters.rateLimited == entry.counters.rateLimited &&
+			session.counters.overflowed == entry.counters.overflowed;
+	}
+
+	bool SameStats(const PTP::SessionTableStats& a, const PTP::SessionTableStats& b)
+	{
+		return a.sessions == b.sessions && a.created == b.created && a.evicted == b.evicted &&
+			a.rateLimited == b.rateLimited && a.overflowed == b.overflowed && a.rejected == b.rejected;
+	}
+
+	// Random admits and completions from more clients than fit, compared against the model after
+	// every step. Every client is looked up now and then as well, so an index left inconsistent by
+	// a backward-shift erase shows up as a session that is lost or found twice.
+	void CheckSessionTableAgainstModel(const PTP::SessionTableOptions& options, uint32_t clients, size_t steps, uint64_t seed)
+	{
+		const auto name{ std::format("session table capacity {} rate {} burst {} in flight {}",
+			options.Capacity, options.Rate, options.Burst, options.MaxInFlight) };
+		PTP::SessionTable table(options);
+		SessionModel model(options);
+		std::mt19937_64 random(seed);
+		struct Pending
+		{
+			uint32_t session;
+			uint32_t client;
+		};
+		std::vector<Pending> pending;
+		int64_t now{ 0 };
+
+		for (size_t step{ 0 }; step < steps; ++step)
+		{
+			now += std::uniform_int_distribution<int64_t>(0, 2'000'000)(random);
+			if (!pending.empty() && random() % 3 == 0)
+			{
+				const auto index{ random() % pending.size() };
+				const bool answered{ random() % 8 != 0 };
+				table.Complete(pending[index].session, answered);
+				model.Complete(MakeKey(pending[index].client), answered);
+				pending[index] = pending.back();
+				pending.pop_back();
+			}
+			else
+			{
+				// Skewed towards low client numbers, so some clients stay hot and others get evicted
+				const auto client{ static_cast<uint32_t>(std::min<uint64_t>(random() % clients, random() % clients)) };
+				const auto key{ MakeKey(client) };
+				const auto expected{ model.Admit(key, now) };
+				const auto [admission, session]{ table.Admit(key, now) };
+				if (!Check(admission == expected, std::format("{} step {}: {} instead of {}", name, step,
+					ToString(admission), ToString(expected))))
+				{
+					return;
+				}
+				if (admission == Admission::Accepted)
+					pending.push_back({ session, client });
+				Check((admission == Admission::Rejected) == (session == PTP::SessionTable::c_noSession),
+					name + ": a session exactly when not rejected");
+			}
+
+			if (!Check(SameStats(table.GetStats(), model.GetStats()), std::format("{} step {}: stats", name, step)))
+				return;
+			auto expected{ model.GetEntries().begin() };
+			bool same{ true };
+			table.ForEach([&](const PTP::Session& session)
+			{
+				same = same && expected != model.GetEntries().end() && SameSession(session, *expected);
+				if (expected != model.GetEntries().end())
+					++expected;
+			});
+			if (!Check(same && expected == model.GetEntries().end(), std::format("{} step {}: sessions in LRU order", name, step)))
+				return;
+
+			if (step % 16 == 0)
+			{
+				for (uint32_t client{ 0 }; client < clients; ++client)
+				{
+					const auto key{ MakeKey(client) };
+					const auto* session{ table.Find(key) };
+					const auto entry{ std::ranges::find(model.GetEntries(), key, &SessionModel::Entry::key) };
+					const bool found{ entry != model.GetEntries().end() };
+					if (!Check(found ? session && SameSession(*session, *entry) : !session,
+						std::format("{} step {}: lookup of client {}", name, step, client)))
+					{
+						return;
+					}
+				}
+			}
+		}
+
+		// Otherwise the run proves little
+		const auto& stats{ table.GetStats() };
+		Check(stats.evicted > 0 && stats.rejected > 0 && stats.overflowed > 0 && (options.Rate == 0.0 || stats.rateLimited > 0),
+			name + ": every admission path taken");
+	}
+
+	void CheckSessionTable()
+	{
+		// Token bucket: a burst, then one request per refill interval
+		{
+			PTP::SessionTable table({ .Capacity = 4, .Rate = 10.0, .Burst = 3.0, .MaxInFlight = 100 });
+			const auto key{ MakeKey(1) };
+			for (int request{ 0 }; request < 3; ++request)
+				Check(table.Admit(key, 0).admission == Admission::Accepted, "burst admitted");
+			Check(table.Admit(key, 0).admission == Admission::RateLimited, "empty bucket limits");
+			Check(table.Admit(key, 50'000'000).admission == Admission::RateLimited, "half a token is not enough");
+			Check(table.Admit(key, 100'000'000).admission == Admission::Accepted, "one token after 1 / Rate");
+			Check(table.Admit(key, 100'000'000).admission == Admission::RateLimited, "and only one");
+			Check(table.Admit(key, 10'000'000'000).admission == Admission::Accepted, "refilled after a pause");
+			Check(table.Find(key)->tokens == 2.0, "refill is capped at Burst");
+			Check(table.GetStats().rateLimited == 3, "rate limited count");
+		}
+
+		// In-flight bound: Overflowed until a response completes
+		{
+			PTP::SessionTable table({ .Capacity = 4, .Rate = 0.0, .MaxInFlight = 2 });
+			const auto key{ MakeKey(1) };
+			const auto first{ table.Admit(key, 0) };
+			Check(table.Admit(key, 0).admission == Admission::Accepted, "second in flight");
+			Check(table.Admit(key, 0).admission == Admission::Overflowed, "third overflows");
+			table.Complete(first.session, true);
+			Check(table.Admit(key, 0).admission == Admission::Accepted, "room again after Complete");
+			Check(table.Find(key)->counters.answered == 1 && table.Find(key)->counters.overflowed == 1, "counters");
+		}
+
+		// Eviction takes the least recently seen idle session; a busy one turns newcomers away
+		{
+			PTP::SessionTable table({ .Capacity = 2, .Rate = 0.0, .MaxInFlight = 4 });
+			const auto a{ table.Admit(MakeKey(1), 0) };
+			const auto b{ table.Admit(MakeKey(2), 0) };
+			Check(table.Admit(MakeKey(3), 0).admission == Admission::Rejected, "rejected while every session is busy");
+			Check(table.Find(MakeKey(3)) == nullptr && table.GetStats().rejected == 1, "rejected client has no session");
+			table.Complete(b.session, true);
+			Check(table.Admit(MakeKey(3), 0).admission == Admission::Rejected, "the LRU session is still busy");
+			table.Complete(a.session, true);
+			Check(table.Admit(MakeKey(3), 0).admission == Admission::Accepted, "LRU session evicted once idle");
+			Check(table.Find(MakeKey(1)) == nullptr, "evicted client is gone");
+			Check(table.Find(MakeKey(2)) != nullptr && table.Find(MakeKey(3)) != nullptr, "the others stay");
+			Check(table.GetStats().evicted == 1 && table.GetStats().sessions == 2, "eviction stats");
+		}
+
+		// Small tables keep the index short, so probe runs wrap around it and erases shift often.
+		CheckSessionTableAgainstModel({ .Capacity = 1, .Rate = 0.0, .MaxInFlight = 1 }, 4, 2'000, 1);
+		CheckSessionTableAgainstModel({ .Capacity = 5, .Rate = 0.0, .MaxInFlight = 2 }, 12, 20'000, 2);
+		CheckSessionTableAgainstModel({ .Capacity = 48, .Rate = 2.0, .Burst = 4.0, .MaxInFlight = 2 }, 160, 50'000, 3);
+		CheckSessionTableAgainstModel({ .Capacity = 64, .Rate = 4.0, .Burst = 8.0, .MaxInFlight = 4 }, 96, 50'000, 4);
+	}
+
+	PTP::PtpMessage MakeAnnounce(const PTP::PortIdentity& sender, uint8_t priority1, uint16_t stepsRemoved = 0)
+	{
+		PTP::PtpMessage message;
+		message.header.messageType = PTP::PtpMessageType::Announce;
+		message.header.sourcePortIdentity = sender;
+		message.header.logMessageInterval = 0; // 1 s
+		message.announce.grandmasterPriority1 = priority1;
+		std::copy_n(sender.begin(), message.announce.grandmasterIdentity.size(), message.announce.grandmasterIdentity.begin());
+		message.announce.stepsRemoved = stepsRemoved;
+		return message;
+	}
+
+	PTP::PortIdentity MakePort(uint8_t number)
+	{
+		return PTP::MakePortIdentity({ 0x00, 0x1B, 0x19, 0xFF, 0xFE, 0x00, 0x00, number }, 1);
+	}
+
+	void CheckMasterSelection()
+	{
+		const std::chrono::steady_clock::time_point start{};
+		const auto a{ MakePort(1) };
+		const auto b{ MakePort(2) };
+
+		PTP::MasterSelector selector;
+		Check(!selector.OnAnnounce(MakeAnnounce(a, 128), start), "one Announce does not qualify");
+		Check(selector.GetMaster() == nullptr, "no master before the threshold");
+		Check(selector.OnAnnounce(MakeAnnounce(a, 128), start + 1s), "second Announce selects");
+		Check(selector.GetMaster() && selector.GetMaster()->portIdentity == a, "first master");
+
+		Check(!selector.OnAnnounce(MakeAnnounce(b, 100), start + 1s), "better master still has to qualify");
+		Check(selector.OnAnnounce(MakeAnnounce(b, 100), start + 2s), "better master selected once qualified");
+		Check(selector.GetMasterIdentity() == b, "lower priority1 wins");
+		Check(!selector.OnAnnounce(MakeAnnounce(a, 128), start + 2s), "worse master does not take over");
+
+		Check(!selector.OnAnnounce(MakeAnnounce(MakePort(3), 1, 255), start + 2s), "stepsRemoved 255 ignored");
+		Check(selector.GetForeignMasterCount() == 2, "looped Announce not recorded");
+
+		// b goes silent: it is lost after c_announceReceiptTimeout of its 1 s intervals
+		Check(!selector.OnAnnounce(MakeAnnounce(a, 128), start + 4s), "b within its receipt timeout");
+		Check(selector.OnAnnounce(MakeAnnounce(a, 128), start + 5s + 1ms), "failover to a once b times out");
+		Check(selector.GetMasterIdentity() == a && selector.GetForeignMasterCount() == 1, "a followed, b dropped");
+
+		// a goes silent as well: nothing selected, but its identity is kept for holdover
+		Check(!selector.Expire(start + 9s), "losing the last master changes nothing to follow");
+		Check(selector.GetMaster() == nullptr && selector.GetMasterIdentity() == a, "holdover on the lost master");
+
+		// Same grandmaster over two paths: fewer steps, then the lower sender port identity
+		PTP::ForeignMaster near{ .portIdentity = MakePort(9), .announce = MakeAnnounce(a, 128, 1).announce };
+		PTP::ForeignMaster far{ .portIdentity = MakePort(8), .announce = MakeAnnounce(a, 128, 2).announce };
+		Check(PTP::CompareMasters(near, far) < 0 && PTP::CompareMasters(far, near) > 0, "stepsRemoved ranks paths");
+		far.announce.stepsRemoved = 1;
+		Check(PTP::CompareMasters(far, near) < 0, "sender port identity breaks ties");
+		Check(PTP::CompareMasters(near, near) == 0, "same port compares equal");
+
+		PTP::MasterSelector crowded;
+		for (uint8_t port{ 0 }; port <= PTP::c_maxForeignMasters; ++port)
+			crowded.OnAnnounce(MakeAnnounce(MakePort(port), 128), start);
+		Check(crowded.GetForeignMasterCount() == PTP::c_maxForeignMasters, "foreign master table is bounded");
+	}
+
+	bool SameTimestamp(const PTP::PtpTimestamp& a, const PTP::PtpTimestamp& b)
+	{
+		return a.Seconds() == b.Seconds() && a.to_nanoseconds() == b.to_nanoseconds();
+	}
+
+	bool SameMessage(const PTP::PtpMessage& a, const PTP::PtpMessage& b)
+	{
+		const auto& x{ a.header };
+		const auto& y{ b.header };
+		const auto& p{ a.announce };
+		const auto& q{ b.announce };
+		const bool announce{ x.messageType != PTP::PtpMessageType::Announce || (p.currentUtcOffset == q.currentUtcOffset &&
+			p.grandmasterPriority1 == q.grandmasterPriority1 && p.grandmasterClockQuality == q.grandmasterClockQuality &&
+			p.grandmasterPriority2 == q.grandmasterPriority2 && p.grandmasterIdentity == q.grandmasterIdentity &&
+			p.stepsRemoved == q.stepsRemoved && p.timeSource == q.timeSource) };
+		const bool requester{ (x.messageType != PTP::PtpMessageType::Delay_Resp && x.messageType != PTP::PtpMessageType::Pdelay_Resp &&
+			x.messageType != PTP::PtpMessageType::Pdelay_Resp_Follow_Up) || a.requestingPortIdentity == b.requestingPortIdentity };
+		return x.messageType == y.messageType && x.transportSpecific == y.transportSpecific && x.version == y.version &&
+			x.domainNumber == y.domainNumber && x.flags == y.flags && x.correctionField == y.correctionField &&
+			x.sourcePortIdentity == y.sourcePortIdentity && x.sequenceId == y.sequenceId &&
+			x.logMessageInterval == y.logMessageInterval && SameTimestamp(a.timestamp, b.timestamp) && announce && requester;
+	}
+
+	void CheckCodec()
+	{
+		constexpr std::array c_types{ PTP::PtpMessageType::Sync, PTP::PtpMessageType::Delay_Req, PTP::PtpMessageType::Follow_Up,
+			PTP::PtpMessageType::Delay_Resp, PTP::PtpMessageType::Pdelay_Req, PTP::PtpMessageType::Pdelay_Resp,
+			PTP::PtpMessageType::Pdelay_Resp_Follow_Up, PTP::PtpMessageType::Announce };
+		std::mt19937_64 random(5);
+		const auto byte{ [&] { return static_cast<uint8_t>(random()); } };
+		std::array<uint8_t, PTP::Wire::c_maxMessageSize + 16> buffer{};
+
+		for (int round{ 0 }; round < 1000; ++round)
+		{
+			for (const auto type : c_types)
+			{
+				PTP::PtpMessage message;
+				auto& header{ message.header };
+				header.messageType = type;
+				header.transportSpecific = byte() & 0x0F;
+				header.domainNumber = byte();
+				header.flags = static_cast<uint16_t>(random());
+				header.correctionField = static_cast<int64_t>(random());
+				std::ranges::generate(header.sourcePortIdentity, byte);
+				header.sequenceId = static_cast<uint16_t>(random());
+				header.logMessageInterval = static_cast<int8_t>(byte());
+				message.timestamp = PTP::PtpTimestamp::FromParts(random() >> 16, static_cast<uint32_t>(random() % 1'000'000'000));
+				std::ranges::generate(message.requestingPortIdentity, byte);
+				message.announce = { .currentUtcOffset = static_cast<int16_t>(random()), .grandmasterPriority1 = byte(),
+					.grandmasterClockQuality = { byte(), byte(), static_cast<uint16_t>(random()) },
+					.grandmasterPriority2 = byte(), .stepsRemoved = static_cast<uint16_t>(random()), .timeSource = byte() };
+				std::ranges::generate(message.announce.grandmasterIdentity, byte);
+
+				const auto size{ PTP::EncodeMessage(message, buffer) };
+				if (!Check(size == PTP::MessageSize(type) && size > 0, std::format("encoded size of type {}", static_cast<int>(type))))
+					return;
+				const auto decoded{ PTP::DecodeMessage(std::span(buffer).first(size)) };
+				if (!Check(decoded && SameMessage(message, *decoded) && decoded->header.messageLength == size,
+					std::format("round trip of type {}", static_cast<int>(type))))
+				{
+					return;
+				}
+
+				// Trailing TLVs are ignored, truncation and a short buffer are not
+				Check(PTP::DecodeMessage(buffer).has_value(), "datagram longer than messageLength");
+				Check(PTP::EncodeMessage(message, std::span(buffer).first(size - 1)) == 0, "encode into a short buffer");
+				const auto truncated{ static_cast<size_t>(random() % size) };
+				Check(!PTP::DecodeMessage(std::span(buffer).first(truncated)), std::format("truncated to {} of {}", truncated, size));
+			}
+		}
+
+		PTP::PtpMessage sync;
+		sync.header.messageType = PTP::PtpMessageType::Sync;
+		const auto size{ PTP::EncodeMessage(sync, buffer) };
+		const auto corrupt{ [&](size_t offset, uint8_t value)
+		{
+			auto copy{ buffer };
+			copy[offset] = value;
+			return PTP::DecodeMessage(std::span(copy).first(size));
+		} };
+		Check(PTP::DecodeMessage(std::span(buffer).first(size)).has_value(), "valid Sync");
+		Check(!corrupt(PTP::Wire::c_versionOffset, 1), "PTPv1 rejected");
+		Check(!corrupt(PTP::Wire::c_messageTypeOffset, 0x0C), "Signaling not decoded");
+		Check(!corrupt(PTP::Wire::c_messageLengthOffset + 1, static_cast<uint8_t>(size + 1)), "messageLength beyond the datagram");
+		Check(!corrupt(PTP::Wire::c_messageLengthOffset + 1, static_cast<uint8_t>(size - 1)), "messageLength below the type's size");
+		Check(!corrupt(PTP::Wire::c_timestampOffset + 6, 0x3C), "nanoseconds of one second or more"); // 0x3C000000 > 10^9
+		sync.header.messageType = PTP::PtpMessageType::Management;
+		Check(PTP::EncodeMessage(sync, buffer) == 0, "unsupported type not encoded");
+	}
+
+	// ClientCore without sockets: a transmit timestamp that arrives after the response.
+	void CheckExchangeMatching()
+	{
+		constexpr int64_t c_second{ 1'000'000'000 };
+		constexpr int64_t c_start{ 1'700'000'000 * c_second };
+		constexpr int64_t c_delay{ 100'000 }; // Nanoseconds each way
+		const auto now{ std::chrono::steady_clock::time_point{} };
+		const auto at{ [](int64_t nanoseconds) { return PTP::PtpTimestamp::FromNanoseconds(nanoseconds); } };
+
+		PTP::ServerCore server;
+		PTP::ClientCore client(nullptr);
+		std::array<uint8_t, PTP::Wire::c_maxMessageSize> buffer{};
+		std::array<uint8_t, PTP::Wire::c_maxMessageSize> request{};
+		const auto deliver{ [&](PTP::ClientCore& core, size_t size, PTP::PtpTimestamp receiveTimestamp)
+		{
+			core.OnMessage(*PTP::DecodeMessage(std::span(buffer).first(size)), receiveTimestamp, now);
+		} };
+
+		// End to end: the Delay_Resp comes in before the Delay_Req's t3. The first estimate still
+		// carries the filter's prior, so the value is checked once a few exchanges are in.
+		for (int64_t round{ 0 }; round < 5; ++round)
+		{
+			const auto t1{ c_start + round * c_second };
+			server.NextSequence();
+			deliver(client, server.WriteSyncMessage(buffer), at(t1 + c_delay));
+			deliver(client, server.WriteFollowUpMessage(buffer, at(t1)), {});
+			const auto sequenceId{ client.GetSequenceId() };
+			const auto size{ client.WriteDelayRequest(request, std::nullopt) };
+			const auto delayRequest{ PTP::DecodeMessage(std::span(request).first(size)) };
+			if (!Check(delayRequest.has_value(), "Delay_Req decodes"))
+				return;
+			const auto before{ client.GetMeanPathDelay() };
+			deliver(client, server.WriteDelayResponse(buffer, *delayRequest, at(t1 + 3 * c_delay)), {});
+			Check(client.GetMeanPathDelay() == before, "no path delay while t3 is pending");
+			client.SetDelayRequestTimestamp(sequenceId, at(t1 + 2 * c_delay));
+			Check(client.GetMeanPathDelay() != before, "path delay once t3 is in");
+		}
+		const auto pathDelay{ client.GetMeanPathDelay() };
+		Check(pathDelay && std::abs(*pathDelay - c_delay / 1000.0) < 1.0, std::format("path delay {} us",
+			pathDelay.value_or(-1.0)));
+
+		// Peer to peer: both responses in before the Pdelay_Req's t1
+		PTP::ClientCore peer(nullptr);
+		for (int64_t round{ 0 }; round < 5; ++round)
+		{
+			const auto t1{ c_start + round * c_second };
+			const auto size{ peer.WritePeerDelayRequest(request, std::nullopt) };
+			const auto sequenceId{ peer.GetPeerDelaySequenceId() };
+			const auto peerRequest{ PTP::DecodeMessage(std::span(request).first(size)) };
+			if (!Check(peerRequest && peerRequest->header.sequenceId == sequenceId, "Pdelay_Req decodes with its sequenceId"))
+				return;
+			const auto before{ peer.GetMeanPathDelay() };
+			deliver(peer, server.WritePeerDelayResponse(buffer, *peerRequest, at(t1 + c_delay)), at(t1 + 2 * c_delay + 50'000));
+			deliver(peer, server.WritePeerDelayResponseFollowUp(buffer, *peerRequest, at(t1 + c_delay + 50'000)), {});
+			Check(peer.GetMeanPathDelay() == before, "no link delay while t1 is pending");
+			peer.SetPeerDelayRequestTimestamp(sequenceId, at(t1));
+			Check(peer.GetMeanPathDelay() != before, "link delay once t1 is in");
+		}
+		const auto linkDelay{ peer.GetMeanPathDelay() };
+		Check(linkDelay && std::abs(*linkDelay - c_delay / 1000.0) < 1.0, std::format("link delay {} us",
+			linkDelay.value_or(-1.0)));
+	}
+}
+
+int main()
+{
+	try
+	{
+		PTP::SetLogLevel(PTP::LogLevel::Error);
+		CheckSessionTable();
+		CheckMasterSelection();
+		CheckCodec();
+		CheckExchangeMatching();
+		std::cout << std::format("{} checks, {} failed\n", g_checks, g_failures);
+		return g_failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+	catch (const std::exception& e)
+	{
+		std::cerr << "Error: " << e.what() << std::endl;
+		return EXIT_FAILURE;
+	}
+}
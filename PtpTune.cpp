@@ -0,0 +1,242 @@
+// Parameter sweep for KalmanFilter1D. Takes the path delay series out of a capture (PTP or
+// PtpSim --Capture), runs the filter with every combination of the listed tunings in
+// vectorized, multithreaded blocks (KalmanSweep) and ranks them: tunings whose NIS mean
+// says P and R are honest first, each group by RMS error.
+#include "CaptureFile.h"
+#include "KalmanSweep.h"
+#include "Logger.h"
+
+#include <boost/program_options.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <format>
+#include <iostream>
+#include <limits>
+#include <numeric>
+#include <optional>
+#include <span>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace
+{
+	struct TuneOptions
+	{
+		std::string Input;
+		uint8_t Source{ 0 };
+		std::vector<double> QScale;
+		std::vector<double> QMin;
+		std::vector<double> QMax;
+		std::vector<size_t> Window;
+		std::vector<double> InflationThreshold;
+		std::vector<double> InflationFactor;
+		double NisTolerance{ 2.0 }; // Consistent: NIS mean within [1 / tolerance, tolerance]
+		size_t Top{ 10 };
+		PTP::SweepOptions Sweep;
+	};
+
+	template <typename T>
+	std::vector<T> ParseList(const std::string& name, const std::string& list)
+	{
+		std::vector<T> values;
+		std::istringstream stream(list);
+		std::string item;
+		while (std::getline(stream, item, ','))
+		{
+			std::istringstream parser(item);
+			T value{};
+			if (!(parser >> value) || !(parser >> std::ws).eof())
+				throw std::runtime_error("--" + name + " must be a comma-separated list of numbers");
+			values.push_back(value);
+		}
+		if (values.empty())
+			throw std::runtime_error("--" + name + " must be a comma-separated list of numbers");
+		return values;
+	}
+
+	TuneOptions ReadTuneOptions(std::span<const char* const> args)
+	{
+		namespace po = boost::program_options;
+
+		TuneOptions options;
+		std::string qScale{ "0.0001,0.0003,0.001,0.003,0.01,0.03,0.1,0.3,1" };
+		std::string qMin{ "1e-8,1e-7,1e-6,1e-5,1e-4" };
+		std::string qMax{ "0.1,1,10,100" };
+		std::string window{ "5,10,20,40,64" };
+		std::string inflationThreshold{ "0.01,0.03,0.1,0.3" };
+		std::string inflationFactor{ "2,5,10,20" };
+		double truth{ std::numeric_limits<double>::quiet_NaN() };
+		unsigned source{ 0 };
+
+		po::options_description description("KalmanFilter1D parameter sweep");
+		description.add_options()
+			("Input", po::value(&options.Input)->required(), "capture file written with --Capture")
+			("Source", po::value(&source)->default_value(source), "ensemble source whose path delays to use")
+			("QScale", po::value(&qScale)->default_value(qScale), "comma-separated values to try")
+			("QMin", po::value(&qMin)->default_value(qMin), "comma-separated values to try")
+			("QMax", po::value(&qMax)->default_value(qMax), "comma-separated values to try")
+			("Window", po::value(&window)->default_value(window), "comma-separated R window lengths to try (1-64)")
+			("InflationThreshold", po::value(&inflationThreshold)->default_value(inflationThreshold),
+				"comma-separated values to try")
+			("InflationFactor", po::value(&inflationFactor)->default_value(inflationFactor), "comma-separated values to try")
+			("Truth", po::value(&truth),
+				"true path delay in us (PtpSim prints it): score the estimate against it instead of the prediction error")
+			("Warmup", po::value(&options.Sweep.Warmup)->default_value(options.Sweep.Warmup), "leading samples left out of the scores")
+			("NisTolerance", po::value(&options.NisTolerance)->default_value(options.NisTolerance),
+				"NIS mean within [1/x, x] counts as consistent")
+			("Threads", po::value(&options.Sweep.Threads)->default_value(options.Sweep.Threads), "0 = one per hardware thread")
+			("Top", po::value(&options.Top)->default_value(options.Top), "tunings to print");
+
+		po::positional_options_description positional;
+		positional.add("Input", 1);
+
+		po::variables_map vm;
+		try
+		{
+			po::store(po::command_line_parser(static_cast<int>(args.size()), args.data())
+				.options(description)
+				.positional(positional)
+				.run(),
+				vm);
+			po::notify(vm);
+		}
+		catch (const po::error& ex)
+		{
+			throw std::runtime_error(std::string("Argument parsing error: ") + ex.what());
+		}
+
+		if (source > UINT8_MAX)
+			throw std::runtime_error("Source must be between 0 and 255");
+		if (options.NisTolerance < 1.0)
+			throw std::runtime_error("NisTolerance must be at least 1");
+		options.Source = static_cast<uint8_t>(source);
+		options.QScale = ParseList<double>("QScale", qScale);
+		options.QMin = ParseList<double>("QMin", qMin);
+		options.QMax = ParseList<double>("QMax", qMax);
+		options.Window = ParseList<size_t>("Window", window);
+		options.InflationThreshold = ParseList<double>("InflationThreshold", inflationThreshold);
+		options.InflationFactor = ParseList<double>("InflationFactor", inflationFactor);
+		if (std::ranges::any_of(options.Window, [](size_t length) { return length == 0 || length > PTP::KalmanFilter1D::c_maxWindow; }))
+			throw std::runtime_error("Window lengths must be 1-64");
+		if (!std::isnan(truth))
+			options.Sweep.Truth = truth;
+		return options;
+	}
+
+	// The delays the path delay filter was handed live, in microseconds.
+	std::vector<double> ReadPathDelays(const std::string& path, uint8_t source)
+	{
+		PTP::CaptureReader reader(path);
+		std::vector<double> delays;
+		while (const auto record = reader.Next())
+		{
+			if (record->header.source != source)
+				continue;
+			const auto type{ record->header.type };
+			if (type != PTP::CaptureRecordType::DelayExchange && type != PTP::CaptureRecordType::PeerDelay)
+				continue;
+			const auto& timestamps{ record->Timestamps() };
+			const auto correction{ type == PTP::CaptureRecordType::PeerDelay ? timestamps.correction : 0 };
+			const auto delay{ ((timestamps.t4 - timestamps.t1) - (timestamps.t3 - timestamps.t2) - correction) / 2.0 };
+			if (delay > 0)
+				delays.push_back(delay / 1000.0);
+		}
+		return delays;
+	}
+
+	std::vector<PTP::KalmanTuning> MakeGrid(const TuneOptions& options)
+	{
+		std::vector<PTP::KalmanTuning> grid;
+		for (const auto window : options.Window)
+			for (const auto qScale : options.QScale)
+				for (const auto qMin : options.QMin)
+					for (const auto qMax : options.QMax)
+						for (const auto threshold : options.InflationThreshold)
+							for (const auto factor : options.InflationFactor)
+							{
+								if (qMin <= qMax)
+									grid.push_back({ qScale, qMin, qMax, window, threshold, factor });
+							}
+		return grid;
+	}
+
+	std::string Describe(const PTP::KalmanTuning& tuning)
+	{
+		return std::format("QScale {:g} | QMin {:g} | QMax {:g} | Window {} | InflationThreshold {:g} | InflationFactor {:g}",
+			tuning.QScale, tuning.QMin, tuning.QMax, tuning.Window, tuning.InflationThreshold, tuning.InflationFactor);
+	}
+
+	void Tune(const TuneOptions& options)
+	{
+		const auto delays{ ReadPathDelays(options.Input, options.Source) };
+		auto grid{ MakeGrid(options) };
+		// The filter's current constants are always scored, for comparison.
+		grid.push_back({});
+
+		const auto start{ std::chrono::steady_clock::now() };
+		const auto results{ PTP::SweepKalmanTuning(delays, grid, options.Sweep) };
+		const auto wall{ std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() };
+
+		const auto consistent = [&options](const PTP::SweepResult& result)
+		{
+			return result.nisMean >= 1.0 / options.NisTolerance && result.nisMean <= options.NisTolerance;
+		};
+		std::vector<size_t> ranking(results.size());
+		std::iota(ranking.begin(), ranking.end(), 0);
+		std::ranges::stable_sort(ranking, [&](size_t a, size_t b)
+		{
+			const bool consistentA{ consistent(results[a]) };
+			const bool consistentB{ consistent(results[b]) };
+			if (consistentA != consistentB)
+				return consistentA;
+			return results[a].rmsError < results[b].rmsError;
+		});
+
+		const auto updates{ static_cast<double>(delays.size()) * static_cast<double>(grid.size()) };
+		std::cout << std::format(
+			"delays: {} from {} source {} | tunings: {} ({} consistent) | wall: {:.3f} s | {:.0f} M filter updates/s\n"
+			"scored against {} after {} samples\n",
+			delays.size(), options.Input, options.Source, grid.size(), std::ranges::count_if(results, consistent),
+			wall, wall > 0.0 ? updates / wall * 1e-6 : 0.0,
+			options.Sweep.Truth ? std::format("the true delay {:.3f} us", *options.Sweep.Truth) : std::string("the one-step prediction error"),
+			options.Sweep.Warmup);
+
+		for (size_t rank = 0; rank < std::min(options.Top, ranking.size()); ++rank)
+		{
+			const auto& result{ results[ranking[rank]] };
+			std::cout << std::format("{:>3}. rms {:.4f} us | NIS {:.3f}{} | {}\n", rank + 1, result.rmsError, result.nisMean,
+				consistent(result) ? "" : " (inconsistent)", Describe(result.tuning));
+		}
+
+		const auto defaults{ results.size() - 1 };
+		const auto defaultRank{ static_cast<size_t>(std::ranges::find(ranking, defaults) - ranking.begin()) };
+		std::cout << std::format("current constants: rank {} of {} | rms {:.4f} us | NIS {:.3f}\n",
+			defaultRank + 1, ranking.size(), results[defaults].rmsError, results[defaults].nisMean);
+
+		// The sweep kernel is a rewrite of Update; the winner run through the filter itself shows it still agrees.
+		const auto& best{ results[ranking.front()] };
+		PTP::KalmanFilter1D filter(options.Sweep.InitialEstimate, best.tuning);
+		for (const auto delay : delays)
+			filter.Update(delay);
+		std::cout << std::format("check: KalmanFilter1D with the best tuning ends at {:.6f} us, the sweep at {:.6f} us\n",
+			filter.GetEstimate(), best.estimate);
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	try
+	{
+		const auto options{ ReadTuneOptions(std::span(argv, argc)) };
+		PTP::SetLogLevel(PTP::LogLevel::Warning);
+		Tune(options);
+		return EXIT_SUCCESS;
+	}
+	catch (const std::exception& e)
+	{
+		std::cerr << "Error: " << e.what() << std::endl;
+		return EXIT_FAILURE;
+	}
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+namespace PTP
+{
+	// One writer publishes a trivially copyable value, any number of threads read it.
+	// Store is wait-free; Load never blocks the writer and retries only if a Store overlapped
+	// it. The value is kept in relaxed atomic words, so concurrent access is not a data race.
+	template <typename T>
+	class SeqLock
+	{
+		static_assert(std::is_trivially_copyable_v<T>, "SeqLock copies the value as bytes");
+
+	public:
+		SeqLock() { Store(T{}); }
+
+		// Writer thread only.
+		void Store(const T& value)
+		{
+			std::array<uint64_t, c_words> words{};
+			std::memcpy(words.data(), &value, sizeof(T));
+
+			const auto sequence{ m_sequence.load(std::memory_order_relaxed) };
+			m_sequence.store(sequence + 1, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_release);
+			for (size_t i = 0; i < c_words; ++i)
+				m_words[i].store(words[i], std::memory_order_relaxed);
+			m_sequence.store(sequence + 2, std::memory_order_release);
+		}
+
+		T Load() const
+		{
+			std::array<uint64_t, c_words> words{};
+			while (true)
+			{
+				const auto sequence{ m_sequence.load(std::memory_order_acquire) };
+				if (sequence & 1)
+					continue;
+				for (size_t i = 0; i < c_words; ++i)
+					words[i] = m_words[i].load(std::memory_order_relaxed);
+				std::atomic_thread_fence(std::memory_order_acquire);
+				if (sequence == m_sequence.load(std::memory_order_relaxed))
+					break;
+			}
+
+			T value;
+			std::memcpy(static_cast<void*>(&value), words.data(), sizeof(T));
+			return value;
+		}
+
+	private:
+		static constexpr size_t c_words{ (sizeof(T) + sizeof(uint64_t) - 1) / sizeof(uint64_t) };
+
+		alignas(64) std::atomic<uint32_t> m_sequence{ 0 };
+		std::array<std::atomic<uint64_t>, c_words> m_words{};
+	};
+}
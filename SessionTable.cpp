@@ -0,0 +1,204 @@
+#include "SessionTable.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+
+namespace PTP
+{
+	SessionKey SessionKey::From(const boost::asio::ip::udp::endpoint& endpoint, const PortIdentity& portIdentity)
+	{
+		SessionKey key;
+		const auto address{ endpoint.address() };
+		key.address = address.is_v6()
+			? address.to_v6().to_bytes()
+			: boost::asio::ip::make_address_v6(boost::asio::ip::v4_mapped, address.to_v4()).to_bytes();
+		key.port = endpoint.port();
+		key.portIdentity = portIdentity;
+		return key;
+	}
+
+	std::string SessionKey::ToString() const
+	{
+		const auto v6{ boost::asio::ip::make_address_v6(address) };
+		const auto host{ v6.is_v4_mapped()
+			? boost::asio::ip::make_address_v4(boost::asio::ip::v4_mapped, v6).to_string()
+			: "[" + v6.to_string() + "]" };
+		return host + ":" + std::to_string(port);
+	}
+
+	SessionTable::SessionTable(const SessionTableOptions& options)
+		: m_options(options)
+		, m_sessions(std::max<size_t>(options.Capacity, 1))
+		, m_index(std::bit_ceil(m_sessions.size() * 2), Slot{ 0, c_noSession })
+		, m_mask(m_index.size() - 1)
+	{
+		for (auto index{ static_cast<uint32_t>(m_sessions.size()) }; index-- > 0;)
+		{
+			m_sessions[index].next = m_free;
+			m_free = index;
+		}
+	}
+
+	uint64_t SessionTable::Hash(const SessionKey& key)
+	{
+		// Word-wise multiply-xorshift over the 28 key bytes; the low bits that pick the home
+		// slot depend on every byte.
+		std::array<uint64_t, 4> words{};
+		std::memcpy(words.data(), &key, sizeof(SessionKey));
+		uint64_t hash{ 0 };
+		for (const auto word : words)
+		{
+			hash = (hash ^ word) * 0x9e3779b97f4a7c15ULL;
+			hash ^= hash >> 32;
+		}
+		hash *= 0xd6e8feb86659fd93ULL;
+		return hash ^ (hash >> 32);
+	}
+
+	size_t SessionTable::FindSlot(const SessionKey& key, uint64_t hash) const
+	{
+		const auto tag{ static_cast<uint32_t>(hash) };
+		for (auto slot{ tag & m_mask };; slot = (slot + 1) & m_mask)
+		{
+			const auto& entry{ m_index[slot] };
+			if (entry.session == c_noSession || (entry.tag == tag && m_sessions[entry.session].key == key))
+				return slot;
+		}
+	}
+
+	void SessionTable::EraseSlot(size_t slot)
+	{
+		// Backward shift: pull later entries of the probe run into the hole unless that would
+		// move them in front of their home slot. No tombstones, so probes stay short.
+		auto hole{ slot };
+		for (auto next{ (hole + 1) & m_mask }; m_index[next].session != c_noSession; next = (next + 1) & m_mask)
+		{
+			const auto home{ m_index[next].tag & m_mask };
+			if (((next - home) & m_mask) >= ((next - hole) & m_mask))
+			{
+				m_index[hole] = m_index[next];
+				hole = next;
+			}
+		}
+		m_index[hole].session = c_noSession;
+	}
+
+	void SessionTable::Unlink(uint32_t session)
+	{
+		auto& entry{ m_sessions[session] };
+		if (entry.prev != c_noSession)
+			m_sessions[entry.prev].next = entry.next;
+		else
+			m_head = entry.next;
+		if (entry.next != c_noSession)
+			m_sessions[entry.next].prev = entry.prev;
+		else
+			m_tail = entry.prev;
+	}
+
+	void SessionTable::PushFront(uint32_t session)
+	{
+		auto& entry{ m_sessions[session] };
+		entry.prev = c_noSession;
+		entry.next = m_head;
+		if (m_head != c_noSession)
+			m_sessions[m_head].prev = session;
+		else
+			m_tail = session;
+		m_head = session;
+	}
+
+	uint32_t SessionTable::Allocate(const SessionKey& key, int64_t now)
+	{
+		if (m_free == c_noSession)
+		{
+			// Evict the least recently seen client, unless even it still has a response queued:
+			// then every session is busy and the newcomer waits for its next request.
+			const auto victim{ m_tail };
+			if (victim == c_noSession || m_sessions[victim].inFlight > 0)
+				return c_noSession;
+
+			EraseSlot(FindSlot(m_sessions[victim].key, Hash(m_sessions[victim].key)));
+			Unlink(victim);
+			m_sessions[victim].next = c_noSession;
+			m_free = victim;
+			++m_stats.evicted;
+			--m_stats.sessions;
+		}
+
+		const auto session{ m_free };
+		m_free = m_sessions[session].next;
+		auto& entry{ m_sessions[session] };
+		entry = Session{ .key = key, .counters = {}, .tokens = m_options.Burst, .lastRefill = now, .firstSeen = now,
+			.prev = c_noSession, .next = c_noSession };
+		++m_stats.created;
+		++m_stats.sessions;
+		return session;
+	}
+
+	SessionTable::AdmitResult SessionTable::Admit(const SessionKey& key, int64_t now)
+	{
+		const auto hash{ Hash(key) };
+		auto slot{ FindSlot(key, hash) };
+		auto session{ m_index[slot].session };
+		if (session == c_noSession)
+		{
+			session = Allocate(key, now);
+			if (session == c_noSession)
+			{
+				++m_stats.rejected;
+				return { Admission::Rejected, c_noSession };
+			}
+			// An eviction may have shifted the probe run the key belongs to.
+			slot = FindSlot(key, hash);
+			m_index[slot] = { static_cast<uint32_t>(hash), session };
+		}
+		else
+		{
+			Unlink(session);
+		}
+		PushFront(session);
+
+		auto& entry{ m_sessions[session] };
+		++entry.counters.requests;
+		if (m_options.Rate > 0.0)
+		{
+			const auto elapsed{ static_cast<double>(std::max<int64_t>(now - entry.lastRefill, 0)) * 1e-9 };
+			entry.tokens = std::min(m_options.Burst, entry.tokens + elapsed * m_options.Rate);
+			entry.lastRefill = now;
+			if (entry.tokens < 1.0)
+			{
+				++entry.counters.rateLimited;
+				++m_stats.rateLimited;
+				return { Admission::RateLimited, session };
+			}
+		}
+		if (entry.inFlight >= m_options.MaxInFlight)
+		{
+			++entry.counters.overflowed;
+			++m_stats.overflowed;
+			return { Admission::Overflowed, session };
+		}
+
+		if (m_options.Rate > 0.0)
+			entry.tokens -= 1.0;
+		++entry.inFlight;
+		return { Admission::Accepted, session };
+	}
+
+	void SessionTable::Complete(uint32_t session, bool answered)
+	{
+		auto& entry{ m_sessions[session] };
+		if (entry.inFlight > 0)
+			--entry.inFlight;
+		if (answered)
+			++entry.counters.answered;
+	}
+
+	const Session* SessionTable::Find(const SessionKey& key) const
+	{
+		const auto session{ m_index[FindSlot(key, Hash(key))].session };
+		return session == c_noSession ? nullptr : &m_sessions[session];
+	}
+}
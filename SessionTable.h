@@ -0,0 +1,134 @@
+#pragma once
+
+#include "PtpCodec.h"
+
+#include <boost/asio/ip/udp.hpp>
+#include <array>
+#include <cstdint>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace PTP
+{
+	// A client as the server sees it: source address and port plus the PTP port identity,
+	// so clients behind one NAT address stay apart.
+	struct SessionKey
+	{
+		std::array<uint8_t, 16> address{}; // IPv6, or IPv4-mapped
+		uint16_t port{ 0 };
+		PortIdentity portIdentity{};
+
+		static SessionKey From(const boost::asio::ip::udp::endpoint& endpoint, const PortIdentity& portIdentity);
+		std::string ToString() const; // address:port
+
+		bool operator==(const SessionKey&) const = default;
+	};
+	static_assert(std::has_unique_object_representations_v<SessionKey>, "SessionKey is hashed as bytes");
+
+	struct SessionCounters
+	{
+		uint64_t requests{ 0 };    // Delay_Req/Pdelay_Req received
+		uint64_t answered{ 0 };
+		uint64_t rateLimited{ 0 }; // Dropped because the token bucket was empty
+		uint64_t overflowed{ 0 };  // Dropped because the client had too many responses in flight
+	};
+
+	struct Session
+	{
+		SessionKey key;
+		SessionCounters counters;
+		double tokens{ 0.0 };
+		int64_t lastRefill{ 0 };   // Nanoseconds, caller's monotonic clock
+		int64_t firstSeen{ 0 };
+		uint32_t inFlight{ 0 };
+		uint32_t prev{ UINT32_MAX }; // LRU list, most recent at the head
+		uint32_t next{ UINT32_MAX };
+	};
+
+	struct SessionTableOptions
+	{
+		size_t Capacity{ 16384 };  // Sessions; the least recently seen is evicted beyond this
+		double Rate{ 16.0 };       // Requests per second each client may sustain, 0 = no limit
+		double Burst{ 32.0 };      // Requests a client may send back to back
+		uint32_t MaxInFlight{ 4 }; // Responses per client queued and not yet sent
+	};
+
+	struct SessionTableStats
+	{
+		size_t sessions{ 0 };
+		uint64_t created{ 0 };
+		uint64_t evicted{ 0 };
+		uint64_t rateLimited{ 0 };
+		uint64_t overflowed{ 0 };
+		uint64_t rejected{ 0 };    // New clients turned away because every session had responses in flight
+	};
+
+	enum class Admission
+	{
+		Accepted,
+		RateLimited,
+		Overflowed,
+		Rejected
+	};
+
+	// Bounded per-client state for the server's request path. Sessions live in a pool allocated
+	// up front; lookups go through an open-addressing index of 8-byte slots (linear probing,
+	// load factor at most 1/2, backward-shift deletion), so a lookup usually touches one cache
+	// line of the index and one session. Not thread-safe: each server shard owns its table, and
+	// SO_REUSEPORT steers a client's requests to the same shard.
+	class SessionTable
+	{
+	public:
+		static constexpr uint32_t c_noSession{ UINT32_MAX };
+
+		struct AdmitResult
+		{
+			Admission admission;
+			uint32_t session; // c_noSession when Rejected
+		};
+
+		explicit SessionTable(const SessionTableOptions& options = {});
+
+		// Finds or creates the client's session, marks it most recently used and charges one
+		// request against its token bucket and in-flight bound. 'now' is monotonic nanoseconds.
+		// An Accepted request must be finished with Complete once its response is sent or dropped.
+		AdmitResult Admit(const SessionKey& key, int64_t now);
+		void Complete(uint32_t session, bool answered);
+
+		const Session* Find(const SessionKey& key) const;
+		const SessionTableStats& GetStats() const { return m_stats; }
+
+		// Visits sessions from most to least recently seen.
+		template <typename Visitor>
+		void ForEach(Visitor&& visitor) const
+		{
+			for (auto index{ m_head }; index != c_noSession; index = m_sessions[index].next)
+				visitor(m_sessions[index]);
+		}
+
+	private:
+		struct Slot
+		{
+			uint32_t tag;     // Low 32 hash bits: pick the home slot, compared before the key
+			uint32_t session; // c_noSession when empty
+		};
+		static_assert(sizeof(Slot) == 8);
+
+		static uint64_t Hash(const SessionKey& key);
+		size_t FindSlot(const SessionKey& key, uint64_t hash) const; // Slot holding the key, or the empty slot ending its probe
+		void EraseSlot(size_t slot);
+		void Unlink(uint32_t session);
+		void PushFront(uint32_t session);
+		uint32_t Allocate(const SessionKey& key, int64_t now);
+
+		SessionTableOptions m_options;
+		std::vector<Session> m_sessions;
+		std::vector<Slot> m_index;
+		size_t m_mask;
+		uint32_t m_free{ c_noSession }; // Free list threaded through Session::next
+		uint32_t m_head{ c_noSession };
+		uint32_t m_tail{ c_noSession };
+		SessionTableStats m_stats;
+	};
+}
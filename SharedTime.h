@@ -0,0 +1,178 @@
+#pragma once
+
+// Reader for the synchronized time a PTP client exports to shared memory (--TimeExport).
+// Header-only and independent of the rest of the project: include it, open the page by
+// name, and every Now() is one vDSO clock_gettime plus a seqlock read of a single cache
+// line, with no syscall, lock or IPC round trip. Readers never write to the page, so any
+// number of them in any number of processes do not slow each other or the client down.
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <ctime>
+#include <stdexcept>
+#include <string>
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace PTP
+{
+	enum class SharedTimeState : uint32_t
+	{
+		NoData,    // Nothing published yet
+		Measuring, // Client only measures (--Clock none); the mapping applies its last offset
+		Acquiring, // Servo stepped the clock, not yet within its lock threshold
+		Locked     // Servo locked
+	};
+
+	// One published state of the client. Synchronized time is a line over a kernel clock:
+	// time = timeAnchor + (clock - clockAnchor) * (1 + frequencyPpb * 1e-9).
+	struct SharedTimeSnapshot
+	{
+		SharedTimeState state{ SharedTimeState::NoData };
+		int32_t clockId{ 0 };                   // clockid_t the line runs over
+		int64_t clockAnchor{ 0 };
+		int64_t timeAnchor{ 0 };
+		double frequencyPpb{ 0.0 };             // Rate correction of the line
+		double driftPpb{ 0.0 };                 // Servo's correction of the local oscillator
+		int64_t offsetFromMaster{ 0 };          // Nanoseconds, last measurement before the correction
+		double offsetRms{ 0.0 };                // Nanoseconds, servo's recent offset RMS (quality)
+		double meanPathDelay{ 0.0 };            // Nanoseconds
+		int64_t updateTime{ 0 };                // CLOCK_MONOTONIC_RAW at publication, for staleness checks
+		uint64_t updates{ 0 };                  // Publications so far
+
+		int64_t TimeAt(int64_t clock) const
+		{
+			const auto elapsed{ static_cast<double>(clock - clockAnchor) };
+			return timeAnchor + std::llround(elapsed * (1.0 + frequencyPpb * 1e-9));
+		}
+
+#if defined(CLOCK_REALTIME)
+		// One read of the kernel clock, through the vDSO for the clocks the client uses.
+		int64_t Now() const
+		{
+			timespec ts{};
+			::clock_gettime(static_cast<clockid_t>(clockId), &ts);
+			return TimeAt(static_cast<int64_t>(ts.tv_sec) * 1000000000LL + ts.tv_nsec);
+		}
+#endif
+	};
+
+	// The shared page. One writer (the client), any number of readers. Every field is a
+	// lock-free atomic so the page can be shared between processes.
+	struct SharedTimePage
+	{
+		static constexpr uint32_t c_magic{ 0x50545054 }; // "PTPT"
+		static constexpr uint32_t c_version{ 1 };
+
+		std::atomic<uint32_t> magic;
+		std::atomic<uint32_t> version;
+
+		// Readers touch only this cache line.
+		alignas(64) std::atomic<uint32_t> sequence; // Odd while the writer is updating, publications * 2
+		std::atomic<uint32_t> state;
+		std::atomic<int32_t> clockId;
+		std::atomic<float> offsetRms;
+		std::atomic<int64_t> clockAnchor;
+		std::atomic<int64_t> timeAnchor;
+		std::atomic<double> frequencyPpb;
+		std::atomic<int64_t> offsetFromMaster;
+		std::atomic<int64_t> updateTime;
+		std::atomic<float> meanPathDelay;
+		std::atomic<float> driftPpb;
+
+		void Store(const SharedTimeSnapshot& snapshot)
+		{
+			const auto current{ sequence.load(std::memory_order_relaxed) };
+			sequence.store(current + 1, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_release);
+			state.store(static_cast<uint32_t>(snapshot.state), std::memory_order_relaxed);
+			clockId.store(snapshot.clockId, std::memory_order_relaxed);
+			clockAnchor.store(snapshot.clockAnchor, std::memory_order_relaxed);
+			timeAnchor.store(snapshot.timeAnchor, std::memory_order_relaxed);
+			frequencyPpb.store(snapshot.frequencyPpb, std::memory_order_relaxed);
+			offsetFromMaster.store(snapshot.offsetFromMaster, std::memory_order_relaxed);
+			offsetRms.store(static_cast<float>(snapshot.offsetRms), std::memory_order_relaxed);
+			meanPathDelay.store(static_cast<float>(snapshot.meanPathDelay), std::memory_order_relaxed);
+			driftPpb.store(static_cast<float>(snapshot.driftPpb), std::memory_order_relaxed);
+			updateTime.store(snapshot.updateTime, std::memory_order_relaxed);
+			sequence.store(current + 2, std::memory_order_release);
+		}
+
+		SharedTimeSnapshot Load() const
+		{
+			while (true)
+			{
+				const auto before{ sequence.load(std::memory_order_acquire) };
+				if (before & 1)
+					continue;
+				SharedTimeSnapshot snapshot;
+				snapshot.state = static_cast<SharedTimeState>(state.load(std::memory_order_relaxed));
+				snapshot.clockId = clockId.load(std::memory_order_relaxed);
+				snapshot.clockAnchor = clockAnchor.load(std::memory_order_relaxed);
+				snapshot.timeAnchor = timeAnchor.load(std::memory_order_relaxed);
+				snapshot.frequencyPpb = frequencyPpb.load(std::memory_order_relaxed);
+				snapshot.offsetFromMaster = offsetFromMaster.load(std::memory_order_relaxed);
+				snapshot.offsetRms = offsetRms.load(std::memory_order_relaxed);
+				snapshot.meanPathDelay = meanPathDelay.load(std::memory_order_relaxed);
+				snapshot.driftPpb = driftPpb.load(std::memory_order_relaxed);
+				snapshot.updateTime = updateTime.load(std::memory_order_relaxed);
+				snapshot.updates = before / 2;
+				std::atomic_thread_fence(std::memory_order_acquire);
+				if (before == sequence.load(std::memory_order_relaxed))
+					return snapshot;
+			}
+		}
+	};
+
+	static_assert(std::atomic<int64_t>::is_always_lock_free && std::atomic<double>::is_always_lock_free &&
+		std::atomic<float>::is_always_lock_free, "the shared page needs address-free atomics");
+	static_assert(sizeof(SharedTimePage) == 128, "the seqlock and its payload share one cache line");
+
+#if defined(__linux__)
+	// Maps a page exported with --TimeExport <name> read-only. Throws std::runtime_error if
+	// it does not exist or was written by an incompatible version.
+	class SharedTimeReader
+	{
+	public:
+		explicit SharedTimeReader(const std::string& name)
+		{
+			const auto fd{ ::shm_open(name.c_str(), O_RDONLY, 0) };
+			if (fd < 0)
+				throw std::runtime_error("Cannot open shared time page " + name);
+			auto* mapping = ::mmap(nullptr, sizeof(SharedTimePage), PROT_READ, MAP_SHARED, fd, 0);
+			::close(fd);
+			if (mapping == MAP_FAILED)
+				throw std::runtime_error("Cannot map shared time page " + name);
+			m_page = static_cast<const SharedTimePage*>(mapping);
+			if (m_page->magic.load(std::memory_order_acquire) != SharedTimePage::c_magic ||
+				m_page->version.load(std::memory_order_relaxed) != SharedTimePage::c_version)
+			{
+				::munmap(const_cast<SharedTimePage*>(m_page), sizeof(SharedTimePage));
+				throw std::runtime_error("Shared time page " + name + " has an unknown layout");
+			}
+		}
+
+		~SharedTimeReader()
+		{
+			::munmap(const_cast<SharedTimePage*>(m_page), sizeof(SharedTimePage));
+		}
+
+		SharedTimeReader(const SharedTimeReader&) = delete;
+		SharedTimeReader& operator=(const SharedTimeReader&) = delete;
+		SharedTimeReader(SharedTimeReader&&) = delete;
+		SharedTimeReader& operator=(SharedTimeReader&&) = delete;
+
+		SharedTimeSnapshot Snapshot() const { return m_page->Load(); }
+
+		// Synchronized time in nanoseconds on the PTP timescale; meaningless while NoData.
+		int64_t Now() const { return m_page->Load().Now(); }
+
+	private:
+		const SharedTimePage* m_page;
+	};
+#endif
+}
@@ -0,0 +1,53 @@
+#include "SharedTimePublisher.h"
+
+#include <new>
+#include <stdexcept>
+
+#if defined(__linux__)
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace PTP
+{
+	SharedTimePublisher::SharedTimePublisher(const std::string& name)
+		: m_name(name)
+	{
+#if defined(__linux__)
+		const auto fd{ ::shm_open(name.c_str(), O_CREAT | O_RDWR, 0644) };
+		if (fd < 0)
+			throw std::runtime_error("shm_open " + name + " failed, errno " + std::to_string(errno));
+		if (::ftruncate(fd, sizeof(SharedTimePage)) < 0)
+		{
+			::close(fd);
+			throw std::runtime_error("ftruncate " + name + " failed, errno " + std::to_string(errno));
+		}
+		auto* mapping = ::mmap(nullptr, sizeof(SharedTimePage), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		::close(fd);
+		if (mapping == MAP_FAILED)
+			throw std::runtime_error("mmap " + name + " failed, errno " + std::to_string(errno));
+
+		// A page left behind by an earlier run is reset; its readers see NoData until the first Publish.
+		m_page = new (mapping) SharedTimePage();
+		m_page->version.store(SharedTimePage::c_version, std::memory_order_relaxed);
+		m_page->magic.store(SharedTimePage::c_magic, std::memory_order_release);
+#else
+		throw std::runtime_error("Shared memory time export is only supported on Linux");
+#endif
+	}
+
+	SharedTimePublisher::~SharedTimePublisher()
+	{
+#if defined(__linux__)
+		::munmap(m_page, sizeof(SharedTimePage));
+		::shm_unlink(m_name.c_str());
+#endif
+	}
+
+	void SharedTimePublisher::Publish(const SharedTimeSnapshot& snapshot)
+	{
+		m_page->Store(snapshot);
+	}
+}
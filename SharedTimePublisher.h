@@ -0,0 +1,31 @@
+#pragma once
+
+#include "SharedTime.h"
+
+#include <string>
+
+namespace PTP
+{
+	// Creates the shared page SharedTimeReader maps and is its only writer. The page is
+	// unlinked again on destruction; readers that still have it mapped keep the last state
+	// and can tell from SharedTimeSnapshot::updateTime that it went stale.
+	class SharedTimePublisher
+	{
+	public:
+		// 'name' is a POSIX shared memory name such as "/ptp-time". Throws std::runtime_error.
+		explicit SharedTimePublisher(const std::string& name);
+		~SharedTimePublisher();
+
+		SharedTimePublisher(const SharedTimePublisher&) = delete;
+		SharedTimePublisher& operator=(const SharedTimePublisher&) = delete;
+		SharedTimePublisher(SharedTimePublisher&&) = delete;
+		SharedTimePublisher& operator=(SharedTimePublisher&&) = delete;
+
+		// Wait-free: a handful of relaxed stores between the two sequence increments.
+		void Publish(const SharedTimeSnapshot& snapshot);
+
+	private:
+		std::string m_name;
+		SharedTimePage* m_page{ nullptr };
+	};
+}
@@ -0,0 +1,177 @@
+#include "Simulation.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace PTP
+{
+	void VirtualTimeExecutor::Post(int64_t time, Handler handler)
+	{
+		m_events.push({ std::max(time, m_now), m_posted++, std::move(handler) });
+	}
+
+	void VirtualTimeExecutor::PostPeriodic(int64_t first, int64_t interval, std::function<bool()> handler)
+	{
+		Post(first, [this, first, interval, handler = std::move(handler)]() mutable
+		{
+			if (handler())
+				PostPeriodic(first + interval, interval, std::move(handler));
+		});
+	}
+
+	size_t VirtualTimeExecutor::RunUntil(int64_t end)
+	{
+		size_t run{ 0 };
+		while (!m_events.empty() && m_events.top().time <= end)
+		{
+			// top() is const; the handler is moved out before pop() so it may post new events.
+			auto event{ std::move(const_cast<Event&>(m_events.top())) };
+			m_events.pop();
+			m_now = event.time;
+			event.handler();
+			++run;
+		}
+		m_now = std::max(m_now, end);
+		return run;
+	}
+
+	SimulatedLink::SimulatedLink(VirtualTimeExecutor& executor, std::mt19937_64& random, const LinkOptions& options)
+		: m_executor(executor)
+		, m_random(random)
+		, m_options(options)
+	{}
+
+	double SimulatedLink::MeanDelay() const
+	{
+		switch (m_options.Distribution)
+		{
+			case DelayDistribution::Uniform: return m_options.Delay + m_options.Jitter / 2.0;
+			case DelayDistribution::Exponential: return m_options.Delay + m_options.Jitter;
+			// Normal ignores the clamp at zero, which only matters when Jitter is close to Delay.
+			default: return m_options.Delay;
+		}
+	}
+
+	int64_t SimulatedLink::SampleDelay()
+	{
+		double delay{ m_options.Delay };
+		if (m_options.Jitter > 0.0)
+		{
+			switch (m_options.Distribution)
+			{
+				case DelayDistribution::Uniform:
+					delay += std::uniform_real_distribution<double>(0.0, m_options.Jitter)(m_random);
+					break;
+				case DelayDistribution::Normal:
+					delay += std::normal_distribution<double>(0.0, m_options.Jitter)(m_random);
+					break;
+				case DelayDistribution::Exponential:
+					delay += std::exponential_distribution<double>(1.0 / m_options.Jitter)(m_random);
+					break;
+				default:
+					break;
+			}
+		}
+		return std::llround(std::max(delay, 0.0));
+	}
+
+	void SimulatedLink::Send(std::span<const uint8_t> datagram, Receiver receiver)
+	{
+		++m_sent;
+		std::uniform_real_distribution<double> chance(0.0, 1.0);
+		if (m_options.Loss > 0.0 && chance(m_random) < m_options.Loss)
+		{
+			++m_lost;
+			return;
+		}
+
+		// A path is a FIFO: a datagram can be delayed by queueing, but only overtakes the
+		// ones sent before it when it is picked for reordering.
+		auto arrival{ m_executor.Now() + SampleDelay() };
+		if (m_options.Reorder > 0.0 && chance(m_random) < m_options.Reorder)
+		{
+			++m_reordered;
+			arrival += std::llround(chance(m_random) * m_options.ReorderDelay);
+		}
+		else
+		{
+			arrival = std::max(arrival, m_lastArrival);
+			m_lastArrival = arrival;
+		}
+
+		std::array<uint8_t, Wire::c_maxMessageSize> payload{};
+		const auto size{ std::min(datagram.size(), payload.size()) };
+		std::copy_n(datagram.begin(), size, payload.begin());
+		m_executor.Post(arrival, [payload, size, receiver = std::move(receiver)]
+		{
+			receiver(std::span(payload.data(), size));
+		});
+	}
+
+	SimulatedOscillator::SimulatedOscillator(const VirtualTimeExecutor& executor, std::mt19937_64& random, const OscillatorOptions& options)
+		: m_executor(executor)
+		, m_random(random)
+		, m_options(options)
+		, m_lastTrueTime(executor.Now())
+		, m_local(options.Offset + executor.Now())
+		, m_frequencyPpb(options.Drift * 1000.0)
+	{}
+
+	int64_t SimulatedOscillator::Read()
+	{
+		const auto now{ m_executor.Now() };
+		const auto elapsed{ now - m_lastTrueTime };
+		if (elapsed > 0)
+		{
+			// The whole nanoseconds advance exactly; only the frequency error goes through
+			// a double, so the reading keeps its resolution far from the epoch.
+			m_fraction += static_cast<double>(elapsed) * m_frequencyPpb * 1e-9;
+			const auto whole{ std::floor(m_fraction) };
+			m_local += elapsed + static_cast<int64_t>(whole);
+			m_fraction -= whole;
+			m_lastTrueTime = now;
+
+			if (m_options.Wander > 0.0)
+				m_frequencyPpb += std::normal_distribution<double>(0.0, m_options.Wander * std::sqrt(static_cast<double>(elapsed) * 1e-9))(m_random);
+		}
+		return m_local;
+	}
+
+	PtpTimestamp SimulatedOscillator::Timestamp()
+	{
+		auto reading{ Read() };
+		if (m_options.TimestampNoise > 0.0)
+			reading += std::llround(std::normal_distribution<double>(0.0, m_options.TimestampNoise)(m_random));
+		return PtpTimestamp::FromNanoseconds(reading);
+	}
+
+	SimulatedClock::SimulatedClock(SimulatedOscillator& oscillator)
+		: m_oscillator(oscillator)
+		, m_rawAnchor(oscillator.Read())
+		, m_timeAnchor(m_rawAnchor)
+	{}
+
+	int64_t SimulatedClock::At(int64_t raw) const
+	{
+		const auto elapsed{ static_cast<double>(raw - m_rawAnchor) };
+		return m_timeAnchor + std::llround(elapsed * (1.0 + m_frequencyPpb * 1e-9));
+	}
+
+	int64_t SimulatedClock::Now() const
+	{
+		return At(m_oscillator.Read());
+	}
+
+	void SimulatedClock::AdjustFrequency(double ppb)
+	{
+		const auto raw{ m_oscillator.Read() };
+		m_timeAnchor = At(raw);
+		m_rawAnchor = raw;
+		m_frequencyPpb = ppb;
+	}
+
+	void SimulatedClock::Step(int64_t nanoseconds)
+	{
+		m_timeAnchor += nanoseconds;
+	}
+}
@@ -0,0 +1,151 @@
+#pragma once
+
+#include "DisciplinedClock.h"
+#include "PtpCodec.h"
+
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <queue>
+#include <random>
+#include <span>
+#include <string_view>
+#include <vector>
+
+namespace PTP
+{
+	// Discrete-event executor on a virtual timeline (nanoseconds of "true" time).
+	// Handlers run in time order, equal times in the order they were posted, so a run
+	// is fully determined by its inputs and the seed of the random source.
+	class VirtualTimeExecutor
+	{
+	public:
+		using Handler = std::function<void()>;
+
+		int64_t Now() const { return m_now; }
+		void Post(int64_t time, Handler handler);
+		void PostAfter(int64_t delay, Handler handler) { Post(m_now + delay, std::move(handler)); }
+		// Repeats 'handler' every 'interval' starting at 'first' for as long as it returns true.
+		void PostPeriodic(int64_t first, int64_t interval, std::function<bool()> handler);
+
+		// Runs every event due up to and including 'end', then advances Now() to 'end'.
+		// Returns the number of handlers run.
+		size_t RunUntil(int64_t end);
+
+	private:
+		struct Event
+		{
+			int64_t time;
+			uint64_t order;
+			Handler handler;
+
+			bool operator>(const Event& other) const
+			{
+				return time != other.time ? time > other.time : order > other.order;
+			}
+		};
+
+		std::priority_queue<Event, std::vector<Event>, std::greater<>> m_events;
+		int64_t m_now{ 0 };
+		uint64_t m_posted{ 0 };
+	};
+
+	enum class DelayDistribution
+	{
+		Constant,   // Delay
+		Uniform,    // Delay + U(0, Jitter)
+		Normal,     // Delay + N(0, Jitter), never below zero
+		Exponential // Delay + Exp(mean Jitter), queueing-like long tail
+	};
+
+	struct LinkOptions
+	{
+		double Delay{ 50'000.0 };       // Nanoseconds, fixed part of the one-way delay
+		double Jitter{ 5'000.0 };       // Nanoseconds, scale of the random part
+		DelayDistribution Distribution{ DelayDistribution::Exponential };
+		double Loss{ 0.0 };             // Probability a datagram is dropped
+		double Reorder{ 0.0 };          // Probability a datagram is held back, letting later ones overtake it ...
+		double ReorderDelay{ 1e6 };     // ... by up to this many extra nanoseconds
+	};
+
+	// One direction of an in-memory network path. Datagrams are copied into the event,
+	// so the sender's buffer can be reused as soon as Send returns.
+	class SimulatedLink
+	{
+	public:
+		using Receiver = std::function<void(std::span<const uint8_t> datagram)>;
+
+		SimulatedLink(VirtualTimeExecutor& executor, std::mt19937_64& random, const LinkOptions& options);
+
+		void Send(std::span<const uint8_t> datagram, Receiver receiver);
+
+		// Mean of the delay distribution, i.e. what a perfect estimator converges to.
+		double MeanDelay() const;
+		uint64_t Sent() const { return m_sent; }
+		uint64_t Lost() const { return m_lost; }
+		uint64_t Reordered() const { return m_reordered; }
+
+	private:
+		int64_t SampleDelay();
+
+		VirtualTimeExecutor& m_executor;
+		std::mt19937_64& m_random;
+		LinkOptions m_options;
+		int64_t m_lastArrival{ 0 };
+		uint64_t m_sent{ 0 };
+		uint64_t m_lost{ 0 };
+		uint64_t m_reordered{ 0 };
+	};
+
+	struct OscillatorOptions
+	{
+		double Drift{ 0.0 };          // ppm, constant frequency error
+		double Wander{ 0.0 };         // ppb per sqrt(second), random walk of the frequency
+		int64_t Offset{ 0 };          // Nanoseconds at true time zero
+		double TimestampNoise{ 0.0 }; // Nanoseconds RMS added to every packet timestamp
+	};
+
+	// A node's free-running oscillator: what its CLOCK_MONOTONIC_RAW/TSC would read.
+	// Must be read at non-decreasing true times, which the executor guarantees.
+	class SimulatedOscillator
+	{
+	public:
+		SimulatedOscillator(const VirtualTimeExecutor& executor, std::mt19937_64& random, const OscillatorOptions& options);
+
+		int64_t Read();
+		// Read() plus timestamping noise, as a packet timestamp.
+		PtpTimestamp Timestamp();
+		double GetFrequency() const { return m_frequencyPpb; }
+
+	private:
+		const VirtualTimeExecutor& m_executor;
+		std::mt19937_64& m_random;
+		OscillatorOptions m_options;
+		int64_t m_lastTrueTime;
+		int64_t m_local;
+		double m_fraction{ 0.0 }; // Sub-nanosecond part of m_local
+		double m_frequencyPpb;
+	};
+
+	// DisciplinedClock over a simulated oscillator instead of CLOCK_MONOTONIC_RAW.
+	// Packet timestamps are oscillator readings, so FromTimestamp maps them exactly.
+	class SimulatedClock : public AdjustableClock
+	{
+	public:
+		explicit SimulatedClock(SimulatedOscillator& oscillator);
+
+		int64_t Now() const override;
+		int64_t FromTimestamp(int64_t nanoseconds) const override { return At(nanoseconds); }
+		void AdjustFrequency(double ppb) override;
+		void Step(int64_t nanoseconds) override;
+		std::string_view Name() const override { return "simulated"; }
+
+	private:
+		int64_t At(int64_t raw) const;
+
+		SimulatedOscillator& m_oscillator;
+		int64_t m_rawAnchor;
+		int64_t m_timeAnchor;
+		double m_frequencyPpb{ 0.0 };
+	};
+}
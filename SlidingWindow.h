@@ -0,0 +1,145 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <limits>
+
+namespace PTP
+{
+	// Running mean over the last N samples, O(1) per sample and no allocation.
+	template <size_t N>
+	class SlidingWindowMean
+	{
+	public:
+		void Push(double value)
+		{
+			if (m_count == N)
+				m_sum -= m_values[m_next];
+			else
+				++m_count;
+
+			m_sum += value;
+			m_values[m_next] = value;
+			m_next = (m_next + 1) % N;
+		}
+
+		size_t Size() const { return m_count; }
+		double Mean() const
+		{
+			return m_count == 0 ? std::numeric_limits<double>::quiet_NaN() : m_sum / m_count;
+		}
+
+	private:
+		std::array<double, N> m_values{};
+		size_t m_next{ 0 };
+		size_t m_count{ 0 };
+		double m_sum{ 0.0 };
+	};
+
+	// Welford mean and sum of squared deviations over the last 'size' (at most N) samples.
+	// Full windows use the replace-oldest update, so each sample costs O(1).
+	template <size_t N>
+	class SlidingWindowVariance
+	{
+	public:
+		explicit SlidingWindowVariance(size_t size = N)
+			: m_size(std::clamp<size_t>(size, 1, N))
+		{}
+
+		void Push(double value)
+		{
+			if (m_count < m_size)
+			{
+				++m_count;
+				const double delta{ value - m_mean };
+				m_mean += delta / m_count;
+				m_m2 += delta * (value - m_mean);
+			}
+			else
+			{
+				const double oldest{ m_values[m_next] };
+				const double oldMean{ m_mean };
+				m_mean += (value - oldest) / m_size;
+				m_m2 += (value - oldest) * (value - m_mean + oldest - oldMean);
+				if (m_m2 < 0.0)
+					m_m2 = 0.0; // Rounding on a constant window
+			}
+
+			m_values[m_next] = value;
+			m_next = (m_next + 1) % m_size;
+		}
+
+		size_t Size() const { return m_count; }
+		double Mean() const { return m_mean; }
+
+		// Sum of (v - center)^2 over the window.
+		double SumOfSquaredDeviations(double center) const
+		{
+			const double offset{ m_mean - center };
+			return m_m2 + m_count * offset * offset;
+		}
+
+	private:
+		std::array<double, N> m_values{};
+		size_t m_size;
+		size_t m_next{ 0 };
+		size_t m_count{ 0 };
+		double m_mean{ 0.0 };
+		double m_m2{ 0.0 };
+	};
+
+	// The last 'size' (at most N) values kept sorted as well as in arrival order, for order
+	// statistics: minimum, percentiles, median. Finding a value is a binary search; making room
+	// or closing the gap is one memmove of at most N doubles, no allocation.
+	template <size_t N>
+	class SlidingWindowOrder
+	{
+	public:
+		explicit SlidingWindowOrder(size_t size = N)
+			: m_size(std::clamp<size_t>(size, 1, N))
+		{}
+
+		void Push(double value)
+		{
+			if (m_count == m_size)
+			{
+				const auto sortedEnd{ m_sorted.begin() + m_count };
+				const auto oldest{ std::lower_bound(m_sorted.begin(), sortedEnd, m_values[m_next]) };
+				std::copy(oldest + 1, sortedEnd, oldest);
+				--m_count;
+			}
+
+			const auto sortedEnd{ m_sorted.begin() + m_count };
+			const auto position{ std::upper_bound(m_sorted.begin(), sortedEnd, value) };
+			std::copy_backward(position, sortedEnd, sortedEnd + 1);
+			*position = value;
+			++m_count;
+
+			m_values[m_next] = value;
+			m_next = (m_next + 1) % m_size;
+		}
+
+		size_t Size() const { return m_count; }
+		size_t Capacity() const { return m_size; }
+
+		// Nearest-rank value at fraction q of the window: 0 = minimum, 0.5 = median, 1 = maximum.
+		double Quantile(double q) const
+		{
+			if (m_count == 0)
+				return std::numeric_limits<double>::quiet_NaN();
+			const auto rank{ std::lround(std::clamp(q, 0.0, 1.0) * static_cast<double>(m_count - 1)) };
+			return m_sorted[static_cast<size_t>(rank)];
+		}
+		double Minimum() const { return Quantile(0.0); }
+		double Median() const { return Quantile(0.5); }
+
+	private:
+		std::array<double, N> m_values{}; // Ring in arrival order, the oldest at m_next once full
+		std::array<double, N> m_sorted{};
+		size_t m_size;
+		size_t m_next{ 0 };
+		size_t m_count{ 0 };
+	};
+}
@@ -0,0 +1,258 @@
+#include "Timestamping.h"
+
+#include <array>
+#include <cstring>
+#include <optional>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define PTP_HAS_RECVMSG 1
+#include <cerrno>
+#include <sys/socket.h>
+#include <sys/time.h>
+#endif
+
+#if defined(__linux__)
+#include <linux/errqueue.h>
+#include <linux/net_tstamp.h>
+#include <netinet/in.h>
+#if defined(SO_TIMESTAMPING)
+#define PTP_HAS_OPT_ID 1
+#endif
+#endif
+
+namespace PTP
+{
+	namespace
+	{
+		PtpTimestamp ToPtpTimestamp(int64_t seconds, int64_t nanoseconds)
+		{
+			return PtpTimestamp::FromParts(static_cast<uint64_t>(seconds), static_cast<uint32_t>(nanoseconds));
+		}
+
+#if defined(PTP_HAS_RECVMSG)
+		bool SetSocketOption(int fd, int option, int value)
+		{
+			return ::setsockopt(fd, SOL_SOCKET, option, &value, sizeof(value)) == 0;
+		}
+
+		// Non-blocking recvmsg. Returns nullopt if the wakeup was spurious.
+		std::optional<ReceiveResult> TryReceiveMessage(
+			boost::asio::ip::udp::socket& socket,
+			boost::asio::mutable_buffer buffer,
+			boost::asio::ip::udp::endpoint& senderEndpoint)
+		{
+			iovec iov{ buffer.data(), buffer.size() };
+			alignas(cmsghdr) std::array<char, 256> control{};
+
+			msghdr message{};
+			message.msg_name = senderEndpoint.data();
+			message.msg_namelen = static_cast<socklen_t>(senderEndpoint.capacity());
+			message.msg_iov = &iov;
+			message.msg_iovlen = 1;
+			message.msg_control = control.data();
+			message.msg_controllen = control.size();
+
+			const auto bytesReceived = ::recvmsg(socket.native_handle(), &message, MSG_DONTWAIT);
+			if (bytesReceived < 0)
+			{
+				if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+					return std::nullopt;
+				throw boost::system::system_error(errno, boost::system::system_category(), "recvmsg");
+			}
+			senderEndpoint.resize(message.msg_namelen);
+
+			const auto kernelTimestamp{ GetKernelTimestamp(message) };
+			return ReceiveResult{ static_cast<size_t>(bytesReceived),
+				kernelTimestamp.value_or(GetCurrentPtpTime()),
+				kernelTimestamp.has_value() };
+		}
+#endif
+
+#if defined(PTP_HAS_OPT_ID)
+		// The number SOF_TIMESTAMPING_OPT_ID gave the datagram, from the error queue message.
+		std::optional<uint32_t> GetTimestampKey(msghdr& message)
+		{
+			for (auto* cmsg = CMSG_FIRSTHDR(&message); cmsg != nullptr; cmsg = CMSG_NXTHDR(&message, cmsg))
+			{
+				const bool isError{ (cmsg->cmsg_level == IPPROTO_IP && cmsg->cmsg_type == IP_RECVERR) ||
+					(cmsg->cmsg_level == IPPROTO_IPV6 && cmsg->cmsg_type == IPV6_RECVERR) };
+				if (!isError)
+					continue;
+
+				sock_extended_err error{};
+				std::memcpy(&error, CMSG_DATA(cmsg), sizeof(error));
+				if (error.ee_errno == ENOMSG && error.ee_origin == SO_EE_ORIGIN_TIMESTAMPING)
+					return error.ee_data;
+			}
+			return std::nullopt;
+		}
+#endif
+	}
+
+#if defined(PTP_HAS_RECVMSG)
+	std::optional<PtpTimestamp> GetKernelTimestamp(msghdr& message)
+	{
+		for (auto* cmsg = CMSG_FIRSTHDR(&message); cmsg != nullptr; cmsg = CMSG_NXTHDR(&message, cmsg))
+		{
+			if (cmsg->cmsg_level != SOL_SOCKET)
+				continue;
+#if defined(SO_TIMESTAMPING)
+			if (cmsg->cmsg_type == SCM_TIMESTAMPING)
+			{
+				// ts[0] software, ts[1] deprecated, ts[2] raw hardware on the PHC, which is not
+				// CLOCK_REALTIME and is never requested (see TimestampMode).
+				std::array<timespec, 3> ts{};
+				std::memcpy(ts.data(), CMSG_DATA(cmsg), sizeof(ts));
+				if (ts[0].tv_sec == 0 && ts[0].tv_nsec == 0)
+					continue;
+				return ToPtpTimestamp(ts[0].tv_sec, ts[0].tv_nsec);
+			}
+#endif
+#if defined(SO_TIMESTAMPNS)
+			if (cmsg->cmsg_type == SCM_TIMESTAMPNS)
+			{
+				timespec ts{};
+				std::memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+				return ToPtpTimestamp(ts.tv_sec, ts.tv_nsec);
+			}
+#endif
+			if (cmsg->cmsg_type == SCM_TIMESTAMP)
+			{
+				timeval tv{};
+				std::memcpy(&tv, CMSG_DATA(cmsg), sizeof(tv));
+				return ToPtpTimestamp(tv.tv_sec, static_cast<int64_t>(tv.tv_usec) * 1000);
+			}
+		}
+		return std::nullopt;
+	}
+#endif
+
+	TimestampingSupport EnableTimestamping(boost::asio::ip::udp::socket& socket,
+		TimestampMode mode, bool txTimestamps)
+	{
+		if (mode == TimestampMode::Application && !txTimestamps)
+			return {};
+
+#if defined(PTP_HAS_RECVMSG)
+		const auto fd = socket.native_handle();
+#if defined(SO_TIMESTAMPING)
+		// RX and TX share one option, so both directions have to be requested together.
+		int flags = SOF_TIMESTAMPING_SOFTWARE;
+		if (mode != TimestampMode::Application)
+			flags |= SOF_TIMESTAMPING_RX_SOFTWARE;
+		if (txTimestamps)
+			flags |= SOF_TIMESTAMPING_TX_SOFTWARE | SOF_TIMESTAMPING_OPT_TSONLY | SOF_TIMESTAMPING_OPT_ID;
+		if (SetSocketOption(fd, SO_TIMESTAMPING, flags))
+			return { mode != TimestampMode::Application, txTimestamps };
+#endif
+		if (mode == TimestampMode::Application)
+			return {};
+#if defined(SO_TIMESTAMPNS)
+		if (SetSocketOption(fd, SO_TIMESTAMPNS, 1))
+			return { true, false };
+#endif
+		return { SetSocketOption(fd, SO_TIMESTAMP, 1), false };
+#else
+		(void)socket;
+		return {};
+#endif
+	}
+
+	boost::asio::awaitable<ReceiveResult> ReceiveWithTimestamp(
+		boost::asio::ip::udp::socket& socket,
+		boost::asio::mutable_buffer buffer,
+		boost::asio::ip::udp::endpoint& senderEndpoint,
+		bool kernelTimestamps)
+	{
+#if defined(PTP_HAS_RECVMSG)
+		while (kernelTimestamps)
+		{
+			co_await socket.async_wait(boost::asio::socket_base::wait_read, boost::asio::use_awaitable);
+			if (const auto result{ TryReceiveMessage(socket, buffer, senderEndpoint) })
+				co_return *result;
+		}
+#endif
+		const size_t bytesReceived
+		{
+			co_await socket.async_receive_from(buffer, senderEndpoint, boost::asio::use_awaitable)
+		};
+		co_return ReceiveResult{ bytesReceived, GetCurrentPtpTime(), false };
+	}
+
+	TxTimestampReader::TxTimestampReader(boost::asio::ip::udp::socket& socket)
+		: m_socket(socket)
+	{
+		m_waiters.reserve(c_keptTimestamps);
+	}
+
+	boost::asio::awaitable<void> TxTimestampReader::Run()
+	{
+		while (true)
+		{
+			DrainErrorQueue();
+			co_await m_socket.async_wait(boost::asio::socket_base::wait_error, boost::asio::use_awaitable);
+		}
+	}
+
+	boost::asio::awaitable<std::optional<PtpTimestamp>> TxTimestampReader::WaitForTimestamp(
+		uint32_t key, std::chrono::microseconds timeout)
+	{
+		// The timestamp usually lands before we get here, the timer only covers the
+		// race and kernels that silently drop the request.
+		DrainErrorQueue();
+		if (const auto timestamp{ Find(key) })
+			co_return timestamp;
+
+		boost::asio::steady_timer timer(m_socket.get_executor(), timeout);
+		Waiter waiter{ key, timer, std::nullopt };
+		m_waiters.push_back(&waiter);
+		boost::system::error_code ec;
+		co_await timer.async_wait(boost::asio::redirect_error(boost::asio::use_awaitable, ec));
+		std::erase(m_waiters, &waiter);
+		co_return waiter.timestamp;
+	}
+
+	std::optional<PtpTimestamp> TxTimestampReader::Find(uint32_t key) const
+	{
+		const auto& arrival{ m_arrivals[key % c_keptTimestamps] };
+		if (!arrival.valid || arrival.key != key)
+			return std::nullopt;
+		return arrival.timestamp;
+	}
+
+	void TxTimestampReader::DrainErrorQueue()
+	{
+#if defined(PTP_HAS_OPT_ID)
+		while (true)
+		{
+			std::array<char, 64> payload{};
+			iovec iov{ payload.data(), payload.size() };
+			alignas(cmsghdr) std::array<char, 256> control{};
+
+			msghdr message{};
+			message.msg_iov = &iov;
+			message.msg_iovlen = 1;
+			message.msg_control = control.data();
+			message.msg_controllen = control.size();
+
+			if (::recvmsg(m_socket.native_handle(), &message, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+				return;
+
+			const auto timestamp{ GetKernelTimestamp(message) };
+			const auto key{ GetTimestampKey(message) };
+			if (!timestamp || !key)
+				continue;
+
+			m_arrivals[*key % c_keptTimestamps] = { *key, *timestamp, true };
+			for (auto* waiter : m_waiters)
+			{
+				if (waiter->key == *key)
+				{
+					waiter->timestamp = *timestamp;
+					waiter->timer.cancel();
+				}
+			}
+		}
+#endif
+	}
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include "Utils.h"
+
+#include <boost/asio.hpp>
+#include <array>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/socket.h>
+#endif
+
+namespace PTP
+{
+	// Where t2 (Sync arrival) and t4 (Delay_Req arrival) are taken. Transmit timestamps are
+	// kernel software timestamps in either mode. NIC timestamps are not used: they count on the
+	// NIC's own clock (PHC), which nothing here disciplines, and would put t1..t4 on different
+	// timelines whenever one of them falls back to the application time.
+	enum class TimestampMode
+	{
+		Application, // GetCurrentPtpTime() once the receiving coroutine has resumed
+		Software     // Kernel software receive timestamp from the cmsg ancillary data, CLOCK_REALTIME
+	};
+
+	struct TimestampingSupport
+	{
+		bool rx{ false };
+		bool tx{ false };
+	};
+
+	struct ReceiveResult
+	{
+		size_t bytesReceived{ 0 };
+		PtpTimestamp timestamp{};
+		bool fromKernel{ false };
+	};
+
+	// Reports which directions the kernel accepted. If rx is false ReceiveWithTimestamp
+	// must be called with kernelTimestamps = false, if tx is false no TxTimestampReader
+	// should be run on the socket.
+	TimestampingSupport EnableTimestamping(boost::asio::ip::udp::socket& socket,
+		TimestampMode mode, bool txTimestamps);
+
+#if defined(__unix__) || defined(__APPLE__)
+	// Extracts the kernel software timestamp from a message returned by recvmsg/recvmmsg.
+	std::optional<PtpTimestamp> GetKernelTimestamp(msghdr& message);
+#endif
+
+	// recvmsg based replacement for async_receive_from. Falls back to GetCurrentPtpTime()
+	// if kernel timestamps are disabled or a datagram arrives without one.
+	boost::asio::awaitable<ReceiveResult> ReceiveWithTimestamp(
+		boost::asio::ip::udp::socket& socket,
+		boost::asio::mutable_buffer buffer,
+		boost::asio::ip::udp::endpoint& senderEndpoint,
+		bool kernelTimestamps);
+
+	// Drains SO_TIMESTAMPING transmit timestamps from the socket's error queue. The kernel
+	// numbers the datagrams sent on the socket (SOF_TIMESTAMPING_OPT_ID) and returns each
+	// timestamp with its number, so any number of sends may wait at once. Every successful
+	// send on the socket must be followed by Sent(), whose key is then waited for; a failed
+	// send takes no number.
+	class TxTimestampReader
+	{
+	public:
+		explicit TxTimestampReader(boost::asio::ip::udp::socket& socket);
+
+		TxTimestampReader(const TxTimestampReader&) = delete;
+		TxTimestampReader& operator=(const TxTimestampReader&) = delete;
+		TxTimestampReader(TxTimestampReader&&) = delete;
+		TxTimestampReader& operator=(TxTimestampReader&&) = delete;
+
+		boost::asio::awaitable<void> Run();
+		// Key of the datagram the last send put on the wire.
+		uint32_t Sent() { return m_sent++; }
+		boost::asio::awaitable<std::optional<PtpTimestamp>> WaitForTimestamp(
+			uint32_t key, std::chrono::microseconds timeout);
+
+	private:
+		static constexpr size_t c_keptTimestamps{ 256 }; // By key, for timestamps in before their waiter
+
+		struct Arrival
+		{
+			uint32_t key{ 0 };
+			PtpTimestamp timestamp{};
+			bool valid{ false };
+		};
+
+		// Lives in WaitForTimestamp's frame; an arrival for its key fills it in and wakes it.
+		struct Waiter
+		{
+			uint32_t key;
+			boost::asio::steady_timer& timer;
+			std::optional<PtpTimestamp> timestamp;
+		};
+
+		std::optional<PtpTimestamp> Find(uint32_t key) const;
+		void DrainErrorQueue();
+
+		boost::asio::ip::udp::socket& m_socket;
+		std::array<Arrival, c_keptTimestamps> m_arrivals{};
+		std::vector<Waiter*> m_waiters;
+		uint32_t m_sent{ 0 };
+	};
+}